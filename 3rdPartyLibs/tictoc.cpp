@@ -40,6 +40,14 @@
 #include <cassert>
 #include <sstream>
 #include "Timer.h"
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 using namespace std;
 using namespace TICTOC;
@@ -48,8 +56,15 @@ tictoc::tictoc() {
     tim = new Timer();
     tim->start();
     enabled = true;
+    trace = NULL;
+    traceCapacity = 0;
+    traceHead = 0;
+    traceFull = false;
+    tracePaused = false;
+    traceFrame = 0;
 }
 tictoc::~tictoc() {
+    disableTrace();
     delete tim;
 }
 
@@ -63,6 +78,15 @@ struct TICTOC::_tictoc_data {
     int numblowntics;
 };
 
+struct TICTOC::_tictoc_event {
+    char name[tictoc::TRACE_NAME_LENGTH];
+    char phase; // 'B' for tic, 'E' for toc
+    unsigned long tid;
+    long frame;
+    double timestamp;
+    volatile unsigned long seq; // slot number + 1 once written, 0 while being written
+};
+
 static _tictoc_data ntt();
 
 _tictoc_data ntt() {
@@ -93,6 +117,7 @@ void tictoc::tic(const string &name, bool notick) {
     }
     td = &(it->second);
     td->starttime = clock();
+    traceEvent(name, 'B');
     if (td->ticked) {
         ++(td->numblowntics);
     }
@@ -119,6 +144,7 @@ double tictoc::toc(const string &name, bool notock) {
     ++(td->ncalls);
     td->ticked = false;
     double et = clock() - td->starttime;
+    traceEvent(name, 'E');
     td->maxtime = et > td->maxtime ? et : td->maxtime;
     td->mintime = et < td->mintime ? et : td->mintime;
     td->totaltime += et;
@@ -160,12 +186,171 @@ char *tictoc::generateReportCstr() {
     return c;
 }
 
+void tictoc::enable(bool state) {
+    enabled = state;
+}
+
 double tictoc::clock() {
     return tim->getElapsedTimeInMicroSec();
 }
 
 void tictoc::clear() {
     tt.clear();
+    traceHead = 0;
+    traceFull = false;
+}
+
+/* returns a number identifying the calling thread */
+static unsigned long currentThreadId() {
+#ifdef WIN32
+    return (unsigned long) GetCurrentThreadId();
+#else
+    return (unsigned long) pthread_self();
+#endif
+}
+
+/* atomically reserve the next slot in the trace ring buffer
+ * so that the main and display threads can record concurrently
+ */
+static long nextTraceSlot(volatile long *head) {
+#ifdef WIN32
+    return InterlockedIncrement(head) - 1;
+#else
+    return __sync_fetch_and_add(head, 1);
+#endif
+}
+
+/* order the writes to a trace event against the writes to its seq number */
+static void traceBarrier() {
+#ifdef WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+void tictoc::enableTrace(int numEvents) {
+    disableTrace();
+    if (numEvents <= 0)
+        return;
+    /* a power of two, so the slot stays continuous when the counter wraps */
+    int capacity = 1;
+    while (capacity < numEvents && capacity < (1 << 30))
+        capacity <<= 1;
+    numEvents = capacity;
+    _tictoc_event *buf = (_tictoc_event *) malloc(sizeof(_tictoc_event) * numEvents);
+    assert(buf != NULL);
+    for (int i = 0; i < numEvents; ++i)
+        buf[i].seq = 0;
+    traceHead = 0;
+    traceFull = false;
+    tracePaused = false;
+    traceCapacity = numEvents;
+    trace = buf;
+}
+
+void tictoc::disableTrace() {
+    _tictoc_event *buf = trace;
+    trace = NULL;
+    traceCapacity = 0;
+    free(buf);
+}
+
+bool tictoc::isTracing() {
+    return trace != NULL;
+}
+
+void tictoc::setTraceFrame(long frame) {
+    traceFrame = frame;
+}
+
+void tictoc::traceEvent(const string &name, char phase) {
+    if (trace == NULL || tracePaused)
+        return;
+    unsigned long n = (unsigned long) nextTraceSlot(&traceHead);
+    if (n >= (unsigned long) traceCapacity)
+        traceFull = true;
+    _tictoc_event *ev = &trace[n & (traceCapacity - 1)];
+    ev->seq = 0;
+    traceBarrier();
+    strncpy(ev->name, name.c_str(), TRACE_NAME_LENGTH - 1);
+    ev->name[TRACE_NAME_LENGTH - 1] = '\0';
+    ev->phase = phase;
+    ev->tid = currentThreadId();
+    ev->frame = traceFrame;
+    ev->timestamp = clock();
+    traceBarrier();
+    ev->seq = n + 1;
+}
+
+/* write a string to a JSON file, escaping quotes and backslashes */
+static void writeJSONString(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (; *str != '\0'; ++str) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', fp);
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+int tictoc::writeTrace(const char *filename) {
+    if (trace == NULL)
+        return 0;
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        printf("tictoc: cannot open trace file %s\n", filename);
+        return -1;
+    }
+
+    /* stop new events while we read. Any that were already under way are
+     * caught by their seq numbers below.
+     */
+    tracePaused = true;
+    traceBarrier();
+
+    /* the ring buffer may have wrapped, in which case start at the oldest event */
+    unsigned long head = (unsigned long) traceHead;
+    unsigned long count = (traceFull || head > (unsigned long) traceCapacity) ? traceCapacity : head;
+
+    /* once the buffer has wrapped, a toc may have lost its matching tic.
+     * Keep track of how deep each thread is so we can drop orphaned end events.
+     */
+    map<unsigned long, int> depth;
+
+    int written = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (unsigned long i = 0; i < count; ++i) {
+        unsigned long n = head - count + i;
+        const _tictoc_event *slot = &trace[n & (traceCapacity - 1)];
+        unsigned long seq = slot->seq;
+        traceBarrier();
+        _tictoc_event copy;
+        memcpy(&copy, (const void *) slot, sizeof(_tictoc_event));
+        traceBarrier();
+        /* skip events still being written, or overwritten since we started */
+        if (seq != n + 1 || slot->seq != seq)
+            continue;
+        const _tictoc_event *ev = &copy;
+        if (ev->phase == 'B') {
+            ++depth[ev->tid];
+        } else {
+            if (depth[ev->tid] <= 0)
+                continue;
+            --depth[ev->tid];
+        }
+        if (written > 0)
+            fprintf(fp, ",\n");
+        fprintf(fp, "{\"name\":");
+        writeJSONString(fp, ev->name);
+        fprintf(fp, ",\"ph\":\"%c\",\"ts\":%.1f,\"pid\":1,\"tid\":%lu,\"args\":{\"frame\":%ld}}",
+                ev->phase, ev->timestamp, ev->tid, ev->frame);
+        ++written;
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    tracePaused = false;
+    return written;
 }
 
 tictoc &TICTOC::timer() {
@@ -120,13 +120,51 @@ namespace TICTOC {
         char *generateReportCstr();
         //static tictoc *timer = new tictoc();
 
+        /* Tracing
+         *
+         * In addition to the summary statistics above, tictoc can record every
+         * tic and toc as a begin/end event in a fixed size ring buffer. Each event
+         * carries the id of the calling thread and the current frame number, so
+         * that the main thread and the display thread can be viewed together on
+         * a timeline.
+         *
+         * enableTrace(n) allocates a ring buffer of n events, rounded up to a
+         * power of two, and starts recording.
+         * Once the buffer is full the oldest events are overwritten.
+         * disableTrace() stops recording and frees the buffer.
+         *
+         * setTraceFrame(frame) sets the frame number attached to subsequent events.
+         *
+         * writeTrace(filename) writes the contents of the ring buffer out in the
+         * Chrome trace event JSON format which can be opened in chrome://tracing
+         * or https://ui.perfetto.dev . Returns the number of events written or
+         * -1 if the file could not be opened. The buffer is left intact.
+         * Recording pauses while the file is written, and events that other
+         * threads were still writing are left out.
+         */
+        static const int DEFAULT_TRACE_EVENTS = 65536;
+        static const int TRACE_NAME_LENGTH = 48;
+        void enableTrace(int numEvents = DEFAULT_TRACE_EVENTS);
+        void disableTrace();
+        bool isTracing();
+        void setTraceFrame(long frame);
+        int writeTrace(const char *filename);
+
     private:
         double clock();
+        void traceEvent(const std::string &name, char phase);
 
         tictoc(const tictoc& orig);
         std::map <std::string, struct _tictoc_data> tt;
         Timer *tim;
         bool enabled;
+
+        struct _tictoc_event *trace;
+        int traceCapacity;
+        volatile long traceHead; //total number of events ever recorded, modulo 2^32
+        volatile bool traceFull; //true once the ring has wrapped
+        volatile bool tracePaused; //true while writeTrace is reading the ring
+        volatile long traceFrame;
     };
 
     /* tictoc timer
@@ -46,7 +46,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
+#include <windows.h>
 
 #include "AndysComputations.h"
 
@@ -243,7 +245,7 @@ int mean_derivative(double *x, double *x_dot, int n)
     	printf("denom=%f\n",delta);
     	printf("*x_dot=%f\n",*x_dot);
     }
-
+    return A_OK;
 }
 
 /*
@@ -251,20 +253,50 @@ int mean_derivative(double *x, double *x_dot, int n)
  */
 int compareDouble (const void * a, const void * b)
 {
-  return (int) ( *(double*)a - *(double*)b );
+  double d= *(double*)a - *(double*)b;
+  return (d > 0) - (d < 0);
+}
+
+
+/*
+ * Find the element that would be at index k if arr were sorted,
+ * by partitioning arr in place (Hoare's selection).
+ */
+double SelectDoubleInPlace(double* arr, int N, int k){
+	int lo=0, hi=N-1;
+	while (lo<hi){
+		double pivot=arr[(lo+hi)/2];
+		int i=lo, j=hi;
+		while (i<=j){
+			while (arr[i]<pivot) i++;
+			while (arr[j]>pivot) j--;
+			if (i<=j){
+				double t=arr[i];
+				arr[i]=arr[j];
+				arr[j]=t;
+				i++;
+				j--;
+			}
+		}
+		if (k<=j) hi=j;
+		else if (k>=i) lo=i;
+		else break;
+	}
+	return arr[k];
 }
 
+double MedianOfDoubleArrInPlace(double* arr, int N){
+	return SelectDoubleInPlace(arr,N,N/2);
+}
 
 /*
  *get the median of an array of doubles
- *uses qsort under the hood
  */
 double MedianOfDoubleArr(const double* arr, int N){
 
 	double* temp=(double*) malloc(N*sizeof(double));
 	memcpy(temp,arr,N*sizeof(double));
-	qsort(temp, N, sizeof(arr[0]), compareDouble);
-	double result= temp[N/2];
+	double result= MedianOfDoubleArrInPlace(temp,N);
 	free(temp);
 	return result;
 }
@@ -282,3 +314,59 @@ void printDoubleArr(const double* arr, int N){
 		printf("%d: %f\n",i,arr[i]);
 	}
 }
+
+
+/*
+ * Microseconds on the monotonic clock
+ */
+long long MonotonicUs(){
+	static LARGE_INTEGER freq = { 0 };
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	/** Split to avoid overflowing the multiply on long uptimes **/
+	return (count.QuadPart / freq.QuadPart) * 1000000LL
+			+ ((count.QuadPart % freq.QuadPart) * 1000000LL) / freq.QuadPart;
+}
+
+/*
+ * Comparison function for qsort of floats
+ */
+static int compareFloat(const void* a, const void* b){
+	float fa = *(const float*) a;
+	float fb = *(const float*) b;
+	if (fa < fb) return -1;
+	if (fa > fb) return 1;
+	return 0;
+}
+
+void SortFloatArr(float* arr, int N){
+	if (N < 2) return;
+	qsort(arr, N, sizeof(float), compareFloat);
+}
+
+float PercentileOfSortedFloatArr(const float* sorted, int N, double frac){
+	if (N <= 0) return 0;
+	return sorted[(int) (frac * (N - 1) + 0.5)];
+}
+
+void SortDoubleArr(double* arr, int N){
+	if (N < 2) return;
+	qsort(arr, N, sizeof(double), compareDouble);
+}
+
+unsigned int RandomBits(unsigned long long* seed){
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (unsigned int) (*seed >> 33);
+}
+
+double RandomUniform(unsigned long long* seed){
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return ((*seed >> 11) + 0.5) / 9007199254740992.0;
+}
+
+double RandomGaussian(unsigned long long* seed){
+	/** Box-Muller **/
+	double u = RandomUniform(seed);
+	return sqrt(-2 * log(u)) * cos(2 * 3.14159265358979 * RandomUniform(seed));
+}
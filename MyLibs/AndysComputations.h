@@ -156,7 +156,58 @@ void printDoubleArr(const double* arr, int N);
 
 /*
  *get the median of an array of doubles
- *uses qsort under the hood
+ *(the upper median if N is even)
  */
 double MedianOfDoubleArr(const double* arr, int N);
+
+/*
+ * The same, without copying: reorders arr
+ */
+double MedianOfDoubleArrInPlace(double* arr, int N);
+
+/*
+ * The element that would be at index k if arr were sorted.
+ * Reorders arr.
+ */
+double SelectDoubleInPlace(double* arr, int N, int k);
+
+/*
+ * Microseconds on a monotonic clock, from QueryPerformanceCounter().
+ * Take every timestamp and time every interval with this, so that they
+ * can all be compared.
+ */
+long long MonotonicUs();
+
+/*
+ * Sort an array of N floats, smallest first
+ */
+void SortFloatArr(float* arr, int N);
+
+/*
+ * The value a fraction frac (0 to 1) of the way through a sorted array of
+ * N floats, to the nearest element. 0 if the array is empty.
+ */
+float PercentileOfSortedFloatArr(const float* sorted, int N, double frac);
+
+/*
+ * Sort an array of N doubles, smallest first
+ */
+void SortDoubleArr(double* arr, int N);
+
+/*
+ * A small, reproducible random number generator for simulations and
+ * benchmarks. Each caller keeps its own seed (e.g. 12345), so runs repeat
+ * exactly and threads don't share state.
+ */
+unsigned int RandomBits(unsigned long long* seed);
+
+/*
+ * Uniform between 0 and 1, never exactly either
+ */
+double RandomUniform(unsigned long long* seed);
+
+/*
+ * Normally distributed, mean 0 and standard deviation 1
+ */
+double RandomGaussian(unsigned long long* seed);
 #endif /* ANDYSCOMPUTATIONS_H_ */
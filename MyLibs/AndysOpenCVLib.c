@@ -45,6 +45,9 @@
 #include <stdbool.h>
 #include "AndysOpenCVLib.h"
 #include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 #define PRINTOUT 0
@@ -63,6 +66,12 @@
  */
 static int cmp_funcy( const void* _a, const void* _b, void* userdata );
 
+/*
+ * Integer gaussian kernel of width sigma, for the convolutions below.
+ * Allocates *kernel.
+ */
+void CreateGaussianKernel (double sigma, int **kernel, int *klength, int *normfactor);
+
 
 /*
  * The compartive function used to sort a sequence of points by their x value
@@ -310,9 +319,8 @@ int PushToSeqBuffer(CvSeq* seq, void* element, int MaxBuffSize){
 	cvSeqPushFront(seq, element);
 
 	/** if full, pop off the last value **/
-	void* popped_pt;
 	while (seq->total > MaxBuffSize){
-		cvSeqPop(seq, popped_pt);
+		cvSeqPop(seq, NULL);
 	} ;
 
 	return A_OK;
@@ -666,6 +674,88 @@ void resampleSeqConstPtsPerArcLength(CvSeq* sequence, CvSeq* ResampledSeq, int N
 
 
 
+/*
+ * Resample a sequence of CvPoint2D32f into Numsegments CvPoints evenly spaced along its arc length.
+ * See AndysOpenCVLib.h
+ */
+void resampleSeq2D32fConstPtsPerArcLength(const CvSeq* sequence, CvSeq* ResampledSeq, int Numsegments) {
+	if (sequence==NULL || ResampledSeq==NULL) {
+		printf("Error! sequence passed to resampleSeq2D32fConstPtsPerArcLength() is NULL!\n");
+		return;
+	}
+	if (sequence->total < 1 || Numsegments < 1) {
+		printf("Error! Sequence passed to resampleSeq2D32fConstPtsPerArcLength() is empty!\n");
+		return;
+	}
+
+	/** Total arc length **/
+	CvSeqReader reader;
+	CvPoint2D32f prev, curr;
+	double totalArcLength=0;
+	int i;
+	cvStartReadSeq(sequence, &reader, 0);
+	CV_READ_SEQ_ELEM(prev, reader);
+	for (i = 1; i < sequence->total; i++) {
+		CV_READ_SEQ_ELEM(curr, reader);
+		totalArcLength+=sqrt( (double) (curr.x-prev.x)*(curr.x-prev.x) + (double) (curr.y-prev.y)*(curr.y-prev.y) );
+		prev=curr;
+	}
+
+	/** The kth output point lies a distance k*spacing along the arc **/
+	double spacing= (Numsegments>1) ? totalArcLength / (double) (Numsegments-1) : 0;
+
+	CvSeqWriter writer;
+	cvStartAppendToSeq(ResampledSeq, &writer);
+	cvStartReadSeq(sequence, &reader, 0);
+	CV_READ_SEQ_ELEM(prev, reader);
+	curr=prev;
+	double sumAtPrev=0; // arc length up to prev
+	double segLength=0; // length from prev to curr
+	int j=0; // index of curr
+	CvPoint interpPt;
+	int k;
+	for (k = 0; k < Numsegments; k++) {
+		double s= (k==Numsegments-1) ? totalArcLength : k*spacing;
+
+		/** Walk forward until s lies between prev and curr **/
+		while (sumAtPrev+segLength < s && j < sequence->total-1) {
+			sumAtPrev+=segLength;
+			prev=curr;
+			CV_READ_SEQ_ELEM(curr, reader);
+			j++;
+			segLength=sqrt( (double) (curr.x-prev.x)*(curr.x-prev.x) + (double) (curr.y-prev.y)*(curr.y-prev.y) );
+		}
+
+		double t= (segLength > 0) ? (s-sumAtPrev)/segLength : 0;
+		if (t>1) t=1;
+		interpPt=cvPoint( cvRound(prev.x+t*(curr.x-prev.x)), cvRound(prev.y+t*(curr.y-prev.y)) );
+		CV_WRITE_SEQ_ELEM(interpPt, writer);
+	}
+	cvEndWriteSeq(&writer);
+}
+
+
+/*
+ * Append the CvPoint2D32f's of src to dst, a sequence of CvPoints, rounded to the nearest pixel.
+ */
+void RoundSeq2D32f(const CvSeq* src, CvSeq* dst) {
+	CvSeqReader reader;
+	CvSeqWriter writer;
+	CvPoint2D32f pt;
+	CvPoint rounded;
+	int i;
+	cvStartReadSeq(src, &reader, 0);
+	cvStartAppendToSeq(dst, &writer);
+	for (i = 0; i < src->total; i++) {
+		CV_READ_SEQ_ELEM(pt, reader);
+		rounded=cvPoint(cvRound(pt.x), cvRound(pt.y));
+		CV_WRITE_SEQ_ELEM(rounded, writer);
+	}
+	cvEndWriteSeq(&writer);
+}
+
+
+
 /*
  *
  * Resamples a boundary and stores it by omitting points. There is no interpolation.
@@ -999,6 +1089,32 @@ void FindCenterline(CvSeq* NBoundA, CvSeq* NBoundB, CvSeq* centerline) {
 }
 
 
+/*
+ * FindCenterline() for sequences of CvPoint2D32f.
+ * The midpoints aren't rounded.
+ */
+void FindCenterline2D32f(const CvSeq* NBoundA, const CvSeq* NBoundB, CvSeq* centerline) {
+	CvSeqReader readerA;
+	CvSeqReader readerB;
+	CvSeqWriter writer;
+	cvStartReadSeq(NBoundA, &readerA, 0);
+	cvStartReadSeq(NBoundB, &readerB, 0);
+	cvStartAppendToSeq(centerline, &writer);
+
+	CvPoint2D32f SideA;
+	CvPoint2D32f SideB;
+	CvPoint2D32f MidPt;
+	int i;
+	for (i = 0; i < NBoundA->total; i++) {
+		CV_READ_SEQ_ELEM(SideA, readerA);
+		CV_READ_SEQ_ELEM(SideB, readerB);
+		MidPt = cvPoint2D32f(0.5f*(SideA.x + SideB.x), 0.5f*(SideA.y + SideB.y));
+		CV_WRITE_SEQ_ELEM(MidPt, writer);
+	}
+	cvEndWriteSeq(&writer);
+}
+
+
 /*
  * extractCurvatureOfSeq
  *
@@ -1063,6 +1179,9 @@ int extractCurvatureOfSeqDouble(const CvSeq* seq, double* curvature, double sigm
 	free(k);
 	free(x);
 	free(y);
+	free(diff_x);
+	free(diff_y);
+	free(theta);
 	return A_OK;
 }
 
@@ -1139,10 +1258,109 @@ int extractCurvatureOfSeq(const CvSeq* seq, double* curvature, double sigma,CvMe
 	free(k);
 	free(x);
 	free(y);
+	free(diff_x);
+	free(diff_y);
+	free(theta);
 	return A_OK;
 }
 
 
+/*
+ * Preallocate what CurvatureOfSeqSegment() needs for segments
+ * of up to maxPoints points, smoothed with a gaussian of width sigma.
+ */
+CurvatureScratch* CreateCurvatureScratch(int maxPoints, double sigma){
+	if (maxPoints<3) return NULL;
+	CurvatureScratch* cs=(CurvatureScratch*) malloc(sizeof(CurvatureScratch));
+	cs->capacity=maxPoints;
+	cs->pts=(CvPoint*) malloc(maxPoints*sizeof(CvPoint));
+	cs->x=(double*) malloc(maxPoints*sizeof(double));
+	cs->y=(double*) malloc(maxPoints*sizeof(double));
+	cs->k=(double*) malloc(maxPoints*sizeof(double));
+	cs->sigma=sigma;
+	CreateGaussianKernel(sigma,&(cs->kernel),&(cs->klength),&(cs->normfactor));
+	return cs;
+}
+
+void DestroyCurvatureScratch(CurvatureScratch** cs){
+	if (cs==NULL || *cs==NULL) return;
+	free((*cs)->pts);
+	free((*cs)->x);
+	free((*cs)->y);
+	free((*cs)->k);
+	free((*cs)->kernel);
+	free(*cs);
+	*cs=NULL;
+}
+
+/*
+ * atan(r) for |r| <= 1 to within 1e-5 radians
+ * (Abramowitz and Stegun 4.4.49)
+ */
+static inline double AtanUnit(double r){
+	double r2=r*r;
+	return r*(0.9998660+r2*(-0.3302995+r2*(0.1801410+r2*(-0.0851330+r2*0.0208351))));
+}
+
+/*
+ * Signed angle from tangent (ax,ay) to tangent (bx,by).
+ * Tangents between adjacent points of a smoothed centerline turn by a few
+ * degrees, so this is nearly always atan(cross/dot); atan2 is only needed
+ * for turns of more than 45 degrees.
+ */
+static inline double TurnAngle(double ax, double ay, double bx, double by){
+	double cross=ax*by-ay*bx;
+	double dot=ax*bx+ay*by;
+	if (dot > fabs(cross)) return AtanUnit(cross/dot);
+	return atan2(cross,dot);
+}
+
+int CurvatureOfSeqSegment(const CvSeq* seq, int begin, int end, CurvatureScratch* cs){
+	if (seq==NULL || cs==NULL) return A_ERROR;
+	if (seq->elem_size!=sizeof(CvPoint)) return A_ERROR;
+	if (end>seq->total) end=seq->total;
+	int N=end-begin;
+	if (begin<0 || N<3 || N>cs->capacity) return A_ERROR;
+
+	/** Read the points straight out of the sequence's block if they're all in the first one **/
+	const CvPoint* pts;
+	if (seq->first!=NULL && seq->first->count>=end){
+		pts=((const CvPoint*) seq->first->data)+begin;
+	} else {
+		cvCvtSeqToArray(seq,cs->pts,cvSlice(begin,end));
+		pts=cs->pts;
+	}
+
+	/** Smooth, repeating the end points past the ends, as ConvolveDouble1D() does **/
+	int j, m, ind;
+	int anchor=cs->klength/2;
+	for (j = 0; j < N; j++) {
+		double sx=0, sy=0;
+		for (m = 0; m < cs->klength; m++) {
+			ind=j+m-anchor;
+			ind= ind > 0 ? ind : 0;
+			ind= ind < N ? ind : (N-1);
+			sx+=pts[ind].x*cs->kernel[m];
+			sy+=pts[ind].y*cs->kernel[m];
+		}
+		cs->x[j]=sx/cs->normfactor;
+		cs->y[j]=sy/cs->normfactor;
+	}
+
+	/** Curvature is the angle between adjacent tangents, with y pointing up **/
+	double ax=cs->x[1]-cs->x[0];
+	double ay=-(cs->y[1]-cs->y[0]);
+	for (j = 0; j < N-2; j++) {
+		double bx=cs->x[j+2]-cs->x[j+1];
+		double by=-(cs->y[j+2]-cs->y[j+1]);
+		cs->k[j]=TurnAngle(ax,ay,bx,by);
+		ax=bx;
+		ay=by;
+	}
+	return N-2;
+}
+
+
 
 
 /*
@@ -1501,6 +1719,7 @@ int ConvolveCvPtSeqInt2Double (const CvSeq *src, CvSeq *dst, int *kernel, int kl
 	free(y);
 	free(xc);
 	free(yc);
+	return A_OK;
 }
 
 void CreateGaussianKernel (double sigma, int **kernel, int *klength, int *normfactor) {
@@ -1601,6 +1820,92 @@ int CropNumber(int min, int max, int x){
 
 
 
+int SetLevelsLUT(LevelsLUT* lut, int min, int max){
+	if (lut->valid && lut->min==min && lut->max==max) return 0;
+	lut->valid=1;
+	lut->min=min;
+	lut->max=max;
+
+	/** If the user made min bigger than max, then invert the two **/
+	int lo= (min < max) ? min : max;
+	int hi= (min < max) ? max : min;
+	lo=CropNumber(0,255,lo);
+	hi=CropNumber(0,255,hi);
+	lut->lo=lo;
+	lut->span= (hi-lo > 0) ? hi-lo : 1;
+	lut->mult=(255*256 + lut->span - 1) / lut->span;
+
+	int k;
+	for (k = 0; k < 256; k++) {
+		int x=CropNumber(0,lut->span,k-lo);
+		lut->table[k]=(unsigned char) ((x*lut->mult) >> 8);
+	}
+	return 1;
+}
+
+/*
+ * Levels adjust one row of n pixels from src into dest, also copying
+ * src into copyA and copyB if they aren't NULL.
+ */
+static void LevelsRow(const unsigned char* src, unsigned char* copyA, unsigned char* copyB,
+		unsigned char* dest, int n, const LevelsLUT* lut){
+	int i=0;
+#ifdef __SSE2__
+	/** 16 pixels at a time: clamp(src-lo, 0, span) * mult >> 8 **/
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i lo=_mm_set1_epi16((short) lut->lo);
+	const __m128i span=_mm_set1_epi16((short) lut->span);
+	const __m128i mult=_mm_set1_epi16((short) lut->mult);
+	for (; i+16 <= n; i+=16) {
+		__m128i p=_mm_loadu_si128((const __m128i*) (src+i));
+		if (copyA!=NULL) _mm_storeu_si128((__m128i*) (copyA+i),p);
+		if (copyB!=NULL) _mm_storeu_si128((__m128i*) (copyB+i),p);
+		__m128i a=_mm_min_epi16(_mm_subs_epu16(_mm_unpacklo_epi8(p,zero),lo),span);
+		__m128i b=_mm_min_epi16(_mm_subs_epu16(_mm_unpackhi_epi8(p,zero),lo),span);
+		a=_mm_mulhi_epu16(_mm_slli_epi16(a,8),mult);
+		b=_mm_mulhi_epu16(_mm_slli_epi16(b,8),mult);
+		_mm_storeu_si128((__m128i*) (dest+i),_mm_packus_epi16(a,b));
+	}
+#endif
+	for (; i < n; i++) {
+		if (copyA!=NULL) copyA[i]=src[i];
+		if (copyB!=NULL) copyB[i]=src[i];
+		dest[i]=lut->table[src[i]];
+	}
+}
+
+int LoadFrameWithBinAndLevels(const unsigned char* binsrc, Frame* myFrame, IplImage* levelsDest, const LevelsLUT* lut){
+	int width=myFrame->size.width;
+	int height=myFrame->size.height;
+	if (levelsDest->width!=width || levelsDest->height!=height || levelsDest->nChannels!=1 || levelsDest->depth!=IPL_DEPTH_8U){
+		printf("Error. Image size does not match in LoadFrameWithBinAndLevels()\n");
+		return -1;
+	}
+	int y;
+	for (y = 0; y < height; y++) {
+		LevelsRow(binsrc + y*width,
+				myFrame->binary + y*width,
+				(unsigned char*) myFrame->iplimg->imageData + y*myFrame->iplimg->widthStep,
+				(unsigned char*) levelsDest->imageData + y*levelsDest->widthStep,
+				width, lut);
+	}
+	return 0;
+}
+
+int ApplyLevelsLUT(const IplImage* src, IplImage* dest, const LevelsLUT* lut){
+	if (src->width!=dest->width || src->height!=dest->height || src->nChannels!=1 || dest->nChannels!=1
+			|| src->depth!=IPL_DEPTH_8U || dest->depth!=IPL_DEPTH_8U){
+		printf("Error. Images don't match in ApplyLevelsLUT()\n");
+		return -1;
+	}
+	int y;
+	for (y = 0; y < src->height; y++) {
+		LevelsRow((const unsigned char*) src->imageData + y*src->widthStep, NULL, NULL,
+				(unsigned char*) dest->imageData + y*dest->widthStep, src->width, lut);
+	}
+	return 0;
+}
+
 /*
  * Create a lookup table  such that:
  * 1) all pixels less then min are zero
@@ -1608,33 +1913,14 @@ int CropNumber(int min, int max, int x){
  * 3) everything in between is linear.
  */
 CvMat* CreateMinMaxLUT(int min, int max){
+	LevelsLUT levels;
+	levels.valid=0;
+	SetLevelsLUT(&levels,min,max);
 
-	CvMat* LUT=NULL;
-	if (min <0 || max <0 ){
-		return LUT;
-	}
-
-	if (min>max){
-		/** If the user made min bigger than max, then invert the two **/
-		int tmp;
-		tmp=max;
-		max=min;
-		min=tmp;
-	}
-
-	LUT=cvCreateMat(1,256,CV_8U);
+	CvMat* LUT=cvCreateMat(1,256,CV_8U);
 	for (int k=0; k<256; k++){
-
-		if (k<min) {
-			*(  (unsigned int *) CV_MAT_ELEM_PTR(*LUT,0,k)  ) =0;
-		} else if (k>max){
-			*(  (unsigned int *) CV_MAT_ELEM_PTR(*LUT,0,k)  )=255;
-		} else {
-			*(  (unsigned int *) CV_MAT_ELEM_PTR(*LUT,0,k)  )= (k-min) *   (unsigned int) (  (  255.0 ) / ( (float) max-  (float) min) );
-		}
-
+		CV_MAT_ELEM(*LUT,unsigned char,0,k)=levels.table[k];
 	}
-
 	return LUT;
 }
 
@@ -1643,15 +1929,10 @@ CvMat* CreateMinMaxLUT(int min, int max){
  *  Creates a lookup table and applies it
  */
 int simpleAdjustLevels(const IplImage* src, IplImage* dest, int min, int max){
-
-	CvMat* LUT= NULL;
-	LUT=CreateMinMaxLUT(min,max);
-
-	cvLUT( src, dest, (const CvArr*) LUT);
-
-	cvReleaseMat(&LUT);
-
-	return 0;
+	LevelsLUT levels;
+	levels.valid=0;
+	SetLevelsLUT(&levels,min,max);
+	return ApplyLevelsLUT(src,dest,&levels);
 }
 
 
@@ -107,6 +107,46 @@ void DestroyFrame(Frame** myFrame);
  */
 void LoadFrameWithBin(unsigned char* binsrc, Frame* myFrame);
 
+/*
+ * Levels adjustment as a lookup table:
+ * 1) all pixels less then min are zero
+ * 2) all pixels greater than max are 255
+ * 3) everything in between is linear.
+ *
+ * Computed in 8.8 fixed point so that the table and the
+ * vectorized code in LoadFrameWithBinAndLevels() agree exactly.
+ */
+typedef struct LevelsLUTStruct{
+	int valid;
+	int min; // as requested, to notice when they change
+	int max;
+	int lo; // after sorting and clamping to 0..255
+	int span; // hi-lo, at least 1
+	int mult; // 255*256/span, rounded up
+	unsigned char table[256];
+} LevelsLUT;
+
+/*
+ * Rebuild the table if min or max changed since the last call.
+ * Returns 1 if it was rebuilt, 0 otherwise.
+ */
+int SetLevelsLUT(LevelsLUT* lut, int min, int max);
+
+/*
+ * LoadFrameWithBin() and the levels adjustment in one pass:
+ * copies binsrc into myFrame's binary and iplimg and writes
+ * the levels adjusted image into levelsDest.
+ *
+ * levelsDest must be 8 bit, one channel and of size myFrame->size.
+ * Returns 0, or -1 if it isn't.
+ */
+int LoadFrameWithBinAndLevels(const unsigned char* binsrc, Frame* myFrame, IplImage* levelsDest, const LevelsLUT* lut);
+
+/*
+ * Apply a levels table from src to dest (which may be the same image)
+ */
+int ApplyLevelsLUT(const IplImage* src, IplImage* dest, const LevelsLUT* lut);
+
 /*
  * RefreshFrame
  *
@@ -246,6 +286,21 @@ void resampleSeq(CvSeq* sequence,CvSeq* ResampledSeq, int Numsegments);
 
 void resampleSeqConstPtsPerArcLength(CvSeq* sequence, CvSeq* ResampledSeq, int Numsegments);
 
+/*
+ * Resample a sequence of CvPoint2D32f into Numsegments CvPoints, evenly
+ * spaced along its arc length, rounding only at the end.
+ *
+ * Unlike resampleSeqConstPtsPerArcLength() there is no decimation first:
+ * the arc length is measured along every point, which is only worth doing
+ * when the points aren't stuck to the pixel grid.
+ */
+void resampleSeq2D32fConstPtsPerArcLength(const CvSeq* sequence, CvSeq* ResampledSeq, int Numsegments);
+
+/*
+ * Append the CvPoint2D32f's of src to dst, a sequence of CvPoints, rounded to the nearest pixel.
+ */
+void RoundSeq2D32f(const CvSeq* src, CvSeq* dst);
+
 /*
  *
  * Returns the squared distance between two points
@@ -290,6 +345,11 @@ int CvtPolySeq2ContourSeq(CvSeq* polygon, CvSeq* contour );
  */
 void FindCenterline(CvSeq* NBoundA,CvSeq* NBoundB,CvSeq* centerline);
 
+/*
+ * FindCenterline() for sequences of CvPoint2D32f.
+ */
+void FindCenterline2D32f(const CvSeq* NBoundA, const CvSeq* NBoundB, CvSeq* centerline);
+
 /*
  * Given a point, and a boundary, this function returns the coordinates of the closest point on the boundary.
  */
@@ -420,6 +480,38 @@ int extractCurvatureOfSeq(const CvSeq* seq, double* curvature, double sigma,CvMe
  */
 int extractCurvatureOfSeqDouble(const CvSeq* seq, double* curvature, double sigma,CvMemStorage* mem);
 
+/*
+ * Buffers and gaussian kernel for CurvatureOfSeqSegment(),
+ * allocated once so that finding the curvature allocates nothing.
+ */
+typedef struct CurvatureScratchStruct{
+	int capacity; // most points in a segment
+	CvPoint* pts; // copy of the segment, if it isn't contiguous in the sequence
+	double* x; // smoothed segment
+	double* y;
+	double* k; // curvature
+	double sigma;
+	int* kernel;
+	int klength;
+	int normfactor;
+} CurvatureScratch;
+
+CurvatureScratch* CreateCurvatureScratch(int maxPoints, double sigma);
+
+void DestroyCurvatureScratch(CurvatureScratch** cs);
+
+/*
+ * CurvatureOfSeqSegment
+ *
+ * The same curvature as extractCurvatureOfSeq() of the slice [begin, end)
+ * of a sequence of CvPoints, in one pass and without allocating.
+ * The angle between tangents is unwrapped, so it is always in (-pi, pi].
+ *
+ * The curvature is left in cs->k. Returns the number of values, end-begin-2,
+ * or A_ERROR.
+ */
+int CurvatureOfSeqSegment(const CvSeq* seq, int begin, int end, CurvatureScratch* cs);
+
 /**** Testing Functions ****/
 
 /*
@@ -465,6 +557,7 @@ int PushToSeqBuffer(CvSeq* seq, void* element, int MaxBuffSize);
 /*
  *  Adjust the pixel levels of an image
  *  Creates a lookup table and applies it
+ *  (To reuse the table from frame to frame, use SetLevelsLUT() and ApplyLevelsLUT())
  */
 int simpleAdjustLevels(const IplImage* src, IplImage* dest, int min, int max);
 
@@ -0,0 +1,335 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ContourTracer.c
+ *
+ * Seeded tracing of a single object's outer border.
+ * See ContourTracer.h
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cxcore.h>
+#include <cv.h>
+
+#include "AndysOpenCVLib.h"
+#include "ContourTracer.h"
+
+/** Borders longer than this many times the image's width plus height are left to the full search **/
+#define CONTOUR_TRACER_MAX_PTS_FACTOR 8
+
+/** The 8 neighbours, counterclockwise from east, in the order cvFindContours() uses **/
+static const int NeighbourDx[8]={1,1,0,-1,-1,-1,0,1};
+static const int NeighbourDy[8]={0,-1,-1,-1,0,1,1,1};
+
+
+ContourTracer* CreateContourTracer(CvSize size){
+	ContourTracer* ct=(ContourTracer*) malloc(sizeof(ContourTracer));
+	if (ct==NULL) return NULL;
+	memset(ct,0,sizeof(ContourTracer));
+	ct->size=size;
+
+	ct->stackSize=size.width*size.height;
+	ct->maxPts=CONTOUR_TRACER_MAX_PTS_FACTOR*(size.width+size.height);
+	ct->stamp=(unsigned int*) calloc(size.width*size.height,sizeof(unsigned int));
+	ct->stack=(int*) malloc(ct->stackSize*sizeof(int));
+	ct->pts=(CvPoint*) malloc(ct->maxPts*sizeof(CvPoint));
+	ct->scratch=cvCreateImage(size,IPL_DEPTH_8U,1);
+	ct->pass=0;
+
+	if (ct->stamp==NULL || ct->stack==NULL || ct->pts==NULL){
+		printf("Error! Out of memory in CreateContourTracer()!\n");
+		DestroyContourTracer(&ct);
+		return NULL;
+	}
+	return ct;
+}
+
+
+void DestroyContourTracer(ContourTracer** ct){
+	if (ct==NULL || *ct==NULL) return;
+	free((*ct)->stamp);
+	free((*ct)->stack);
+	free((*ct)->pts);
+	if ((*ct)->scratch!=NULL) cvReleaseImage(&((*ct)->scratch));
+	free(*ct);
+	*ct=NULL;
+}
+
+
+/** Is (x,y) an object pixel? The outermost rows and columns never are **/
+static inline int IsOn(const ContourTracer* ct, const unsigned char* data, int step, int x, int y){
+	return x>=1 && x<ct->size.width-1 && y>=1 && y<ct->size.height-1 && data[y*step+x]!=0;
+}
+
+
+/*
+ * Flood fill the 8-connected object containing seed one run of pixels at a
+ * time, and return its first pixel in raster order: the leftmost of its
+ * topmost pixels. That is where cvFindContours() starts its border.
+ *
+ * Returns -1 if the fill outgrows its stack.
+ */
+static int FindFirstPixelOfObject(ContourTracer* ct, const unsigned char* data, int step, CvPoint seed, CvPoint* first){
+	const int w=ct->size.width;
+	const int h=ct->size.height;
+	unsigned int* stamp=ct->stamp;
+	int* stack=ct->stack;
+	int sp=0;
+
+	/** A fresh pass number marks every pixel unvisited **/
+	ct->pass++;
+	if (ct->pass==0){
+		memset(stamp,0,w*h*sizeof(unsigned int));
+		ct->pass=1;
+	}
+	const unsigned int pass=ct->pass;
+
+	*first=seed;
+	stack[sp++]=seed.y*w+seed.x;
+	while (sp>0){
+		int idx=stack[--sp];
+		/** Runs are always stamped whole, so one stamped pixel means the run is done **/
+		if (stamp[idx]==pass) continue;
+
+		int y=idx/w;
+		int x=idx-y*w;
+		const unsigned char* row=data+y*step;
+		int l=x;
+		int r=x;
+		while (l>1 && row[l-1]) l--;
+		while (r<w-2 && row[r+1]) r++;
+
+		unsigned int* srow=stamp+y*w;
+		for (int i=l; i<=r; i++) srow[i]=pass;
+
+		if (y<first->y || (y==first->y && l<first->x)) *first=cvPoint(l,y);
+
+		/** Queue each run in the rows above and below that touches this one, diagonals included **/
+		for (int ny=y-1; ny<=y+1; ny+=2){
+			if (ny<1 || ny>h-2) continue;
+			const unsigned char* nrow=data+ny*step;
+			const unsigned int* nstamp=stamp+ny*w;
+			int hi= (r+1<w-2) ? r+1 : w-2;
+			int i= (l-1>1) ? l-1 : 1;
+			while (i<=hi){
+				if (nrow[i] && nstamp[i]!=pass){
+					if (sp>=ct->stackSize) return -1;
+					stack[sp++]=ny*w+i;
+					while (i<=hi && nrow[i]) i++;
+				} else {
+					i++;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Follow the outer border of the object whose first pixel in raster order
+ * is start, exactly as cvFindContours() does, writing every border pixel
+ * into ct->pts.
+ *
+ * Returns the number of points, or -1 if the buffer is too small.
+ */
+static int TraceOuterBorder(ContourTracer* ct, const unsigned char* data, int step, CvPoint start, CvRect* bound){
+	CvPoint* pts=ct->pts;
+	int n=0;
+	int s=4;
+	int k;
+	int xmin=start.x, xmax=start.x, ymax=start.y;
+
+	/** Find the first neighbour, searching clockwise from the west **/
+	for (k=0; k<8; k++){
+		s=(s-1)&7;
+		if (IsOn(ct,data,step,start.x+NeighbourDx[s],start.y+NeighbourDy[s])) break;
+	}
+	if (k==8){
+		/** A lone pixel **/
+		pts[0]=start;
+		*bound=cvRect(start.x,start.y,1,1);
+		return 1;
+	}
+
+	const int x1=start.x+NeighbourDx[s];
+	const int y1=start.y+NeighbourDy[s];
+	int x3=start.x;
+	int y3=start.y;
+	int x4, y4;
+	for (;;){
+		/** The next border pixel is the first object pixel counterclockwise from where we came from **/
+		for (k=0; k<8; k++){
+			s=(s+1)&7;
+			x4=x3+NeighbourDx[s];
+			y4=y3+NeighbourDy[s];
+			if (IsOn(ct,data,step,x4,y4)) break;
+		}
+
+		if (n>=ct->maxPts) return -1;
+		pts[n++]=cvPoint(x3,y3);
+		if (x3<xmin) xmin=x3;
+		if (x3>xmax) xmax=x3;
+		if (y3>ymax) ymax=y3;
+
+		/** Back at the start, about to repeat the first step **/
+		if (x4==start.x && y4==start.y && x3==x1 && y3==y1) break;
+
+		x3=x4;
+		y3=y4;
+		s=(s+4)&7;
+	}
+
+	*bound=cvRect(xmin,start.y,xmax-xmin+1,ymax-start.y+1);
+	return n;
+}
+
+
+CvSeq* TraceSeededContour(ContourTracer* ct, const IplImage* img, const CvSeq* seeds){
+	if (ct==NULL || img==NULL || seeds==NULL || seeds->total<1) return NULL;
+	if (img->width!=ct->size.width || img->height!=ct->size.height || img->depth!=IPL_DEPTH_8U || img->nChannels!=1){
+		printf("Error! Image does not match the tracer in TraceSeededContour()!\n");
+		return NULL;
+	}
+	const unsigned char* data=(const unsigned char*) img->imageData;
+	const int step=img->widthStep;
+
+	/** Try the seeds from the middle outwards **/
+	const int n=seeds->total;
+	CvPoint seed;
+	int found=0;
+	for (int k=0; k<n && !found; k++){
+		int i= (k&1) ? n/2-(k+1)/2 : n/2+k/2;
+		seed=*(CvPoint*) cvGetSeqElem(seeds,i);
+		found=IsOn(ct,data,step,seed.x,seed.y);
+	}
+	if (!found) return NULL;
+
+	CvPoint first;
+	if (FindFirstPixelOfObject(ct,data,step,seed,&first)<0) return NULL;
+
+	CvRect bound;
+	int total=TraceOuterBorder(ct,data,step,first,&bound);
+	if (total<0) return NULL;
+
+	memset(&(ct->header),0,sizeof(CvContour));
+	CvSeq* contour=cvMakeSeqHeaderForArray(CV_SEQ_POLYGON,sizeof(CvContour),sizeof(CvPoint),ct->pts,total,(CvSeq*) &(ct->header),&(ct->block));
+	ct->header.rect=bound;
+	return contour;
+}
+
+
+/** The 4 neighbours, counterclockwise from east **/
+static const int CrackDx[4]={1,0,-1,0};
+static const int CrackDy[4]={0,-1,0,1};
+
+/** Is (x,y) brighter than thresh? The outermost rows and columns never are **/
+static inline int IsAbove(const ContourTracer* ct, const unsigned char* data, int step, int thresh, int x, int y){
+	return x>=1 && x<ct->size.width-1 && y>=1 && y<ct->size.height-1 && data[y*step+x]>thresh;
+}
+
+
+CvSeq* TraceSubPixelBorder(ContourTracer* ct, const IplImage* img, int thresh, CvPoint start, CvMemStorage* mem){
+	if (ct==NULL || img==NULL || mem==NULL) return NULL;
+	if (img->width!=ct->size.width || img->height!=ct->size.height || img->depth!=IPL_DEPTH_8U || img->nChannels!=1){
+		printf("Error! Image does not match the tracer in TraceSubPixelBorder()!\n");
+		return NULL;
+	}
+	const unsigned char* data=(const unsigned char*) img->imageData;
+	const int step=img->widthStep;
+	if (!IsAbove(ct,data,step,thresh,start.x,start.y) || IsAbove(ct,data,step,thresh,start.x,start.y-1)) return NULL;
+
+	const float level=thresh+0.5f;
+	const int maxPts=4*ct->maxPts;
+	CvSeq* border=cvCreateSeq(CV_32FC2,sizeof(CvSeq),sizeof(CvPoint2D32f),mem);
+	CvSeqWriter writer;
+	cvStartAppendToSeq(border,&writer);
+
+	/*
+	 * Walk the cracks between object pixels and the background pixels
+	 * beside them, with the object on the left. p is the object pixel and
+	 * d the direction of the background pixel across the crack.
+	 */
+	int px=start.x;
+	int py=start.y;
+	int d=1;
+	int n=0;
+	do {
+		/** Where the image crosses level between p and the background pixel q **/
+		const int qx=px+CrackDx[d];
+		const int qy=py+CrackDy[d];
+		const float vp=data[py*step+px];
+		float vq=data[qy*step+qx];
+		if (vq>thresh) vq=thresh; // q is in the outermost frame, which is always background
+		const float frac=(vp-level)/(vp-vq);
+		CvPoint2D32f pt=cvPoint2D32f(px+frac*CrackDx[d],py+frac*CrackDy[d]);
+		CV_WRITE_SEQ_ELEM(pt,writer);
+		if (++n>maxPts){
+			cvEndWriteSeq(&writer);
+			return NULL;
+		}
+
+		/** Step along the crack. a is the next pixel on the object's side and b the one diagonally across **/
+		const int t=(d+1)&3;
+		const int ax=px+CrackDx[t];
+		const int ay=py+CrackDy[t];
+		if (IsAbove(ct,data,step,thresh,ax+CrackDx[d],ay+CrackDy[d])){
+			/** Turn towards the background **/
+			px=ax+CrackDx[d];
+			py=ay+CrackDy[d];
+			d=(t+2)&3;
+		} else if (IsAbove(ct,data,step,thresh,ax,ay)){
+			/** Straight on **/
+			px=ax;
+			py=ay;
+		} else {
+			/** Round the corner of p **/
+			d=t;
+		}
+	} while (px!=start.x || py!=start.y || d!=1);
+
+	cvEndWriteSeq(&writer);
+	return border;
+}
+
+
+CvSeq* FindLongestContour(ContourTracer* ct, const IplImage* img, CvMemStorage* mem){
+	CvSeq* contours=NULL;
+	CvSeq* longest=NULL;
+	cvCopy(img,ct->scratch);
+	cvFindContours(ct->scratch,mem,&contours,sizeof(CvContour),CV_RETR_EXTERNAL,CV_CHAIN_APPROX_NONE,cvPoint(0,0));
+	if (contours!=NULL) LongestContour(contours,&longest);
+	return longest;
+}
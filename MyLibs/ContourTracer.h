@@ -0,0 +1,136 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ContourTracer.h
+ *
+ * Traces the outline of just the worm in a thresholded image, instead of
+ * asking cvFindContours() for the outline of every object in the frame.
+ *
+ * The worm barely moves between frames, so some pixel of last frame's
+ * centerline is almost always still on the worm. Starting from such a seed
+ * the tracer finds the top-left pixel of the seed's connected object with a
+ * run-based fill, then follows its outer border into a preallocated,
+ * contiguous point buffer. Nothing is allocated per frame.
+ *
+ * The border is followed with the same rules cvFindContours() uses for
+ * CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE, so the points are identical, in
+ * the same order, to the contour cvFindContours() would have returned for
+ * that object. As in cvFindContours() the one pixel frame around the image
+ * counts as background.
+ *
+ * If no seed lands on an object, the caller falls back to the full search.
+ *
+ * Optionally, the same border can then be found to sub-pixel precision
+ * from the image before it was thresholded.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef CONTOURTRACER_H_
+#define CONTOURTRACER_H_
+
+typedef struct ContourTracerStruct{
+	CvSize size;
+
+	/** Pixel p was reached by the fill in the current pass if stamp[p]==pass. Never needs clearing **/
+	unsigned int* stamp;
+	unsigned int pass;
+
+	/** Fill stack, pixel indices **/
+	int* stack;
+	int stackSize;
+
+	/** The traced border **/
+	CvPoint* pts;
+	int maxPts;
+
+	/** Sequence header handed to the caller, over pts **/
+	CvContour header;
+	CvSeqBlock block;
+
+	/** Length of the last boundary the caller settled on, to sanity check the next seeded trace against **/
+	int lastTotal;
+
+	/** Scratch copy for the full search, which cvFindContours() scribbles on **/
+	IplImage* scratch;
+} ContourTracer;
+
+
+/*
+ * Allocate a tracer for images of the given size.
+ */
+ContourTracer* CreateContourTracer(CvSize size);
+
+/*
+ * Free the tracer and set the pointer to NULL.
+ */
+void DestroyContourTracer(ContourTracer** ct);
+
+/*
+ * Trace the outer border of the object in the 8 bit binary image img that
+ * contains the first seed point landing on a nonzero pixel.
+ *
+ * Seeds are tried starting from the middle of the sequence, which for a
+ * centerline is the most reliable part of the worm.
+ *
+ * Returns a sequence of CvPoints backed by the tracer's own buffer. It is
+ * overwritten by the next call and must be copied (into a CvMemStorage) to
+ * be kept. Returns NULL if no seed is on an object, or the border is too
+ * long for the buffer.
+ */
+CvSeq* TraceSeededContour(ContourTracer* ct, const IplImage* img, const CvSeq* seeds);
+
+/*
+ * The border of the same object to sub-pixel precision, found from the
+ * grayscale image img that was thresholded at thresh to make the binary
+ * image, so that the object is the pixels brighter than thresh. start is
+ * the object's top-left pixel, which is the first point of its integer
+ * contour from TraceSeededContour() or cvFindContours().
+ *
+ * This is marching squares at the level thresh+0.5, following just this
+ * object's border so that only pixels along it are read. There is one
+ * point wherever an object pixel sits beside a background pixel, linearly
+ * interpolated between the two. Diagonal neighbours are connected, as in
+ * the integer contour, and the points run in the same direction, starting
+ * above start.
+ *
+ * Returns a sequence of CvPoint2D32f in mem, or NULL if start isn't the
+ * top-left pixel of an object or the border is too long.
+ */
+CvSeq* TraceSubPixelBorder(ContourTracer* ct, const IplImage* img, int thresh, CvPoint start, CvMemStorage* mem);
+
+/*
+ * The full search: every external contour in img via cvFindContours(),
+ * returning a copy of the longest one in mem, or NULL if there are no
+ * objects. img is left untouched.
+ */
+CvSeq* FindLongestContour(ContourTracer* ct, const IplImage* img, CvMemStorage* mem);
+
+#endif /* CONTOURTRACER_H_ */
@@ -0,0 +1,96 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * DisplayMailbox.c
+ *
+ * A lock-free triple buffer of display images.
+ * See DisplayMailbox.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include <cv.h>
+#include <cxcore.h>
+
+#include "DisplayMailbox.h"
+
+DisplayMailbox* CreateDisplayMailbox(CvSize size){
+	DisplayMailbox* box = (DisplayMailbox*) calloc(1, sizeof(DisplayMailbox));
+	if (box == NULL) return NULL;
+	int k;
+	for (k = 0; k < DISPLAY_NUM_SLOTS; k++) {
+		box->slot[k] = cvCreateImage(size, IPL_DEPTH_8U, 1);
+		cvZero(box->slot[k]);
+	}
+	box->back = 0;
+	box->front = 1;
+	box->middle = 2; // not fresh: nothing published yet
+	return box;
+}
+
+void DestroyDisplayMailbox(DisplayMailbox** box){
+	if (box == NULL || *box == NULL) return;
+	int k;
+	for (k = 0; k < DISPLAY_NUM_SLOTS; k++)
+		cvReleaseImage(&((*box)->slot[k]));
+	free(*box);
+	*box = NULL;
+}
+
+IplImage* DisplayMailboxBackImage(DisplayMailbox* box){
+	return box->slot[box->back];
+}
+
+void DisplayMailboxPublish(DisplayMailbox* box){
+	/** InterlockedExchange is a full barrier, so the drawing is visible before the index is **/
+	LONG prev = InterlockedExchange(&(box->middle), box->back | DISPLAY_SLOT_FRESH);
+	if (prev & DISPLAY_SLOT_FRESH) box->overwritten++;
+	box->back = prev & ~DISPLAY_SLOT_FRESH;
+	box->published++;
+}
+
+IplImage* DisplayMailboxLatest(DisplayMailbox* box, int* isNew){
+	int fresh = (InterlockedCompareExchange(&(box->middle), 0, 0) & DISPLAY_SLOT_FRESH) != 0;
+	if (fresh) {
+		/** Only the GUI clears the fresh bit, so it is still set when we swap **/
+		LONG prev = InterlockedExchange(&(box->middle), box->front);
+		box->front = prev & ~DISPLAY_SLOT_FRESH;
+		box->frontValid = 1;
+	}
+	if (isNew != NULL) *isNew = fresh;
+
+	if (!box->frontValid) return NULL;
+	return box->slot[box->front];
+}
@@ -0,0 +1,97 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * DisplayMailbox.h
+ *
+ * Hands finished display images from the processing thread to the GUI
+ * thread without either one ever waiting for the other.
+ *
+ * The mailbox owns three images. The processing thread draws into the back
+ * image and publishes it, which atomically swaps it with the shared middle
+ * image. The GUI thread picks up the latest published image by swapping the
+ * middle image with its front image. No image is ever copied and neither
+ * thread blocks; if the GUI falls behind, older images are simply replaced.
+ *
+ * The image the GUI is showing is never written to by the processing thread,
+ * so the display can't tear.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef DISPLAYMAILBOX_H_
+#define DISPLAYMAILBOX_H_
+
+#include <windows.h>
+
+#define DISPLAY_NUM_SLOTS 3
+
+/** OR'd into middle when it holds an image the GUI hasn't picked up yet **/
+#define DISPLAY_SLOT_FRESH 0x4
+
+typedef struct DisplayMailboxStruct{
+	IplImage* slot[DISPLAY_NUM_SLOTS];
+
+	int back; // only touched by the processing thread
+	int front; // only touched by the GUI thread
+	int frontValid; // GUI thread: front holds a published image
+	volatile LONG middle; // shared, slot index | DISPLAY_SLOT_FRESH
+
+	/** Statistics, each written by one thread only **/
+	long published;
+	long overwritten; // published but replaced before the GUI picked them up
+} DisplayMailbox;
+
+/*
+ * Create a mailbox of 8-bit grayscale images of the given size
+ */
+DisplayMailbox* CreateDisplayMailbox(CvSize size);
+
+void DestroyDisplayMailbox(DisplayMailbox** box);
+
+/*
+ * Processing thread: the image to draw the next display into.
+ */
+IplImage* DisplayMailboxBackImage(DisplayMailbox* box);
+
+/*
+ * Processing thread: hand the back image to the GUI.
+ * The back image is replaced with a free one.
+ */
+void DisplayMailboxPublish(DisplayMailbox* box);
+
+/*
+ * GUI thread: the most recently published image, or NULL if nothing has been
+ * published yet. The image stays valid, and unchanged, until the next call.
+ * isNew is set to 1 if the image was published since the last call.
+ * isNew may be NULL.
+ */
+IplImage* DisplayMailboxLatest(DisplayMailbox* box, int* isNew);
+
+#endif /* DISPLAYMAILBOX_H_ */
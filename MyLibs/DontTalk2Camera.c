@@ -141,3 +141,14 @@ void T2Cam_TurnOff(CamData** CameraDataStruct){
 	assert(0);
 }
 
+/*
+ * Block until the camera callback delivers a frame that has not been seen
+ * yet, or until timeoutMs milliseconds elapse.
+ */
+int T2Cam_WaitForFrame(CamData* MyCamera, DWORD timeoutMs){
+	T2Cam_errormsg();
+	UNUSED(MyCamera);
+	UNUSED(timeoutMs);
+	assert(0);
+	return T2CAM_ERROR;
+}
@@ -136,6 +136,14 @@ int AcquireFrame(FrameGrabber* fg){
 }
 
 
+int StartContinuousAcquisition(FrameGrabber* fg, int numBuffers){
+	T2FrameGrabber_errormsg();
+	assert(0);
+
+	return 0;
+}
+
+
 int CloseFrameGrabber(FrameGrabber* fg){
 
 	T2FrameGrabber_errormsg();
@@ -0,0 +1,782 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * FrameArchive.c
+ *
+ * Timestamped 8-bit frame archives, raw or losslessly compressed: a
+ * batched, sector-aligned writer and a timed replay reader.
+ *
+ * See FrameArchive.h for the file layout and the compressed format.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+#include "AndysComputations.h"
+#include "FrameArchive.h"
+
+/** Space reserved at the start of each record for its header **/
+#define FRAMEARCHIVE_RECORD_HEADER_SIZE 64
+
+static long AlignTo(long x, long a){
+	return ((x + a - 1) / a) * a;
+}
+
+int IsFrameArchiveFileName(const char* fname){
+	if (fname == NULL) return 0;
+	size_t n = strlen(fname);
+	size_t e = strlen(FRAMEARCHIVE_EXTENSION);
+	return (n > e && _stricmp(fname + n - e, FRAMEARCHIVE_EXTENSION) == 0);
+}
+
+
+/************************
+ * Codec
+ */
+
+/*
+ * Size of a stripe of n pixels coded entirely as literal groups: one control
+ * byte per 64 residuals. No stripe is ever stored any bigger than this.
+ */
+static long LiteralSize(long n){
+	return n + (n + 63) / 64;
+}
+
+/** Largest payload a frame of numPixels in numStripes stripes can compress to **/
+static long MaxPayload(long numPixels, int numStripes){
+	return numPixels + numPixels / 64 + 2 * numStripes + 16;
+}
+
+/** Scratch EncodeStripe() needs for n pixels before it falls back to literals **/
+static long MaxEncodeScratch(long n){
+	return 2 * n + 16;
+}
+
+/** Map residuals -128..127 to 0..255 as 0,-1,1,-2,2... **/
+static unsigned char Zigzag(unsigned char d){
+	int r = (signed char) d;
+	return (unsigned char) (((r << 1) ^ (r >> 7)) & 0xFF);
+}
+
+static unsigned char Unzigzag(unsigned char z){
+	return (unsigned char) ((z >> 1) ^ (unsigned char) (-(int) (z & 1)));
+}
+
+/*
+ * Length of the run of zero residuals at zz[i], counting no further than max
+ */
+static long ZeroRun(const unsigned char* zz, long i, long n, long max){
+	long r = 0;
+	while (i + r < n && r < max && zz[i + r] == 0) r++;
+	return r;
+}
+
+/*
+ * Compress one stripe of n pixels into out, predicting from prev, or from
+ * the left neighbour if prev is NULL. zz is n bytes of scratch and out must
+ * hold MaxEncodeScratch(n) bytes. Returns the number of bytes written, which
+ * is never more than LiteralSize(n).
+ */
+static long EncodeStripe(const unsigned char* cur, const unsigned char* prev, long n,
+		unsigned char* zz, unsigned char* out){
+	long i;
+	if (prev != NULL) {
+		for (i = 0; i < n; i++)
+			zz[i] = Zigzag((unsigned char) (cur[i] - prev[i]));
+	} else {
+		unsigned char left = 0;
+		for (i = 0; i < n; i++) {
+			zz[i] = Zigzag((unsigned char) (cur[i] - left));
+			left = cur[i];
+		}
+	}
+
+	long o = 0;
+	i = 0;
+	while (i < n) {
+		if (zz[i] == 0) {
+			/** Run of zeros **/
+			long r = ZeroRun(zz, i, n, 128);
+			out[o++] = (unsigned char) (r - 1);
+			i += r;
+		} else if (zz[i] < 16) {
+			/** Small residuals, two to a byte. Stop where a zero run would be cheaper. **/
+			long k = 0;
+			while (i + k < n && k < 64 && zz[i + k] < 16) {
+				if (zz[i + k] == 0 && ZeroRun(zz, i + k, n, 4) == 4) break;
+				k++;
+			}
+			out[o++] = (unsigned char) (0x80 | (k - 1));
+			long j;
+			for (j = 0; j < k; j += 2) {
+				unsigned char hi = (j + 1 < k) ? zz[i + j + 1] : 0;
+				out[o++] = (unsigned char) (zz[i + j] | (hi << 4));
+			}
+			i += k;
+		} else {
+			/** Large residuals. Swallow an isolated small one rather than switching groups. **/
+			long k = 0;
+			while (i + k < n && k < 64 && (zz[i + k] >= 16
+					|| (zz[i + k] != 0 && i + k + 1 < n && zz[i + k + 1] >= 16)))
+				k++;
+			out[o++] = (unsigned char) (0xC0 | (k - 1));
+			memcpy(out + o, zz + i, k);
+			o += k;
+			i += k;
+		}
+	}
+
+	/** Pathological noise can beat the greedy grouping. Store it verbatim instead. **/
+	if (o > LiteralSize(n)) {
+		o = 0;
+		for (i = 0; i < n; i += 64) {
+			long k = (n - i < 64) ? n - i : 64;
+			out[o++] = (unsigned char) (0xC0 | (k - 1));
+			memcpy(out + o, zz + i, k);
+			o += k;
+		}
+	}
+	return o;
+}
+
+/*
+ * Decompress one stripe of n pixels from in (at most inLen bytes) into out.
+ * Returns the number of bytes consumed, or -1 if the data is corrupt.
+ */
+static long DecodeStripe(const unsigned char* in, long inLen, const unsigned char* prev,
+		long n, unsigned char* out){
+	long i = 0;
+	long o = 0;
+	unsigned char left = 0;
+	while (o < n) {
+		if (i >= inLen) return -1;
+		unsigned char c = in[i++];
+		long k;
+		long j;
+		if (c < 0x80) {
+			k = c + 1;
+			if (o + k > n) return -1;
+			if (prev != NULL) {
+				memcpy(out + o, prev + o, k);
+			} else {
+				memset(out + o, left, k);
+			}
+			o += k;
+		} else if (c < 0xC0) {
+			k = (c & 0x3F) + 1;
+			long nb = (k + 1) / 2;
+			if (o + k > n || i + nb > inLen) return -1;
+			for (j = 0; j < k; j++) {
+				unsigned char z = (j & 1) ? (in[i + j / 2] >> 4) : (in[i + j / 2] & 0x0F);
+				unsigned char pred = (prev != NULL) ? prev[o] : left;
+				out[o] = (unsigned char) (pred + Unzigzag(z));
+				left = out[o++];
+			}
+			i += nb;
+		} else {
+			k = (c & 0x3F) + 1;
+			if (o + k > n || i + k > inLen) return -1;
+			for (j = 0; j < k; j++) {
+				unsigned char pred = (prev != NULL) ? prev[o] : left;
+				out[o] = (unsigned char) (pred + Unzigzag(in[i + j]));
+				left = out[o++];
+			}
+			i += k;
+		}
+	}
+	return i;
+}
+
+/** First row of stripe k of numStripes **/
+static int StripeRow(int height, int numStripes, int k){
+	return (int) (((long) k * height) / numStripes);
+}
+
+
+/************************
+ * Compression threads
+ */
+
+static DWORD WINAPI FrameArchiveWorkerThread(LPVOID lpParam){
+	FrameArchiveWorker* w = (FrameArchiveWorker*) lpParam;
+	while (1) {
+		WaitForSingleObject(w->start, INFINITE);
+		if (InterlockedCompareExchange(&(w->quit), 0, 0)) break;
+		w->outBytes = EncodeStripe(w->cur, w->prev, w->numPixels, w->zz, w->out);
+		SetEvent(w->done);
+	}
+	return 0;
+}
+
+static int StartFrameArchiveWorkers(FrameArchiveWriter* fa){
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	fa->numWorkers = (int) sysinfo.dwNumberOfProcessors;
+	if (fa->numWorkers > FRAMEARCHIVE_MAX_WORKERS) fa->numWorkers = FRAMEARCHIVE_MAX_WORKERS;
+	if (fa->numWorkers < 1) fa->numWorkers = 1;
+
+	long maxStripe = (long) (fa->header.height / fa->numWorkers + 1) * fa->header.width;
+	int k;
+	for (k = 0; k < fa->numWorkers; k++) {
+		FrameArchiveWorker* w = &(fa->worker[k]);
+		w->zz = (unsigned char*) malloc(maxStripe);
+		w->out = (unsigned char*) malloc(MaxEncodeScratch(maxStripe));
+		if (w->zz == NULL || w->out == NULL) return FRAMEARCHIVE_ERROR;
+		/** With a single worker we encode on the writer thread itself **/
+		if (fa->numWorkers == 1) break;
+		w->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w->thread = CreateThread(NULL, 0, FrameArchiveWorkerThread, (LPVOID) w, 0, NULL);
+		if (w->thread == NULL) return FRAMEARCHIVE_ERROR;
+	}
+	return FRAMEARCHIVE_OK;
+}
+
+static void StopFrameArchiveWorkers(FrameArchiveWriter* fa){
+	int k;
+	for (k = 0; k < FRAMEARCHIVE_MAX_WORKERS; k++) {
+		FrameArchiveWorker* w = &(fa->worker[k]);
+		if (w->thread != NULL) {
+			InterlockedExchange(&(w->quit), 1);
+			SetEvent(w->start);
+			WaitForSingleObject(w->thread, INFINITE);
+			CloseHandle(w->thread);
+		}
+		if (w->start != NULL) CloseHandle(w->start);
+		if (w->done != NULL) CloseHandle(w->done);
+		free(w->zz);
+		free(w->out);
+	}
+}
+
+/*
+ * Compress one frame into dest, one stripe per worker, in parallel.
+ * prev is NULL for a keyframe. Returns the payload size.
+ */
+static long EncodeFrame(FrameArchiveWriter* fa, const unsigned char* cur,
+		const unsigned char* prev, unsigned char* dest){
+	int width = fa->header.width;
+	int height = fa->header.height;
+	int k;
+	for (k = 0; k < fa->numWorkers; k++) {
+		FrameArchiveWorker* w = &(fa->worker[k]);
+		int r0 = StripeRow(height, fa->numWorkers, k);
+		int r1 = StripeRow(height, fa->numWorkers, k + 1);
+		w->cur = cur + (long) r0 * width;
+		w->prev = (prev != NULL) ? prev + (long) r0 * width : NULL;
+		w->numPixels = (long) (r1 - r0) * width;
+		if (w->thread != NULL) {
+			SetEvent(w->start);
+		} else {
+			w->outBytes = EncodeStripe(w->cur, w->prev, w->numPixels, w->zz, w->out);
+		}
+	}
+
+	long payload = 0;
+	for (k = 0; k < fa->numWorkers; k++) {
+		FrameArchiveWorker* w = &(fa->worker[k]);
+		if (w->thread != NULL) WaitForSingleObject(w->done, INFINITE);
+		memcpy(dest + payload, w->out, w->outBytes);
+		payload += w->outBytes;
+	}
+	return payload;
+}
+
+
+/************************
+ * Writer
+ */
+
+static void AddFrameArchiveStats(FrameArchiveWriter* fa, long long rawBytes,
+		long long packedBytes, long long encodeUs){
+	EnterCriticalSection(&(fa->statsLock));
+	fa->statFrames++;
+	fa->statRawBytes += rawBytes;
+	fa->statPackedBytes += packedBytes;
+	fa->statEncodeUs += encodeUs;
+	if (encodeUs > fa->statMaxEncodeUs) fa->statMaxEncodeUs = encodeUs;
+	LeaveCriticalSection(&(fa->statsLock));
+}
+
+/*
+ * Compress batch b into fa->packed and return how many bytes to write,
+ * padded to FRAMEARCHIVE_ALIGN.
+ */
+static long PackBatch(FrameArchiveWriter* fa, int b){
+	long numPixels = (long) fa->header.width * fa->header.height;
+	int hdrSize = fa->header.recordHeaderSize;
+	long pos = 0;
+	int r;
+	for (r = 0; r < fa->batchFrames[b]; r++) {
+		unsigned char* rec = fa->batch[b] + (long) r * fa->header.recordSize;
+		const unsigned char* pixels = rec + hdrSize;
+		FrameArchiveRecordHeader hdr;
+		memcpy(&hdr, rec, sizeof(hdr));
+
+		int keyframe = (fa->recordsPacked % FRAMEARCHIVE_KEYFRAME_INTERVAL == 0);
+		long long t0 = MonotonicUs();
+		long payload = EncodeFrame(fa, pixels, keyframe ? NULL : fa->prevFrame,
+				fa->packed + pos + hdrSize);
+		long long encodeUs = MonotonicUs() - t0;
+
+		hdr.payloadBytes = (unsigned int) payload;
+		hdr.flags = keyframe ? FRAMEARCHIVE_FLAG_KEYFRAME : 0;
+		hdr.numStripes = (unsigned int) fa->numWorkers;
+		memset(fa->packed + pos, 0, hdrSize);
+		memcpy(fa->packed + pos, &hdr, sizeof(hdr));
+
+		long recBytes = AlignTo(hdrSize + payload, FRAMEARCHIVE_RECORD_ALIGN);
+		memset(fa->packed + pos + hdrSize + payload, 0, recBytes - hdrSize - payload);
+		pos += recBytes;
+
+		memcpy(fa->prevFrame, pixels, numPixels);
+		fa->recordsPacked++;
+		AddFrameArchiveStats(fa, numPixels, recBytes, encodeUs);
+	}
+
+	/** A zero magic after the last record tells the reader to skip to the next block **/
+	long total = AlignTo(pos, FRAMEARCHIVE_ALIGN);
+	memset(fa->packed + pos, 0, total - pos);
+	return total;
+}
+
+static DWORD WINAPI FrameArchiveWriterThread(LPVOID lpParam){
+	FrameArchiveWriter* fa = (FrameArchiveWriter*) lpParam;
+	while (1) {
+		WaitForSingleObject(fa->fullBatches, INFINITE);
+		int b = fa->nextWrite;
+
+		/** An empty batch is the signal to quit; everything before it has been written **/
+		if (fa->batchFrames[b] == 0) break;
+
+		unsigned char* buf;
+		DWORD bytes;
+		if (fa->header.codec == FRAMEARCHIVE_CODEC_RAW) {
+			buf = fa->batch[b];
+			bytes = (DWORD) fa->batchFrames[b] * fa->header.recordSize;
+			int r;
+			for (r = 0; r < fa->batchFrames[b]; r++)
+				AddFrameArchiveStats(fa, (long long) fa->header.width * fa->header.height,
+						fa->header.recordSize, 0);
+		} else {
+			buf = fa->packed;
+			bytes = (DWORD) PackBatch(fa, b);
+		}
+
+		DWORD written = 0;
+		if (!WriteFile(fa->file, buf, bytes, &written, NULL) || written != bytes) {
+			if (!fa->writeError)
+				printf("Error! Could not write to the frame archive (error %lu).\n", (unsigned long) GetLastError());
+			InterlockedExchange(&(fa->writeError), 1);
+		}
+
+		fa->batchFrames[b] = 0;
+		fa->nextWrite = (b + 1) % FRAMEARCHIVE_NUM_BATCHES;
+		ReleaseSemaphore(fa->freeBatches, 1, NULL);
+	}
+	return 0;
+}
+
+FrameArchiveWriter* CreateFrameArchive(const char* fname, int width, int height,
+		int options, int codec){
+	FrameArchiveWriter* fa = (FrameArchiveWriter*) calloc(1, sizeof(FrameArchiveWriter));
+	if (fa == NULL) return NULL;
+	InitializeCriticalSection(&(fa->statsLock));
+
+	memcpy(fa->header.magic, FRAMEARCHIVE_MAGIC, 8);
+	fa->header.version = FRAMEARCHIVE_VERSION;
+	fa->header.width = width;
+	fa->header.height = height;
+	fa->header.headerSize = FRAMEARCHIVE_ALIGN;
+	fa->header.recordHeaderSize = FRAMEARCHIVE_RECORD_HEADER_SIZE;
+	fa->header.recordSize = (int) AlignTo(FRAMEARCHIVE_RECORD_HEADER_SIZE + (long) width * height,
+			FRAMEARCHIVE_ALIGN);
+	fa->header.startTimeUs = MonotonicUs();
+	fa->header.codec = codec;
+
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+	if (options == FRAMEARCHIVE_UNBUFFERED)
+		flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+	fa->file = CreateFile(fname, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+	if (fa->file == INVALID_HANDLE_VALUE) {
+		printf("Error! Could not create frame archive %s\n", fname);
+		CloseFrameArchive(&fa);
+		return NULL;
+	}
+
+	/** VirtualAlloc hands back zeroed, page-aligned memory, as unbuffered I/O requires **/
+	long batchBytes = (long) FRAMEARCHIVE_BATCH_FRAMES * fa->header.recordSize;
+	int k;
+	for (k = 0; k < FRAMEARCHIVE_NUM_BATCHES; k++) {
+		fa->batch[k] = (unsigned char*) VirtualAlloc(NULL, batchBytes,
+				MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (fa->batch[k] == NULL) {
+			printf("Error! Could not allocate frame archive buffers.\n");
+			CloseFrameArchive(&fa);
+			return NULL;
+		}
+	}
+
+	if (codec != FRAMEARCHIVE_CODEC_RAW) {
+		if (StartFrameArchiveWorkers(fa) != FRAMEARCHIVE_OK) {
+			printf("Error! Could not start the frame archive compression threads.\n");
+			CloseFrameArchive(&fa);
+			return NULL;
+		}
+		long packedBytes = FRAMEARCHIVE_BATCH_FRAMES
+				* AlignTo(FRAMEARCHIVE_RECORD_HEADER_SIZE + MaxPayload((long) width * height, fa->numWorkers),
+						FRAMEARCHIVE_RECORD_ALIGN) + FRAMEARCHIVE_ALIGN;
+		fa->packed = (unsigned char*) VirtualAlloc(NULL, packedBytes,
+				MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		fa->prevFrame = (unsigned char*) malloc((long) width * height);
+		if (fa->packed == NULL || fa->prevFrame == NULL) {
+			printf("Error! Could not allocate frame archive compression buffers.\n");
+			CloseFrameArchive(&fa);
+			return NULL;
+		}
+	}
+
+	/** The file header goes out first, padded to a full aligned block **/
+	memcpy(fa->batch[0], &(fa->header), sizeof(FrameArchiveFileHeader));
+	DWORD written = 0;
+	if (!WriteFile(fa->file, fa->batch[0], fa->header.headerSize, &written, NULL)
+			|| written != (DWORD) fa->header.headerSize) {
+		printf("Error! Could not write the frame archive header.\n");
+		CloseFrameArchive(&fa);
+		return NULL;
+	}
+	memset(fa->batch[0], 0, fa->header.headerSize);
+
+	fa->fillBatch = -1;
+	fa->freeBatches = CreateSemaphore(NULL, FRAMEARCHIVE_NUM_BATCHES, FRAMEARCHIVE_NUM_BATCHES, NULL);
+	fa->fullBatches = CreateSemaphore(NULL, 0, FRAMEARCHIVE_NUM_BATCHES + 1, NULL);
+	fa->thread = CreateThread(NULL, 0, FrameArchiveWriterThread, (LPVOID) fa, 0, NULL);
+	if (fa->thread == NULL) {
+		printf("Error! Could not start the frame archive writer thread.\n");
+		CloseFrameArchive(&fa);
+		return NULL;
+	}
+
+	if (codec == FRAMEARCHIVE_CODEC_RAW) {
+		printf("Recording raw frames to %s (%d bytes per frame)\n", fname, fa->header.recordSize);
+	} else {
+		printf("Recording losslessly compressed frames to %s on %d threads\n", fname, fa->numWorkers);
+	}
+	return fa;
+}
+
+/*
+ * Hand the batch being filled to the writer thread
+ */
+static void SubmitBatch(FrameArchiveWriter* fa){
+	if (fa->fillBatch < 0) return;
+	fa->fillBatch = -1;
+	ReleaseSemaphore(fa->fullBatches, 1, NULL);
+}
+
+int AppendFrameToArchive(FrameArchiveWriter* fa, const unsigned char* pixels,
+		long long frameNum, long long camFrameNum, long long timestampUs){
+	if (fa == NULL || fa->writeError) return FRAMEARCHIVE_ERROR;
+
+	if (fa->fillBatch < 0) {
+		/** Never wait on the disk. If it can't keep up, drop the frame. **/
+		if (WaitForSingleObject(fa->freeBatches, 0) != WAIT_OBJECT_0) {
+			fa->framesDropped++;
+			return FRAMEARCHIVE_ERROR;
+		}
+		fa->fillBatch = fa->nextFill;
+		fa->nextFill = (fa->nextFill + 1) % FRAMEARCHIVE_NUM_BATCHES;
+		fa->batchFrames[fa->fillBatch] = 0;
+	}
+
+	unsigned char* rec = fa->batch[fa->fillBatch]
+			+ (long) fa->batchFrames[fa->fillBatch] * fa->header.recordSize;
+	FrameArchiveRecordHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = FRAMEARCHIVE_RECORD_MAGIC;
+	hdr.payloadBytes = (unsigned int) fa->header.width * fa->header.height;
+	hdr.frameNum = frameNum;
+	hdr.camFrameNum = camFrameNum;
+	hdr.timestampUs = timestampUs;
+	hdr.numStripes = 1;
+	memcpy(rec, &hdr, sizeof(hdr));
+	/** The padding after the pixels was zeroed at allocation and is never written **/
+	memcpy(rec + fa->header.recordHeaderSize, pixels,
+			(size_t) fa->header.width * fa->header.height);
+
+	fa->batchFrames[fa->fillBatch]++;
+	fa->framesWritten++;
+	if (fa->batchFrames[fa->fillBatch] == FRAMEARCHIVE_BATCH_FRAMES)
+		SubmitBatch(fa);
+	return FRAMEARCHIVE_OK;
+}
+
+long long FrameArchiveStats(FrameArchiveWriter* fa, double* ratio, double* meanEncodeUs,
+		double* maxEncodeUs){
+	if (fa == NULL) return 0;
+	EnterCriticalSection(&(fa->statsLock));
+	long long frames = fa->statFrames;
+	*ratio = (fa->statPackedBytes > 0) ? (double) fa->statRawBytes / (double) fa->statPackedBytes : 0;
+	*meanEncodeUs = (frames > 0) ? (double) fa->statEncodeUs / (double) frames : 0;
+	*maxEncodeUs = (double) fa->statMaxEncodeUs;
+	LeaveCriticalSection(&(fa->statsLock));
+	return frames;
+}
+
+void CloseFrameArchive(FrameArchiveWriter** fa){
+	if (fa == NULL || *fa == NULL) return;
+	FrameArchiveWriter* f = *fa;
+
+	if (f->thread != NULL) {
+		/** Flush the partial batch, then queue the empty batch that tells the thread to stop **/
+		if (f->fillBatch >= 0 && f->batchFrames[f->fillBatch] > 0)
+			SubmitBatch(f);
+		ReleaseSemaphore(f->fullBatches, 1, NULL);
+		WaitForSingleObject(f->thread, INFINITE);
+		CloseHandle(f->thread);
+
+		double ratio, meanUs, maxUs;
+		FrameArchiveStats(f, &ratio, &meanUs, &maxUs);
+		printf("Frame archive closed: %ld frames written, %ld dropped.\n",
+				f->framesWritten, f->framesDropped);
+		if (f->header.codec != FRAMEARCHIVE_CODEC_RAW)
+			printf("Compression ratio %.2f:1, %.0f us to encode a frame on average, %.0f us at worst.\n",
+					ratio, meanUs, maxUs);
+	}
+	StopFrameArchiveWorkers(f);
+	if (f->freeBatches != NULL) CloseHandle(f->freeBatches);
+	if (f->fullBatches != NULL) CloseHandle(f->fullBatches);
+
+	int k;
+	for (k = 0; k < FRAMEARCHIVE_NUM_BATCHES; k++)
+		if (f->batch[k] != NULL) VirtualFree(f->batch[k], 0, MEM_RELEASE);
+	if (f->packed != NULL) VirtualFree(f->packed, 0, MEM_RELEASE);
+	free(f->prevFrame);
+	if (f->file != NULL && f->file != INVALID_HANDLE_VALUE) CloseHandle(f->file);
+	DeleteCriticalSection(&(f->statsLock));
+
+	free(f);
+	*fa = NULL;
+}
+
+
+/************************
+ * Reader
+ */
+
+/*
+ * Read exactly n bytes. Returns the number actually read, -1 on error.
+ */
+static long ReadArchiveBytes(FrameArchiveReader* fr, unsigned char* dest, long n){
+	DWORD got = 0;
+	if (!ReadFile(fr->file, dest, (DWORD) n, &got, NULL)) return -1;
+	fr->offset += got;
+	return (long) got;
+}
+
+FrameArchiveReader* OpenFrameArchive(const char* fname, double speed){
+	HANDLE file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		printf("Error! Could not open frame archive %s\n", fname);
+		return NULL;
+	}
+
+	FrameArchiveReader* fr = (FrameArchiveReader*) calloc(1, sizeof(FrameArchiveReader));
+	fr->file = file;
+	fr->speed = speed;
+
+	if (ReadArchiveBytes(fr, (unsigned char*) &(fr->header), sizeof(FrameArchiveFileHeader))
+			!= (long) sizeof(FrameArchiveFileHeader)
+			|| memcmp(fr->header.magic, FRAMEARCHIVE_MAGIC, 8) != 0) {
+		printf("Error! %s is not a frame archive.\n", fname);
+		CloseFrameArchiveReader(&fr);
+		return NULL;
+	}
+	if (fr->header.version < 1 || fr->header.version > FRAMEARCHIVE_VERSION) {
+		printf("Error! %s is frame archive version %d, but I only read up to version %d.\n",
+				fname, fr->header.version, FRAMEARCHIVE_VERSION);
+		CloseFrameArchiveReader(&fr);
+		return NULL;
+	}
+	if (fr->header.version == 1) fr->header.codec = FRAMEARCHIVE_CODEC_RAW;
+
+	SetFilePointer(file, fr->header.headerSize, NULL, FILE_BEGIN);
+	fr->offset = fr->header.headerSize;
+
+	long numPixels = (long) fr->header.width * fr->header.height;
+	if (fr->header.codec == FRAMEARCHIVE_CODEC_RAW) {
+		fr->record = (unsigned char*) malloc(fr->header.recordSize);
+	} else {
+		fr->record = (unsigned char*) malloc(fr->header.recordHeaderSize
+				+ AlignTo(MaxPayload(numPixels, FRAMEARCHIVE_MAX_WORKERS), FRAMEARCHIVE_RECORD_ALIGN));
+		fr->frame[0] = (unsigned char*) malloc(numPixels);
+		fr->frame[1] = (unsigned char*) malloc(numPixels);
+		if (fr->frame[0] == NULL || fr->frame[1] == NULL) {
+			CloseFrameArchiveReader(&fr);
+			return NULL;
+		}
+	}
+	if (fr->record == NULL) {
+		CloseFrameArchiveReader(&fr);
+		return NULL;
+	}
+	printf("Replaying %dx%d %s frames from %s\n", fr->header.width, fr->header.height,
+			fr->header.codec == FRAMEARCHIVE_CODEC_RAW ? "raw" : "compressed", fname);
+	return fr;
+}
+
+/*
+ * Sleep until the frame stamped timestampUs is due
+ */
+static void WaitUntilDue(FrameArchiveReader* fr, long long timestampUs){
+	if (fr->speed <= 0) return;
+	if (fr->framesRead == 0) {
+		fr->firstTimestampUs = timestampUs;
+		fr->replayStartUs = MonotonicUs();
+		return;
+	}
+	long long due = fr->replayStartUs
+			+ (long long) ((double) (timestampUs - fr->firstTimestampUs) / fr->speed);
+	long long now;
+	while ((now = MonotonicUs()) < due) {
+		long long ms = (due - now) / 1000;
+		/** Sleep() overshoots, so sleep a little short and then yield **/
+		Sleep(ms > 1 ? (DWORD) (ms - 1) : 0);
+	}
+}
+
+/*
+ * Read and decompress the next record of a compressed archive
+ */
+static int ReadCompressedRecord(FrameArchiveReader* fr, FrameArchiveRecordHeader* hdr,
+		unsigned char** pixels){
+	int hdrSize = fr->header.recordHeaderSize;
+	while (1) {
+		long got = ReadArchiveBytes(fr, fr->record, hdrSize);
+		if (got < 0) return FRAMEARCHIVE_ERROR;
+		if (got == 0) return FRAMEARCHIVE_EOF;
+		if (got != hdrSize) {
+			printf("Frame archive ends with a partial record. Stopping.\n");
+			return FRAMEARCHIVE_EOF;
+		}
+		memcpy(hdr, fr->record, sizeof(FrameArchiveRecordHeader));
+		if (hdr->magic != 0) break;
+
+		/** Padding at the end of a batch: skip to the next block **/
+		long skip = (long) (AlignTo((long) (fr->offset % FRAMEARCHIVE_ALIGN), FRAMEARCHIVE_ALIGN)
+				- fr->offset % FRAMEARCHIVE_ALIGN);
+		if (skip > 0 && ReadArchiveBytes(fr, fr->record, skip) != skip) return FRAMEARCHIVE_EOF;
+	}
+
+	long numPixels = (long) fr->header.width * fr->header.height;
+	long maxPayload = MaxPayload(numPixels, FRAMEARCHIVE_MAX_WORKERS);
+	if (hdr->magic != FRAMEARCHIVE_RECORD_MAGIC || hdr->payloadBytes > (unsigned int) maxPayload
+			|| hdr->numStripes < 1 || hdr->numStripes > FRAMEARCHIVE_MAX_WORKERS) {
+		printf("Error! Corrupt record %ld in frame archive.\n", fr->framesRead);
+		return FRAMEARCHIVE_ERROR;
+	}
+	long rest = AlignTo(hdrSize + hdr->payloadBytes, FRAMEARCHIVE_RECORD_ALIGN) - hdrSize;
+	if (ReadArchiveBytes(fr, fr->record + hdrSize, rest) != rest) {
+		printf("Frame archive ends with a partial record. Stopping.\n");
+		return FRAMEARCHIVE_EOF;
+	}
+
+	int keyframe = (hdr->flags & FRAMEARCHIVE_FLAG_KEYFRAME);
+	if (!keyframe && fr->framesRead == 0) {
+		printf("Error! Frame archive does not start with a keyframe.\n");
+		return FRAMEARCHIVE_ERROR;
+	}
+	int next = 1 - fr->current;
+	const unsigned char* prev = keyframe ? NULL : fr->frame[fr->current];
+	const unsigned char* in = fr->record + hdrSize;
+	long pos = 0;
+	int width = fr->header.width;
+	int k;
+	for (k = 0; k < (int) hdr->numStripes; k++) {
+		int r0 = StripeRow(fr->header.height, hdr->numStripes, k);
+		int r1 = StripeRow(fr->header.height, hdr->numStripes, k + 1);
+		long used = DecodeStripe(in + pos, (long) hdr->payloadBytes - pos,
+				prev ? prev + (long) r0 * width : NULL, (long) (r1 - r0) * width,
+				fr->frame[next] + (long) r0 * width);
+		if (used < 0) {
+			printf("Error! Corrupt compressed data in record %ld of frame archive.\n", fr->framesRead);
+			return FRAMEARCHIVE_ERROR;
+		}
+		pos += used;
+	}
+	fr->current = next;
+	*pixels = fr->frame[next];
+	return FRAMEARCHIVE_OK;
+}
+
+int ReadFrameFromArchive(FrameArchiveReader* fr, FrameArchiveRecordHeader* hdr,
+		unsigned char** pixels){
+	if (fr == NULL) return FRAMEARCHIVE_ERROR;
+
+	if (fr->header.codec != FRAMEARCHIVE_CODEC_RAW) {
+		int ret = ReadCompressedRecord(fr, hdr, pixels);
+		if (ret != FRAMEARCHIVE_OK) return ret;
+	} else {
+		long got = ReadArchiveBytes(fr, fr->record, fr->header.recordSize);
+		if (got < 0) return FRAMEARCHIVE_ERROR;
+		if (got == 0) return FRAMEARCHIVE_EOF;
+		if (got != fr->header.recordSize) {
+			printf("Frame archive ends with a partial record. Stopping.\n");
+			return FRAMEARCHIVE_EOF;
+		}
+
+		memcpy(hdr, fr->record, sizeof(FrameArchiveRecordHeader));
+		if (hdr->magic != FRAMEARCHIVE_RECORD_MAGIC) {
+			printf("Error! Corrupt record %ld in frame archive.\n", fr->framesRead);
+			return FRAMEARCHIVE_ERROR;
+		}
+		*pixels = fr->record + fr->header.recordHeaderSize;
+	}
+
+	WaitUntilDue(fr, hdr->timestampUs);
+	fr->framesRead++;
+	return FRAMEARCHIVE_OK;
+}
+
+void CloseFrameArchiveReader(FrameArchiveReader** fr){
+	if (fr == NULL || *fr == NULL) return;
+	if ((*fr)->file != INVALID_HANDLE_VALUE) CloseHandle((*fr)->file);
+	free((*fr)->record);
+	free((*fr)->frame[0]);
+	free((*fr)->frame[1]);
+	free(*fr);
+	*fr = NULL;
+}
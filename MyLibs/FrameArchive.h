@@ -0,0 +1,262 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * FrameArchive.h
+ *
+ * A raw archive of the exact 8-bit frames the tracker saw, and a reader
+ * that plays them back with their original timing.
+ *
+ * File layout. The file header and every write are multiples of
+ * FRAMEARCHIVE_ALIGN bytes so that the file can be written with unbuffered,
+ * sector-aligned I/O:
+ *
+ *   FrameArchiveFileHeader, zero padded to headerSize bytes
+ *   record: FrameArchiveRecordHeader padded to recordHeaderSize, then payload
+ *   record: ...
+ *
+ * FRAMEARCHIVE_CODEC_RAW: every record is exactly recordSize bytes and the
+ * payload is width*height bytes of pixels, row after row, with no padding
+ * between rows.
+ *
+ * FRAMEARCHIVE_CODEC_DELTA_RLE: the payload is payloadBytes of compressed
+ * pixels and the record is padded to a multiple of FRAMEARCHIVE_RECORD_ALIGN.
+ * Each batch of records is followed by zeros up to the next FRAMEARCHIVE_ALIGN
+ * boundary; a reader that finds a zero magic skips to that boundary.
+ *
+ * The compressed payload is the frame's row stripes, one after another, each
+ * coded independently. Every pixel is predicted from the same pixel in the
+ * previous record, or, in keyframes, from its left neighbour in the stripe.
+ * The residual (pixel - prediction, mod 256) is zigzag mapped so that small
+ * positive and negative residuals become small numbers, and the residuals
+ * are coded as a stream of groups, each starting with a control byte c:
+ *
+ *   0x00-0x7F  a run of c+1 zero residuals
+ *   0x80-0xBF  (c & 0x3F)+1 residuals below 16, packed two per byte, low nibble first
+ *   0xC0-0xFF  (c & 0x3F)+1 residuals, one per byte
+ *
+ * Background that is still or merely noisy costs between a few bits per
+ * kilopixel and four bits per pixel. The stripes of each frame are coded in
+ * parallel on a small pool of threads.
+ *
+ * The writer collects records into large batches and a background thread
+ * compresses and writes each full batch with one sequential WriteFile(). If
+ * the disk falls behind and no batch is free, the frame is dropped and
+ * counted rather than stalling acquisition. Dropped frames show up as gaps
+ * in frameNum.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef FRAMEARCHIVE_H_
+#define FRAMEARCHIVE_H_
+
+#include <windows.h>
+
+#define FRAMEARCHIVE_OK 0
+#define FRAMEARCHIVE_EOF 1
+#define FRAMEARCHIVE_ERROR -1
+
+#define FRAMEARCHIVE_MAGIC "MCRAWFR1"
+#define FRAMEARCHIVE_RECORD_MAGIC 0x46524D31 // "FRM1"
+#define FRAMEARCHIVE_VERSION 2 // version 1 had only raw records
+#define FRAMEARCHIVE_EXTENSION ".mcraw"
+
+/** Alignment of everything in the file. A multiple of any disk's sector size. **/
+#define FRAMEARCHIVE_ALIGN 4096
+
+/** Compressed records are padded to a multiple of this **/
+#define FRAMEARCHIVE_RECORD_ALIGN 64
+
+/** Codecs **/
+#define FRAMEARCHIVE_CODEC_RAW 0
+#define FRAMEARCHIVE_CODEC_DELTA_RLE 1
+
+/** Compressed records that don't depend on the previous record **/
+#define FRAMEARCHIVE_KEYFRAME_INTERVAL 100
+#define FRAMEARCHIVE_FLAG_KEYFRAME 0x1
+
+/** Upper limit on threads compressing each frame **/
+#define FRAMEARCHIVE_MAX_WORKERS 4
+
+/** Records per write and number of batches in flight **/
+#define FRAMEARCHIVE_BATCH_FRAMES 8
+#define FRAMEARCHIVE_NUM_BATCHES 3
+
+/** Writer options **/
+#define FRAMEARCHIVE_BUFFERED 0
+#define FRAMEARCHIVE_UNBUFFERED 1 // bypass the OS file cache (FILE_FLAG_NO_BUFFERING)
+
+typedef struct FrameArchiveFileHeaderStruct{
+	char magic[8];
+	int version;
+	int width;
+	int height;
+	int headerSize; //bytes before the first record
+	int recordSize; //bytes per raw record, header and padding included
+	int recordHeaderSize; //bytes before the payload in each record
+	long long startTimeUs; //MonotonicUs() when recording began
+	int codec; //FRAMEARCHIVE_CODEC_*, always 0 in version 1
+} FrameArchiveFileHeader;
+
+typedef struct FrameArchiveRecordHeaderStruct{
+	unsigned int magic;
+	unsigned int payloadBytes; //bytes after the record header, before padding
+	long long frameNum; //the tracker's frame number, Worm->frameNum
+	long long camFrameNum; //the camera's or frame grabber's own frame number, 0 if none
+	long long timestampUs; //MonotonicUs() when the frame was acquired
+	unsigned int flags; //FRAMEARCHIVE_FLAG_*
+	unsigned int numStripes; //row stripes the payload is split into
+} FrameArchiveRecordHeader;
+
+/*
+ * One of the threads that compress a stripe of each frame.
+ */
+typedef struct FrameArchiveWorkerStruct{
+	HANDLE thread;
+	HANDLE start;
+	HANDLE done;
+	volatile LONG quit;
+
+	/** The job **/
+	const unsigned char* cur;
+	const unsigned char* prev; //NULL for a keyframe
+	long numPixels;
+
+	/** The result **/
+	unsigned char* zz; //scratch, numPixels
+	unsigned char* out; //worst case size
+	long outBytes;
+} FrameArchiveWorker;
+
+typedef struct FrameArchiveWriterStruct{
+	HANDLE file;
+	FrameArchiveFileHeader header;
+
+	/** Compression, only touched by the writer thread **/
+	int numWorkers;
+	FrameArchiveWorker worker[FRAMEARCHIVE_MAX_WORKERS];
+	unsigned char* packed; //compressed batch, aligned
+	unsigned char* prevFrame; //the last frame written, for prediction
+	long long recordsPacked;
+
+	/** Statistics, written by the writer thread **/
+	CRITICAL_SECTION statsLock;
+	long long statFrames;
+	long long statRawBytes;
+	long long statPackedBytes;
+	long long statEncodeUs;
+	long long statMaxEncodeUs;
+
+	/** Batches of records, aligned for unbuffered writes **/
+	unsigned char* batch[FRAMEARCHIVE_NUM_BATCHES];
+	int batchFrames[FRAMEARCHIVE_NUM_BATCHES]; //records in each batch
+	int fillBatch; //batch being filled, -1 if we need a free one
+	int nextFill; //the next batch to fill, in ring order
+	int nextWrite; //the next batch the writer thread will write
+
+	/** Writer thread **/
+	HANDLE thread;
+	HANDLE freeBatches; //semaphore
+	HANDLE fullBatches; //semaphore
+	volatile LONG writeError;
+
+	long framesWritten;
+	long framesDropped;
+} FrameArchiveWriter;
+
+typedef struct FrameArchiveReaderStruct{
+	HANDLE file;
+	FrameArchiveFileHeader header;
+	unsigned char* record; //one record's worth of buffer
+	long long offset; //bytes read from the file so far
+	unsigned char* frame[2]; //decoded frames, alternating, for compressed archives
+	int current; //frame[current] is the last one returned
+	long framesRead;
+
+	/** Replay timing **/
+	double speed; //1.0 = original timing, 2.0 = twice as fast, 0 = as fast as possible
+	long long firstTimestampUs; //timestamp of the first frame replayed
+	long long replayStartUs; //MonotonicUs() when the first frame was replayed
+} FrameArchiveReader;
+
+/*
+ * Create an archive of width x height 8-bit frames.
+ * options is FRAMEARCHIVE_BUFFERED or FRAMEARCHIVE_UNBUFFERED.
+ * codec is FRAMEARCHIVE_CODEC_RAW or FRAMEARCHIVE_CODEC_DELTA_RLE.
+ * Returns NULL on failure.
+ */
+FrameArchiveWriter* CreateFrameArchive(const char* fname, int width, int height,
+		int options, int codec);
+
+/*
+ * Queue one frame of width*height bytes for writing.
+ * Returns FRAMEARCHIVE_OK, or FRAMEARCHIVE_ERROR if the frame was dropped.
+ */
+int AppendFrameToArchive(FrameArchiveWriter* fa, const unsigned char* pixels,
+		long long frameNum, long long camFrameNum, long long timestampUs);
+
+/*
+ * How well the frames written so far compressed: raw bytes over stored bytes,
+ * and the mean and worst time to encode one frame in microseconds.
+ * Returns the number of frames written so far.
+ */
+long long FrameArchiveStats(FrameArchiveWriter* fa, double* ratio, double* meanEncodeUs,
+		double* maxEncodeUs);
+
+/*
+ * Write out everything queued, close the file and free the writer.
+ */
+void CloseFrameArchive(FrameArchiveWriter** fa);
+
+/*
+ * Open an archive for replay. speed is as described for FrameArchiveReader.
+ * Returns NULL if the file is missing or not an archive.
+ */
+FrameArchiveReader* OpenFrameArchive(const char* fname, double speed);
+
+/*
+ * Read the next frame, first waiting until it is due according to its
+ * timestamp and the replay speed.
+ *
+ * On FRAMEARCHIVE_OK *hdr holds the frame's record header and *pixels
+ * points to its width*height bytes, valid until the next call.
+ * Returns FRAMEARCHIVE_OK, FRAMEARCHIVE_EOF or FRAMEARCHIVE_ERROR.
+ */
+int ReadFrameFromArchive(FrameArchiveReader* fr, FrameArchiveRecordHeader* hdr,
+		unsigned char** pixels);
+
+void CloseFrameArchiveReader(FrameArchiveReader** fr);
+
+/*
+ * Does fname end in FRAMEARCHIVE_EXTENSION?
+ */
+int IsFrameArchiveFileName(const char* fname);
+
+#endif /* FRAMEARCHIVE_H_ */
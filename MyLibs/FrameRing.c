@@ -0,0 +1,481 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * FrameRing.c
+ *
+ * A ring of host frame buffers filled continuously by an acquisition thread,
+ * and a simulated frame source for exercising it without hardware.
+ *
+ * See FrameRing.h for a description.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "FrameRing.h"
+
+
+/*
+ * Allocate a ring and its bookkeeping, but not the buffers themselves.
+ */
+static FrameRing* AllocateFrameRing(int numSlots, long frameSize){
+	if (numSlots < 3 || frameSize <= 0) {
+		printf("Error! A FrameRing needs at least 3 slots and a positive frame size.\n");
+		return NULL;
+	}
+
+	FrameRing* ring = (FrameRing*) calloc(1, sizeof(FrameRing));
+	if (ring == NULL) return NULL;
+	ring->numSlots = numSlots;
+	ring->frameSize = frameSize;
+	ring->slot = (unsigned char**) calloc(numSlots, sizeof(unsigned char*));
+	ring->slotSeq = (unsigned long*) calloc(numSlots, sizeof(unsigned long));
+	ring->slotHeld = (int*) calloc(numSlots, sizeof(int));
+	if (ring->slot == NULL || ring->slotSeq == NULL || ring->slotHeld == NULL) {
+		DestroyFrameRing(&ring);
+		return NULL;
+	}
+
+	ring->newest = -1;
+	ring->writing = -1;
+	ring->reading = -1;
+	ring->seq = 0;
+	InitializeCriticalSection(&(ring->lock));
+	ring->frameEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	ring->thread = NULL;
+	return ring;
+}
+
+FrameRing* CreateFrameRing(int numSlots, long frameSize){
+	FrameRing* ring = AllocateFrameRing(numSlots, frameSize);
+	if (ring == NULL) return NULL;
+	ring->ownsSlots = 1;
+
+	int k;
+	for (k = 0; k < numSlots; k++) {
+		ring->slot[k] = (unsigned char*) malloc(frameSize);
+		if (ring->slot[k] == NULL) {
+			printf("Error! Could not allocate frame ring buffer %d.\n", k);
+			DestroyFrameRing(&ring);
+			return NULL;
+		}
+	}
+	return ring;
+}
+
+FrameRing* CreateFrameRingOnBuffers(int numSlots, long frameSize, unsigned char** buffers){
+	if (buffers == NULL) return NULL;
+	FrameRing* ring = AllocateFrameRing(numSlots, frameSize);
+	if (ring == NULL) return NULL;
+	ring->ownsSlots = 0;
+
+	int k;
+	for (k = 0; k < numSlots; k++)
+		ring->slot[k] = buffers[k];
+	return ring;
+}
+
+void DestroyFrameRing(FrameRing** ring){
+	if (ring == NULL || *ring == NULL) return;
+	FrameRing* r = *ring;
+
+	StopFrameRingAcquisition(r);
+
+	if (r->slot != NULL && r->ownsSlots) {
+		int k;
+		for (k = 0; k < r->numSlots; k++)
+			free(r->slot[k]);
+	}
+	free(r->slot);
+	free(r->slotSeq);
+	free(r->slotHeld);
+	if (r->frameEvent != NULL) {
+		CloseHandle(r->frameEvent);
+		DeleteCriticalSection(&(r->lock));
+	}
+	free(r);
+	*ring = NULL;
+}
+
+
+/************************
+ * Acquisition side
+ */
+
+unsigned char* FrameRingBeginWrite(FrameRing* ring){
+	EnterCriticalSection(&(ring->lock));
+
+	/** Overwrite the oldest frame that nobody is using **/
+	int k;
+	int pick = -1;
+	for (k = 0; k < ring->numSlots; k++) {
+		if (k == ring->newest || k == ring->reading) continue;
+		if (pick < 0 || ring->slotSeq[k] < ring->slotSeq[pick]) pick = k;
+	}
+	ring->writing = pick;
+
+	LeaveCriticalSection(&(ring->lock));
+	return ring->slot[pick];
+}
+
+/*
+ * Give up on the slot from FrameRingBeginWrite() without publishing it.
+ */
+static void FrameRingAbortWrite(FrameRing* ring){
+	EnterCriticalSection(&(ring->lock));
+	ring->writing = -1;
+	LeaveCriticalSection(&(ring->lock));
+}
+
+/*
+ * Keep a source that fills the buffers itself out of the newest frame and
+ * the one being read, and let it back into every other buffer.
+ * The reader never calls into the source, so a slot it has let go of stays
+ * held until the next frame completes.
+ *
+ * Called with the lock held.
+ */
+static void UpdateHolds(FrameRing* ring){
+	FrameSource* src = &(ring->source);
+	if (src->SetHold == NULL) return;
+	int k;
+	for (k = 0; k < ring->numSlots; k++) {
+		int hold = (k == ring->newest || k == ring->reading);
+		if (hold != ring->slotHeld[k]) {
+			src->SetHold(src->ctx, k, hold);
+			ring->slotHeld[k] = hold;
+		}
+	}
+}
+
+/*
+ * Make slot k the newest complete frame. Returns its sequence number.
+ *
+ * Called with the lock held.
+ */
+static unsigned long PublishSlot(FrameRing* ring, int k){
+	/** The frame we are about to replace as newest was never claimed **/
+	if (ring->newest >= 0 && ring->slotSeq[ring->newest] > ring->lastClaimedSeq)
+		InterlockedIncrement(&(ring->overflows));
+
+	ring->seq++;
+	ring->slotSeq[k] = ring->seq;
+	ring->newest = k;
+	UpdateHolds(ring);
+	return ring->seq;
+}
+
+unsigned long FrameRingCommitWrite(FrameRing* ring){
+	EnterCriticalSection(&(ring->lock));
+	unsigned long seq = PublishSlot(ring, ring->writing);
+	ring->writing = -1;
+	LeaveCriticalSection(&(ring->lock));
+	SetEvent(ring->frameEvent);
+	return seq;
+}
+
+/*
+ * Publish the slot a WaitSlot() source just finished filling.
+ */
+static void FrameRingCommitSlot(FrameRing* ring, int k){
+	EnterCriticalSection(&(ring->lock));
+	PublishSlot(ring, k);
+	LeaveCriticalSection(&(ring->lock));
+	SetEvent(ring->frameEvent);
+}
+
+/*
+ * After a Recover() the source may have forgotten which buffers are held.
+ */
+static void ReapplyHolds(FrameRing* ring){
+	EnterCriticalSection(&(ring->lock));
+	memset(ring->slotHeld, 0, ring->numSlots * sizeof(int));
+	UpdateHolds(ring);
+	LeaveCriticalSection(&(ring->lock));
+}
+
+static DWORD WINAPI FrameRingThread(LPVOID lpParam){
+	FrameRing* ring = (FrameRing*) lpParam;
+	FrameSource* src = &(ring->source);
+	int consecutiveTimeouts = 0;
+
+	while (InterlockedCompareExchange(&(ring->keepRunning), 0, 0)) {
+		int ret;
+		if (src->WaitSlot != NULL) {
+			/** The source fills the buffers itself and tells us which one is done **/
+			int k = -1;
+			ret = src->WaitSlot(src->ctx, &k);
+			if (ret == FRAMERING_OK && (k < 0 || k >= ring->numSlots)) ret = FRAMERING_ERROR;
+			if (ret == FRAMERING_OK) {
+				FrameRingCommitSlot(ring, k);
+				consecutiveTimeouts = 0;
+				continue;
+			}
+		} else {
+			unsigned char* dest = FrameRingBeginWrite(ring);
+			ret = src->Grab(src->ctx, dest, ring->frameSize);
+			if (ret == FRAMERING_OK) {
+				FrameRingCommitWrite(ring);
+				consecutiveTimeouts = 0;
+				continue;
+			}
+			FrameRingAbortWrite(ring);
+		}
+
+		if (ret == FRAMERING_TIMEOUT) {
+			InterlockedIncrement(&(ring->timeouts));
+			consecutiveTimeouts++;
+			if (src->Recover != NULL && src->maxConsecutiveTimeouts > 0
+					&& consecutiveTimeouts >= src->maxConsecutiveTimeouts) {
+				printf("FrameRing: %d acquisition timeouts in a row. Recovering.\n", consecutiveTimeouts);
+				src->Recover(src->ctx);
+				ReapplyHolds(ring);
+				InterlockedIncrement(&(ring->recoveries));
+				consecutiveTimeouts = 0;
+			}
+		} else {
+			InterlockedIncrement(&(ring->errors));
+			/** Don't spin on a source that has failed **/
+			Sleep(1);
+		}
+	}
+	return 0;
+}
+
+int StartFrameRingAcquisition(FrameRing* ring, FrameSource source){
+	if (ring == NULL || (source.Grab == NULL && source.WaitSlot == NULL)) return FRAMERING_ERROR;
+	if (ring->thread != NULL) {
+		printf("Error! FrameRing acquisition is already running.\n");
+		return FRAMERING_ERROR;
+	}
+	EnterCriticalSection(&(ring->lock));
+	ring->source = source;
+	memset(ring->slotHeld, 0, ring->numSlots * sizeof(int));
+	UpdateHolds(ring);
+	LeaveCriticalSection(&(ring->lock));
+	InterlockedExchange(&(ring->keepRunning), 1);
+	ring->thread = CreateThread(NULL, 0, FrameRingThread, (LPVOID) ring, 0, NULL);
+	if (ring->thread == NULL) {
+		printf("Error! Could not create FrameRing acquisition thread.\n");
+		InterlockedExchange(&(ring->keepRunning), 0);
+		return FRAMERING_ERROR;
+	}
+	return FRAMERING_OK;
+}
+
+void StopFrameRingAcquisition(FrameRing* ring){
+	if (ring == NULL || ring->thread == NULL) return;
+	InterlockedExchange(&(ring->keepRunning), 0);
+	WaitForSingleObject(ring->thread, INFINITE);
+	CloseHandle(ring->thread);
+	ring->thread = NULL;
+	printf("FrameRing stopped after %lu frames: %ld overflows, %ld timeouts, %ld recoveries, %ld errors.\n",
+			ring->seq, (long) ring->overflows, (long) ring->timeouts,
+			(long) ring->recoveries, (long) ring->errors);
+}
+
+
+/************************
+ * Processing side
+ */
+
+int FrameRingGetNewest(FrameRing* ring, unsigned long lastSeq, DWORD timeoutMs,
+		unsigned char** frame, unsigned long* seq){
+	if (ring == NULL) return FRAMERING_ERROR;
+
+	DWORD start = GetTickCount();
+	while (1) {
+		EnterCriticalSection(&(ring->lock));
+		/** Hand back whatever the caller forgot to release **/
+		ring->reading = -1;
+		if (ring->newest >= 0 && ring->slotSeq[ring->newest] > lastSeq) {
+			ring->reading = ring->newest;
+			ring->lastClaimedSeq = ring->slotSeq[ring->reading];
+			*frame = ring->slot[ring->reading];
+			*seq = ring->lastClaimedSeq;
+			LeaveCriticalSection(&(ring->lock));
+			return FRAMERING_OK;
+		}
+		LeaveCriticalSection(&(ring->lock));
+
+		DWORD elapsed = GetTickCount() - start;
+		if (elapsed >= timeoutMs) return FRAMERING_TIMEOUT;
+		if (WaitForSingleObject(ring->frameEvent, timeoutMs - elapsed) == WAIT_FAILED)
+			return FRAMERING_ERROR;
+	}
+}
+
+void FrameRingRelease(FrameRing* ring){
+	if (ring == NULL) return;
+	EnterCriticalSection(&(ring->lock));
+	ring->reading = -1;
+	LeaveCriticalSection(&(ring->lock));
+}
+
+
+/************************
+ * Simulated source
+ */
+
+SimulatedGrabber* CreateSimulatedGrabber(DWORD periodMs, int timeoutEvery,
+		int overrunEvery, int overrunBurst){
+	SimulatedGrabber* sim = (SimulatedGrabber*) calloc(1, sizeof(SimulatedGrabber));
+	if (sim == NULL) return NULL;
+	sim->periodMs = periodMs;
+	sim->timeoutEvery = timeoutEvery;
+	sim->overrunEvery = overrunEvery;
+	sim->overrunBurst = overrunBurst;
+	sim->timeoutRun = 1;
+	return sim;
+}
+
+void DestroySimulatedGrabber(SimulatedGrabber** sim){
+	if (sim == NULL || *sim == NULL) return;
+	SimulatedGrabber* s = *sim;
+	if (s->buffers != NULL) {
+		int k;
+		for (k = 0; k < s->numBuffers; k++)
+			free(s->buffers[k]);
+		free(s->buffers);
+	}
+	free(s->held);
+	free(s);
+	*sim = NULL;
+}
+
+/*
+ * Wait out one exposure. Returns FRAMERING_OK if it produced a frame.
+ */
+static int SimulatedExposure(SimulatedGrabber* sim){
+	sim->grabs++;
+
+	if (sim->timeoutLeft > 0) {
+		sim->timeoutLeft--;
+		Sleep(sim->periodMs);
+		return FRAMERING_TIMEOUT;
+	}
+	if (sim->timeoutEvery > 0 && sim->grabs % sim->timeoutEvery == 0) {
+		sim->timeoutLeft = sim->timeoutRun - 1;
+		Sleep(sim->periodMs);
+		return FRAMERING_TIMEOUT;
+	}
+
+	if (sim->burstLeft > 0) {
+		/** Mid-burst: no waiting **/
+		sim->burstLeft--;
+	} else if (sim->overrunEvery > 0 && sim->grabs % sim->overrunEvery == 0) {
+		sim->burstLeft = sim->overrunBurst - 1;
+	} else {
+		Sleep(sim->periodMs);
+	}
+
+	sim->frames++;
+	return FRAMERING_OK;
+}
+
+static int SimulatedGrab(void* ctx, unsigned char* dest, long frameSize){
+	SimulatedGrabber* sim = (SimulatedGrabber*) ctx;
+	int ret = SimulatedExposure(sim);
+	if (ret != FRAMERING_OK) return ret;
+	memset(dest, (int) (sim->frames & 0xFF), frameSize);
+	return FRAMERING_OK;
+}
+
+static int SimulatedWaitSlot(void* ctx, int* slot){
+	SimulatedGrabber* sim = (SimulatedGrabber*) ctx;
+	int ret = SimulatedExposure(sim);
+	if (ret != FRAMERING_OK) return ret;
+
+	/** Like a frame grabber's DMA, go round the buffers in order, skipping held ones **/
+	int tries;
+	for (tries = 0; tries < sim->numBuffers && sim->held[sim->next]; tries++)
+		sim->next = (sim->next + 1) % sim->numBuffers;
+	if (sim->held[sim->next]) return FRAMERING_ERROR;
+
+	int k = sim->next;
+	sim->next = (k + 1) % sim->numBuffers;
+	memset(sim->buffers[k], (int) (sim->frames & 0xFF), sim->frameSize);
+	*slot = k;
+	return FRAMERING_OK;
+}
+
+static void SimulatedSetHold(void* ctx, int slot, int hold){
+	SimulatedGrabber* sim = (SimulatedGrabber*) ctx;
+	sim->held[slot] = hold;
+}
+
+/*
+ * Like a board reset: forget the held buffers and start again from the first one.
+ */
+static void SimulatedRecover(void* ctx){
+	SimulatedGrabber* sim = (SimulatedGrabber*) ctx;
+	sim->recoveries++;
+	sim->timeoutLeft = 0;
+	if (sim->held != NULL) {
+		memset(sim->held, 0, sim->numBuffers * sizeof(int));
+		sim->next = 0;
+	}
+}
+
+FrameSource SimulatedFrameSource(SimulatedGrabber* sim){
+	FrameSource src;
+	src.Grab = SimulatedGrab;
+	src.WaitSlot = NULL;
+	src.SetHold = NULL;
+	src.Recover = SimulatedRecover;
+	src.ctx = (void*) sim;
+	src.maxConsecutiveTimeouts = 0;
+	return src;
+}
+
+FrameSource SimulatedDMAFrameSource(SimulatedGrabber* sim, int numBuffers, long frameSize){
+	FrameSource src = SimulatedFrameSource(sim);
+	src.Grab = NULL;
+
+	sim->buffers = (unsigned char**) calloc(numBuffers, sizeof(unsigned char*));
+	sim->held = (int*) calloc(numBuffers, sizeof(int));
+	if (sim->buffers == NULL || sim->held == NULL) return src;
+	sim->numBuffers = numBuffers;
+	sim->frameSize = frameSize;
+	sim->next = 0;
+	int k;
+	for (k = 0; k < numBuffers; k++) {
+		sim->buffers[k] = (unsigned char*) calloc(1, frameSize);
+		if (sim->buffers[k] == NULL) return src;
+	}
+
+	src.WaitSlot = SimulatedWaitSlot;
+	src.SetHold = SimulatedSetHold;
+	return src;
+}
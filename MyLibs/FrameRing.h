@@ -0,0 +1,242 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * FrameRing.h
+ *
+ * A ring of host frame buffers filled continuously by an acquisition thread.
+ *
+ * The acquisition thread calls a FrameSource's Grab function over and over,
+ * writing each frame into a free slot of the ring and stamping it with an
+ * increasing sequence number. The processing thread asks for the newest
+ * complete frame and gets it immediately if one is waiting, so acquisition
+ * is never held up by processing and processing never waits for the next
+ * exposure to start.
+ *
+ * Frames that are replaced by a newer one before the processing thread asks
+ * for them are counted as overflows. The processing thread can also see how
+ * many frames it missed from the gap in sequence numbers.
+ *
+ * The slot the processing thread is reading from is never written to, and
+ * the slot being written to is never handed out, so there are no torn frames.
+ *
+ * A ring can also wrap buffers that something else fills in its own order,
+ * such as a frame grabber streaming into host memory by DMA. The source then
+ * reports which buffer it just finished instead of being handed one to fill,
+ * and is told which buffers to hold back from (the newest and the one being
+ * read), so frames go from the board to processing without being copied.
+ *
+ * A simulated source is included that produces numbered test frames and can
+ * inject overruns and timeouts, so that the ring and its consumers can be
+ * exercised without a frame grabber.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef FRAMERING_H_
+#define FRAMERING_H_
+
+#include <windows.h>
+
+#define FRAMERING_OK 0
+#define FRAMERING_TIMEOUT 1
+#define FRAMERING_ERROR -1
+
+/*
+ * Somewhere frames come from.
+ *
+ * Grab() blocks until one frame has been written into dest, which is
+ * frameSize bytes long, and returns FRAMERING_OK. It returns
+ * FRAMERING_TIMEOUT if no frame arrived in time and FRAMERING_ERROR if the
+ * source has failed. Grab() is always called from the acquisition thread.
+ *
+ * A source that fills the ring's buffers itself sets WaitSlot() instead of
+ * Grab(). WaitSlot() blocks until the buffer with index *slot holds a new
+ * complete frame and returns as Grab() does. SetHold() tells it to stop
+ * (hold = 1) or go back to (hold = 0) writing into a buffer. Both are only
+ * called from the acquisition thread.
+ *
+ * Recover() is optional and is called after maxConsecutiveTimeouts
+ * timeouts in a row, e.g. to reset a board.
+ */
+typedef struct FrameSourceStruct{
+	int (*Grab)(void* ctx, unsigned char* dest, long frameSize);
+	int (*WaitSlot)(void* ctx, int* slot);
+	void (*SetHold)(void* ctx, int slot, int hold);
+	void (*Recover)(void* ctx);
+	void* ctx;
+	int maxConsecutiveTimeouts;
+} FrameSource;
+
+typedef struct FrameRingStruct{
+	int numSlots;
+	long frameSize;
+	unsigned char** slot;
+	unsigned long* slotSeq; //sequence number of the frame in each slot, 0 if empty
+	int* slotHeld; //slots the source has been told not to write into
+	int ownsSlots; //0 if the buffers belong to someone else
+
+	/** Bookkeeping, protected by lock **/
+	CRITICAL_SECTION lock;
+	int newest; //slot holding the newest complete frame, -1 if none
+	int writing; //slot the acquisition thread is filling, -1 if none
+	int reading; //slot the processing thread holds, -1 if none
+	unsigned long seq; //sequence number of the newest complete frame
+	unsigned long lastClaimedSeq; //sequence number of the last frame handed to the reader
+	HANDLE frameEvent; //auto-reset, signaled each time a frame completes
+
+	/** Statistics **/
+	volatile LONG overflows; //complete frames replaced before anyone read them
+	volatile LONG timeouts; //Grab() timeouts
+	volatile LONG recoveries; //times Recover() was called
+	volatile LONG errors; //Grab() errors
+
+	/** Acquisition thread **/
+	FrameSource source;
+	HANDLE thread;
+	volatile LONG keepRunning;
+} FrameRing;
+
+/*
+ * Allocate a ring of numSlots buffers of frameSize bytes each.
+ * At least three slots are needed so that the acquisition thread always has
+ * somewhere to write. Returns NULL on failure.
+ */
+FrameRing* CreateFrameRing(int numSlots, long frameSize);
+
+/*
+ * Make a ring out of numSlots buffers of frameSize bytes that belong to
+ * someone else, for use with a source that has WaitSlot(). The buffers are
+ * not freed with the ring. Returns NULL on failure.
+ */
+FrameRing* CreateFrameRingOnBuffers(int numSlots, long frameSize, unsigned char** buffers);
+
+/*
+ * Stop acquisition if it is running and free the ring.
+ */
+void DestroyFrameRing(FrameRing** ring);
+
+/*
+ * Start a thread that fills the ring from source until StopFrameRingAcquisition().
+ * Returns FRAMERING_OK or FRAMERING_ERROR.
+ */
+int StartFrameRingAcquisition(FrameRing* ring, FrameSource source);
+
+/*
+ * Ask the acquisition thread to stop and wait for it to finish its current grab.
+ */
+void StopFrameRingAcquisition(FrameRing* ring);
+
+/*
+ * Acquisition side: get a free slot to write the next frame into.
+ * The slot is neither the newest complete frame nor the one being read.
+ * Used by the acquisition thread; exposed so that other producers can fill a ring too.
+ */
+unsigned char* FrameRingBeginWrite(FrameRing* ring);
+
+/*
+ * Acquisition side: mark the slot from FrameRingBeginWrite() as the newest
+ * complete frame and wake the reader. Returns the frame's sequence number.
+ */
+unsigned long FrameRingCommitWrite(FrameRing* ring);
+
+/*
+ * Processing side: claim the newest complete frame with a sequence number
+ * greater than lastSeq, waiting up to timeoutMs for one to arrive.
+ *
+ * On FRAMERING_OK *frame points to the frame and *seq holds its sequence
+ * number. The frame stays valid until FrameRingRelease() is called.
+ * Returns FRAMERING_OK, FRAMERING_TIMEOUT or FRAMERING_ERROR.
+ */
+int FrameRingGetNewest(FrameRing* ring, unsigned long lastSeq, DWORD timeoutMs,
+		unsigned char** frame, unsigned long* seq);
+
+/*
+ * Processing side: give back the frame claimed by FrameRingGetNewest().
+ */
+void FrameRingRelease(FrameRing* ring);
+
+
+/************************
+ * Simulated source
+ */
+
+/*
+ * A frame source that produces a new frame every periodMs milliseconds.
+ * Every byte of frame n is set to n & 0xFF so consumers can check for torn frames.
+ *
+ * Every timeoutEvery'th grab times out instead of producing a frame, and every
+ * overrunEvery'th grab produces a burst of overrunBurst frames back to back,
+ * faster than any consumer could keep up. Set either to 0 to disable it.
+ * Each timeout lasts timeoutRun grabs in a row (1 unless changed), so setting
+ * it to the source's maxConsecutiveTimeouts exercises Recover().
+ *
+ * It can either be handed buffers to fill (SimulatedFrameSource) or, like a
+ * frame grabber's DMA, fill its own ring of buffers in order, skipping held
+ * ones (SimulatedDMAFrameSource).
+ */
+typedef struct SimulatedGrabberStruct{
+	DWORD periodMs;
+	int timeoutEvery;
+	int overrunEvery;
+	int overrunBurst;
+	int timeoutRun;
+	unsigned long grabs; //calls to Grab
+	unsigned long frames; //frames produced
+	unsigned long recoveries; //calls to Recover
+	int burstLeft;
+	int timeoutLeft;
+
+	/** Own buffers, for the DMA-like source **/
+	int numBuffers;
+	long frameSize;
+	unsigned char** buffers;
+	int* held;
+	int next; //buffer the next frame goes into, unless it is held
+} SimulatedGrabber;
+
+SimulatedGrabber* CreateSimulatedGrabber(DWORD periodMs, int timeoutEvery,
+		int overrunEvery, int overrunBurst);
+
+void DestroySimulatedGrabber(SimulatedGrabber** sim);
+
+/*
+ * Wrap a SimulatedGrabber as a FrameSource
+ */
+FrameSource SimulatedFrameSource(SimulatedGrabber* sim);
+
+/*
+ * Wrap a SimulatedGrabber as a FrameSource that writes into its own
+ * numBuffers buffers of frameSize bytes, found afterwards in sim->buffers,
+ * for a ring made with CreateFrameRingOnBuffers().
+ * Returns a source with no WaitSlot() if the buffers could not be allocated.
+ */
+FrameSource SimulatedDMAFrameSource(SimulatedGrabber* sim, int numBuffers, long frameSize);
+
+#endif /* FRAMERING_H_ */
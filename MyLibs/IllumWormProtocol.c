@@ -44,7 +44,6 @@
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/time.h>
 
 //OpenCV Headers
 //#include <cxcore.h>
@@ -60,6 +59,10 @@
 #include "version.h"
 #include "AndysComputations.h"
 
+static void WriteCompiledSteps(CompiledProtocol* c, CvFileStorage* fs);
+static CvSeq* GetMontageFromCompiledProtocol(Protocol* p, int step);
+static void ReleaseCompiledProtocol(CompiledProtocol** c);
+
 
 
 /*******************************************/
@@ -83,7 +86,10 @@ Protocol* CreateProtocolObject(){
 	MyProto->Filename=NULL;
 	MyProto->Description=NULL;
 	MyProto->Steps=NULL;
+	MyProto->InterpSteps=NULL;
 	MyProto->memory=cvCreateMemStorage();
+	MyProto->NoMontage=CreateIlluminationMontage(MyProto->memory);
+	MyProto->Compiled=NULL;
 	return MyProto;
 
 }
@@ -97,7 +103,7 @@ Protocol* CreateProtocolObject(){
 void WriteProtocolToYAML(Protocol* myP){
 	/** Open file for writing **/
 	printf("We are about to write out a protocol. Here is some info about the protocol.:\n");
-	printf("The protocol has %d steps.\n",myP->Steps->total);
+	printf("The protocol has %d steps.\n",ProtocolNumSteps(myP));
 
 
 	CvFileStorage* fs=cvOpenFileStorage(myP->Filename,myP->memory,CV_STORAGE_WRITE);
@@ -139,6 +145,13 @@ void WriteProtocol(Protocol* myP, CvFileStorage* fs){
 		//printf("yo\n");
 		/** Write Out Steps **/
 		cvStartWriteStruct(fs,"Steps",CV_NODE_SEQ,NULL);
+		if (myP->Compiled!=NULL){
+			/** A compiled protocol writes out its interpolated contours **/
+			WriteCompiledSteps(myP->Compiled,fs);
+			cvEndWriteStruct(fs);
+			cvEndWriteStruct(fs);
+			return;
+		}
 		int j;
 		int jtot=myP->Steps->total;
 
@@ -197,49 +210,48 @@ void LoadProtocolWithDescription(const char* str, Protocol* myP){
 
 
 
+/*
+ * Destroy every polygon of every montage in a steps object.
+ * The montages themselves live in the protocol's memory.
+ */
+static void DestroyStepsPolygons(CvSeq* steps){
+	if (steps==NULL) return;
+	int numsteps=steps->total;
+	for (int step= 0; step < numsteps ; ++step) {
+		CvSeq* montage=*((CvSeq**) cvGetSeqElem(steps,step));
+		if (montage==NULL) continue;
+		int numpolygons=montage->total;
+		for (int k= 0; k< numpolygons; ++k) {
+			WormPolygon* polygon=*((WormPolygon**) cvGetSeqElem(montage,k));
+			DestroyWormPolygon(&polygon);
+		}
+	}
+}
+
 void DestroyProtocolObject(Protocol** MyProto){
 	/** **/
 	assert(MyProto!=NULL);
 	if (*MyProto==NULL) return;
 	if  ((*MyProto)->Filename!=NULL ) {
-		free( &((*MyProto)->Filename));
+		free((*MyProto)->Filename);
 		(*MyProto)->Filename=NULL;
 	}
 
 	printf("about to cycle through...\n");
 
-	if ((*MyProto)->Steps!=NULL){
-	//	printf("(*MyProto)->Steps!=NULL\n");
-		int numsteps=(*MyProto)->Steps->total;
-	//	printf("numsteps=%d\n",numsteps);
-		for (int step= 0; step < numsteps ; ++step) {
-			CvSeq** montagePtr=(CvSeq**) cvGetSeqElem((*MyProto)->Steps,step);
-			CvSeq* montage=*montagePtr;
-			if (montage!=NULL){
-		//		printf("montage!=NULL\n");
-				int numpolygons=montage->total;
-			//	printf("numpolygons=%d\n",numpolygons);
-				for (int k= 0; k< numpolygons; ++k) {
-					WormPolygon** polygonPtr=(WormPolygon**) cvGetSeqElem(montage,k);
-					WormPolygon* polygon=*polygonPtr;
-		//			printf( "\tFound polygon with %d nubmer of points.\n",polygon->Points->total );
-					DestroyWormPolygon(&polygon);
-		//			printf("Destroying polygon...\n");
-
-				}
-			}
-
-		}
-	}
-
+	/** The polygon wrappers are malloc'd, the points live in memory **/
+	DestroyStepsPolygons((*MyProto)->Steps);
+	DestroyStepsPolygons((*MyProto)->InterpSteps);
 
 	if  ((*MyProto)->Description!=NULL ) {
-		free( &((*MyProto)->Description) );
+		free((*MyProto)->Description);
 		(*MyProto)->Description=NULL;
 	}
 
+	if ((*MyProto)->Compiled!=NULL) ReleaseCompiledProtocol(&((*MyProto)->Compiled));
+
 	cvReleaseMemStorage(&(*MyProto)->memory);
-	free(MyProto);
+	free(*MyProto);
 	*MyProto=NULL;
 }
 
@@ -325,7 +337,7 @@ WormPolygon* CreateWormPolygonFromSeq(CvMemStorage* memory,CvSize GridSize,CvSeq
  *
  */
 void DestroyWormPolygon(WormPolygon** myPoly){
-	free(myPoly); 
+	free(*myPoly);
 	*myPoly=NULL;
 }
 
@@ -359,6 +371,16 @@ void PrintPointsOfSeq(CvSeq* seq){
 }
 
 
+/*
+ * Number of steps in a protocol, whether it was loaded from YAML
+ * or from a compiled file.
+ */
+int ProtocolNumSteps(Protocol* p){
+	if (p->Compiled!=NULL) return p->Compiled->header->numSteps;
+	return p->Steps->total;
+}
+
+
 int VerifyProtocol(Protocol* p){
 	printf("\n\n========== VERIFYING PROTOCOL============\n");
 	if (p==NULL){
@@ -368,6 +390,14 @@ int VerifyProtocol(Protocol* p){
 
 	printf("Protocol description: %s\n", p->Description);
 	printf("Filename= %s\n",p->Filename);
+
+	/** A compiled protocol's tables were checked when it was mapped **/
+	if (p->Compiled!=NULL){
+		const ProtocolFileHeader* h=p->Compiled->header;
+		printf("Compiled protocol: %d steps, %d polygons, %d points\n",h->numSteps,h->numPolygons,h->numPoints);
+		printf("========================================\n");
+		return 0;
+	}
 	printf("Total number of steps: p->Steps->total=%d\n",p->Steps->total);
 
 	CvSeqReader StepReader;
@@ -447,6 +477,7 @@ IplImage* GenerateRectangleWorm(CvSize size){
  * e.g. a square in worm space may only be defined by four points.
  */
 CvSeq* GetMontageFromProtocol(Protocol* p, int step){
+	if (p->Compiled!=NULL) return GetMontageFromCompiledProtocol(p,step);
 	CvSeq** montagePtr=(CvSeq**) cvGetSeqElem(p->Steps,step);
 	return *montagePtr;
 }
@@ -541,10 +572,13 @@ int CvtPolyMontage2ContourMontage(CvSeq* PolyMontage, CvSeq* ContourMontage){
  * have at least one vertex per grid point on the worm-grid
  */
 CvSeq* GetMontageFromProtocolInterp(Protocol* p, int step){
-	CvSeq** polymontagePtr=(CvSeq**) cvGetSeqElem(p->Steps,step);
-	CvSeq* montage=CreateIlluminationMontage(p->memory);
-	CvtPolyMontage2ContourMontage(*polymontagePtr,montage);
-	return montage;
+	/** Compiled protocols were interpolated when they were compiled **/
+	if (p->Compiled!=NULL) return GetMontageFromCompiledProtocol(p,step);
+	if (p->InterpSteps==NULL || step<0 || step>=p->InterpSteps->total){
+		printf("ERROR! Protocol step %d requested, but the protocol has no such step\n",step);
+		return p->NoMontage;
+	}
+	return *((CvSeq**) cvGetSeqElem(p->InterpSteps,step));
 }
 
 
@@ -651,9 +685,7 @@ void OffsetPtArray(CvPoint** Pts,int numPts,int offset,int XorY){
  * Illuminate a rectangle worm (worm space)
  */
 void IllumRectWorm(IplImage* rectWorm,Protocol* p,int step,int FlipLR){
-	CvSeq* polyMontage= GetMontageFromProtocol(p,step);
-	CvSeq* montage=CreateIlluminationMontage(p->memory);
-	CvtPolyMontage2ContourMontage(polyMontage,montage);
+	CvSeq* montage=GetMontageFromProtocolInterp(p,step);
 
 	int numOfPolys=montage->total;
 	int numPtsInCurrPoly;
@@ -680,7 +712,6 @@ void IllumRectWorm(IplImage* rectWorm,Protocol* p,int step,int FlipLR){
 
 		free(currPolyPts);
 	}
-	cvClearSeq(montage);
 
 }
 
@@ -884,93 +915,12 @@ int IlluminateFromProtocol(SegmentedWorm* SegWorm,Frame* dest, Protocol* p,WormA
 	IllumWorm(SegWorm,montage,TempImage,p->GridSize,Params->IllumFlipLR);
 	LoadFrameWithImage(TempImage,dest);
 
-	cvClearSeq(montage);
-	
 	cvReleaseImage(&TempImage);
 	return 0;
 }
 
 
 
-/*
- * Switch to a different protocol step for a specified amount of time and then switch back
- *
- * This is useful for combined calcium imaging and optogenetic stimulation. 
- * Let some protocol step, A, be to illuminate a cell with a calcium indicator
- * and protocol step B, be to illuminate that cell plus also some cell expressing ChR2. 
- * 
- * Often when calcium imaging we want to transiently stimulate some other cell for a given time,
- * say 2 seconds. The machinery here allows the user to set a secondary protocol step and will transiently
- * switch to that protocol for a specified amount of time.
- */
-int HandleTimedSecondaryProtocolStep(Protocol* p,WormAnalysisParam* Params) {
-
-	struct timeval curr_tv;
-	double diff;
-
-	int tenthsOfSecondsElapsed;
-
-
-	/** Case 1: Nothing to do **/
-	if (!Params->ProtocolSecondaryIsOn) { 
-		/** Timed Secondary Protocl Step is off **/
-		Params->ProtocolSecondaryStartTime = 0;
-		
-		/** Just for neatness the primary step should be set to zero **/
-		Params->ProtocolPrimaryStep=0;
-		return 0;
-	}
-
-	/** Case 2: First time the Secondary Protocol Step  is turned on**/
-	if ((Params->ProtocolSecondaryIsOn) && (Params->ProtocolSecondaryStartTime == 0)) {
-		
-		/** Set the Primary Protocol Step to the currently selected Protocol **/
-		Params->ProtocolPrimaryStep=Params->ProtocolStep;
-		
-		/**Set the start time to now. **/
-		gettimeofday(&curr_tv, NULL);
-
-		/** Set the Start Time of the Timed Secondary Protocol Step **/
-		Params->ProtocolSecondaryStartTime = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0);
-
-
-		/** Set the Current Protocol Step to be the Secondary Protocol Step **/
-		Params->ProtocolStep = Params->ProtocolSecondaryStep;
-		printf("Turning on the Secondary Protocol Step transiently for %d tenths of seconds ...\n",Params->ProtocolSecondaryDuration);
-		return 1;
-	}
-
-	/** Case 3: Secondary Protocol Step has already been on **/
-	if ((Params->ProtocolSecondaryIsOn) && (Params->ProtocolSecondaryStartTime > (double) 0)) {
-		gettimeofday(&curr_tv, NULL);
-		diff = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0) - Params->ProtocolSecondaryStartTime;
-
-
-		/** Determine if we should continue illuminating or stop **/
-		tenthsOfSecondsElapsed = (int) (diff * 10.0);
-		if (tenthsOfSecondsElapsed > Params->ProtocolSecondaryDuration) {
-			/** The transient secondary protocol step is now finished **/
-			/** Switch back to the primary protocol step **/
-			Params->ProtocolStep = Params->ProtocolPrimaryStep;
-			Params->ProtocolSecondaryIsOn = 0;
-
-			/** Set the start time to zero.**/
-			Params->ProtocolSecondaryStartTime = 0;
-			printf("Timed Secondary Protocol Step is finished.\n");
-			return 0;
-
-		} else {
-			/** We should continue to leave the secondary protocol as the current protocol **/
-			
-			return 1;
-		}
-
-	}
-
-}
-
-
-
 
 
 
@@ -983,11 +933,28 @@ int HandleTimedSecondaryProtocolStep(Protocol* p,WormAnalysisParam* Params) {
  *
  */
 
+/*
+ * Interpolate the montage of every step of a protocol loaded from YAML
+ * into contours once, in p->memory, so that asking for a step each frame
+ * allocates nothing.
+ */
+static void BuildInterpMontages(Protocol* p){
+	p->InterpSteps=CreateStepsObject(p->memory);
+	int step;
+	for (step = 0; step < p->Steps->total; ++step) {
+		CvSeq* montage=CreateIlluminationMontage(p->memory);
+		CvtPolyMontage2ContourMontage(GetMontageFromProtocol(p,step),montage);
+		cvSeqPush(p->InterpSteps,&montage);
+	}
+}
+
 /*
  * Load a  Protocol From yaml File
  *
  */
 Protocol* LoadProtocolFromFile(const char* filename){
+		if (IsCompiledProtocolFile(filename)) return LoadCompiledProtocol(filename);
+
 		Protocol* myP=CreateProtocolObject();
 		LoadProtocolWithFilename(filename,myP);
 		CvFileStorage* fs=cvOpenFileStorage(myP->Filename,0,CV_STORAGE_READ);
@@ -1075,10 +1042,320 @@ Protocol* LoadProtocolFromFile(const char* filename){
 
 		}
 
+		BuildInterpMontages(myP);
 		return myP;
 
 }
 
 
 
+/**********************
+ *
+ * Compiled Protocols
+ *
+ */
+
+/*
+ * Make a read-only CvSeq header over the points of polygon j of a compiled protocol.
+ * Nothing is copied.
+ */
+static CvSeq* CompiledPolygonSeq(CompiledProtocol* c, int j, CvSeq* header, CvSeqBlock* block){
+	int first=c->polyStart[j];
+	return cvMakeSeqHeaderForArray(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),
+			(void*) (c->points+first),c->polyStart[j+1]-first,header,block);
+}
+
+/*
+ * Build the illumination montage of every step of a compiled protocol once,
+ * in p->memory, so that asking for a step each frame allocates nothing.
+ * Only the montages and the sequence headers are allocated.
+ * The points stay in the mapped file.
+ */
+static void BuildCompiledMontages(Protocol* p){
+	CompiledProtocol* c=p->Compiled;
+	int numSteps=c->header->numSteps;
+	c->montages=(CvSeq**) malloc(sizeof(CvSeq*)*(numSteps+1));
+
+	int step;
+	for (step = 0; step < numSteps; ++step) {
+		c->montages[step]=CreateIlluminationMontage(p->memory);
+		int j;
+		for (j = c->stepStart[step]; j < c->stepStart[step+1]; ++j) {
+			WormPolygon* polygon=(WormPolygon*) cvMemStorageAlloc(p->memory,sizeof(WormPolygon));
+			CvSeq* header=(CvSeq*) cvMemStorageAlloc(p->memory,sizeof(CvSeq));
+			CvSeqBlock* block=(CvSeqBlock*) cvMemStorageAlloc(p->memory,sizeof(CvSeqBlock));
+			polygon->GridSize=p->GridSize;
+			polygon->Points=CompiledPolygonSeq(c,j,header,block);
+			cvSeqPush(c->montages[step],&polygon);
+		}
+	}
+}
+
+/*
+ * The illumination montage for one step of a compiled protocol.
+ * It was built at load time and must not be changed.
+ */
+static CvSeq* GetMontageFromCompiledProtocol(Protocol* p, int step){
+	CompiledProtocol* c=p->Compiled;
+	if (step<0 || step>=c->header->numSteps){
+		printf("ERROR! Protocol step %d requested, but the protocol only has %d steps\n",step,c->header->numSteps);
+		return p->NoMontage;
+	}
+	return c->montages[step];
+}
+
+/*
+ * Write the steps of a compiled protocol into an open "Steps" sequence
+ */
+static void WriteCompiledSteps(CompiledProtocol* c, CvFileStorage* fs){
+	int step;
+	for (step = 0; step < c->header->numSteps; ++step) {
+		cvStartWriteStruct(fs,NULL,CV_NODE_SEQ,NULL);
+		int j;
+		for (j = c->stepStart[step]; j < c->stepStart[step+1]; ++j) {
+			CvSeq header;
+			CvSeqBlock block;
+			cvWrite(fs,NULL,CompiledPolygonSeq(c,j,&header,&block));
+		}
+		cvEndWriteStruct(fs);
+	}
+}
+
+static void ReleaseCompiledProtocol(CompiledProtocol** c){
+	if (*c==NULL) return;
+	if ((*c)->base!=NULL) UnmapViewOfFile((*c)->base);
+	if ((*c)->mapping!=NULL) CloseHandle((*c)->mapping);
+	if ((*c)->file!=INVALID_HANDLE_VALUE) CloseHandle((*c)->file);
+	free((*c)->montages);
+	free(*c);
+	*c=NULL;
+}
+
+/*
+ * Returns 1 if the file starts like a compiled protocol, 0 otherwise.
+ */
+int IsCompiledProtocolFile(const char* filename){
+	char magic[8];
+	FILE* f=fopen(filename,"rb");
+	if (f==NULL) return 0;
+	int isCompiled= (fread(magic,1,8,f)==8 && memcmp(magic,PROTOCOL_COMPILED_MAGIC,8)==0);
+	fclose(f);
+	return isCompiled;
+}
+
+/*
+ * Pad the file with zeros to the next 8 byte boundary and return the offset there
+ */
+static int AlignCompiledProtocolFile(FILE* f){
+	static const char zeros[8]={0};
+	long offset=ftell(f);
+	fwrite(zeros,1,(8-offset%8)%8,f);
+	return (int) ftell(f);
+}
+
+/*
+ * Write a protocol loaded from YAML out as a compiled protocol file.
+ * Every polygon is interpolated into a contour, exactly as
+ * GetMontageFromProtocolInterp() would do it at run time.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int WriteCompiledProtocol(Protocol* p, const char* filename){
+	if (p==NULL || p->Steps==NULL){
+		printf("ERROR! WriteCompiledProtocol() needs a protocol loaded from YAML.\n");
+		return -1;
+	}
+	FILE* f=fopen(filename,"wb");
+	if (f==NULL){
+		printf("ERROR! Could not open %s for writing.\n",filename);
+		return -1;
+	}
+
+	ProtocolFileHeader h;
+	memset(&h,0,sizeof(ProtocolFileHeader));
+	memcpy(h.magic,PROTOCOL_COMPILED_MAGIC,8);
+	h.version=PROTOCOL_COMPILED_VERSION;
+	h.headerSize=sizeof(ProtocolFileHeader);
+	h.gridWidth=p->GridSize.width;
+	h.gridHeight=p->GridSize.height;
+	h.numSteps=p->Steps->total;
+
+	/** The header is written again at the end, once the offsets are known **/
+	fwrite(&h,sizeof(ProtocolFileHeader),1,f);
+
+	h.descriptionOffset=AlignCompiledProtocolFile(f);
+	const char* description= (p->Description!=NULL) ? p->Description : "";
+	fwrite(description,1,strlen(description)+1,f);
+
+	/** Interpolate each polygon and write out its points **/
+	h.pointsOffset=AlignCompiledProtocolFile(f);
+	int* stepStart=(int*) malloc(sizeof(int)*(h.numSteps+1));
+	int polyCapacity=1024;
+	int* polyStart=(int*) malloc(sizeof(int)*polyCapacity);
+	int ptsCapacity=1024;
+	CvPoint* pts=(CvPoint*) malloc(sizeof(CvPoint)*ptsCapacity);
+	CvMemStorage* scratch=cvCreateMemStorage();
+
+	int step;
+	for (step = 0; step < h.numSteps; ++step) {
+		stepStart[step]=h.numPolygons;
+		CvSeq* polyMontage=GetMontageFromProtocol(p,step);
+
+		CvSeqReader PolyReader;
+		cvStartReadSeq(polyMontage,&PolyReader);
+		int k;
+		for (k = 0; k < polyMontage->total; ++k) {
+			WormPolygon* polygon=*((WormPolygon**) PolyReader.ptr);
+			CvSeq* contour=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),scratch);
+			CvtPolySeq2ContourSeq(polygon->Points,contour);
+
+			if (h.numPolygons+1>=polyCapacity){
+				polyCapacity*=2;
+				polyStart=(int*) realloc(polyStart,sizeof(int)*polyCapacity);
+			}
+			if (contour->total>ptsCapacity){
+				ptsCapacity=contour->total;
+				pts=(CvPoint*) realloc(pts,sizeof(CvPoint)*ptsCapacity);
+			}
+			polyStart[h.numPolygons++]=h.numPoints;
+			cvCvtSeqToArray(contour,pts,CV_WHOLE_SEQ);
+			fwrite(pts,sizeof(CvPoint),contour->total,f);
+			h.numPoints+=contour->total;
+
+			CV_NEXT_SEQ_ELEM(polyMontage->elem_size,PolyReader);
+		}
+		cvClearMemStorage(scratch);
+	}
+	stepStart[h.numSteps]=h.numPolygons;
+	polyStart[h.numPolygons]=h.numPoints;
+
+	/** Write out the tables and then the finished header **/
+	h.stepStartOffset=AlignCompiledProtocolFile(f);
+	fwrite(stepStart,sizeof(int),h.numSteps+1,f);
+	h.polyStartOffset=AlignCompiledProtocolFile(f);
+	fwrite(polyStart,sizeof(int),h.numPolygons+1,f);
+	h.fileSize=(int) ftell(f);
+	fseek(f,0,SEEK_SET);
+	fwrite(&h,sizeof(ProtocolFileHeader),1,f);
+
+	int err=ferror(f);
+	if (fclose(f)!=0) err=1;
+	cvReleaseMemStorage(&scratch);
+	free(pts);
+	free(polyStart);
+	free(stepStart);
+	if (err){
+		printf("ERROR! Could not write compiled protocol %s.\n",filename);
+		return -1;
+	}
+	printf("Compiled %d steps, %d polygons, %d points into %s (%d bytes)\n",
+			h.numSteps,h.numPolygons,h.numPoints,filename,h.fileSize);
+	return 0;
+}
+
+/*
+ * Check that a table of count entries of elemSize bytes at offset lies inside the file
+ */
+static int CompiledBlockFits(const ProtocolFileHeader* h, int offset, int count, int elemSize, DWORD size){
+	if (count<0 || elemSize<=0 || offset<h->headerSize || offset%sizeof(int)!=0) return 0;
+	return (long long) offset+(long long) count*elemSize <= (long long) size;
+}
+
+/*
+ * Check that a table of starting indices begins at zero, never decreases
+ * and ends at last.
+ */
+static int CompiledStartsAreValid(const int* start, int n, int last){
+	if (n<0 || last<0) return 0;
+	if (start[0]!=0 || start[n]!=last) return 0;
+	int i;
+	for (i = 0; i < n; ++i) {
+		if (start[i+1]<start[i]) return 0;
+	}
+	return 1;
+}
+
+/*
+ * Check the header and tables of a mapped compiled protocol,
+ * so that nothing later has to check any index it reads from the file.
+ * Returns 0 if the file is good, -1 otherwise.
+ */
+static int CheckCompiledProtocol(CompiledProtocol* c, DWORD size){
+	const ProtocolFileHeader* h=c->header;
+	if (memcmp(h->magic,PROTOCOL_COMPILED_MAGIC,8)!=0){
+		printf("ERROR! Not a compiled protocol.\n");
+		return -1;
+	}
+	if (h->version<1 || h->version>PROTOCOL_COMPILED_VERSION){
+		printf("ERROR! Compiled protocol is version %d, but I only read up to version %d. Recompile it from the YAML.\n",
+				h->version,PROTOCOL_COMPILED_VERSION);
+		return -1;
+	}
+	if (h->headerSize<(int) sizeof(ProtocolFileHeader) || (DWORD) h->fileSize!=size){
+		printf("ERROR! Compiled protocol is truncated or has a bad header.\n");
+		return -1;
+	}
+	if (!CompiledBlockFits(h,h->pointsOffset,h->numPoints,sizeof(CvPoint),size)
+			|| !CompiledBlockFits(h,h->stepStartOffset,h->numSteps+1,sizeof(int),size)
+			|| !CompiledBlockFits(h,h->polyStartOffset,h->numPolygons+1,sizeof(int),size)
+			|| !CompiledBlockFits(h,h->descriptionOffset,1,1,size)
+			|| memchr(c->base+h->descriptionOffset,0,size-h->descriptionOffset)==NULL){
+		printf("ERROR! Compiled protocol has a table that runs off the end of the file.\n");
+		return -1;
+	}
+
+	c->points=(const CvPoint*) (c->base+h->pointsOffset);
+	c->stepStart=(const int*) (c->base+h->stepStartOffset);
+	c->polyStart=(const int*) (c->base+h->polyStartOffset);
+	if (!CompiledStartsAreValid(c->stepStart,h->numSteps,h->numPolygons)
+			|| !CompiledStartsAreValid(c->polyStart,h->numPolygons,h->numPoints)){
+		printf("ERROR! Compiled protocol has inconsistent step or polygon tables.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Memory-map a compiled protocol file and check that its tables are consistent.
+ * Nothing is parsed or copied: the montage of each step is built once, over
+ * the mapped points.
+ *
+ * Returns NULL on error.
+ */
+Protocol* LoadCompiledProtocol(const char* filename){
+	CompiledProtocol* c=(CompiledProtocol*) calloc(1,sizeof(CompiledProtocol));
+	c->file=CreateFile(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,NULL);
+	if (c->file==INVALID_HANDLE_VALUE){
+		printf("ERROR! Could not open compiled protocol %s\n",filename);
+		ReleaseCompiledProtocol(&c);
+		return NULL;
+	}
+
+	DWORD size=GetFileSize(c->file,NULL);
+	if (size!=INVALID_FILE_SIZE && size>=sizeof(ProtocolFileHeader)){
+		c->mapping=CreateFileMapping(c->file,NULL,PAGE_READONLY,0,0,NULL);
+		if (c->mapping!=NULL) c->base=(const char*) MapViewOfFile(c->mapping,FILE_MAP_READ,0,0,0);
+	}
+	if (c->base==NULL){
+		printf("ERROR! Could not map compiled protocol %s\n",filename);
+		ReleaseCompiledProtocol(&c);
+		return NULL;
+	}
+	c->header=(const ProtocolFileHeader*) c->base;
+	if (CheckCompiledProtocol(c,size)!=0){
+		printf("ERROR! %s can not be used.\n",filename);
+		ReleaseCompiledProtocol(&c);
+		return NULL;
+	}
 
+	Protocol* myP=CreateProtocolObject();
+	LoadProtocolWithFilename(filename,myP);
+	myP->Compiled=c;
+	myP->GridSize=cvSize(c->header->gridWidth,c->header->gridHeight);
+	myP->Description=copyString(c->base+c->header->descriptionOffset);
+	BuildCompiledMontages(myP);
+	printf("Mapped compiled protocol %s: %d steps, %d polygons, %d points\n",
+			filename,c->header->numSteps,c->header->numPolygons,c->header->numPoints);
+	return myP;
+}
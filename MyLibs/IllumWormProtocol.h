@@ -44,14 +44,66 @@
  #error "#include WormAnalysis.h" must appear in source files before "#include IllumWormProtocol.h"
 #endif
 
+#include <windows.h>
+
+/** Compiled protocol files **/
+#define PROTOCOL_COMPILED_MAGIC "MCPROTO1"
+#define PROTOCOL_COMPILED_VERSION 1
+#define PROTOCOL_COMPILED_EXTENSION ".mcproto"
+
+/*
+ * A compiled protocol is a protocol with every polygon already interpolated
+ * into a contour, laid out so that it can be used straight from a read-only
+ * memory-mapped view of the file without parsing or copying:
+ *
+ *   ProtocolFileHeader
+ *   char description[]               nul terminated
+ *   CvPoint points[numPoints]        every contour, one after the other
+ *   int stepStart[numSteps+1]        index of each step's first polygon
+ *   int polyStart[numPolygons+1]     index of each polygon's first point
+ *
+ * Each block starts at the offset given in the header, on an 8 byte boundary.
+ * Polygons of step i are stepStart[i] .. stepStart[i+1]-1, and the points of
+ * polygon j are polyStart[j] .. polyStart[j+1]-1.
+ * Numbers are in the byte order of the PC that compiled the protocol.
+ */
+typedef struct ProtocolFileHeaderStruct{
+	char magic[8];
+	int version;
+	int headerSize;
+	int gridWidth;
+	int gridHeight;
+	int numSteps;
+	int numPolygons;
+	int numPoints;
+	int descriptionOffset;
+	int pointsOffset;
+	int stepStartOffset;
+	int polyStartOffset;
+	int fileSize;
+} ProtocolFileHeader;
+
+typedef struct CompiledProtocolStruct{
+	HANDLE file;
+	HANDLE mapping;
+	const char* base; //start of the mapped file
+	const ProtocolFileHeader* header;
+	const CvPoint* points;
+	const int* stepStart;
+	const int* polyStart;
+	CvSeq** montages; //the montage of each step, built once at load time
+} CompiledProtocol;
 
 typedef struct ProtocolStruct{
 	CvSize GridSize;//height is length of worm
 					//width is width of worm
 	char* Filename;
 	char* Description;
-	CvSeq* Steps;
+	CvSeq* Steps; //NULL when the protocol was loaded from a compiled file
+	CvSeq* InterpSteps; //Steps with every polygon interpolated into a contour, built once at load time
+	CvSeq* NoMontage; //empty montage returned for a step that doesn't exist
 	CvMemStorage* memory;
+	CompiledProtocol* Compiled; //NULL unless loaded from a compiled file
 
 }Protocol;
 
@@ -84,6 +136,12 @@ Protocol* CreateProtocolObject();
 
 int VerifyProtocol(Protocol* p);
 
+/*
+ * Number of steps in a protocol, whether it was loaded from YAML
+ * or from a compiled file.
+ */
+int ProtocolNumSteps(Protocol* p);
+
 void DestroyProtocolObject(Protocol** MyProto);
 
 void LoadProtocolWithFilename(const char* str, Protocol* myP);
@@ -196,6 +254,9 @@ char *copyString (const char *src);
  *
  * NOTE: all polygons have been converted into contours so that they
  * have at least one vertex per grid point on the worm-grid
+ *
+ * The montage is built once when the protocol is loaded and belongs
+ * to the protocol. Don't change, clear or free it.
  */
 CvSeq* GetMontageFromProtocolInterp(Protocol* p, int step);
 /*
@@ -250,18 +311,6 @@ void IllumWorm(SegmentedWorm* segworm, CvSeq* IllumMontage, IplImage* img,CvSize
  */
 int IlluminateFromProtocol(SegmentedWorm* SegWorm,Frame* dest, Protocol* p,WormAnalysisParam* Params);
 
-/*
- * Switch to a different protocol step for a specified amount of time and then switch back
- *
- * This is useful for combined calcium imaging and optogenetic stimulation. 
- * Let some protocol step, A, be to illuminate a cell with a calcium indicator
- * and protocol step B, be to illuminate that cell plus also some cell expressing ChR2. 
- * 
- * Often when calcium imaging we want to transiently stimulate some other cell for a given time,
- * say 2 seconds. The machinery here allows the user to set a secondary protocol step and will transiently
- * switch to that protocol for a specified amount of time.
- */
-int HandleTimedSecondaryProtocolStep(Protocol* p,WormAnalysisParam* Params);
 
 
 /*****************
@@ -275,6 +324,30 @@ int HandleTimedSecondaryProtocolStep(Protocol* p,WormAnalysisParam* Params);
  */
 Protocol* LoadProtocolFromFile(const char* filename);
 
+/*
+ * Returns 1 if the file starts like a compiled protocol, 0 otherwise.
+ */
+int IsCompiledProtocolFile(const char* filename);
+
+/*
+ * Write a protocol loaded from YAML out as a compiled protocol file.
+ * Every polygon is interpolated into a contour, exactly as
+ * GetMontageFromProtocolInterp() would do it at run time.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int WriteCompiledProtocol(Protocol* p, const char* filename);
+
+/*
+ * Memory-map a compiled protocol file and check that its tables are consistent.
+ * Nothing is parsed or copied: the montage of each step is built once, over
+ * the mapped points.
+ *
+ * LoadProtocolFromFile() calls this when it is given a compiled file.
+ * Returns NULL on error.
+ */
+Protocol* LoadCompiledProtocol(const char* filename);
+
 
 
 #endif /* ILLUMWORMPROTOCOL_H_ */
@@ -0,0 +1,176 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * MotionPredictor.c
+ *
+ * Latency compensation for illumination. See MotionPredictor.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "MotionPredictor.h"
+
+void ResetMotionPredictor(MotionPredictor* mp){
+	mp->numFrames = 0;
+	mp->newest = 0;
+	mp->numPoints = 0;
+}
+
+void InitializeMotionPredictor(MotionPredictor* mp){
+	memset(mp, 0, sizeof(MotionPredictor));
+}
+
+/*
+ * Least squares velocity of every point over the history,
+ * then averaged with its neighbours along the body.
+ */
+static void FitVelocities(MotionPredictor* mp){
+	double tau[MOTION_PREDICTOR_HISTORY];
+	double meanTau = 0;
+	int k, i;
+
+	/** Times in seconds relative to the newest frame **/
+	for (k = 0; k < mp->numFrames; k++){
+		int slot = (mp->newest - k + MOTION_PREDICTOR_HISTORY) % MOTION_PREDICTOR_HISTORY;
+		tau[k] = (mp->t[slot] - mp->t[mp->newest]) / 1e6;
+		meanTau += tau[k];
+	}
+	meanTau /= mp->numFrames;
+
+	double stt = 0;
+	for (k = 0; k < mp->numFrames; k++) stt += (tau[k] - meanTau) * (tau[k] - meanTau);
+
+	double rawX[MOTION_PREDICTOR_MAX_POINTS];
+	double rawY[MOTION_PREDICTOR_MAX_POINTS];
+	for (i = 0; i < mp->numPoints; i++){
+		double meanX = 0, meanY = 0;
+		for (k = 0; k < mp->numFrames; k++){
+			int slot = (mp->newest - k + MOTION_PREDICTOR_HISTORY) % MOTION_PREDICTOR_HISTORY;
+			meanX += mp->x[slot][i];
+			meanY += mp->y[slot][i];
+		}
+		meanX /= mp->numFrames;
+		meanY /= mp->numFrames;
+
+		double stx = 0, sty = 0;
+		for (k = 0; k < mp->numFrames; k++){
+			int slot = (mp->newest - k + MOTION_PREDICTOR_HISTORY) % MOTION_PREDICTOR_HISTORY;
+			stx += (tau[k] - meanTau) * (mp->x[slot][i] - meanX);
+			sty += (tau[k] - meanTau) * (mp->y[slot][i] - meanY);
+		}
+		rawX[i] = (stt > 0) ? stx / stt : 0;
+		rawY[i] = (stt > 0) ? sty / stt : 0;
+	}
+
+	/** Neighbouring segments move together, so averaging them takes out segmentation noise **/
+	for (i = 0; i < mp->numPoints; i++){
+		int lo = i - MOTION_PREDICTOR_NEIGHBOURS;
+		int hi = i + MOTION_PREDICTOR_NEIGHBOURS;
+		if (lo < 0) lo = 0;
+		if (hi > mp->numPoints - 1) hi = mp->numPoints - 1;
+		double sx = 0, sy = 0;
+		int j;
+		for (j = lo; j <= hi; j++){
+			sx += rawX[j];
+			sy += rawY[j];
+		}
+		mp->vx[i] = sx / (hi - lo + 1);
+		mp->vy[i] = sy / (hi - lo + 1);
+	}
+}
+
+int MotionPredictorAddFrame(MotionPredictor* mp, const double* x, const double* y, int numPoints, long long timeUs){
+	if (numPoints < 1 || numPoints > MOTION_PREDICTOR_MAX_POINTS){
+		ResetMotionPredictor(mp);
+		return 0;
+	}
+
+	/** Start over if the history no longer describes this worm **/
+	if (mp->numFrames > 0){
+		long long gap = timeUs - mp->t[mp->newest];
+		int restart = (numPoints != mp->numPoints) || gap <= 0 || gap > MOTION_PREDICTOR_MAX_GAP_US;
+		if (!restart){
+			double jump = 0;
+			int i;
+			for (i = 0; i < numPoints; i++){
+				double dx = x[i] - mp->x[mp->newest][i];
+				double dy = y[i] - mp->y[mp->newest][i];
+				jump += sqrt(dx * dx + dy * dy);
+			}
+			restart = (jump / numPoints > MOTION_PREDICTOR_MAX_JUMP_PX);
+		}
+		if (restart) ResetMotionPredictor(mp);
+	}
+
+	if (mp->numFrames > 0) mp->newest = (mp->newest + 1) % MOTION_PREDICTOR_HISTORY;
+	mp->numPoints = numPoints;
+	mp->t[mp->newest] = timeUs;
+	memcpy(mp->x[mp->newest], x, numPoints * sizeof(double));
+	memcpy(mp->y[mp->newest], y, numPoints * sizeof(double));
+	if (mp->numFrames < MOTION_PREDICTOR_HISTORY) mp->numFrames++;
+
+	if (mp->numFrames < 2) return 0;
+	FitVelocities(mp);
+	return 1;
+}
+
+void MotionPredictorAddLatency(MotionPredictor* mp, long long latencyUs){
+	/** A replayed recording's timestamps aren't from this clock **/
+	if (latencyUs <= 0 || latencyUs > 10 * MOTION_PREDICTOR_MAX_HORIZON_US) return;
+
+	if (!mp->latencyValid){
+		mp->latencyUs = (double) latencyUs;
+		mp->latencyValid = 1;
+	} else {
+		mp->latencyUs += MOTION_PREDICTOR_LATENCY_WEIGHT * (latencyUs - mp->latencyUs);
+	}
+}
+
+long long MotionPredictorHorizon(const MotionPredictor* mp, long long extraUs){
+	if (!mp->latencyValid) return 0;
+	long long horizon = (long long) (mp->latencyUs + 0.5) + extraUs;
+	if (horizon < 0) horizon = 0;
+	if (horizon > MOTION_PREDICTOR_MAX_HORIZON_US) horizon = MOTION_PREDICTOR_MAX_HORIZON_US;
+	return horizon;
+}
+
+void MotionPredictorShift(const MotionPredictor* mp, int i, long long horizonUs, double* dx, double* dy){
+	if (mp->numFrames < 2 || i < 0 || i >= mp->numPoints){
+		*dx = 0;
+		*dy = 0;
+		return;
+	}
+	*dx = mp->vx[i] * horizonUs / 1e6;
+	*dy = mp->vy[i] * horizonUs / 1e6;
+}
@@ -0,0 +1,135 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * MotionPredictor.h
+ *
+ * Predicts where each segment of the worm will be when the DLP finally
+ * shows the pattern made from the current frame.
+ *
+ * Between grabbing a frame and the mirrors flipping, the worm keeps
+ * crawling (and the stage keeps moving), so a pattern drawn on the
+ * segmented worm lands where the worm was. The predictor keeps the last
+ * few segmented centerlines and fits a velocity to each segment by least
+ * squares, averaged with its neighbours along the body. Each segment is
+ * then moved on by its velocity times the latency.
+ *
+ * The latency is measured: the time from grabbing each frame until its
+ * pattern has been sent to the DLP, smoothed over frames. The DLP's own
+ * delay in showing a frame it has been sent can't be measured from here
+ * and is added by the caller.
+ *
+ * Velocities are in image coordinates, so they include the image motion
+ * caused by the stage. That's what's wanted, because the camera and the
+ * DLP move with the stage.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef MOTIONPREDICTOR_H_
+#define MOTIONPREDICTOR_H_
+
+/** Frames of history the velocities are fitted to **/
+#define MOTION_PREDICTOR_HISTORY 4
+
+/** Most points on a centerline **/
+#define MOTION_PREDICTOR_MAX_POINTS 512
+
+/** Forget the history if no frame arrives for this long **/
+#define MOTION_PREDICTOR_MAX_GAP_US 250000
+
+/*
+ * If the centerline moves further than this, on average, from one frame to
+ * the next, it has flipped head to tail or been badly segmented. Start over.
+ */
+#define MOTION_PREDICTOR_MAX_JUMP_PX 30
+
+/** Average each segment's velocity with this many neighbours on either side **/
+#define MOTION_PREDICTOR_NEIGHBOURS 2
+
+/** Never predict further ahead than this, whatever is measured **/
+#define MOTION_PREDICTOR_MAX_HORIZON_US 200000
+
+/** Weight of each new latency measurement in the running average **/
+#define MOTION_PREDICTOR_LATENCY_WEIGHT 0.1
+
+typedef struct MotionPredictorStruct{
+	int numPoints;
+
+	/** Recent centerlines, in a ring **/
+	long long t[MOTION_PREDICTOR_HISTORY];
+	double x[MOTION_PREDICTOR_HISTORY][MOTION_PREDICTOR_MAX_POINTS];
+	double y[MOTION_PREDICTOR_HISTORY][MOTION_PREDICTOR_MAX_POINTS];
+	int numFrames;
+	int newest;
+
+	/** Velocity of each point in pixels per second, if numFrames>1 **/
+	double vx[MOTION_PREDICTOR_MAX_POINTS];
+	double vy[MOTION_PREDICTOR_MAX_POINTS];
+
+	/** Smoothed time from grabbing a frame to sending its pattern **/
+	double latencyUs;
+	int latencyValid;
+} MotionPredictor;
+
+/*
+ * Forget the history. The latency estimate is kept.
+ */
+void ResetMotionPredictor(MotionPredictor* mp);
+
+/*
+ * Start from scratch, latency included.
+ */
+void InitializeMotionPredictor(MotionPredictor* mp);
+
+/*
+ * Add the newest centerline of numPoints points, from a frame grabbed at
+ * timeUs, and update the velocities.
+ *
+ * Returns 1 if there are velocities to predict with and 0 otherwise.
+ */
+int MotionPredictorAddFrame(MotionPredictor* mp, const double* x, const double* y, int numPoints, long long timeUs);
+
+/*
+ * Measured time from grabbing a frame to sending its pattern to the DLP.
+ */
+void MotionPredictorAddLatency(MotionPredictor* mp, long long latencyUs);
+
+/*
+ * How far ahead to predict: the measured latency plus extraUs, the delay
+ * the measurement doesn't see. Returns 0 before any latency is measured.
+ */
+long long MotionPredictorHorizon(const MotionPredictor* mp, long long extraUs);
+
+/*
+ * How far point i of the newest centerline will have moved horizonUs from now.
+ */
+void MotionPredictorShift(const MotionPredictor* mp, int i, long long horizonUs, double* dx, double* dy);
+
+#endif /* MOTIONPREDICTOR_H_ */
@@ -0,0 +1,391 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * MultiWorm.c
+ *
+ * Tracking and parallel segmentation of several worms. See MultiWorm.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <windows.h>
+
+#include <cxcore.h>
+#include <cv.h>
+
+#include "AndysOpenCVLib.h"
+#include "AndysComputations.h"
+#include "WormAnalysis.h"
+#include "MultiWorm.h"
+
+
+/************************
+ * Workers
+ */
+
+/*
+ * Head/tail, temporal correction and segmentation of one worm, from its
+ * contour. Runs on a worker thread. Touches only the track's own memory.
+ */
+static void SegmentTrack(MultiWormTracker* tracker, MultiWormTrack* t){
+	WormAnalysisParam* Params = tracker->Params;
+	WormAnalysisData* Worm = t->Worm;
+
+	t->e = RefreshWormMemStorage(Worm);
+	if (t->e != 0) return;
+
+	LoadWormBoundary(Worm, Params, t->contour);
+	t->e = GivenBoundaryFindWormHeadTail(Worm, Params);
+	if (t->e != 0) return;
+
+	if (Params->TemporalOn) PrevFrameImproveWormHeadTail(Worm, Params, t->PrevWorm);
+
+	/** Only the primary worm can be flipped from the keyboard **/
+	if (Params->InduceHeadTailFlip && t == &(tracker->track[tracker->primary])) ReverseWormHeadTail(Worm);
+
+	t->e = SegmentWorm(Worm, Params);
+	if (t->e == 0) LoadWormGeom(t->PrevWorm, Worm);
+}
+
+/** Claim worms until there are none left **/
+static void SegmentClaimedTracks(MultiWormTracker* tracker){
+	LONG k;
+	while ((k = InterlockedIncrement(&(tracker->nextWork)) - 1) < tracker->numWork) {
+		SegmentTrack(tracker, tracker->work[k]);
+	}
+}
+
+static DWORD WINAPI MultiWormWorkerThread(LPVOID lpParam){
+	MultiWormWorker* w = (MultiWormWorker*) lpParam;
+	MultiWormTracker* tracker = w->tracker;
+	while (1) {
+		WaitForSingleObject(w->start, INFINITE);
+		if (InterlockedCompareExchange(&(tracker->quit), 0, 0)) break;
+		SegmentClaimedTracks(tracker);
+		SetEvent(w->done);
+	}
+	return 0;
+}
+
+
+/************************
+ * Tracker
+ */
+
+static void ClearTrack(MultiWormTrack* t){
+	t->id = 0;
+	t->age = 0;
+	t->missed = 0;
+	t->seen = 0;
+	t->e = 0;
+	t->protocolStep = MULTIWORM_FOLLOW_SLIDER;
+	t->centroid = cvPoint2D32f(0, 0);
+	t->contour = NULL;
+	if (t->PrevWorm != NULL) ClearWormGeom(t->PrevWorm);
+	if (t->Worm != NULL) ClearSegmentedInfo(t->Worm->Segmented);
+}
+
+MultiWormTracker* CreateMultiWormTracker(CvSize size){
+	MultiWormTracker* tracker = (MultiWormTracker*) malloc(sizeof(MultiWormTracker));
+	if (tracker == NULL) return NULL;
+	memset(tracker, 0, sizeof(MultiWormTracker));
+	tracker->size = size;
+	tracker->nextId = 1;
+	tracker->primary = -1;
+
+	tracker->scratch = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	tracker->mem = cvCreateMemStorage(0);
+
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(tracker->track[k]);
+		t->Worm = CreateWormAnalysisDataStruct();
+		t->Worm->SizeOfImage = size;
+		t->PrevWorm = CreateWormGeom();
+		t->segWormDLP = CreateSegmentedWormStruct();
+		ClearTrack(t);
+	}
+
+	/** The calling thread segments worms too, so one fewer worker than processors **/
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	tracker->numWorkers = (int) sysinfo.dwNumberOfProcessors - 1;
+	if (tracker->numWorkers > MULTIWORM_MAX_WORMS - 1) tracker->numWorkers = MULTIWORM_MAX_WORMS - 1;
+	if (tracker->numWorkers < 0) tracker->numWorkers = 0;
+	for (k = 0; k < tracker->numWorkers; k++) {
+		MultiWormWorker* w = &(tracker->worker[k]);
+		w->tracker = tracker;
+		w->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+		tracker->doneEvents[k] = w->done;
+		w->thread = CreateThread(NULL, 0, MultiWormWorkerThread, (LPVOID) w, 0, NULL);
+		if (w->thread == NULL) {
+			printf("Error! Could not start a multi-worm segmentation thread.\n");
+			DestroyMultiWormTracker(&tracker);
+			return NULL;
+		}
+	}
+	return tracker;
+}
+
+void DestroyMultiWormTracker(MultiWormTracker** tracker){
+	if (tracker == NULL || *tracker == NULL) return;
+	MultiWormTracker* mw = *tracker;
+
+	InterlockedExchange(&(mw->quit), 1);
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormWorker* w = &(mw->worker[k]);
+		if (w->thread != NULL) {
+			SetEvent(w->start);
+			WaitForSingleObject(w->thread, INFINITE);
+			CloseHandle(w->thread);
+		}
+		if (w->start != NULL) CloseHandle(w->start);
+		if (w->done != NULL) CloseHandle(w->done);
+	}
+
+	PrintMultiWormCost(mw);
+
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(mw->track[k]);
+		if (t->Worm != NULL) DestroyWormAnalysisDataStruct(t->Worm);
+		DestroyWormGeom(&(t->PrevWorm));
+		if (t->segWormDLP != NULL) DestroySegmentedWormStruct(t->segWormDLP);
+	}
+	cvReleaseImage(&(mw->scratch));
+	cvReleaseMemStorage(&(mw->mem));
+	free(mw);
+	*tracker = NULL;
+}
+
+void ResetMultiWormTracker(MultiWormTracker* tracker){
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) ClearTrack(&(tracker->track[k]));
+	tracker->primary = -1;
+}
+
+/** Mean of the points of a contour **/
+static CvPoint2D32f ContourCentroid(CvSeq* contour){
+	CvSeqReader reader;
+	CvPoint pt;
+	double sx = 0, sy = 0;
+	int i;
+	cvStartReadSeq(contour, &reader, 0);
+	for (i = 0; i < contour->total; i++) {
+		CV_READ_SEQ_ELEM(pt, reader);
+		sx += pt.x;
+		sy += pt.y;
+	}
+	return cvPoint2D32f(sx / contour->total, sy / contour->total);
+}
+
+/*
+ * Give each live worm the nearest contour within Params->MaxLocationChange,
+ * nearest pairs first, and start new worms on the longest of the rest.
+ */
+static void MatchContoursToTracks(MultiWormTracker* tracker, CvSeq** cand, CvPoint2D32f* centroid,
+		int numCand, int maxWorms, int maxJump){
+	int taken[MULTIWORM_MAX_CANDIDATES];
+	int i, k;
+	for (i = 0; i < numCand; i++) taken[i] = 0;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		tracker->track[k].seen = 0;
+		tracker->track[k].contour = NULL;
+	}
+
+	double maxSq = (double) maxJump * maxJump;
+	while (1) {
+		double best = DBL_MAX;
+		int bestTrack = -1, bestCand = -1;
+		for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+			MultiWormTrack* t = &(tracker->track[k]);
+			if (t->id == 0 || t->seen) continue;
+			for (i = 0; i < numCand; i++) {
+				if (taken[i]) continue;
+				double dx = centroid[i].x - t->centroid.x;
+				double dy = centroid[i].y - t->centroid.y;
+				double d = dx * dx + dy * dy;
+				if (d <= maxSq && d < best) {
+					best = d;
+					bestTrack = k;
+					bestCand = i;
+				}
+			}
+		}
+		if (bestTrack < 0) break;
+		MultiWormTrack* t = &(tracker->track[bestTrack]);
+		t->seen = 1;
+		t->contour = cand[bestCand];
+		t->centroid = centroid[bestCand];
+		taken[bestCand] = 1;
+	}
+
+	/** Worms that weren't found this frame **/
+	int live = 0;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(tracker->track[k]);
+		if (t->id == 0) continue;
+		if (t->seen) {
+			t->missed = 0;
+			t->age++;
+		} else if (++(t->missed) > MULTIWORM_MAX_MISSED) {
+			ClearTrack(t);
+			continue;
+		}
+		live++;
+	}
+
+	/** New worms. The candidates are sorted longest first **/
+	for (i = 0; i < numCand && live < maxWorms; i++) {
+		if (taken[i]) continue;
+		for (k = 0; k < MULTIWORM_MAX_WORMS && tracker->track[k].id != 0; k++);
+		if (k == MULTIWORM_MAX_WORMS) break;
+		MultiWormTrack* t = &(tracker->track[k]);
+		ClearTrack(t);
+		t->id = tracker->nextId++;
+		t->seen = 1;
+		t->contour = cand[i];
+		t->centroid = centroid[i];
+		taken[i] = 1;
+		live++;
+	}
+}
+
+static int CompareContourLength(const void* a, const void* b){
+	return (*(CvSeq* const*) b)->total - (*(CvSeq* const*) a)->total;
+}
+
+int MultiWormSegment(MultiWormTracker* tracker, WormAnalysisData* Worm, WormAnalysisParam* Params){
+	long long startUs = MonotonicUs();
+
+	SmoothAndThresholdWorm(Worm, Params);
+
+	/** Every object big enough to be a worm **/
+	cvClearMemStorage(tracker->mem);
+	cvCopy(Worm->ImgThresh, tracker->scratch, 0);
+	CvSeq* contours = NULL;
+	cvFindContours(tracker->scratch, tracker->mem, &contours, sizeof(CvContour), CV_RETR_EXTERNAL,
+			CV_CHAIN_APPROX_NONE, cvPoint(0, 0));
+
+	CvSeq* cand[MULTIWORM_MAX_CANDIDATES];
+	CvPoint2D32f centroid[MULTIWORM_MAX_CANDIDATES];
+	int numCand = 0;
+	CvSeq* c;
+	for (c = contours; c != NULL; c = c->h_next) {
+		if (c->total < 2 * Params->NumSegments) continue;
+		if (numCand < MULTIWORM_MAX_CANDIDATES) {
+			cand[numCand++] = c;
+		} else {
+			/** Too many: keep the longest **/
+			int shortest = 0, i;
+			for (i = 1; i < numCand; i++) if (cand[i]->total < cand[shortest]->total) shortest = i;
+			if (c->total > cand[shortest]->total) cand[shortest] = c;
+		}
+	}
+	qsort(cand, numCand, sizeof(CvSeq*), CompareContourLength);
+	int i;
+	for (i = 0; i < numCand; i++) centroid[i] = ContourCentroid(cand[i]);
+
+	int maxWorms = Params->MultiWorm;
+	if (maxWorms > MULTIWORM_MAX_WORMS) maxWorms = MULTIWORM_MAX_WORMS;
+	if (maxWorms < 1) maxWorms = 1;
+	MatchContoursToTracks(tracker, cand, centroid, numCand, maxWorms, Params->MaxLocationChange);
+
+	/** The oldest worm in view is the primary one **/
+	tracker->primary = -1;
+	tracker->numWork = 0;
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(tracker->track[k]);
+		if (t->id == 0 || !t->seen) continue;
+		tracker->work[tracker->numWork++] = t;
+		if (tracker->primary < 0 || t->id < tracker->track[tracker->primary].id) tracker->primary = k;
+	}
+
+	/** Segment them all in parallel **/
+	tracker->Params = Params;
+	InterlockedExchange(&(tracker->nextWork), 0);
+	int numWorkers = tracker->numWork - 1;
+	if (numWorkers > tracker->numWorkers) numWorkers = tracker->numWorkers;
+	for (k = 0; k < numWorkers; k++) SetEvent(tracker->worker[k].start);
+	SegmentClaimedTracks(tracker);
+	if (numWorkers > 0) WaitForMultipleObjects(numWorkers, tracker->doneEvents, TRUE, INFINITE);
+
+	/** The primary worm is the oldest one that segmented **/
+	int numOk = 0;
+	tracker->primary = -1;
+	for (k = 0; k < tracker->numWork; k++) {
+		MultiWormTrack* t = tracker->work[k];
+		if (t->e != 0) continue;
+		numOk++;
+		if (tracker->primary < 0 || t->id < tracker->track[tracker->primary].id) tracker->primary = (int) (t - tracker->track);
+	}
+
+	double us = (double) (MonotonicUs() - startUs);
+	tracker->statFrames[tracker->numWork]++;
+	tracker->statUs[tracker->numWork] += us;
+	if (us > tracker->statMaxUs[tracker->numWork]) tracker->statMaxUs[tracker->numWork] = us;
+
+	return (numOk > 0) ? MULTIWORM_OK : MULTIWORM_ERROR;
+}
+
+MultiWormTrack* MultiWormPrimary(MultiWormTracker* tracker){
+	if (tracker == NULL || tracker->primary < 0) return NULL;
+	return &(tracker->track[tracker->primary]);
+}
+
+int MultiWormCount(const MultiWormTracker* tracker){
+	int n = 0, k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		const MultiWormTrack* t = &(tracker->track[k]);
+		if (t->id != 0 && t->seen && t->e == 0) n++;
+	}
+	return n;
+}
+
+void PrintMultiWormCost(const MultiWormTracker* tracker){
+	int n;
+	long total = 0;
+	for (n = 0; n <= MULTIWORM_MAX_WORMS; n++) total += tracker->statFrames[n];
+	if (total == 0) return;
+
+	printf("Multi-worm segmentation, %d threads:\n", tracker->numWorkers + 1);
+	printf("%6s %8s %10s %10s\n", "worms", "frames", "mean ms", "max ms");
+	for (n = 0; n <= MULTIWORM_MAX_WORMS; n++) {
+		if (tracker->statFrames[n] == 0) continue;
+		printf("%6d %8ld %10.2f %10.2f\n", n, tracker->statFrames[n],
+				tracker->statUs[n] / tracker->statFrames[n] / 1000.0, tracker->statMaxUs[n] / 1000.0);
+	}
+}
@@ -0,0 +1,176 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * MultiWorm.h
+ *
+ * Tracks and segments several worms in the same field of view.
+ *
+ * The frame is smoothed and thresholded once, as for a single worm, and
+ * every outer contour long enough to be a worm is found. Each contour is
+ * matched to the worm whose boundary was nearest last frame, so every worm
+ * keeps the same ID for as long as it stays in view. Contours that match
+ * no worm start a new one, up to the number of worms asked for. A worm
+ * that isn't seen for MULTIWORM_MAX_MISSED frames is forgotten.
+ *
+ * Each worm has its own WormAnalysisData and its own previous head and
+ * tail, so head/tail finding, temporal correction and segmentation run on
+ * each worm independently. They run in parallel on a pool of worker
+ * threads, with the calling thread taking a share of the worms too.
+ *
+ * Each worm also carries a protocol step, so different worms can be given
+ * different illumination, and its own segmented worm in DLP space.
+ *
+ * The time taken by each frame is kept by the number of worms in it and
+ * printed when the tracker is destroyed.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef MULTIWORM_H_
+#define MULTIWORM_H_
+
+#ifndef WORMANALYSIS_H_
+ #error "#include WormAnalysis.h" must appear in source files before "#include MultiWorm.h"
+#endif
+
+#include <windows.h>
+
+/** Most worms tracked at once **/
+#define MULTIWORM_MAX_WORMS 8
+
+/** Forget a worm that hasn't been seen for this many frames **/
+#define MULTIWORM_MAX_MISSED 10
+
+/** Most contours considered in one frame; the rest are debris **/
+#define MULTIWORM_MAX_CANDIDATES 64
+
+/** protocolStep of a worm that follows the ProtocolStep slider **/
+#define MULTIWORM_FOLLOW_SLIDER -1
+
+#define MULTIWORM_OK 0
+#define MULTIWORM_ERROR -1
+
+typedef struct MultiWormTrackStruct{
+	int id; // 0 if this slot is free. IDs count up from 1 and are never reused
+	int age; // frames since the worm was first seen
+	int missed; // frames since the worm was last seen
+	int seen; // 1 if the worm was found this frame
+	int e; // segmentation error this frame. Only meaningful if seen
+	int protocolStep; // protocol step to illuminate it with, or MULTIWORM_FOLLOW_SLIDER
+	CvPoint2D32f centroid; // mean of the boundary when last seen
+
+	CvSeq* contour; // this frame's raw contour, in the tracker's storage
+
+	WormAnalysisData* Worm; // has no images; only the boundary and what comes from it
+	WormGeom* PrevWorm;
+	SegmentedWorm* segWormDLP;
+} MultiWormTrack;
+
+struct MultiWormTrackerStruct;
+
+typedef struct MultiWormWorkerStruct{
+	HANDLE thread;
+	HANDLE start; // auto-reset, signaled when there are worms to segment
+	HANDLE done; // auto-reset, signaled when the worker has run out of worms
+	struct MultiWormTrackerStruct* tracker;
+} MultiWormWorker;
+
+typedef struct MultiWormTrackerStruct{
+	CvSize size;
+	MultiWormTrack track[MULTIWORM_MAX_WORMS];
+	int nextId;
+	int primary; // index of the oldest worm segmented this frame, or -1
+
+	/** Contour search **/
+	IplImage* scratch; // cvFindContours() overwrites its input
+	CvMemStorage* mem;
+
+	/** This frame's work, shared with the workers **/
+	WormAnalysisParam* Params;
+	MultiWormTrack* work[MULTIWORM_MAX_WORMS];
+	int numWork;
+	volatile LONG nextWork;
+	volatile LONG quit;
+
+	int numWorkers;
+	MultiWormWorker worker[MULTIWORM_MAX_WORMS];
+	HANDLE doneEvents[MULTIWORM_MAX_WORMS];
+
+	/** Time per frame, by the number of worms segmented **/
+	long statFrames[MULTIWORM_MAX_WORMS + 1];
+	double statUs[MULTIWORM_MAX_WORMS + 1];
+	double statMaxUs[MULTIWORM_MAX_WORMS + 1];
+} MultiWormTracker;
+
+/*
+ * Create a tracker for frames of the given size and start its workers.
+ * Returns NULL on failure.
+ */
+MultiWormTracker* CreateMultiWormTracker(CvSize size);
+
+/*
+ * Stop the workers, print the time per frame by number of worms,
+ * free everything and set *tracker to NULL.
+ */
+void DestroyMultiWormTracker(MultiWormTracker** tracker);
+
+/*
+ * Forget every worm. The next frame starts new IDs.
+ */
+void ResetMultiWormTracker(MultiWormTracker* tracker);
+
+/*
+ * Find and segment up to Params->MultiWorm worms in Worm->ImgOrig.
+ * Worm->ImgSmooth and Worm->ImgThresh are filled in on the way.
+ *
+ * If Params->InduceHeadTailFlip is set, the primary worm's head and tail
+ * are reversed; the caller clears the flag.
+ *
+ * Returns MULTIWORM_OK if at least one worm was segmented.
+ */
+int MultiWormSegment(MultiWormTracker* tracker, WormAnalysisData* Worm, WormAnalysisParam* Params);
+
+/*
+ * The oldest worm segmented this frame, or NULL if there isn't one.
+ * This is the worm the stage follows and the single-worm displays show.
+ */
+MultiWormTrack* MultiWormPrimary(MultiWormTracker* tracker);
+
+/*
+ * Number of worms segmented this frame
+ */
+int MultiWormCount(const MultiWormTracker* tracker);
+
+/*
+ * Print the mean and maximum time per frame by the number of worms in it.
+ */
+void PrintMultiWormCost(const MultiWormTracker* tracker);
+
+#endif /* MULTIWORM_H_ */
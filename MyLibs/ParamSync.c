@@ -0,0 +1,220 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ParamSync.c
+ *
+ * Versioned, double-buffered exchange of WormAnalysisParam between
+ * the display thread and the processing thread.
+ *
+ * See ParamSync.h for a description.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+//OpenCV Headers
+#include "opencv2/highgui/highgui_c.h"
+
+#include "AndysOpenCVLib.h"
+#include "WormAnalysis.h"
+#include "ParamSync.h"
+
+/*
+ * Atomically read a LONG that other threads modify with Interlocked*()
+ */
+static LONG AtomicRead(volatile LONG* x){
+	return InterlockedCompareExchange(x, 0, 0);
+}
+
+/*
+ * Give a new version to every int of local that was edited since we last
+ * looked, so the other side can tell our edits are newer than what it has.
+ *
+ * WormAnalysisParam is made of ints and pairs of ints,
+ * so comparing it one int at a time never splits a field between two writers.
+ */
+static void StampEdits(ParamSyncSide* me, const WormAnalysisParam* local){
+	const int* d = (const int*) local;
+	int* known = (int*) &(me->known);
+	int k;
+	for (k = 0; k < (int) PARAM_SYNC_WORDS; ++k) {
+		if (d[k] != known[k]) {
+			known[k] = d[k];
+			me->version[k]++;
+			me->unpublished = 1;
+		}
+	}
+}
+
+/*
+ * Copy into local every int whose incoming version is newer than ours.
+ * Two different values with the same version are edits made at once on both
+ * sides, and the display thread's value wins.
+ *
+ * Returns the number of ints copied.
+ */
+static int MergeParams(ParamSyncSide* me, int side, WormAnalysisParam* local,
+		const WormAnalysisParam* latest, const LONG* version){
+	int* d = (int*) local;
+	int* known = (int*) &(me->known);
+	const int* a = (const int*) latest;
+	int theirsWinTies = (side != PARAM_SYNC_GUI);
+	int changed = 0;
+	int k;
+	for (k = 0; k < (int) PARAM_SYNC_WORDS; ++k) {
+		if (version[k] > me->version[k]
+				|| (version[k] == me->version[k] && a[k] != known[k] && theirsWinTies)) {
+			d[k] = a[k];
+			known[k] = a[k];
+			me->version[k] = version[k];
+			changed++;
+		}
+	}
+	return changed;
+}
+
+static void InitializeParamChannel(ParamChannel* ch, const WormAnalysisParam* initial){
+	ch->buf[0] = *initial;
+	ch->buf[1] = *initial;
+	memset(ch->version, 0, sizeof(ch->version));
+	ch->readers[0] = 0;
+	ch->readers[1] = 0;
+	ch->generation = 0;
+	InitializeCriticalSection(&(ch->writeLock));
+}
+
+ParamSync* CreateParamSync(const WormAnalysisParam* initial){
+	ParamSync* ps = (ParamSync*) malloc(sizeof(ParamSync));
+	int k;
+	for (k = 0; k < 2; ++k) {
+		InitializeParamChannel(&(ps->channel[k]), initial);
+		ps->side[k].known = *initial;
+		memset(ps->side[k].version, 0, sizeof(ps->side[k].version));
+		ps->side[k].unpublished = 0;
+		ps->side[k].receivedGeneration = 0;
+	}
+	return ps;
+}
+
+void DestroyParamSync(ParamSync** ps){
+	if (*ps == NULL) return;
+	DeleteCriticalSection(&((*ps)->channel[0].writeLock));
+	DeleteCriticalSection(&((*ps)->channel[1].writeLock));
+	free(*ps);
+	*ps = NULL;
+}
+
+/*
+ * Publish a new generation of parameters, with the version of each int, on a channel.
+ * Returns the new generation number.
+ */
+LONG PublishParams(ParamChannel* ch, const WormAnalysisParam* src, const LONG* version){
+	EnterCriticalSection(&(ch->writeLock));
+	LONG gen = AtomicRead(&(ch->generation));
+	int back = (gen + 1) & 1;
+
+	/** A reader that started on the previous generation may still be copying this buffer **/
+	while (AtomicRead(&(ch->readers[back])) != 0) Sleep(0);
+
+	memcpy(&(ch->buf[back]), src, sizeof(WormAnalysisParam));
+	memcpy(ch->version[back], version, sizeof(ch->version[back]));
+
+	/** Make the new generation current **/
+	InterlockedExchange(&(ch->generation), gen + 1);
+	LeaveCriticalSection(&(ch->writeLock));
+	return gen + 1;
+}
+
+/*
+ * Copy out the current generation of a channel and its versions.
+ * Returns its generation number.
+ */
+LONG ReadParams(ParamChannel* ch, WormAnalysisParam* dest, LONG* version){
+	while (1) {
+		LONG gen = AtomicRead(&(ch->generation));
+		int cur = gen & 1;
+
+		/** Announce that we are reading this buffer, then make sure it is still current **/
+		InterlockedIncrement(&(ch->readers[cur]));
+		if (AtomicRead(&(ch->generation)) == gen) {
+			memcpy(dest, &(ch->buf[cur]), sizeof(WormAnalysisParam));
+			memcpy(version, ch->version[cur], sizeof(ch->version[cur]));
+			InterlockedDecrement(&(ch->readers[cur]));
+			return gen;
+		}
+
+		/** A writer published in the meantime. Try again with the newer generation **/
+		InterlockedDecrement(&(ch->readers[cur]));
+	}
+}
+
+/*
+ * Pull in whatever the other side has changed since our last pull.
+ * Returns 1 if local was modified and 0 otherwise.
+ */
+int ParamSyncPull(ParamSync* ps, int side, WormAnalysisParam* local){
+	ParamChannel* in = &(ps->channel[1 - side]);
+	ParamSyncSide* me = &(ps->side[side]);
+
+	/** Nothing new **/
+	if (AtomicRead(&(in->generation)) == me->receivedGeneration) return 0;
+
+	/** Edits made since our last push must keep their place against incoming ones **/
+	StampEdits(me, local);
+
+	WormAnalysisParam latest;
+	LONG version[PARAM_SYNC_WORDS];
+	me->receivedGeneration = ReadParams(in, &latest, version);
+
+	/*
+	 * Values we take came from the other side,
+	 * so they are not echoed back to it on our next push.
+	 */
+	int changed = MergeParams(me, side, local, &latest, version);
+	return (changed > 0);
+}
+
+/*
+ * Publish our copy if it has changed since we last published.
+ * Returns 1 if a new generation was published and 0 otherwise.
+ */
+int ParamSyncPush(ParamSync* ps, int side, const WormAnalysisParam* local){
+	ParamSyncSide* me = &(ps->side[side]);
+	StampEdits(me, local);
+	if (!me->unpublished) return 0;
+
+	PublishParams(&(ps->channel[side]), local, me->version);
+	me->unpublished = 0;
+	return 1;
+}
@@ -0,0 +1,135 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ParamSync.h
+ *
+ * Sharing WormAnalysisParam between the display thread and the processing thread.
+ *
+ * Each thread keeps its own private copy of the parameters. The display thread's
+ * copy is the one the trackbars and keystrokes write to; the processing thread's
+ * copy is exp->Params, which it reads and writes freely during a frame.
+ *
+ * Changes travel between the two copies through a pair of channels, one per
+ * direction. A channel is a versioned double buffer: the writer fills the buffer
+ * that is not current and then bumps the generation number, so a reader always
+ * copies out one whole, consistent generation. Readers never block. A writer only
+ * waits if a reader is still copying the buffer it is about to reuse.
+ *
+ * Every int of the parameters carries a version: the number of edits made to
+ * it, counting those made on either side. A thread that changes a field bumps
+ * its version past the one it has. When a thread pulls the other side's latest
+ * generation it takes a field only if the other side's version is newer, so its
+ * own changes (e.g. the processing thread turning the DLP off at the end of a
+ * timed illumination) are never clobbered by stale values.
+ *
+ * If both sides change the same field before seeing each other's change, the
+ * two edits get the same version. The display thread's value wins the tie: the
+ * user's last word is kept and the processing thread takes it on its next pull.
+ * Either way both copies end up the same.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef PARAMSYNC_H_
+#define PARAMSYNC_H_
+
+#include <windows.h>
+
+#ifndef WORMANALYSIS_H_
+ #error "#include WormAnalysis.h" must appear in source files before "#include ParamSync.h"
+#endif
+
+/** The two sides **/
+#define PARAM_SYNC_GUI 0
+#define PARAM_SYNC_PROCESSING 1
+
+/** WormAnalysisParam is made of ints and pairs of ints **/
+#define PARAM_SYNC_WORDS (sizeof(WormAnalysisParam) / sizeof(int))
+
+/*
+ * A single-direction, versioned double buffer.
+ */
+typedef struct ParamChannelStruct{
+	WormAnalysisParam buf[2];
+	LONG version[2][PARAM_SYNC_WORDS]; //version of each int in buf
+	volatile LONG readers[2]; //number of readers currently copying each buffer
+	volatile LONG generation; //buf[generation & 1] is current
+	CRITICAL_SECTION writeLock; //serializes writers
+} ParamChannel;
+
+/*
+ * What one side knows about the exchange.
+ * Only ever touched by that side's thread.
+ */
+typedef struct ParamSyncSideStruct{
+	WormAnalysisParam known; //our values as of our last pull or push
+	LONG version[PARAM_SYNC_WORDS]; //version of each int in known
+	int unpublished; //known has edits the other side has not been sent
+	LONG receivedGeneration;
+} ParamSyncSide;
+
+typedef struct ParamSyncStruct{
+	ParamChannel channel[2]; //channel[i] is written by side i
+	ParamSyncSide side[2];
+} ParamSync;
+
+
+/*
+ * Create the exchange with both sides starting from the same parameters.
+ */
+ParamSync* CreateParamSync(const WormAnalysisParam* initial);
+
+void DestroyParamSync(ParamSync** ps);
+
+/*
+ * Publish a new generation of parameters, with the version of each int, on a channel.
+ * Returns the new generation number.
+ */
+LONG PublishParams(ParamChannel* ch, const WormAnalysisParam* src, const LONG* version);
+
+/*
+ * Copy out the current generation of a channel and its versions.
+ * Returns its generation number.
+ */
+LONG ReadParams(ParamChannel* ch, WormAnalysisParam* dest, LONG* version);
+
+/*
+ * Pull in whatever the other side has changed since our last pull.
+ * Returns 1 if local was modified and 0 otherwise.
+ */
+int ParamSyncPull(ParamSync* ps, int side, WormAnalysisParam* local);
+
+/*
+ * Publish our copy if it has changed since we last published.
+ * Returns 1 if a new generation was published and 0 otherwise.
+ */
+int ParamSyncPush(ParamSync* ps, int side, const WormAnalysisParam* local);
+
+#endif /* PARAMSYNC_H_ */
@@ -0,0 +1,150 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * Sequencer.c
+ *
+ * One timeline for everything timed. See Sequencer.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+#include "AndysComputations.h"
+#include "Sequencer.h"
+
+static const char* SequencerEventNames[SEQ_NUM_EVENT_TYPES] = {
+		"DLP",
+		"ProtocolStep",
+		"SweepStep" };
+
+long long SequencerMonotonicUs(void* clockData){
+	return MonotonicUs();
+}
+
+Sequencer* CreateSequencer(SequencerClock clock, void* clockData){
+	Sequencer* s = (Sequencer*) calloc(1, sizeof(Sequencer));
+	s->clock = (clock != NULL) ? clock : SequencerMonotonicUs;
+	s->clockData = clockData;
+	s->startUs = s->clock(s->clockData);
+	s->nowUs = s->startUs;
+	return s;
+}
+
+void DestroySequencer(Sequencer** s){
+	if (*s == NULL) return;
+	PrintSequencerReport(*s);
+	free(*s);
+	*s = NULL;
+}
+
+long long SequencerSampleClock(Sequencer* s){
+	s->nowUs = s->clock(s->clockData);
+	return s->nowUs;
+}
+
+int SequencerSchedule(Sequencer* s, long long dueUs, int type, int value, int source){
+	if (s->numEvents >= SEQUENCER_MAX_EVENTS) {
+		printf("Error! The sequencer's timeline is full. A %s event was dropped.\n", SequencerEventNames[type]);
+		return -1;
+	}
+
+	/** Insert after every event due at or before this one **/
+	int k = s->numEvents;
+	while (k > 0 && s->event[k - 1].dueUs > dueUs) {
+		s->event[k] = s->event[k - 1];
+		k--;
+	}
+	s->event[k].dueUs = dueUs;
+	s->event[k].type = type;
+	s->event[k].value = value;
+	s->event[k].source = source;
+	s->numEvents++;
+	return 0;
+}
+
+int SequencerCancel(Sequencer* s, int source){
+	int kept = 0;
+	int k;
+	for (k = 0; k < s->numEvents; k++) {
+		if (s->event[k].source != source) s->event[kept++] = s->event[k];
+	}
+	int removed = s->numEvents - kept;
+	s->numEvents = kept;
+	return removed;
+}
+
+int SequencerPending(Sequencer* s, int source){
+	int n = 0;
+	int k;
+	for (k = 0; k < s->numEvents; k++) {
+		if (s->event[k].source == source) n++;
+	}
+	return n;
+}
+
+int SequencerNextDue(Sequencer* s, SequencerEvent* ev){
+	if (s->numEvents == 0 || s->event[0].dueUs > s->nowUs) return 0;
+
+	*ev = s->event[0];
+	s->numEvents--;
+	memmove(s->event, s->event + 1, s->numEvents * sizeof(SequencerEvent));
+
+	long long lateUs = s->nowUs - ev->dueUs;
+	s->count[ev->type]++;
+	s->sumLateUs[ev->type] += (double) lateUs;
+	if (lateUs > s->maxLateUs[ev->type]) s->maxLateUs[ev->type] = lateUs;
+
+	if (s->verbose) {
+		printf("Sequencer: %s %d at %.3f s, scheduled for %.3f s (%.1f ms late)\n",
+				SequencerEventNames[ev->type], ev->value, (s->nowUs - s->startUs) / 1e6,
+				(ev->dueUs - s->startUs) / 1e6, lateUs / 1000.0);
+	}
+	return 1;
+}
+
+void PrintSequencerReport(Sequencer* s){
+	long total = 0;
+	int k;
+	for (k = 0; k < SEQ_NUM_EVENT_TYPES; k++) total += s->count[k];
+	if (total == 0) return;
+
+	printf("Sequencer events, run against scheduled time:\n");
+	printf("%-14s %8s %12s %12s\n", "event", "count", "mean late ms", "max late ms");
+	for (k = 0; k < SEQ_NUM_EVENT_TYPES; k++) {
+		if (s->count[k] == 0) continue;
+		printf("%-14s %8ld %12.2f %12.2f\n", SequencerEventNames[k], s->count[k],
+				s->sumLateUs[k] / s->count[k] / 1000.0, s->maxLateUs[k] / 1000.0);
+	}
+}
@@ -0,0 +1,157 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * Sequencer.h
+ *
+ * Runs things that have to happen at a set time: turning the DLP on and off,
+ * changing protocol step, moving the head-to-tail sweep cursor.
+ *
+ * Each timed feature puts its events on one timeline when it starts, with
+ * the time each is due. Once per frame the sequencer samples its clock and
+ * hands back, in order, every event that has come due. So all of the features
+ * see the same time for a frame, and an event's lateness is never more than
+ * the time until the next frame arrives.
+ *
+ * The clock is monotonic, in microseconds, and is MonotonicUs() from
+ * AndysComputations.h. A different clock can be passed in, for example a fake
+ * one to run the sequencer in a simulation.
+ *
+ * For each kind of event the sequencer keeps how late, on average and at
+ * worst, events ran compared to when they were scheduled.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef SEQUENCER_H_
+#define SEQUENCER_H_
+
+/** Most events waiting on the timeline at once **/
+#define SEQUENCER_MAX_EVENTS 64
+
+/** Kinds of event **/
+#define SEQ_EVENT_DLP 0 // value 1 turns the DLP on, 0 turns it off
+#define SEQ_EVENT_PROTOCOL_STEP 1 // value is the protocol step
+#define SEQ_EVENT_SWEEP_STEP 2 // move the head-to-tail sweep cursor on
+#define SEQ_NUM_EVENT_TYPES 3
+
+/** Features that schedule events, so that each can cancel its own **/
+#define SEQ_SOURCE_FLASH 0 // timed DLP on, DLPOnFlash
+#define SEQ_SOURCE_SWEEP 1 // head-to-tail illumination sweep
+#define SEQ_SOURCE_SECONDARY 2 // timed secondary protocol step
+#define SEQ_NUM_SOURCES 3
+
+/** Microseconds in the tenths of a second the GUI uses for durations **/
+#define SEQ_TENTH_US 100000LL
+
+typedef long long (*SequencerClock)(void* clockData);
+
+typedef struct SequencerEventStruct{
+	long long dueUs; //when it should happen, on the sequencer's clock
+	int type; //SEQ_EVENT_*
+	int value;
+	int source; //SEQ_SOURCE_*
+} SequencerEvent;
+
+typedef struct SequencerStruct{
+	SequencerClock clock;
+	void* clockData;
+
+	/** The clock, sampled once at the start of this frame **/
+	long long nowUs;
+	long long startUs;
+
+	/** Waiting events, earliest first. Events due at the same time stay in the order scheduled. **/
+	SequencerEvent event[SEQUENCER_MAX_EVENTS];
+	int numEvents;
+
+	/** How late each kind of event ran **/
+	long count[SEQ_NUM_EVENT_TYPES];
+	double sumLateUs[SEQ_NUM_EVENT_TYPES];
+	long long maxLateUs[SEQ_NUM_EVENT_TYPES];
+
+	/** Print a line for every event run. Off unless set. **/
+	int verbose;
+} Sequencer;
+
+/*
+ * The sequencer's default clock, MonotonicUs() in the form of a SequencerClock
+ */
+long long SequencerMonotonicUs(void* clockData);
+
+/*
+ * Create a sequencer that reads clock(clockData).
+ * If clock is NULL, SequencerMonotonicUs() is used.
+ */
+Sequencer* CreateSequencer(SequencerClock clock, void* clockData);
+
+/*
+ * Prints the report and frees the sequencer.
+ */
+void DestroySequencer(Sequencer** s);
+
+/*
+ * Sample the clock for this frame. Call once, at the start of each frame.
+ * Returns the time.
+ */
+long long SequencerSampleClock(Sequencer* s);
+
+/*
+ * Put an event on the timeline, due at dueUs.
+ * An event due at or before the sampled time runs this frame.
+ *
+ * Returns 0, or -1 if the timeline is full.
+ */
+int SequencerSchedule(Sequencer* s, long long dueUs, int type, int value, int source);
+
+/*
+ * Remove every waiting event from source.
+ * Returns the number removed.
+ */
+int SequencerCancel(Sequencer* s, int source);
+
+/*
+ * Number of events from source still waiting
+ */
+int SequencerPending(Sequencer* s, int source);
+
+/*
+ * Take the earliest event that is due at the sampled time.
+ * Events scheduled while handling one are taken too, if they are due.
+ *
+ * Returns 1 and fills in ev, or 0 if nothing more is due this frame.
+ */
+int SequencerNextDue(Sequencer* s, SequencerEvent* ev);
+
+/*
+ * Print, for each kind of event, how many ran and how late they were.
+ */
+void PrintSequencerReport(Sequencer* s);
+
+#endif /* SEQUENCER_H_ */
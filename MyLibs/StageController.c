@@ -0,0 +1,310 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageController.c
+ *
+ * A command queue and I/O thread for the stage.
+ * See StageController.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+#include "AndysComputations.h"
+#include "Talk2Stage.h"
+#include "StageController.h"
+
+/*
+ * Is there anything to send? Call with the lock held.
+ */
+static int StageHasWork(StageController* sc){
+	return sc->haltPending || sc->queueCount > 0 || sc->spinPending;
+}
+
+/*
+ * Take the next command to send, HALT first, then queued commands in
+ * order, then the latest SPIN. Call with the lock held.
+ * Returns 0 if there is nothing to send.
+ */
+static int TakeNextStageCommand(StageController* sc, StageCommand* cmd){
+	if (sc->haltPending) {
+		sc->haltPending = 0;
+		cmd->type = STAGE_CMD_HALT;
+		cmd->x = 0;
+		cmd->y = 0;
+		cmd->queuedUs = sc->haltQueuedUs;
+		return 1;
+	}
+	if (sc->queueCount > 0) {
+		*cmd = sc->queue[sc->queueHead];
+		sc->queueHead = (sc->queueHead + 1) % STAGE_QUEUE_LENGTH;
+		sc->queueCount--;
+		return 1;
+	}
+	if (sc->spinPending) {
+		sc->spinPending = 0;
+		*cmd = sc->spin;
+		return 1;
+	}
+	return 0;
+}
+
+static void FormatStageCommand(const StageCommand* cmd, char* buff){
+	switch (cmd->type) {
+	case STAGE_CMD_SPIN:
+		sprintf(buff, "SPIN X=%d Y=%d\r", cmd->x, cmd->y);
+		break;
+	case STAGE_CMD_HALT:
+		strcpy(buff, "HALT\r");
+		break;
+	case STAGE_CMD_MOVEREL:
+		sprintf(buff, "MOVEI X=%d Y=%d\r", cmd->x, cmd->y);
+		break;
+	case STAGE_CMD_ZERO:
+		strcpy(buff, "HERE X=0 Y=0\r");
+		break;
+	default:
+		buff[0] = '\0';
+		break;
+	}
+}
+
+/*
+ * Update the statistics and what we know of the stage's velocity after
+ * sending cmd. Call with the lock held.
+ */
+static void RecordStageResult(StageController* sc, const StageCommand* cmd,
+		int writeOk, int replyLen, const char* reply, long long writtenUs, long long repliedUs){
+	int ok = writeOk && replyLen >= 0 && strncmp(reply, ":N", 2) != 0;
+
+	if (!writeOk) {
+		sc->stats.errors++;
+	} else {
+		sc->stats.sent++;
+		if (replyLen < 0) {
+			sc->stats.timeouts++;
+		} else {
+			if (!ok) sc->stats.errors++;
+			sc->rtt[sc->rttHead % STAGE_LATENCY_SAMPLES] = (float) (repliedUs - writtenUs) / 1000.0f;
+			sc->rttHead++;
+		}
+	}
+	float wait = (float) (writtenUs - cmd->queuedUs) / 1000.0f;
+	if (wait > sc->stats.queueDelayMax) sc->stats.queueDelayMax = wait;
+
+	/** Only trust our idea of the stage's velocity if it said yes to the command **/
+	if (!ok) {
+		sc->velocityKnown = 0;
+	} else if (cmd->type == STAGE_CMD_SPIN || cmd->type == STAGE_CMD_HALT) {
+		sc->velocityKnown = 1;
+		sc->velocityX = cmd->x;
+		sc->velocityY = cmd->y;
+	}
+}
+
+static DWORD WINAPI StageThread(LPVOID lpParam){
+	StageController* sc = (StageController*) lpParam;
+	char buff[64];
+	char reply[STAGE_REPLY_LENGTH];
+
+	while (1) {
+		StageCommand cmd;
+		EnterCriticalSection(&(sc->lock));
+		int haveCmd = TakeNextStageCommand(sc, &cmd);
+		sc->busy = haveCmd;
+		if (!haveCmd) SetEvent(sc->idle);
+		LeaveCriticalSection(&(sc->lock));
+
+		if (!haveCmd) {
+			/** Only quit once everything queued has gone out **/
+			if (InterlockedCompareExchange(&(sc->quit), 0, 0)) break;
+			WaitForSingleObject(sc->wake, INFINITE);
+			continue;
+		}
+
+		FormatStageCommand(&cmd, buff);
+		long long writtenUs = MonotonicUs();
+		int writeOk = (StageSendCommand(sc->stage, buff) == 0);
+		int replyLen = -1;
+		reply[0] = '\0';
+		if (writeOk) replyLen = StageReadReply(sc->stage, reply, STAGE_REPLY_LENGTH);
+		long long repliedUs = MonotonicUs();
+
+		EnterCriticalSection(&(sc->lock));
+		RecordStageResult(sc, &cmd, writeOk, replyLen, reply, writtenUs, repliedUs);
+		LeaveCriticalSection(&(sc->lock));
+	}
+	return 0;
+}
+
+StageController* CreateStageController(HANDLE stage){
+	if (stage == NULL) return NULL;
+	StageController* sc = (StageController*) calloc(1, sizeof(StageController));
+	if (sc == NULL) return NULL;
+	sc->stage = stage;
+	InitializeCriticalSection(&(sc->lock));
+	sc->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	sc->idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	sc->thread = CreateThread(NULL, 0, StageThread, (LPVOID) sc, 0, NULL);
+	if (sc->thread == NULL) {
+		printf("Error! Could not start the stage I/O thread.\n");
+		DestroyStageController(&sc);
+		return NULL;
+	}
+	return sc;
+}
+
+void DestroyStageController(StageController** sc){
+	if (sc == NULL || *sc == NULL) return;
+	StageController* s = *sc;
+	if (s->thread != NULL) {
+		InterlockedExchange(&(s->quit), 1);
+		SetEvent(s->wake);
+		WaitForSingleObject(s->thread, INFINITE);
+		CloseHandle(s->thread);
+
+		StageStats stats;
+		GetStageStats(s, &stats);
+		printf("Stage: %ld commands sent, %ld SPINs coalesced, %ld skipped, %ld errors, %ld timeouts.\n",
+				stats.sent, stats.coalesced, stats.skipped, stats.errors, stats.timeouts);
+		if (stats.numSamples > 0)
+			printf("Stage round trip: %.1f ms median, %.1f ms 90th percentile, %.1f ms max.\n",
+					stats.rttP50, stats.rttP90, stats.rttMax);
+	}
+	if (s->wake != NULL) CloseHandle(s->wake);
+	if (s->idle != NULL) CloseHandle(s->idle);
+	DeleteCriticalSection(&(s->lock));
+	free(s);
+	*sc = NULL;
+}
+
+/*
+ * Let the thread know there's work. Call with the lock held.
+ */
+static void WakeStageThread(StageController* sc){
+	ResetEvent(sc->idle);
+	SetEvent(sc->wake);
+}
+
+int StageSpin(StageController* sc, int xspeed, int yspeed){
+	if (sc == NULL) return STAGE_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	if (sc->spinPending) {
+		/** Replace the velocity that hasn't gone out yet **/
+		sc->stats.coalesced++;
+	} else if (sc->velocityKnown && !sc->busy && !sc->haltPending && sc->queueCount == 0
+			&& sc->velocityX == xspeed && sc->velocityY == yspeed) {
+		/** The stage is already doing this **/
+		sc->stats.skipped++;
+		LeaveCriticalSection(&(sc->lock));
+		return STAGE_OK;
+	}
+	sc->spinPending = 1;
+	sc->spin.type = STAGE_CMD_SPIN;
+	sc->spin.x = xspeed;
+	sc->spin.y = yspeed;
+	sc->spin.queuedUs = MonotonicUs();
+	WakeStageThread(sc);
+	LeaveCriticalSection(&(sc->lock));
+	return STAGE_OK;
+}
+
+int StageHalt(StageController* sc){
+	if (sc == NULL) return STAGE_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	if (sc->spinPending) {
+		sc->spinPending = 0;
+		sc->stats.coalesced++;
+	}
+	if (!sc->haltPending) sc->haltQueuedUs = MonotonicUs();
+	sc->haltPending = 1;
+	WakeStageThread(sc);
+	LeaveCriticalSection(&(sc->lock));
+	return STAGE_OK;
+}
+
+/*
+ * Queue a command to be sent in order
+ */
+static int QueueStageCommand(StageController* sc, int type, int x, int y){
+	if (sc == NULL) return STAGE_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	if (sc->queueCount == STAGE_QUEUE_LENGTH) {
+		sc->stats.dropped++;
+		LeaveCriticalSection(&(sc->lock));
+		return STAGE_ERROR;
+	}
+	StageCommand* cmd = &(sc->queue[(sc->queueHead + sc->queueCount) % STAGE_QUEUE_LENGTH]);
+	cmd->type = type;
+	cmd->x = x;
+	cmd->y = y;
+	cmd->queuedUs = MonotonicUs();
+	sc->queueCount++;
+	WakeStageThread(sc);
+	LeaveCriticalSection(&(sc->lock));
+	return STAGE_OK;
+}
+
+int StageMoveRel(StageController* sc, int xpos, int ypos){
+	return QueueStageCommand(sc, STAGE_CMD_MOVEREL, xpos, ypos);
+}
+
+int StageZero(StageController* sc){
+	return QueueStageCommand(sc, STAGE_CMD_ZERO, 0, 0);
+}
+
+int StageFlush(StageController* sc, DWORD timeoutMs){
+	if (sc == NULL) return STAGE_ERROR;
+	if (WaitForSingleObject(sc->idle, timeoutMs) != WAIT_OBJECT_0) return STAGE_ERROR;
+	return STAGE_OK;
+}
+
+void GetStageStats(StageController* sc, StageStats* stats){
+	float sorted[STAGE_LATENCY_SAMPLES];
+	EnterCriticalSection(&(sc->lock));
+	*stats = sc->stats;
+	stats->queued = sc->queueCount + sc->spinPending + sc->haltPending;
+	int n = (sc->rttHead < STAGE_LATENCY_SAMPLES) ? (int) sc->rttHead : STAGE_LATENCY_SAMPLES;
+	memcpy(sorted, sc->rtt, n * sizeof(float));
+	LeaveCriticalSection(&(sc->lock));
+
+	stats->numSamples = n;
+	stats->rttP50 = stats->rttP90 = stats->rttMax = 0;
+	if (n == 0) return;
+	SortFloatArr(sorted, n);
+	stats->rttP50 = PercentileOfSortedFloatArr(sorted, n, 0.5);
+	stats->rttP90 = PercentileOfSortedFloatArr(sorted, n, 0.9);
+	stats->rttMax = sorted[n - 1];
+}
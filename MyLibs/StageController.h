@@ -0,0 +1,146 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageController.h
+ *
+ * Talks to the stage from its own thread so that nobody else ever waits on
+ * the serial port.
+ *
+ * Callers queue commands and return immediately. The stage I/O thread
+ * writes each command, reads the stage's reply and times the round trip.
+ *
+ * SPIN commands are coalesced: only the most recent velocity matters, so a
+ * new SPIN replaces one that hasn't been sent yet, and a SPIN to the
+ * velocity the stage already has is not sent at all. HALT jumps the queue
+ * and cancels any pending SPIN. Other commands are sent in order.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef STAGECONTROLLER_H_
+#define STAGECONTROLLER_H_
+
+#include <windows.h>
+
+#define STAGE_QUEUE_LENGTH 16 // queued commands other than SPIN
+#define STAGE_LATENCY_SAMPLES 256 // round trip times kept for the statistics
+#define STAGE_REPLY_LENGTH 64
+
+#define STAGE_OK 0
+#define STAGE_ERROR -1
+
+/** Commands **/
+#define STAGE_CMD_SPIN 0
+#define STAGE_CMD_HALT 1
+#define STAGE_CMD_MOVEREL 2
+#define STAGE_CMD_ZERO 3
+
+typedef struct StageCommandStruct{
+	int type; // STAGE_CMD_*
+	int x;
+	int y;
+	long long queuedUs; // MonotonicUs() when it was queued
+} StageCommand;
+
+typedef struct StageStatsStruct{
+	long sent; // commands written to the stage
+	long coalesced; // SPINs replaced by a newer one before they were sent
+	long skipped; // SPINs not sent because the stage already had that velocity
+	long dropped; // commands dropped because the queue was full
+	long errors; // failed writes and error replies
+	long timeouts; // commands the stage never answered
+	int queued; // commands waiting right now
+	/** Round trip from writing a command to reading its reply, in ms **/
+	int numSamples;
+	float rttP50;
+	float rttP90;
+	float rttMax;
+	float queueDelayMax; // longest wait from queueing to writing, ms
+} StageStats;
+
+typedef struct StageControllerStruct{
+	HANDLE stage;
+	HANDLE thread;
+	HANDLE wake; // set whenever there is something to send
+	HANDLE idle; // set while nothing is queued or in flight
+	volatile LONG quit;
+
+	/** Everything below is protected by lock **/
+	CRITICAL_SECTION lock;
+	int haltPending;
+	long long haltQueuedUs;
+	int spinPending;
+	StageCommand spin; // the latest velocity requested
+	StageCommand queue[STAGE_QUEUE_LENGTH];
+	int queueHead;
+	int queueCount;
+	int busy; // a command is being written or waiting for its reply
+	int velocityKnown; // the stage is known to be moving at velocityX, velocityY
+	int velocityX;
+	int velocityY;
+
+	StageStats stats;
+	float rtt[STAGE_LATENCY_SAMPLES];
+	long rttHead;
+} StageController;
+
+/*
+ * Start the stage I/O thread for an already initialized stage.
+ * Returns NULL on failure.
+ */
+StageController* CreateStageController(HANDLE stage);
+
+/*
+ * Send whatever is queued, stop the thread and free the controller.
+ * The stage handle is left open.
+ */
+void DestroyStageController(StageController** sc);
+
+/*
+ * Queue commands. These never block.
+ * Returns STAGE_ERROR if the queue is full.
+ */
+int StageSpin(StageController* sc, int xspeed, int yspeed);
+int StageHalt(StageController* sc);
+int StageMoveRel(StageController* sc, int xpos, int ypos);
+int StageZero(StageController* sc);
+
+/*
+ * Wait up to timeoutMs for everything queued to be sent and answered.
+ * Returns STAGE_OK if the queue drained.
+ */
+int StageFlush(StageController* sc, DWORD timeoutMs);
+
+/*
+ * Copy out the statistics so far, with fresh latency percentiles.
+ */
+void GetStageStats(StageController* sc, StageStats* stats);
+
+#endif /* STAGECONTROLLER_H_ */
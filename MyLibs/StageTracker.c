@@ -0,0 +1,190 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageTracker.c
+ *
+ * Feed forward plus PID stage tracking. See StageTracker.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "StageTracker.h"
+
+StageTrackerGains DefaultStageTrackerGains(int speed, int activeZoneRadius){
+	StageTrackerGains g;
+	g.pixelsPerSpeed = STAGE_TRACKER_PIXELS_PER_SPEED;
+	g.maxSpeed = (double) speed * activeZoneRadius;
+	g.kp = speed;
+	double stableKp = STAGE_TRACKER_MAX_LOOP_GAIN / (g.pixelsPerSpeed * STAGE_TRACKER_LAG_US / 1e6);
+	if (g.kp > stableKp) g.kp = stableKp;
+	g.ki = g.kp * STAGE_TRACKER_KI_RATIO;
+	g.kd = g.kp * STAGE_TRACKER_KD_RATIO;
+	g.feedForward = STAGE_TRACKER_FEEDFORWARD;
+	return g;
+}
+
+void ResetStageTracker(StageTracker* st, StageTrackerGains gains){
+	memset(st, 0, sizeof(StageTracker));
+	st->gains = gains;
+}
+
+static double Clamp(double v, double limit){
+	if (v > limit) return limit;
+	if (v < -limit) return -limit;
+	return v;
+}
+
+/*
+ * Least squares slope of v against t over the history, per second
+ */
+static double HistorySlope(const StageTracker* st, const double* v){
+	int n = st->numSamples;
+	if (n < 2) return 0;
+	int k;
+	long long t0 = st->t[st->head];
+	double mt = 0, mv = 0;
+	for (k = 0; k < n; k++) {
+		mt += (st->t[k] - t0) / 1e6;
+		mv += v[k];
+	}
+	mt /= n;
+	mv /= n;
+	double stt = 0, stv = 0;
+	for (k = 0; k < n; k++) {
+		double dt = (st->t[k] - t0) / 1e6 - mt;
+		stt += dt * dt;
+		stv += dt * (v[k] - mv);
+	}
+	if (stt <= 0) return 0;
+	return stv / stt;
+}
+
+/*
+ * The stage velocity in effect at time t: the command worked out from the
+ * latest frame at least STAGE_TRACKER_LAG_US older than t.
+ */
+static double CommandAt(const StageTracker* st, const double* cmd, double t){
+	int n = st->numSamples;
+	double c = cmd[st->head]; // before the history, assume the oldest command
+	int k;
+	for (k = 0; k < n - 1; k++) { // the newest sample has no command yet
+		int i = (st->head + k) % STAGE_TRACKER_HISTORY;
+		if ((st->t[i] - st->t[st->head] + STAGE_TRACKER_LAG_US) / 1e6 <= t) c = cmd[i];
+	}
+	return c;
+}
+
+/*
+ * Where the worm is in the world at each sample: where it is in the image
+ * minus how far the stage has moved since the oldest sample.
+ */
+static void WorldPositions(const StageTracker* st, const double* v, const double* cmd, double* world){
+	int n = st->numSamples;
+	int k;
+	double moved = 0;
+	for (k = 0; k < n; k++) {
+		int i = (st->head + k) % STAGE_TRACKER_HISTORY;
+		if (k > 0) {
+			int prev = (st->head + k - 1) % STAGE_TRACKER_HISTORY;
+			double a = (st->t[prev] - st->t[st->head]) / 1e6;
+			double b = (st->t[i] - st->t[st->head]) / 1e6;
+			moved += CommandAt(st, cmd, (a + b) / 2) * (b - a);
+		}
+		world[i] = v[i] - st->gains.pixelsPerSpeed * moved;
+	}
+}
+
+/*
+ * PID plus feed forward on one axis, with conditional integration
+ */
+static double TrackAxis(const StageTrackerGains* g, double error, double imageVel,
+		double wormVel, double dt, double* integral){
+	double ff = (g->pixelsPerSpeed > 0) ? -g->feedForward * wormVel / g->pixelsPerSpeed : 0;
+	/** The error changes at minus the rate the point moves in the image **/
+	double out = ff + g->kp * error + g->ki * (*integral) - g->kd * imageVel;
+
+	/** Anti-windup: only integrate if that doesn't push further into saturation **/
+	int saturated = (out >= g->maxSpeed && error > 0) || (out <= -g->maxSpeed && error < 0);
+	if (!saturated && g->ki > 0) {
+		*integral += error * dt;
+		*integral = Clamp(*integral, g->maxSpeed / g->ki);
+		out = ff + g->kp * error + g->ki * (*integral) - g->kd * imageVel;
+	}
+	return Clamp(out, g->maxSpeed);
+}
+
+void UpdateStageTracker(StageTracker* st, double x, double y, double targetX, double targetY,
+		long long timeUs, int* vx, int* vy){
+	int last = (st->head + st->numSamples - 1) % STAGE_TRACKER_HISTORY;
+	double dt = 0;
+	if (st->numSamples > 0) {
+		dt = (timeUs - st->t[last]) / 1e6;
+		if (dt <= 0 || timeUs - st->t[last] > STAGE_TRACKER_MAX_GAP_US) {
+			/** Out of order or a long gap: start over, but keep the stage moving as it is **/
+			double outX = st->outX, outY = st->outY;
+			ResetStageTracker(st, st->gains);
+			st->outX = outX;
+			st->outY = outY;
+			dt = 0;
+		}
+	}
+
+	/** Keep the history in time order in a ring **/
+	int slot;
+	if (st->numSamples < STAGE_TRACKER_HISTORY) {
+		slot = st->numSamples++;
+	} else {
+		slot = st->head;
+		st->head = (st->head + 1) % STAGE_TRACKER_HISTORY;
+	}
+	st->t[slot] = timeUs;
+	st->x[slot] = x;
+	st->y[slot] = y;
+
+	/** The point moves in the image because the worm crawls and because the stage moves **/
+	double worldX[STAGE_TRACKER_HISTORY], worldY[STAGE_TRACKER_HISTORY];
+	WorldPositions(st, st->x, st->cmdX, worldX);
+	WorldPositions(st, st->y, st->cmdY, worldY);
+	double imageVelX = HistorySlope(st, st->x);
+	double imageVelY = HistorySlope(st, st->y);
+	st->wormVelX = HistorySlope(st, worldX);
+	st->wormVelY = HistorySlope(st, worldY);
+
+	st->outX = TrackAxis(&(st->gains), targetX - x, imageVelX, st->wormVelX, dt, &(st->integralX));
+	st->outY = TrackAxis(&(st->gains), targetY - y, imageVelY, st->wormVelY, dt, &(st->integralY));
+	st->cmdX[slot] = st->outX;
+	st->cmdY[slot] = st->outY;
+
+	*vx = (int) (st->outX + (st->outX >= 0 ? 0.5 : -0.5));
+	*vy = (int) (st->outY + (st->outY >= 0 ? 0.5 : -0.5));
+}
@@ -0,0 +1,147 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageTracker.h
+ *
+ * A predictive controller that moves the stage to keep a point on the worm
+ * at a target location in the image.
+ *
+ * It runs once per processed frame. From the recent history of the tracked
+ * point's image position, and the velocities the stage was told to move at,
+ * it estimates how fast the worm itself is crawling. The stage velocity it
+ * asks for is then
+ *
+ *   feed forward:  the velocity that would cancel the worm's crawling
+ *   + PID:         on the distance between the point and the target
+ *
+ * clamped to the stage's maximum speed. The integral term only integrates
+ * while the output isn't saturated in the direction of the error, and is
+ * itself clamped, so it can't wind up while the stage is flat out.
+ *
+ * Stage velocities are in the units of the stage's SPIN command. Positions
+ * are in camera pixels and times in microseconds.
+ *
+ * With the integral, derivative and feed forward gains set to zero, and the
+ * speed below STAGE_TRACKER_MAX_LOOP_GAIN, this is the old proportional
+ * controller: velocity = clamp(error, activeZone) * speed.
+ *
+ * simulateStageTracking.exe runs it against a simulated worm and stage.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef STAGETRACKER_H_
+#define STAGETRACKER_H_
+
+/** Frames of history used to estimate velocity **/
+#define STAGE_TRACKER_HISTORY 6
+
+/** Forget the history if no frame arrives for this long **/
+#define STAGE_TRACKER_MAX_GAP_US 250000
+
+/*
+ * How fast the image moves, in pixels per second, for every unit of SPIN
+ * velocity. Measure this on the rig: spin the stage at a known velocity and
+ * watch how fast something stationary crosses the field of view.
+ */
+#define STAGE_TRACKER_PIXELS_PER_SPEED 0.1
+
+/*
+ * Time from grabbing a frame until the stage is moving at the velocity
+ * worked out from it: segmentation, the serial round trip and the stage
+ * getting up to speed. Also worth measuring on the rig.
+ */
+#define STAGE_TRACKER_LAG_US 50000
+
+/*
+ * Above this proportional gain, in units of 1 / (pixelsPerSpeed * lag), the
+ * correction for one frame's error is still on its way when the next frames
+ * arrive, and the loop starts to ring. Faster speed settings are held here.
+ */
+#define STAGE_TRACKER_MAX_LOOP_GAIN 0.5
+
+/** Default gains relative to the proportional gain **/
+#define STAGE_TRACKER_KI_RATIO 1.0 // per second
+#define STAGE_TRACKER_KD_RATIO 0.05 // seconds
+#define STAGE_TRACKER_FEEDFORWARD 1.0 // fraction of the worm's estimated velocity to cancel
+
+typedef struct StageTrackerGainsStruct{
+	double kp; // SPIN units per pixel of error
+	double ki; // SPIN units per pixel-second of error
+	double kd; // SPIN units per pixel/second of error rate
+	double feedForward; // 0 to 1
+	double maxSpeed; // SPIN units, per axis
+	double pixelsPerSpeed; // STAGE_TRACKER_PIXELS_PER_SPEED
+} StageTrackerGains;
+
+typedef struct StageTrackerStruct{
+	StageTrackerGains gains;
+
+	/** Recent samples, oldest first once full **/
+	long long t[STAGE_TRACKER_HISTORY];
+	double x[STAGE_TRACKER_HISTORY];
+	double y[STAGE_TRACKER_HISTORY];
+	double cmdX[STAGE_TRACKER_HISTORY]; // stage velocity worked out from each sample
+	double cmdY[STAGE_TRACKER_HISTORY];
+	int numSamples;
+	int head;
+
+	/** Controller state **/
+	double integralX;
+	double integralY;
+	double outX; // last command
+	double outY;
+
+	/** Estimates, for display and logging **/
+	double wormVelX; // pixels per second the worm crawls, in image coordinates
+	double wormVelY;
+} StageTracker;
+
+/*
+ * Gains that reproduce the legacy controller's speed and active zone, plus
+ * the default integral, derivative and feed forward terms. The speed is
+ * limited to what the loop can take without ringing; the active zone still
+ * sets the maximum speed from the speed asked for.
+ */
+StageTrackerGains DefaultStageTrackerGains(int speed, int activeZoneRadius);
+
+/*
+ * Start over, with a stationary stage and no history
+ */
+void ResetStageTracker(StageTracker* st, StageTrackerGains gains);
+
+/*
+ * Update the tracker with the tracked point's position (x, y) in the frame
+ * taken at timeUs, and compute the stage velocity (vx, vy) to command now.
+ */
+void UpdateStageTracker(StageTracker* st, double x, double y, double targetX, double targetY,
+		long long timeUs, int* vx, int* vy);
+
+#endif /* STAGETRACKER_H_ */
@@ -0,0 +1,418 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StructuredLight.c
+ *
+ * Structured light calibration of the DLP against the camera.
+ * See StructuredLight.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "StructuredLight.h"
+
+#define SL_PI 3.14159265358979323846
+
+/** Terms of the smooth fit: a cubic in camera x and y **/
+#define SL_FIT_TERMS 10
+
+/** Times the decodes are fitted and sorted into those kept and those not **/
+#define STRUCTURED_LIGHT_FIT_PASSES 3
+
+/** Gray code bits needed to number the half period stripes across size mirrors **/
+static int GrayBitsFor(int size){
+	int stripes = (size + STRUCTURED_LIGHT_PERIOD / 2 - 1) / (STRUCTURED_LIGHT_PERIOD / 2);
+	int bits = 0;
+	while ((1 << bits) < stripes) bits++;
+	return bits;
+}
+
+StructuredLight* CreateStructuredLight(int dlpWidth, int dlpHeight, int camWidth, int camHeight){
+	if (dlpWidth <= 0 || dlpHeight <= 0 || camWidth <= 0 || camHeight <= 0) {
+		printf("Error: invalid sizes in CreateStructuredLight()\n");
+		return NULL;
+	}
+	StructuredLight* sl = (StructuredLight*) malloc(sizeof(StructuredLight));
+	memset(sl, 0, sizeof(StructuredLight));
+	sl->dlpWidth = dlpWidth;
+	sl->dlpHeight = dlpHeight;
+	sl->camWidth = camWidth;
+	sl->camHeight = camHeight;
+	sl->grayBitsX = GrayBitsFor(dlpWidth);
+	sl->grayBitsY = GrayBitsFor(dlpHeight);
+	sl->numPatterns = 2 * STRUCTURED_LIGHT_PHASE_STEPS + sl->grayBitsX + sl->grayBitsY;
+
+	int n = camWidth * camHeight;
+	int a;
+	for (a = 0; a < 2; a++) {
+		sl->sum[a] = (int*) calloc(n, sizeof(int));
+		sl->sinSum[a] = (int*) calloc(n, sizeof(int));
+		sl->cosSum[a] = (int*) calloc(n, sizeof(int));
+		sl->gray[a] = (unsigned short*) calloc(n, sizeof(unsigned short));
+	}
+	return sl;
+}
+
+void DestroyStructuredLight(StructuredLight** sl){
+	if (sl == NULL || *sl == NULL) return;
+	int a;
+	for (a = 0; a < 2; a++) {
+		free((*sl)->sum[a]);
+		free((*sl)->sinSum[a]);
+		free((*sl)->cosSum[a]);
+		free((*sl)->gray[a]);
+	}
+	free(*sl);
+	*sl = NULL;
+}
+
+/*
+ * Which axis pattern k is for, and its number among that axis's patterns:
+ * the phase steps first, then the Gray bits, most significant first.
+ */
+static int PatternAxis(StructuredLight* sl, int k, int* j){
+	int numX = STRUCTURED_LIGHT_PHASE_STEPS + sl->grayBitsX;
+	if (k < numX) {
+		*j = k;
+		return 0;
+	}
+	*j = k - numX;
+	return 1;
+}
+
+/** Whether the mirrors at position p along the axis are on in pattern j of that axis **/
+static int PatternIsOn(int j, int bits, int p){
+	if (j < STRUCTURED_LIGHT_PHASE_STEPS) {
+		int shift = j * (STRUCTURED_LIGHT_PERIOD / STRUCTURED_LIGHT_PHASE_STEPS);
+		return (p + shift) % STRUCTURED_LIGHT_PERIOD < STRUCTURED_LIGHT_PERIOD / 2;
+	}
+	int bit = bits - 1 - (j - STRUCTURED_LIGHT_PHASE_STEPS);
+	int stripe = p / (STRUCTURED_LIGHT_PERIOD / 2);
+	return ((stripe ^ (stripe >> 1)) >> bit) & 1;
+}
+
+void DrawStructuredLightPattern(StructuredLight* sl, int k, unsigned char* dlpImage){
+	int j;
+	int axis = PatternAxis(sl, k, &j);
+	int bits = (axis == 0) ? sl->grayBitsX : sl->grayBitsY;
+	int x, y;
+	if (axis == 0) {
+		/** Vertical stripes: work out one row and copy it **/
+		for (x = 0; x < sl->dlpWidth; x++)
+			dlpImage[x] = PatternIsOn(j, bits, x) ? 255 : 0;
+		for (y = 1; y < sl->dlpHeight; y++)
+			memcpy(dlpImage + y * sl->dlpWidth, dlpImage, sl->dlpWidth);
+	} else {
+		for (y = 0; y < sl->dlpHeight; y++)
+			memset(dlpImage + y * sl->dlpWidth, PatternIsOn(j, bits, y) ? 255 : 0, sl->dlpWidth);
+	}
+}
+
+void AddStructuredLightFrame(StructuredLight* sl, int k, const unsigned char* camImage){
+	int j;
+	int axis = PatternAxis(sl, k, &j);
+	int n = sl->camWidth * sl->camHeight;
+	int i;
+	if (j < STRUCTURED_LIGHT_PHASE_STEPS) {
+		/** Phase step j: I = A + B sin(theta + 2 pi j / N) **/
+		double step = 2 * SL_PI * j / STRUCTURED_LIGHT_PHASE_STEPS;
+		int s = (int) floor(1024 * sin(step) + 0.5);
+		int c = (int) floor(1024 * cos(step) + 0.5);
+		if (j == 0) {
+			memset(sl->sum[axis], 0, n * sizeof(int));
+			memset(sl->sinSum[axis], 0, n * sizeof(int));
+			memset(sl->cosSum[axis], 0, n * sizeof(int));
+			memset(sl->gray[axis], 0, n * sizeof(unsigned short));
+		}
+		for (i = 0; i < n; i++) {
+			sl->sum[axis][i] += camImage[i];
+			sl->sinSum[axis][i] += s * camImage[i];
+			sl->cosSum[axis][i] += c * camImage[i];
+		}
+		return;
+	}
+
+	/** A Gray bit: on if brighter than the mean of the phase frames **/
+	int bits = (axis == 0) ? sl->grayBitsX : sl->grayBitsY;
+	unsigned short bit = (unsigned short) (1 << (bits - 1 - (j - STRUCTURED_LIGHT_PHASE_STEPS)));
+	for (i = 0; i < n; i++) {
+		if (STRUCTURED_LIGHT_PHASE_STEPS * camImage[i] > sl->sum[axis][i]) sl->gray[axis][i] |= bit;
+	}
+}
+
+/*
+ * Sum src over a square of STRUCTURED_LIGHT_SMOOTH_RADIUS either side of
+ * each pixel, clipped at the edges, into dst. Rows then columns.
+ */
+static void BoxSum(const int* src, double* dst, double* temp, int width, int height){
+	int r = STRUCTURED_LIGHT_SMOOTH_RADIUS;
+	int x, y;
+	for (y = 0; y < height; y++) {
+		const int* row = src + y * width;
+		double acc = 0;
+		for (x = 0; x < r && x < width; x++) acc += row[x];
+		for (x = 0; x < width; x++) {
+			if (x + r < width) acc += row[x + r];
+			if (x - r - 1 >= 0) acc -= row[x - r - 1];
+			temp[y * width + x] = acc;
+		}
+	}
+	for (x = 0; x < width; x++) {
+		double acc = 0;
+		for (y = 0; y < r && y < height; y++) acc += temp[y * width + x];
+		for (y = 0; y < height; y++) {
+			if (y + r < height) acc += temp[(y + r) * width + x];
+			if (y - r - 1 >= 0) acc -= temp[(y - r - 1) * width + x];
+			dst[y * width + x] = acc;
+		}
+	}
+}
+
+/*
+ * DLP position along one axis of every camera pixel, from the phase and
+ * Gray code. Returns the number decoded and marks the rest 0 in valid.
+ */
+static int DecodeAxis(StructuredLight* sl, int axis, float* pos, unsigned char* valid, double* s, double* c, double* temp){
+	int n = sl->camWidth * sl->camHeight;
+	int bits = (axis == 0) ? sl->grayBitsX : sl->grayBitsY;
+	int window = 2 * STRUCTURED_LIGHT_SMOOTH_RADIUS + 1;
+	double P = STRUCTURED_LIGHT_PERIOD;
+	int numDecoded = 0;
+	int i;
+
+	BoxSum(sl->sinSum[axis], s, temp, sl->camWidth, sl->camHeight);
+	BoxSum(sl->cosSum[axis], c, temp, sl->camWidth, sl->camHeight);
+
+	/*
+	 * The sums are 1024 times N/2 times the amplitude B. The pixel has to
+	 * be lit well enough itself, or its Gray bits can't be trusted, and
+	 * over the window, or its phase can't. The window has fewer pixels at
+	 * the edges of the image, which only makes it stricter there.
+	 */
+	double minAmplitude = 1024.0 * STRUCTURED_LIGHT_PHASE_STEPS / 2 * STRUCTURED_LIGHT_MIN_MODULATION;
+	double minWindowAmplitude = minAmplitude * window * window;
+
+	for (i = 0; i < n; i++) {
+		if (!valid[i]) continue;
+		double rawSin = sl->sinSum[axis][i];
+		double rawCos = sl->cosSum[axis][i];
+		if (rawSin * rawSin + rawCos * rawCos < minAmplitude * minAmplitude
+				|| s[i] * s[i] + c[i] * c[i] < minWindowAmplitude * minWindowAmplitude) {
+			valid[i] = 0;
+			continue;
+		}
+
+		/** Position within the period from the phase, mirror edges at whole numbers **/
+		double theta = atan2(c[i], s[i]);
+		double fine = theta * P / (2 * SL_PI);
+
+		/** Which half period stripe the Gray code says, then its centre **/
+		unsigned int g = sl->gray[axis][i];
+		unsigned int stripe = 0;
+		int b;
+		for (b = bits - 1; b >= 0; b--) stripe |= ((stripe >> 1) ^ g) & (1u << b);
+		double coarse = (stripe + 0.5) * P / 2;
+
+		/** The whole period that puts the phase nearest the Gray code, then mirror centres at whole numbers **/
+		pos[i] = (float) (fine + P * floor((coarse - fine) / P + 0.5) - 0.5);
+		numDecoded++;
+	}
+	return numDecoded;
+}
+
+/** The fit's terms at camera pixel (x,y), scaled to about -1..1 **/
+static void FitTerms(StructuredLight* sl, int x, int y, double* t){
+	double u = 2.0 * x / sl->camWidth - 1;
+	double v = 2.0 * y / sl->camHeight - 1;
+	t[0] = 1; t[1] = u; t[2] = v;
+	t[3] = u * u; t[4] = u * v; t[5] = v * v;
+	t[6] = u * u * u; t[7] = u * u * v; t[8] = u * v * v; t[9] = v * v * v;
+}
+
+/*
+ * Solve the normal equations a*coef=b in place by Gaussian elimination.
+ * Returns -1 if they are singular.
+ */
+static int SolveFit(double a[SL_FIT_TERMS][SL_FIT_TERMS], double* b, double* coef){
+	int i, j, k;
+	for (i = 0; i < SL_FIT_TERMS; i++) {
+		int pivot = i;
+		for (k = i + 1; k < SL_FIT_TERMS; k++)
+			if (fabs(a[k][i]) > fabs(a[pivot][i])) pivot = k;
+		if (fabs(a[pivot][i]) < 1e-12) return -1;
+		for (j = 0; j < SL_FIT_TERMS; j++) {
+			double t = a[i][j]; a[i][j] = a[pivot][j]; a[pivot][j] = t;
+		}
+		double t = b[i]; b[i] = b[pivot]; b[pivot] = t;
+		for (k = i + 1; k < SL_FIT_TERMS; k++) {
+			double f = a[k][i] / a[i][i];
+			for (j = i; j < SL_FIT_TERMS; j++) a[k][j] -= f * a[i][j];
+			b[k] -= f * b[i];
+		}
+	}
+	for (i = SL_FIT_TERMS - 1; i >= 0; i--) {
+		double acc = b[i];
+		for (j = i + 1; j < SL_FIT_TERMS; j++) acc -= a[i][j] * coef[j];
+		coef[i] = acc / a[i][i];
+	}
+	return 0;
+}
+
+/*
+ * Least squares fit of the decoded positions, on every
+ * STRUCTURED_LIGHT_FIT_STRIDE'th pixel that is valid.
+ */
+static int FitAxis(StructuredLight* sl, const float* pos, const unsigned char* valid, double* coef){
+	double a[SL_FIT_TERMS][SL_FIT_TERMS];
+	double b[SL_FIT_TERMS];
+	double t[SL_FIT_TERMS];
+	int x, y, i, j;
+	int used = 0;
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	for (y = 0; y < sl->camHeight; y += STRUCTURED_LIGHT_FIT_STRIDE) {
+		for (x = 0; x < sl->camWidth; x += STRUCTURED_LIGHT_FIT_STRIDE) {
+			int p = y * sl->camWidth + x;
+			if (!valid[p]) continue;
+			FitTerms(sl, x, y, t);
+			for (i = 0; i < SL_FIT_TERMS; i++) {
+				for (j = 0; j < SL_FIT_TERMS; j++) a[i][j] += t[i] * t[j];
+				b[i] += t[i] * pos[p];
+			}
+			used++;
+		}
+	}
+	if (used < 4 * SL_FIT_TERMS) return -1;
+	return SolveFit(a, b, coef);
+}
+
+static double EvalFit(const double* coef, const double* t){
+	double acc = 0;
+	int i;
+	for (i = 0; i < SL_FIT_TERMS; i++) acc += coef[i] * t[i];
+	return acc;
+}
+
+int DecodeStructuredLight(StructuredLight* sl, int* CCD2DLPLookUp){
+	int W = sl->camWidth;
+	int H = sl->camHeight;
+	int n = W * H;
+	int a, i, x, y, pass;
+
+	float* pos[2];
+	pos[0] = (float*) malloc(n * sizeof(float));
+	pos[1] = (float*) malloc(n * sizeof(float));
+	unsigned char* valid = (unsigned char*) malloc(n);
+	double* s = (double*) malloc(n * sizeof(double));
+	double* c = (double*) malloc(n * sizeof(double));
+	double* temp = (double*) malloc(n * sizeof(double));
+
+	/** A pixel is only decoded if both axes decode **/
+	memset(valid, 1, n);
+	DecodeAxis(sl, 0, pos[0], valid, s, c, temp);
+	sl->numDecoded = DecodeAxis(sl, 1, pos[1], valid, s, c, temp);
+	free(s);
+	free(c);
+	free(temp);
+
+	/*
+	 * Fit, and keep the decodes less than half a period from the fit: the
+	 * rest were put in the wrong period by the Gray code. Decodes that are
+	 * badly wrong pull the first fit about, so fit again to those kept and
+	 * sort all the decodes again, a few times.
+	 */
+	unsigned char* decoded = (unsigned char*) malloc(n);
+	memcpy(decoded, valid, n);
+	double coef[2][SL_FIT_TERMS];
+	double t[SL_FIT_TERMS];
+	int ret = 0;
+	for (pass = 0; pass < STRUCTURED_LIGHT_FIT_PASSES && ret == 0; pass++) {
+		for (a = 0; a < 2 && ret == 0; a++) ret = FitAxis(sl, pos[a], valid, coef[a]);
+		if (ret != 0) break;
+		double sumSq = 0;
+		int inliers = 0;
+		sl->numOutliers = 0;
+		for (y = 0; y < H; y++) {
+			for (x = 0; x < W; x++) {
+				i = y * W + x;
+				if (!decoded[i]) continue;
+				FitTerms(sl, x, y, t);
+				double dx = pos[0][i] - EvalFit(coef[0], t);
+				double dy = pos[1][i] - EvalFit(coef[1], t);
+				valid[i] = fabs(dx) < STRUCTURED_LIGHT_PERIOD / 2 && fabs(dy) < STRUCTURED_LIGHT_PERIOD / 2;
+				if (valid[i]) {
+					sumSq += dx * dx + dy * dy;
+					inliers++;
+				} else {
+					sl->numOutliers++;
+				}
+			}
+		}
+		sl->fitRmsPx = (inliers > 0) ? sqrt(sumSq / (2 * inliers)) : 0;
+	}
+	free(decoded);
+	if (ret != 0) {
+		printf("Error: only %d of %d camera pixels could be decoded, too few to calibrate from.\n", sl->numDecoded, n);
+		free(pos[0]);
+		free(pos[1]);
+		free(valid);
+		return -1;
+	}
+
+	/** Fill the lookup table, from the fit where there's no good decode **/
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			i = y * W + x;
+			double dlpx, dlpy;
+			if (valid[i]) {
+				dlpx = pos[0][i];
+				dlpy = pos[1][i];
+			} else {
+				FitTerms(sl, x, y, t);
+				dlpx = EvalFit(coef[0], t);
+				dlpy = EvalFit(coef[1], t);
+			}
+			CCD2DLPLookUp[x * H + y] = (int) floor(dlpx + 0.5);
+			CCD2DLPLookUp[n + x * H + y] = (int) floor(dlpy + 0.5);
+		}
+	}
+
+	printf("Structured light: decoded %d of %d camera pixels, %d of them discarded, fit rms %.2f mirrors\n",
+			sl->numDecoded, n, sl->numOutliers, sl->fitRmsPx);
+	free(pos[0]);
+	free(pos[1]);
+	free(valid);
+	return sl->numDecoded - sl->numOutliers;
+}
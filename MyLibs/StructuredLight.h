@@ -0,0 +1,139 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StructuredLight.h
+ *
+ * Calibrates the DLP against the camera with structured light: a short
+ * sequence of whole-field patterns, not one point at a time.
+ *
+ * Every camera pixel decodes the DLP column and row that lights it from
+ * two kinds of pattern for each axis:
+ *
+ *   phase   square-wave stripes of a fixed period, shifted by a fraction
+ *           of the period each time. The optics blur them into near
+ *           sinusoids, so the standard N-step phase formula gives the
+ *           position within a period to a fraction of a mirror.
+ *   Gray    Gray-coded stripes half a period wide, which say which period
+ *           the pixel is in. Because they are half a period wide they
+ *           only need to be good to a quarter of a period, so the phase
+ *           decides positions near a stripe boundary, not the Gray code.
+ *
+ * The DMD is binary, so there are no grey levels on the DLP side. Each
+ * Gray bit is thresholded against the mean of that axis's phase frames,
+ * which for 50% duty stripes is halfway between the pixel's dark and
+ * lit levels. No separate all-on and all-off frames are needed.
+ * The amplitude of the phase signal says how well lit the pixel is.
+ *
+ * With a 16 mirror period, 4 phase steps and a 1024x768 DLP, that is
+ * 4 + 7 patterns per axis, 22 frames in all.
+ *
+ * Pixels that aren't lit well enough to decode, and decodes that disagree
+ * with a smooth fit to the rest by half a period or more, take their value
+ * from the fit. Like the MATLAB lookup tables, this carries on past the
+ * edge of the DLP, so cvtPtCam2DLP() still works there.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef STRUCTUREDLIGHT_H_
+#define STRUCTUREDLIGHT_H_
+
+/** DLP mirrors in one period of the phase stripes. Even, and a multiple of STRUCTURED_LIGHT_PHASE_STEPS **/
+#define STRUCTURED_LIGHT_PERIOD 16
+
+/** Phase steps per axis. 4 or more **/
+#define STRUCTURED_LIGHT_PHASE_STEPS 4
+
+/** Pixels whose phase amplitude is below this, in camera grey levels, aren't decoded **/
+#define STRUCTURED_LIGHT_MIN_MODULATION 8
+
+/*
+ * The phase frames are averaged over a square this many camera pixels
+ * either side of each pixel, so that stripe edges the optics leave sharp
+ * don't bias the phase.
+ */
+#define STRUCTURED_LIGHT_SMOOTH_RADIUS 2
+
+/** Every this many pixels of those decoded are used for the smooth fit **/
+#define STRUCTURED_LIGHT_FIT_STRIDE 4
+
+typedef struct StructuredLightStruct{
+	int dlpWidth;
+	int dlpHeight;
+	int camWidth;
+	int camHeight;
+
+	/** Patterns **/
+	int grayBitsX;
+	int grayBitsY;
+	int numPatterns;
+
+	/** Per camera pixel, accumulated as the frames come in, one set per axis **/
+	int* sum[2]; // of the phase frames
+	int* sinSum[2];
+	int* cosSum[2];
+	unsigned short* gray[2];
+
+	/** Results of the last decode **/
+	int numDecoded;
+	int numOutliers;
+	double fitRmsPx;
+} StructuredLight;
+
+/*
+ * Returns NULL if the sizes are invalid.
+ */
+StructuredLight* CreateStructuredLight(int dlpWidth, int dlpHeight, int camWidth, int camHeight);
+
+void DestroyStructuredLight(StructuredLight** sl);
+
+/*
+ * Pattern k of sl->numPatterns, drawn into a dlpWidth x dlpHeight
+ * row-major image, 255 where the mirror is on and 0 where it's off.
+ */
+void DrawStructuredLightPattern(StructuredLight* sl, int k, unsigned char* dlpImage);
+
+/*
+ * The camera's camWidth x camHeight row-major image of pattern k.
+ * Every pattern must be added once, in order, before decoding.
+ */
+void AddStructuredLightFrame(StructuredLight* sl, int k, const unsigned char* camImage);
+
+/*
+ * Decode the frames into a CCD2DLPLookUp table of 2*camWidth*camHeight
+ * ints, in the layout TransformLib expects: the DLP x of camera pixel
+ * (x,y) at x*camHeight+y and its DLP y camWidth*camHeight further on.
+ *
+ * Returns the number of pixels whose own decode was used, or -1 if too
+ * few were decoded to fit the rest.
+ */
+int DecodeStructuredLight(StructuredLight* sl, int* CCD2DLPLookUp);
+
+#endif /* STRUCTUREDLIGHT_H_ */
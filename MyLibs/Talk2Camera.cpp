@@ -43,6 +43,7 @@
 #include "Talk2Camera.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Do we print debugging output?
 
@@ -67,11 +68,53 @@ void T2Cam_CloseLib() {
 
 /*
  * Given a pointer to a CamData type, this function will allocate
- * memory.
+ * memory and set up the empty triple buffer.
  */
 void T2Cam_AllocateCamData(CamData** MyCamera) {
 	printf("inside T2Cam_AllocateCamData\n");
-	*MyCamera = (CamData*) malloc(sizeof(CamData));
+	*MyCamera = (CamData*) calloc(1, sizeof(CamData));
+
+	/** Slot 0 belongs to the callback, 1 to the reader, 2 starts out shared and empty **/
+	(*MyCamera)->iBack = 0;
+	(*MyCamera)->iFront = 1;
+	(*MyCamera)->iMiddle = 2;
+	/** Auto-reset: each SetEvent wakes at most one wait **/
+	(*MyCamera)->iFrameEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+/*
+ * Allocate the triple buffer slots once we know how large a frame
+ * the camera will deliver.
+ */
+static int T2Cam_AllocateSlots(CamData* MyCamera) {
+	long width = 0;
+	long height = 0;
+	int bpp = 0;
+	COLORFORMAT format;
+	if (IC_GetImageDescription(MyCamera->hGrabber, &width, &height, &bpp,
+			&format) == IC_SUCCESS && width > 0 && height > 0 && bpp > 0) {
+		MyCamera->iWidth = (int) width;
+		MyCamera->iHeight = (int) height;
+		MyCamera->iBitsPerPixel = bpp;
+		MyCamera->iColorFormat = format;
+	} else {
+		printf("Could not read the image description. Assuming %dx%d 8-bit frames.\n", CCDSIZEX, CCDSIZEY);
+		MyCamera->iWidth = CCDSIZEX;
+		MyCamera->iHeight = CCDSIZEY;
+		MyCamera->iBitsPerPixel = 8;
+	}
+	MyCamera->iSlotSize = (long) MyCamera->iWidth * MyCamera->iHeight
+			* MyCamera->iBitsPerPixel / 8;
+
+	int k;
+	for (k = 0; k < CAM_NUM_SLOTS; k++) {
+		MyCamera->iSlot[k] = (unsigned char*) calloc(MyCamera->iSlotSize, 1);
+		if (MyCamera->iSlot[k] == NULL) {
+			printf("Error! Could not allocate camera frame buffer.\n");
+			return -1;
+		}
+	}
+	return 0;
 }
 
 /*
@@ -114,6 +157,9 @@ void T2Cam_GrabFramesAsFastAsYouCan(CamData** CameraDataStruct) {
 	IC_SetFormat((*CameraDataStruct)->hGrabber, Y800);
 	printf("Set Continuous mode");
 	IC_SetContinuousMode((*CameraDataStruct)->hGrabber, 0); //1 means snap continously
+	/** The callback copies into these, so they must exist before live starts **/
+	if (T2Cam_AllocateSlots(*CameraDataStruct) != 0)
+		return;
 	IC_StartLive((*CameraDataStruct)->hGrabber, 0); //Set to 1 to display
 }
 
@@ -162,6 +208,16 @@ void T2Cam_TurnOff(CamData** CameraDataStruct) {
 			printf("Success. There is no valid video capture device opened.\n ");
 		}
 
+		/** Live has stopped so the callback no longer touches the slots **/
+		int k;
+		for (k = 0; k < CAM_NUM_SLOTS; k++)
+			free((*CameraDataStruct)->iSlot[k]);
+		if ((*CameraDataStruct)->iFrameEvent)
+			CloseHandle((*CameraDataStruct)->iFrameEvent);
+		printf("Camera left %ld frames unread and timed out %ld times\n",
+				(long) (*CameraDataStruct)->iFramesOverwritten,
+				(*CameraDataStruct)->iTimeouts);
+
 		free(*CameraDataStruct);
 		printf("Releasing memory from CamData struct\n");
 	}else{
@@ -172,16 +228,14 @@ void T2Cam_TurnOff(CamData** CameraDataStruct) {
 
 /*
  * In continuousmode, callback is called every time the camera acquires
- * a new frame. The callback populates the data structure "Data" using the
- * CamData datatype.
+ * a new frame. It runs on the driver's thread.
  *
- * Inside this function a dummy variable CallBackDataStruct is used.
- * (my name, not the sample code.) I believe what is going on is that the
- * CallBackDataStruct is a pointer to Data and we are just using it to
- * impose the "structure-ness" of the struct onto the pre-existing data in data.
- *
- * I find this a bit confusing but its basically the same as the sample code
- * with different variable names.
+ * pData belongs to the driver and may be overwritten as soon as we return,
+ * so the frame is copied into the slot the callback owns (iBack). That slot
+ * is then published by swapping it with the shared slot (iMiddle), and
+ * whichever slot comes back becomes the next one to write into. If the
+ * shared slot still held an unread frame, that frame is counted as
+ * overwritten.
  *
  */
 void _cdecl callback(HGRABBER hGrabber, unsigned char* pData,
@@ -191,14 +245,53 @@ void _cdecl callback(HGRABBER hGrabber, unsigned char* pData,
 	if (PRINT_DEBUG) {
 		printf("callback called \n");
 	}
-	//if (!CallBackDataStruct->iProcessing) {
-		//CallBackDataStruct->iProcessing = 1;
-		CallBackDataStruct->iImageData = pData; //Copy the frame data into the structure.
-		CallBackDataStruct->iFrameNumber = frameNumber;
-		if (PRINT_DEBUG) {
-			printf("Within callback: iframeNumber %d \n", frameNumber);
-		}
-		//CallBackDataStruct->iProcessing = 0;
-	//}
+	if (CallBackDataStruct->iSlotSize <= 0 || pData == NULL) return;
+
+	LONG back = CallBackDataStruct->iBack;
+	memcpy(CallBackDataStruct->iSlot[back], pData, CallBackDataStruct->iSlotSize);
+	CallBackDataStruct->iSlotFrameNumber[back] = frameNumber;
+
+	/** Publish. The interlocked exchange is a full barrier so the copy is visible first. **/
+	LONG prev = InterlockedExchange(&(CallBackDataStruct->iMiddle), back | CAM_SLOT_FRESH);
+	if (prev & CAM_SLOT_FRESH)
+		InterlockedIncrement(&(CallBackDataStruct->iFramesOverwritten));
+	CallBackDataStruct->iBack = prev & ~CAM_SLOT_FRESH;
+	SetEvent(CallBackDataStruct->iFrameEvent);
+
+	if (PRINT_DEBUG) {
+		printf("Within callback: iframeNumber %lu \n", frameNumber);
+	}
 }
 
+/*
+ * Block until the camera callback delivers a frame that has not been seen
+ * yet, or until timeoutMs milliseconds elapse.
+ *
+ * The event can be left signaled by a frame that we already picked up on
+ * the previous call, so after waking we re-check the fresh flag and wait
+ * again for whatever time is left.
+ */
+int T2Cam_WaitForFrame(CamData* MyCamera, DWORD timeoutMs) {
+	if (MyCamera == NULL || MyCamera->iFrameEvent == NULL) return T2CAM_ERROR;
+
+	DWORD start = GetTickCount();
+	while (!(InterlockedCompareExchange(&(MyCamera->iMiddle), 0, 0) & CAM_SLOT_FRESH)) {
+		DWORD elapsed = GetTickCount() - start;
+		if (elapsed >= timeoutMs) {
+			MyCamera->iTimeouts++;
+			return T2CAM_TIMEOUT;
+		}
+		DWORD ret = WaitForSingleObject(MyCamera->iFrameEvent, timeoutMs - elapsed);
+		if (ret == WAIT_FAILED) {
+			printf("Error waiting for camera frame event!\n");
+			return T2CAM_ERROR;
+		}
+	}
+
+	/** Take the fresh slot and hand our old one back to the callback **/
+	LONG prev = InterlockedExchange(&(MyCamera->iMiddle), MyCamera->iFront);
+	MyCamera->iFront = prev & ~CAM_SLOT_FRESH;
+	MyCamera->iImageData = MyCamera->iSlot[MyCamera->iFront];
+	MyCamera->iFrameNumber = MyCamera->iSlotFrameNumber[MyCamera->iFront];
+	return T2CAM_FRAME_READY;
+}
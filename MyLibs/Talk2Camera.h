@@ -35,16 +35,40 @@
 
 #ifndef TALK2CAMERA_H_
 #define TALK2CAMERA_H_
+#include <windows.h>
 #include "../3rdPartyLibs/tisgrabber.h"
 #include <stdio.h>
 
 #define PRINT_DEBUG 0
 
+/*
+ * Number of slots in the frame triple buffer and the flag used to mark
+ * the shared slot as holding a frame that has not yet been picked up.
+ */
+#define CAM_NUM_SLOTS 3
+#define CAM_SLOT_FRESH 0x4
+
+/*
+ * Return values of T2Cam_WaitForFrame()
+ */
+#define T2CAM_FRAME_READY 1
+#define T2CAM_TIMEOUT 0
+#define T2CAM_ERROR -1
+
 /*
  * We define a new variable type, "CamData" which is a struct that
  * holds information about the current Data in the camera.
  *
- * The actual data resides in *iImageData
+ * Frames are handed from the camera callback to the processing thread
+ * through a triple buffer. The callback always owns the slot iBack, the
+ * processing thread always owns the slot iFront and the third slot is
+ * swapped atomically through iMiddle. The callback copies each frame
+ * out of the driver's buffer into iBack, swaps it into iMiddle and
+ * signals iFrameEvent. Neither side ever touches the slot the other one
+ * owns, so the processing thread never sees a torn frame.
+ *
+ * After a successful T2Cam_WaitForFrame() the latest frame resides in
+ * *iImageData and its camera frame number in iFrameNumber.
  * The i notation indicates that these are internal values. e.g.
  * iFrameNumber refers to the FrameNumber that the camera sees,
  *
@@ -60,6 +84,20 @@ struct CamDataStruct {
 	COLORFORMAT iColorFormat;
 	int iProcessing;
 	unsigned long iFrameNumber;
+
+	/** Triple Buffer **/
+	unsigned char* iSlot[CAM_NUM_SLOTS];
+	unsigned long iSlotFrameNumber[CAM_NUM_SLOTS];
+	long iSlotSize;
+	LONG iBack; // only touched by the callback
+	LONG iFront; // only touched by the processing thread
+	volatile LONG iMiddle; // slot index, OR'd with CAM_SLOT_FRESH when unread
+	HANDLE iFrameEvent;
+
+	/** Frames the callback wrote that were replaced before anyone read them **/
+	volatile LONG iFramesOverwritten;
+	/** Times T2Cam_WaitForFrame() gave up waiting **/
+	long iTimeouts;
 };
 
 /*
@@ -91,7 +129,7 @@ void _cdecl callback(HGRABBER hGrabber, unsigned char* pData, unsigned long fram
 
 /*
  * Given a pointer to a CamData type, this function will allocate
- * memory.
+ * memory and set up the empty triple buffer.
  */
 void T2Cam_AllocateCamData(CamData** CameraDataStruct);
 
@@ -122,6 +160,18 @@ void T2Cam_GrabFramesAsFastAsYouCan(CamData** CameraDataStruct);
  */
 void T2Cam_TurnOff(CamData** CameraDataStruct);
 
+/*
+ * Block until the camera callback delivers a frame that has not been seen
+ * yet, or until timeoutMs milliseconds elapse.
+ *
+ * On T2CAM_FRAME_READY the new frame is in MyCamera->iImageData and
+ * MyCamera->iFrameNumber. The buffer stays valid and untouched by the
+ * camera until the next call to T2Cam_WaitForFrame().
+ *
+ * Returns T2CAM_FRAME_READY, T2CAM_TIMEOUT or T2CAM_ERROR.
+ */
+int T2Cam_WaitForFrame(CamData* MyCamera, DWORD timeoutMs);
+
 
 void T2Matlab_ArrayTest();
 
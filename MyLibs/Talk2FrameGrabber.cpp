@@ -29,6 +29,8 @@
 
 /** C includes **/
 #include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
 #include    <conio.h>
 
 
@@ -60,6 +62,7 @@ FrameGrabber* CreateFrameGrabberObject(){
 	fg->HostBuf=BFNULL;
 	fg->WasOneShot = FALSE;
 	fg->ContinuousData= FALSE;
+	fg->ring=NULL;
 	return fg;
 
 }
@@ -300,8 +303,110 @@ int AcquireFrame(FrameGrabber* fg){
 }
 
 
+/*
+ * Stop the continuous grab, then free its ring and buffers
+ */
+static void StopContinuousAcquisition(FrameGrabber* fg){
+	// stop the acquisition thread before we pull the buffers out from under it
+	DestroyFrameRing(&(fg->ring));
+	BiCirControl(fg->hBoard, &(fg->BufArray), BISTOP, BiWait);
+	BiCircCleanUp(fg->hBoard, &(fg->BufArray));
+	BiBufferFree(fg->hBoard, &(fg->BufArray));
+}
+
+/*
+ * Go back to snapping single frames into fg->HostBuf
+ * when continuous acquisition could not be started.
+ */
+static int RestoreSnapAcquisition(FrameGrabber* fg){
+	if (CiAqSetup(fg->hBoard, (PBFVOID) fg->HostBuf, fg->ImageSize, 0, CiDMADataMem,
+			CiLutBypass, CiLut8Bit, CiQTabBank0, TRUE, CiQTabModeOneBank,
+			AqEngJ)) {
+		BFErrorShow(fg->hBoard);
+		printf("Setting up for acquisition failed.\n");
+	}
+	return T2FG_ERROR;
+}
+
+/*
+ * FrameSource callbacks for the continuous acquisition ring.
+ * These run on the ring's acquisition thread, which is the only
+ * thread that touches the board once acquisition has started.
+ */
+static int WaitForRingBuffer(void* ctx, int* slot){
+	FrameGrabber* fg = (FrameGrabber*) ctx;
+	BiCirHandle cirHandle;
+	BFRC ret=BiCirWaitDoneFrame(fg->hBoard, &(fg->BufArray), T2FG_FRAME_WAIT_MS, &cirHandle);
+	if (ret==BI_ERROR_CIR_WAIT_TIMEOUT || ret==BI_ERROR_CIR_ACQUISITION) return FRAMERING_TIMEOUT;
+	if (ret!=BI_OK) return FRAMERING_ERROR;
+	*slot = (int) cirHandle.BufferNumber;
+	return FRAMERING_OK;
+}
+
+static void HoldRingBuffer(void* ctx, int slot, int hold){
+	FrameGrabber* fg = (FrameGrabber*) ctx;
+	BiCirBufferStatusSet(fg->hBoard, &(fg->BufArray), (BFU32) slot, hold ? BIHOLD : BIAVAILABLE);
+}
+
+/*
+ * Restart the continuous grab after repeated timeouts
+ */
+static void RecoverRing(void* ctx){
+	FrameGrabber* fg = (FrameGrabber*) ctx;
+	BiCirControl(fg->hBoard, &(fg->BufArray), BIABORT, BiWait);
+	if (BiCirControl(fg->hBoard, &(fg->BufArray), BISTART, BiAsync) != BI_OK) {
+		printf("Restarting continuous acquisition failed.\n");
+	} else {
+		printf("Continuous acquisition restarted.\n");
+	}
+}
+
+int StartContinuousAcquisition(FrameGrabber* fg, int numBuffers){
+	if (fg->ring != NULL) return T2FG_SUCCESS;
+
+	/** Swap the single snap buffer for a ring of buffers the board streams into **/
+	CiAqCleanUp(fg->hBoard, AqEngJ);
+	if (BiBufferAllocCam(fg->hBoard, &(fg->BufArray), (BFU32) numBuffers) != BI_OK) {
+		printf("Could not allocate the acquisition ring.\n");
+		return RestoreSnapAcquisition(fg);
+	}
+	if (BiCircAqSetup(fg->hBoard, &(fg->BufArray), CirErIgnore, BiAqEngJ) != BI_OK) {
+		printf("Setting up continuous acquisition failed.\n");
+		BiBufferFree(fg->hBoard, &(fg->BufArray));
+		return RestoreSnapAcquisition(fg);
+	}
+
+	fg->ring = CreateFrameRingOnBuffers(numBuffers, (long) fg->ImageSize,
+			(unsigned char**) fg->BufArray.BufferArry);
+	if (fg->ring == NULL) {
+		StopContinuousAcquisition(fg);
+		return RestoreSnapAcquisition(fg);
+	}
+
+	FrameSource src;
+	src.Grab = NULL;
+	src.WaitSlot = WaitForRingBuffer;
+	src.SetHold = HoldRingBuffer;
+	src.Recover = RecoverRing;
+	src.ctx = (void*) fg;
+	src.maxConsecutiveTimeouts = T2FG_TIMEOUTS_BEFORE_RESET;
+	if (BiCirControl(fg->hBoard, &(fg->BufArray), BISTART, BiAsync) != BI_OK
+			|| StartFrameRingAcquisition(fg->ring, src) != FRAMERING_OK) {
+		printf("Starting continuous acquisition failed.\n");
+		StopContinuousAcquisition(fg);
+		return RestoreSnapAcquisition(fg);
+	}
+	printf("Continuous acquisition started with %d host buffers.\n", numBuffers);
+	return T2FG_SUCCESS;
+}
+
+
 int CloseFrameGrabber(FrameGrabber* fg){
 
+	// stop the acquisition thread before we pull the board out from under it
+		int continuous = (fg->ring != NULL);
+		if (continuous) StopContinuousAcquisition(fg);
+
 	// put board back in oneshot mode
 		if (fg->WasOneShot)
 			CiConVTrigModeSet(fg->hBoard, fg->OrigTrigMode, fg->TrigAssign, fg->TrigAPolarity,
@@ -311,8 +416,8 @@ int CloseFrameGrabber(FrameGrabber* fg){
 		if (fg->ContinuousData)
 			CiConSwTrig(fg->hBoard, CiTrigA, CiTrigDeassert);
 
-		// clean up acquisition resources
-		CiAqCleanUp(fg->hBoard, AqEngJ);
+		// clean up acquisition resources (the continuous grab already did)
+		if (!continuous) CiAqCleanUp(fg->hBoard, AqEngJ);
 
 		// free buffer
 		free(fg->HostBuf);
@@ -41,10 +41,20 @@
 #include	"BFApi.h"
 #include	"BFErApi.h"
 #include	"DSApi.h"
+#include 	"BiApi.h"
+
+#include "FrameRing.h"
 
 #define T2FG_ERROR -1
 #define T2FG_SUCCESS 0
 
+/** Host buffers in the continuous acquisition ring **/
+#define T2FG_RING_BUFFERS 8
+/** Consecutive acquisition timeouts before the board is reset **/
+#define T2FG_TIMEOUTS_BEFORE_RESET 3
+/** How long to wait for the next frame of a continuous grab, comfortably longer than one exposure **/
+#define T2FG_FRAME_WAIT_MS 100
+
 /*
  * Thread to update the video display
  * using the BitFlow SDK.
@@ -77,6 +87,10 @@ typedef struct FrameGrabberStruct {
 
 	BFBOOL ContinuousData;
 
+	/** Continuous acquisition, NULL unless StartContinuousAcquisition() was called **/
+	FrameRing* ring;
+	BIBA BufArray; //host buffers the board streams into, read in place through ring
+
 } FrameGrabber;
 
 
@@ -128,9 +142,25 @@ int setAcquisitionTimeout(FrameGrabber* fg, int t);
 
 /*
  * The acquired frame is plopped into fg->Hostbuf
+ *
+ * Do not call this once continuous acquisition has started.
  */
 int AcquireFrame(FrameGrabber* fg);
 
+/*
+ * Start a continuous grab into a ring of numBuffers host buffers, which the
+ * board fills by DMA one after the other with no snap command per frame.
+ * A thread waits on each finished buffer and publishes it in fg->ring.
+ * Processing then takes the newest complete frame with FrameRingGetNewest()
+ * instead of calling AcquireFrame(), reading the host buffer in place.
+ * The newest buffer and the one being read are held so the board skips them.
+ *
+ * A frame that doesn't arrive within T2FG_FRAME_WAIT_MS is counted as a
+ * timeout and the grab is only restarted after T2FG_TIMEOUTS_BEFORE_RESET
+ * of them in a row.
+ */
+int StartContinuousAcquisition(FrameGrabber* fg, int numBuffers);
+
 int CloseFrameGrabber(FrameGrabber* fg);
 
 
@@ -94,6 +94,13 @@ HANDLE InitializeUsbStage(){
 		printf("Checking for serial port!\n");
 
 		/** If Serial **/
+		return InitializeSerialStage("COM3");
+}
+
+/*
+ * Opens and configures a stage on a serial port, such as "COM3"
+ */
+HANDLE InitializeSerialStage(const char* port){
 
 		/** This code is adapted from
 		 *
@@ -103,7 +110,7 @@ HANDLE InitializeUsbStage(){
 
 		/** Open the Serial Port **/
 		HANDLE hSerial;
-		hSerial = CreateFile("COM3", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE | FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		hSerial = CreateFile(port, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE | FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
 		if(hSerial==INVALID_HANDLE_VALUE){
 			if(GetLastError()==ERROR_FILE_NOT_FOUND){
 				//serial port does not exist.
@@ -187,25 +194,47 @@ void clearStageBuffer(HANDLE s){
 
 
 /*
- * Set the velocity of the stage
- *
+ * Write a command, which must end in \r, to the stage's port.
+ * (emulateStage.exe also uses this to write replies.)
+ * Returns 0 on success, -1 on failure.
  */
-int spinStage(HANDLE s, int xspeed,int yspeed){
-	
-
-	 DWORD Length;
-	 
-	
+int StageSendCommand(HANDLE s, const char* cmd){
+	DWORD Length;
 	//Error handling modeled off of http://msdn.microsoft.com/en-us/library/windows/hardware/bb540534(v=vs.85).aspx
-	BOOL bErrorFlag = FALSE;
+	if (!WriteFile(s, cmd, strlen(cmd), &Length, NULL) || Length != strlen(cmd)) return -1;
+	return 0;
+}
 
+/*
+ * Read the stage's reply to a command, up to and including the line feed.
+ * The MAC6000 answers ":A" when all is well.
+ * Reading the reply also keeps the virtual com port's buffer from filling up
+ * (see clearStageBuffer()).
+ * Returns the length of the reply, or -1 if none arrived within the port's timeouts.
+ */
+int StageReadReply(HANDLE s, char* reply, int maxLen){
+	int n=0;
+	DWORD nRead=0;
+	char c;
+	while (n < maxLen-1) {
+		/** With the timeouts set in InitializeSerialStage() this returns as soon as a byte arrives **/
+		if (!ReadFile(s, &c, 1, &nRead, NULL) || nRead==0) break;
+		if (c=='\n') break;
+		if (c!='\r') reply[n++]=c;
+	}
+	reply[n]='\0';
+	if (n==0 && nRead==0) return -1;
+	return n;
+}
 
-	char* buff=(char*) malloc(sizeof(char)*1024);
+/*
+ * Set the velocity of the stage
+ *
+ */
+int spinStage(HANDLE s, int xspeed,int yspeed){
+	char buff[64];
 	sprintf(buff,"SPIN X=%d Y=%d\r",xspeed,yspeed);
-	bErrorFlag=WriteFile(s, buff, strlen(buff), &Length, NULL);
-	free(buff);
-
-	if (FALSE == bErrorFlag)
+	if (StageSendCommand(s,buff)!=0)
     {
         printf("Failure: Unable to write to serial port.\n");
     }
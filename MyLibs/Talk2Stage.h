@@ -44,6 +44,25 @@
  */
 HANDLE InitializeUsbStage();
 
+/*
+ * Opens and configures a stage on a serial port, such as "COM3".
+ * Returns NULL on failure.
+ */
+HANDLE InitializeSerialStage(const char* port);
+
+/*
+ * Write a command, which must end in \r, to the stage's port.
+ * (emulateStage.exe also uses this to write replies.)
+ * Returns 0 on success, -1 on failure.
+ */
+int StageSendCommand(HANDLE s, const char* cmd);
+
+/*
+ * Read the stage's one line reply to a command, without the line ending.
+ * Returns the length of the reply, or -1 if none arrived before the port timed out.
+ */
+int StageReadReply(HANDLE s, char* reply, int maxLen);
+
 
 /*
  * Set the velocity of the stage
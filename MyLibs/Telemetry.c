@@ -0,0 +1,244 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * Telemetry.c
+ *
+ * Publishes live performance statistics into a named shared memory
+ * region so that an external process can monitor MindControl.
+ *
+ * See Telemetry.h for a description of the protocol.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+#include "AndysComputations.h"
+#include "Telemetry.h"
+
+static const char* TelemetryStageNames[TELEM_NUM_STAGES] = {
+		"OneLoop",
+		"GrabFrame",
+		"Segmentation",
+		"TransformCam2DLP",
+		"Illumination",
+		"SendFrameToDLP",
+		"PrepareDisplay",
+		"ComposeHUDS",
+		"WriteToDisk" };
+
+/*
+ * Create the telemetry object and the named shared memory region.
+ * If the shared memory can't be created, the object still works
+ * but nothing is published.
+ */
+Telemetry* CreateTelemetry(){
+	Telemetry* t = (Telemetry*) malloc(sizeof(Telemetry));
+	memset(t, 0, sizeof(Telemetry));
+
+	t->local.version = TELEMETRY_VERSION;
+	t->local.numStages = TELEM_NUM_STAGES;
+	int k;
+	for (k = 0; k < TELEM_NUM_STAGES; ++k) {
+		strncpy(t->local.stage[k].name, TelemetryStageNames[k], TELEMETRY_NAME_LENGTH - 1);
+	}
+	t->lastPublish = clock();
+
+	/** Create the shared memory region **/
+	t->hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+			sizeof(TelemetryBlock), TELEMETRY_SHARED_MEMORY_NAME);
+	if (t->hMapFile == NULL) {
+		printf("Telemetry: could not create shared memory (%d). Telemetry will not be published.\n", (int) GetLastError());
+		return t;
+	}
+
+	t->shared = (TelemetryBlock*) MapViewOfFile(t->hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TelemetryBlock));
+	if (t->shared == NULL) {
+		printf("Telemetry: could not map shared memory (%d). Telemetry will not be published.\n", (int) GetLastError());
+		CloseHandle(t->hMapFile);
+		t->hMapFile = NULL;
+		return t;
+	}
+	memcpy(t->shared, &(t->local), sizeof(TelemetryBlock));
+	return t;
+}
+
+/*
+ * Unmap the shared memory and free the telemetry object.
+ */
+void DestroyTelemetry(Telemetry** t){
+	if (t == NULL || *t == NULL) return;
+	if ((*t)->shared != NULL) UnmapViewOfFile((*t)->shared);
+	if ((*t)->hMapFile != NULL) CloseHandle((*t)->hMapFile);
+	free(*t);
+	*t = NULL;
+}
+
+/*
+ * Record how long a stage took, in microseconds.
+ * Negative values, such as tictoc's error codes, are ignored.
+ */
+void TelemetryAddSample(Telemetry* t, int stage, double microseconds){
+	if (t == NULL || stage < 0 || stage >= TELEM_NUM_STAGES || microseconds < 0) return;
+	long n = t->sampleHead[stage]++;
+	t->samples[stage][n % TELEMETRY_NUM_SAMPLES] = (float) (microseconds / 1000.0);
+}
+
+/*
+ * Record the current depth of a named queue or buffer.
+ * Queues are created the first time their name is seen.
+ */
+void TelemetrySetQueueDepth(Telemetry* t, const char* name, int depth){
+	if (t == NULL) return;
+	int k;
+	for (k = 0; k < t->local.numQueues; ++k) {
+		if (strncmp(t->local.queue[k].name, name, TELEMETRY_NAME_LENGTH - 1) == 0) break;
+	}
+	if (k == t->local.numQueues) {
+		/** New queue **/
+		if (k >= TELEMETRY_MAX_QUEUES) return;
+		strncpy(t->local.queue[k].name, name, TELEMETRY_NAME_LENGTH - 1);
+		t->local.numQueues++;
+	}
+	t->local.queue[k].depth = depth;
+	if (depth > t->local.queue[k].maxDepth) t->local.queue[k].maxDepth = depth;
+}
+
+/*
+ * Count frames that were produced by the camera but never processed.
+ */
+void TelemetryAddDroppedFrames(Telemetry* t, long numFrames){
+	if (t == NULL || numFrames <= 0) return;
+	t->local.droppedFrames += numFrames;
+}
+
+/*
+ * Count a frame in which the worm could not be segmented.
+ */
+void TelemetryAddSegmentationFailure(Telemetry* t){
+	if (t == NULL) return;
+	t->local.segmentationFailures++;
+}
+
+/*
+ * Publish to shared memory if more than half a second has passed since
+ * the last time. This is cheap to call every frame.
+ */
+void TelemetryPublish(Telemetry* t, long frameNum){
+	if (t == NULL) return;
+	clock_t now = clock();
+	if ((now - t->lastPublish) < CLOCKS_PER_SEC / 2) return;
+
+	/** Frame rate since the last publish **/
+	t->local.fps = (float) (frameNum - t->framesAtLastPublish) * CLOCKS_PER_SEC / (float) (now - t->lastPublish);
+	t->local.frameNum = frameNum;
+	t->framesAtLastPublish = frameNum;
+	t->lastPublish = now;
+
+	/** Latency percentiles **/
+	float sorted[TELEMETRY_NUM_SAMPLES];
+	int k;
+	for (k = 0; k < TELEM_NUM_STAGES; ++k) {
+		int n = (t->sampleHead[k] < TELEMETRY_NUM_SAMPLES) ? (int) t->sampleHead[k] : TELEMETRY_NUM_SAMPLES;
+		memcpy(sorted, t->samples[k], n * sizeof(float));
+		SortFloatArr(sorted, n);
+		TelemetryStage* s = &(t->local.stage[k]);
+		s->numSamples = n;
+		s->p50 = PercentileOfSortedFloatArr(sorted, n, 0.50);
+		s->p90 = PercentileOfSortedFloatArr(sorted, n, 0.90);
+		s->p99 = PercentileOfSortedFloatArr(sorted, n, 0.99);
+		s->max = (n > 0) ? sorted[n - 1] : 0;
+	}
+	t->local.publishCount++;
+
+	if (t->shared == NULL) return;
+
+	/** Copy into shared memory, bracketed by the sequence counter **/
+	t->local.sequence = InterlockedIncrement(&(t->shared->sequence)); // now odd
+	memcpy(t->shared, &(t->local), sizeof(TelemetryBlock)); // counter stays odd
+	MemoryBarrier();
+	InterlockedIncrement(&(t->shared->sequence)); // even again
+}
+
+
+/*
+ * Open an existing telemetry region for reading.
+ * Returns NULL if MindControl isn't running.
+ */
+TelemetryBlock* OpenTelemetryReader(HANDLE* hMapFile){
+	*hMapFile = OpenFileMapping(FILE_MAP_READ, FALSE, TELEMETRY_SHARED_MEMORY_NAME);
+	if (*hMapFile == NULL) return NULL;
+	TelemetryBlock* shared = (TelemetryBlock*) MapViewOfFile(*hMapFile, FILE_MAP_READ, 0, 0, sizeof(TelemetryBlock));
+	if (shared == NULL) {
+		CloseHandle(*hMapFile);
+		*hMapFile = NULL;
+	}
+	return shared;
+}
+
+/*
+ * Close a telemetry region opened with OpenTelemetryReader().
+ */
+void CloseTelemetryReader(TelemetryBlock* shared, HANDLE hMapFile){
+	if (shared != NULL) UnmapViewOfFile(shared);
+	if (hMapFile != NULL) CloseHandle(hMapFile);
+}
+
+/*
+ * Take a consistent snapshot of the shared block.
+ * Returns TELEMETRY_SUCCESS or TELEMETRY_ERROR if a consistent
+ * copy could not be obtained (e.g. the writer was busy every time).
+ */
+int ReadTelemetry(TelemetryBlock* shared, TelemetryBlock* out){
+	if (shared == NULL || out == NULL) return TELEMETRY_ERROR;
+	int attempt;
+	for (attempt = 0; attempt < 100; ++attempt) {
+		LONG before = shared->sequence;
+		MemoryBarrier();
+		if (before & 1) {
+			Sleep(0);
+			continue;
+		}
+		memcpy(out, (const void*) shared, sizeof(TelemetryBlock));
+		MemoryBarrier();
+		if (shared->sequence == before) {
+			if (out->version != TELEMETRY_VERSION) {
+				printf("Telemetry version mismatch: expected %d, found %d\n", TELEMETRY_VERSION, out->version);
+				return TELEMETRY_ERROR;
+			}
+			return TELEMETRY_SUCCESS;
+		}
+	}
+	return TELEMETRY_ERROR;
+}
@@ -0,0 +1,214 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * Telemetry.h
+ *
+ * Live performance telemetry for MindControl.
+ *
+ * Once or twice a second the main loop publishes a small block of statistics
+ * (frame rate, per-stage latency percentiles, queue depths, dropped frames and
+ * segmentation failures) into a named shared memory region. A separate
+ * monitoring process, such as viewTelemetry.exe, can then poll that region
+ * without ever blocking or slowing down the real-time loop.
+ *
+ * The block is published with a sequence counter: the writer makes the counter
+ * odd while it is copying and even when it is done. Readers copy the block
+ * and retry if the counter was odd or changed during the copy.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <windows.h>
+#include <time.h>
+
+#define TELEMETRY_SHARED_MEMORY_NAME "MindControlTelemetry"
+#define TELEMETRY_VERSION 2
+
+#define TELEMETRY_NAME_LENGTH 32
+#define TELEMETRY_NUM_SAMPLES 256 // latency samples kept per stage
+#define TELEMETRY_MAX_QUEUES 8
+
+#define TELEMETRY_ERROR -1
+#define TELEMETRY_SUCCESS 0
+
+/*
+ * The stages of the main loop for which we keep latency statistics.
+ */
+enum TelemetryStageIndex {
+	TELEM_LOOP = 0,
+	TELEM_GRAB,
+	TELEM_SEGMENT,
+	TELEM_TRANSFORM,
+	TELEM_ILLUMINATE,
+	TELEM_DLP,
+	TELEM_DISPLAY,
+	TELEM_HUDS,
+	TELEM_WRITE,
+	TELEM_NUM_STAGES
+};
+
+/*
+ * Latency percentiles for one stage, in milliseconds.
+ * Computed over the last TELEMETRY_NUM_SAMPLES calls.
+ */
+typedef struct TelemetryStageStruct{
+	char name[TELEMETRY_NAME_LENGTH];
+	int numSamples;
+	float p50;
+	float p90;
+	float p99;
+	float max;
+} TelemetryStage;
+
+typedef struct TelemetryQueueStruct{
+	char name[TELEMETRY_NAME_LENGTH];
+	int depth;
+	int maxDepth; // largest depth seen since the start of the experiment
+} TelemetryQueue;
+
+/*
+ * This is the block that lives in shared memory.
+ * Everything in here must be plain old data.
+ */
+typedef struct TelemetryBlockStruct{
+	int version;
+	volatile LONG sequence; //odd while the writer is updating the block
+
+	long frameNum;
+	float fps;
+	long droppedFrames;
+	long segmentationFailures;
+	long publishCount;
+
+	int numStages;
+	TelemetryStage stage[TELEM_NUM_STAGES];
+
+	int numQueues;
+	TelemetryQueue queue[TELEMETRY_MAX_QUEUES];
+} TelemetryBlock;
+
+
+/*
+ * Writer side object. Lives in the MindControl process.
+ */
+typedef struct TelemetryStruct{
+	HANDLE hMapFile;
+	TelemetryBlock* shared; //NULL if the shared memory could not be created
+
+	/** Local copy that is filled in and then published **/
+	TelemetryBlock local;
+
+	/** Ring buffers of recent latency samples (ms) for each stage **/
+	float samples[TELEM_NUM_STAGES][TELEMETRY_NUM_SAMPLES];
+	long sampleHead[TELEM_NUM_STAGES];
+
+	/** Publishing interval **/
+	clock_t lastPublish;
+	long framesAtLastPublish;
+} Telemetry;
+
+
+/*******************************************/
+/*
+ * Writer
+ */
+/*******************************************/
+
+/*
+ * Create the telemetry object and the named shared memory region.
+ * If the shared memory can't be created, the object still works
+ * but nothing is published.
+ */
+Telemetry* CreateTelemetry();
+
+/*
+ * Unmap the shared memory and free the telemetry object.
+ */
+void DestroyTelemetry(Telemetry** t);
+
+/*
+ * Record how long a stage took, in microseconds.
+ * (This is the unit returned by TICTOC::timer().toc() )
+ * Negative values, such as tictoc's error codes, are ignored.
+ */
+void TelemetryAddSample(Telemetry* t, int stage, double microseconds);
+
+/*
+ * Record the current depth of a named queue or buffer.
+ * Queues are created the first time their name is seen.
+ */
+void TelemetrySetQueueDepth(Telemetry* t, const char* name, int depth);
+
+/*
+ * Count frames that were produced by the camera but never processed.
+ */
+void TelemetryAddDroppedFrames(Telemetry* t, long numFrames);
+
+/*
+ * Count a frame in which the worm could not be segmented.
+ */
+void TelemetryAddSegmentationFailure(Telemetry* t);
+
+/*
+ * Publish to shared memory if more than half a second has passed since
+ * the last time. This is cheap to call every frame.
+ */
+void TelemetryPublish(Telemetry* t, long frameNum);
+
+
+/*******************************************/
+/*
+ * Reader
+ */
+/*******************************************/
+
+/*
+ * Open an existing telemetry region for reading.
+ * Returns NULL if MindControl isn't running.
+ * hMapFile is returned so that the caller can close it later.
+ */
+TelemetryBlock* OpenTelemetryReader(HANDLE* hMapFile);
+
+/*
+ * Close a telemetry region opened with OpenTelemetryReader().
+ */
+void CloseTelemetryReader(TelemetryBlock* shared, HANDLE hMapFile);
+
+/*
+ * Take a consistent snapshot of the shared block.
+ * Returns TELEMETRY_SUCCESS or TELEMETRY_ERROR if a consistent
+ * copy could not be obtained (e.g. the writer was busy every time).
+ */
+int ReadTelemetry(TelemetryBlock* shared, TelemetryBlock* out);
+
+#endif /* TELEMETRY_H_ */
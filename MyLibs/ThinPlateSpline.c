@@ -0,0 +1,285 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ThinPlateSpline.c
+ *
+ * Native lookup table generation. See ThinPlateSpline.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "ThinPlateSpline.h"
+
+/** The radial term, r^2 log r, from r^2 **/
+static double Radial(double r2){
+	return (r2 > 0) ? 0.5 * r2 * log(r2) : 0;
+}
+
+/*
+ * Solve a*sol=b for two right hand sides at once, by Gaussian elimination
+ * with partial pivoting. a is n by n, row major, and is destroyed.
+ * Returns -1 if a is singular.
+ */
+static int SolveLinear(double* a, double* bx, double* by, int n){
+	int i, j, k;
+	for (i = 0; i < n; i++) {
+		int pivot = i;
+		for (k = i + 1; k < n; k++)
+			if (fabs(a[k * n + i]) > fabs(a[pivot * n + i])) pivot = k;
+		if (fabs(a[pivot * n + i]) < 1e-12) return -1;
+		if (pivot != i) {
+			for (j = 0; j < n; j++) {
+				double t = a[i * n + j]; a[i * n + j] = a[pivot * n + j]; a[pivot * n + j] = t;
+			}
+			double t = bx[i]; bx[i] = bx[pivot]; bx[pivot] = t;
+			t = by[i]; by[i] = by[pivot]; by[pivot] = t;
+		}
+		for (k = i + 1; k < n; k++) {
+			double f = a[k * n + i] / a[i * n + i];
+			if (f == 0) continue;
+			for (j = i; j < n; j++) a[k * n + j] -= f * a[i * n + j];
+			bx[k] -= f * bx[i];
+			by[k] -= f * by[i];
+		}
+	}
+	for (i = n - 1; i >= 0; i--) {
+		for (j = i + 1; j < n; j++) {
+			bx[i] -= a[i * n + j] * bx[j];
+			by[i] -= a[i * n + j] * by[j];
+		}
+		bx[i] /= a[i * n + i];
+		by[i] /= a[i * n + i];
+	}
+	return 0;
+}
+
+ThinPlateSpline* FitThinPlateSpline(const double* ccdX, const double* ccdY,
+		const double* dlpX, const double* dlpY, int numPoints, double smoothing){
+	if (numPoints < 3) {
+		printf("Error: a thin-plate spline needs at least 3 pairs of points, not %d.\n", numPoints);
+		return NULL;
+	}
+	int n = numPoints;
+	int m = n + 3;
+	int i, j;
+
+	ThinPlateSpline* tps = (ThinPlateSpline*) malloc(sizeof(ThinPlateSpline));
+	tps->numPoints = n;
+	tps->x = (double*) malloc(n * sizeof(double));
+	tps->y = (double*) malloc(n * sizeof(double));
+	tps->wx = (double*) malloc(n * sizeof(double));
+	tps->wy = (double*) malloc(n * sizeof(double));
+
+	/** Scale the camera points so the radial terms are well conditioned against the affine part **/
+	double minX = ccdX[0], maxX = ccdX[0], minY = ccdY[0], maxY = ccdY[0];
+	for (i = 1; i < n; i++) {
+		if (ccdX[i] < minX) minX = ccdX[i];
+		if (ccdX[i] > maxX) maxX = ccdX[i];
+		if (ccdY[i] < minY) minY = ccdY[i];
+		if (ccdY[i] > maxY) maxY = ccdY[i];
+	}
+	tps->originX = (minX + maxX) / 2;
+	tps->originY = (minY + maxY) / 2;
+	tps->scale = (maxX - minX > maxY - minY) ? maxX - minX : maxY - minY;
+	if (tps->scale <= 0) tps->scale = 1;
+	for (i = 0; i < n; i++) {
+		tps->x[i] = (ccdX[i] - tps->originX) / tps->scale;
+		tps->y[i] = (ccdY[i] - tps->originY) / tps->scale;
+	}
+
+	/*
+	 * [ K + smoothing*I   P ] [ w ]   [ dlp ]
+	 * [ P^T               0 ] [ a ] = [  0  ]
+	 * where K holds the radial term between every two points and P = [1 x y].
+	 */
+	double* a = (double*) calloc(m * m, sizeof(double));
+	double* bx = (double*) calloc(m, sizeof(double));
+	double* by = (double*) calloc(m, sizeof(double));
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double dx = tps->x[i] - tps->x[j];
+			double dy = tps->y[i] - tps->y[j];
+			a[i * m + j] = Radial(dx * dx + dy * dy);
+		}
+		a[i * m + i] += smoothing;
+		a[i * m + n] = a[n * m + i] = 1;
+		a[i * m + n + 1] = a[(n + 1) * m + i] = tps->x[i];
+		a[i * m + n + 2] = a[(n + 2) * m + i] = tps->y[i];
+		bx[i] = dlpX[i];
+		by[i] = dlpY[i];
+	}
+	int ret = SolveLinear(a, bx, by, m);
+	free(a);
+	if (ret != 0) {
+		printf("Error: the calibrated points are all in a line, so no spline can be fitted through them.\n");
+		free(bx);
+		free(by);
+		DestroyThinPlateSpline(&tps);
+		return NULL;
+	}
+	memcpy(tps->wx, bx, n * sizeof(double));
+	memcpy(tps->wy, by, n * sizeof(double));
+	for (i = 0; i < 3; i++) {
+		tps->ax[i] = bx[n + i];
+		tps->ay[i] = by[n + i];
+	}
+	free(bx);
+	free(by);
+
+	double sumSq = 0;
+	for (i = 0; i < n; i++) {
+		double fx, fy;
+		EvalThinPlateSpline(tps, ccdX[i], ccdY[i], &fx, &fy);
+		sumSq += (fx - dlpX[i]) * (fx - dlpX[i]) + (fy - dlpY[i]) * (fy - dlpY[i]);
+	}
+	tps->rmsResidual = sqrt(sumSq / n);
+	return tps;
+}
+
+void DestroyThinPlateSpline(ThinPlateSpline** tps){
+	if (tps == NULL || *tps == NULL) return;
+	free((*tps)->x);
+	free((*tps)->y);
+	free((*tps)->wx);
+	free((*tps)->wy);
+	free(*tps);
+	*tps = NULL;
+}
+
+void EvalThinPlateSpline(const ThinPlateSpline* tps, double x, double y, double* dlpX, double* dlpY){
+	double u = (x - tps->originX) / tps->scale;
+	double v = (y - tps->originY) / tps->scale;
+	double fx = tps->ax[0] + tps->ax[1] * u + tps->ax[2] * v;
+	double fy = tps->ay[0] + tps->ay[1] * u + tps->ay[2] * v;
+	int i;
+	for (i = 0; i < tps->numPoints; i++) {
+		double dx = u - tps->x[i];
+		double dy = v - tps->y[i];
+		double r = Radial(dx * dx + dy * dy);
+		fx += tps->wx[i] * r;
+		fy += tps->wy[i] * r;
+	}
+	*dlpX = fx;
+	*dlpY = fy;
+}
+
+
+/************************
+ * Filling the lookup table
+ */
+
+typedef struct TPSTableJobStruct{
+	const ThinPlateSpline* tps;
+	int* lookUp;
+	int width;
+	int height;
+	volatile LONG nextColumn;
+} TPSTableJob;
+
+/*
+ * Claim columns of camera pixels until there are none left.
+ * The table is stored by column, so each thread writes its own
+ * contiguous stretch of the table and threads don't share cache lines.
+ */
+static DWORD WINAPI TPSTableThread(LPVOID lpParam){
+	TPSTableJob* job = (TPSTableJob*) lpParam;
+	int n = job->width * job->height;
+	LONG x;
+	while ((x = InterlockedIncrement(&(job->nextColumn)) - 1) < job->width) {
+		int* lookUpX = job->lookUp + x * job->height;
+		int* lookUpY = lookUpX + n;
+		int y;
+		for (y = 0; y < job->height; y++) {
+			double dlpX, dlpY;
+			EvalThinPlateSpline(job->tps, x, y, &dlpX, &dlpY);
+			lookUpX[y] = (int) floor(dlpX + 0.5);
+			lookUpY[y] = (int) floor(dlpY + 0.5);
+		}
+	}
+	return 0;
+}
+
+int ThinPlateSplineLookUpTable(const ThinPlateSpline* tps, int* CCD2DLPLookUp, int CCDsizex, int CCDsizey, int numThreads){
+	TPSTableJob job;
+	job.tps = tps;
+	job.lookUp = CCD2DLPLookUp;
+	job.width = CCDsizex;
+	job.height = CCDsizey;
+	job.nextColumn = 0;
+
+	if (numThreads < 1) {
+		SYSTEM_INFO sysinfo;
+		GetSystemInfo(&sysinfo);
+		numThreads = (int) sysinfo.dwNumberOfProcessors;
+	}
+	if (numThreads > TPS_MAX_THREADS) numThreads = TPS_MAX_THREADS;
+	if (numThreads < 1) numThreads = 1;
+
+	/** The calling thread fills columns too **/
+	HANDLE threads[TPS_MAX_THREADS];
+	int numStarted = 0;
+	while (numStarted < numThreads - 1) {
+		threads[numStarted] = CreateThread(NULL, 0, TPSTableThread, (LPVOID) &job, 0, NULL);
+		if (threads[numStarted] == NULL) {
+			printf("Warning: could only start %d lookup table threads.\n", numStarted);
+			break;
+		}
+		numStarted++;
+	}
+	TPSTableThread((LPVOID) &job);
+	if (numStarted > 0) WaitForMultipleObjects(numStarted, threads, TRUE, INFINITE);
+	int k;
+	for (k = 0; k < numStarted; k++) CloseHandle(threads[k]);
+	return numStarted + 1;
+}
+
+double LookUpTableRmsMiss(const int* CCD2DLPLookUp, int CCDsizex, int CCDsizey,
+		const double* ccdX, const double* ccdY, const double* dlpX, const double* dlpY, int numPoints){
+	int n = CCDsizex * CCDsizey;
+	double sumSq = 0;
+	int used = 0;
+	int k;
+	for (k = 0; k < numPoints; k++) {
+		int x = (int) floor(ccdX[k] + 0.5);
+		int y = (int) floor(ccdY[k] + 0.5);
+		if (x < 0 || x >= CCDsizex || y < 0 || y >= CCDsizey) continue;
+		double dx = CCD2DLPLookUp[x * CCDsizey + y] - dlpX[k];
+		double dy = CCD2DLPLookUp[n + x * CCDsizey + y] - dlpY[k];
+		sumSq += dx * dx + dy * dy;
+		used++;
+	}
+	return (used > 0) ? sqrt(sumSq / used) : -1;
+}
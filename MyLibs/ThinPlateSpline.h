@@ -0,0 +1,116 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ThinPlateSpline.h
+ *
+ * Builds the CCD2DLPLookUp table from calibrated pairs of points without
+ * MATLAB.
+ *
+ * A thin-plate spline maps camera pixels to DLP mirrors through every pair
+ * of points from the calibration: an affine part plus a radial term
+ * r^2 log r around each camera point. That makes it the smoothest mapping
+ * that does. Each point comes from a median of frames, so it is still a
+ * little noisy, so the spline is allowed to miss the points a little, as
+ * set by the smoothing, and bends less for it.
+ *
+ * The table has one entry per camera pixel and the spline is evaluated for
+ * every one, so the columns are shared out among threads.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef THINPLATESPLINE_H_
+#define THINPLATESPLINE_H_
+
+/*
+ * How much the spline may miss the points to bend less. It is the weight
+ * of the bending energy, with camera coordinates scaled so that the
+ * larger side of the image is 1.
+ */
+#define TPS_DEFAULT_SMOOTHING 0.03
+
+/** Most threads to fill the lookup table with **/
+#define TPS_MAX_THREADS 64
+
+typedef struct ThinPlateSplineStruct{
+	int numPoints;
+
+	/** Camera points, scaled **/
+	double* x;
+	double* y;
+	double originX;
+	double originY;
+	double scale;
+
+	/** Weight of each point's radial term, and the affine part, for DLP x and y **/
+	double* wx;
+	double* wy;
+	double ax[3];
+	double ay[3];
+
+	/** RMS by which the spline misses the points, in mirrors **/
+	double rmsResidual;
+} ThinPlateSpline;
+
+/*
+ * Fit a spline taking camera points (ccdX, ccdY) to DLP points (dlpX, dlpY).
+ * Returns NULL if there are fewer than 3 points or they are all in a line.
+ */
+ThinPlateSpline* FitThinPlateSpline(const double* ccdX, const double* ccdY,
+		const double* dlpX, const double* dlpY, int numPoints, double smoothing);
+
+void DestroyThinPlateSpline(ThinPlateSpline** tps);
+
+/*
+ * The DLP point for camera point (x,y)
+ */
+void EvalThinPlateSpline(const ThinPlateSpline* tps, double x, double y, double* dlpX, double* dlpY);
+
+/*
+ * Fill a CCD2DLPLookUp table of 2*CCDsizex*CCDsizey ints, in the layout
+ * TransformLib expects: DLP x of camera pixel (x,y) at x*CCDsizey+y and
+ * its DLP y CCDsizex*CCDsizey further on. Rounded to the nearest mirror.
+ *
+ * numThreads<1 means one per processor.
+ * Returns the number of threads that filled it.
+ */
+int ThinPlateSplineLookUpTable(const ThinPlateSpline* tps, int* CCD2DLPLookUp, int CCDsizex, int CCDsizey, int numThreads);
+
+/*
+ * RMS distance, in mirrors, from each DLP point to the entry of a
+ * CCD2DLPLookUp table (layout as above) at its camera point, so tables made
+ * in different ways can be judged against the calibration they came from.
+ * Camera points are rounded to the nearest pixel.
+ * Returns -1 if none of the camera points is in the table.
+ */
+double LookUpTableRmsMiss(const int* CCD2DLPLookUp, int CCDsizex, int CCDsizey,
+		const double* ccdX, const double* ccdY, const double* dlpX, const double* dlpY, int numPoints);
+
+#endif /* THINPLATESPLINE_H_ */
@@ -0,0 +1,199 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * TimedIllumination.c
+ *
+ * The timed illumination features, on the Sequencer's timeline.
+ * See TimedIllumination.h.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+
+#include <cxcore.h>
+#include <cv.h>
+
+#include "AndysOpenCVLib.h"
+#include "WormAnalysis.h"
+#include "TimedIllumination.h"
+
+/*
+ * Move the head-to-tail sweep cursor on one step.
+ * Returns 0 if that would push it off of the worm, 1 otherwise.
+ */
+static int StepIlluminationSweep(WormAnalysisParam* Params){
+	if (Params->IllumSweepHT==1){
+		/** Would the next segment push us off of the worm? **/
+		if (Params->IllumSquareOrig.y <  Params->NumSegments - Params->IllumSquareRad.height){
+			/** Nope we are safe within the worm: INCREMENT **/
+			Params->IllumSquareOrig.y=Params->IllumSquareOrig.y + 2*(Params->IllumSquareRad.height);
+			return 1;
+		}
+	} else {
+		/** We are going in the Opposite direction **/
+		if (Params->IllumSquareOrig.y >= Params->IllumSquareRad.height ) {
+			/** Nope we are safe within the worm: DECREMENT **/
+			Params->IllumSquareOrig.y=Params->IllumSquareOrig.y - 2* (Params->IllumSquareRad.height);
+			return 1;
+		}
+	}
+	/** We are about to walk off. **/
+	return 0;
+}
+
+int ApplyTimedEvent(Sequencer* s, WormAnalysisParam* Params, SequencerEvent* ev){
+	switch (ev->type){
+	case SEQ_EVENT_DLP:
+		Params->DLPOn=ev->value;
+		break;
+	case SEQ_EVENT_PROTOCOL_STEP:
+		Params->ProtocolStep=ev->value;
+		break;
+	case SEQ_EVENT_SWEEP_STEP:
+		if (StepIlluminationSweep(Params)){
+			/** Next step one duration after this one was due, so lateness doesn't add up **/
+			SequencerSchedule(s,ev->dueUs+SEQ_TENTH_US*Params->IllumDuration,SEQ_EVENT_SWEEP_STEP,0,SEQ_SOURCE_SWEEP);
+		}
+		break;
+	}
+
+	/** Has that feature run its course? **/
+	if (SequencerPending(s,ev->source) > 0) return -1;
+	switch (ev->source){
+	case SEQ_SOURCE_FLASH:
+		Params->DLPOnFlash=0;
+		printf("Illumination is finished.\n");
+		break;
+	case SEQ_SOURCE_SWEEP:
+		Params->DLPOn=0;/** Turn off DLP **/
+		Params->IllumSweepOn=0;
+		printf("Head to tail illumination sweep is finished.\n");
+		break;
+	case SEQ_SOURCE_SECONDARY:
+		Params->ProtocolSecondaryIsOn=0;
+		printf("Timed Secondary Protocol Step is finished.\n");
+		break;
+	}
+	return ev->source;
+}
+
+int SequenceIlluminationSweep(Sequencer* s, WormAnalysisParam* Params){
+	int sweeping= (SequencerPending(s,SEQ_SOURCE_SWEEP) > 0);
+
+	// Case 1: We are not doing a head-tail sweep
+	if ((Params->IllumSweepOn == 0) && !sweeping){
+		return 0;
+	}
+
+	// Case 2:We are initiating a head-tail sweep
+	if ((Params->IllumSweepOn == 1) && !sweeping){
+		/** Set the cursor to the head (tail) **/
+		if (Params->IllumSweepHT==1){
+			Params->IllumSquareOrig.y=0;
+		}else{
+			Params->IllumSquareOrig.y=Params->NumSegments-1;
+		}
+
+		/** Turn the DLP on now and move the cursor on every IllumDuration **/
+		SequencerSchedule(s,s->nowUs,SEQ_EVENT_DLP,1,SEQ_SOURCE_SWEEP);
+		SequencerSchedule(s,s->nowUs+SEQ_TENTH_US*Params->IllumDuration,SEQ_EVENT_SWEEP_STEP,0,SEQ_SOURCE_SWEEP);
+
+		printf("Initiating head to tail illumination sweep\n");
+		return 1;
+	}
+
+	/** Case 3: user prematurely aborts head to tail illumination sweep **/
+	if ((Params->IllumSweepOn == 0) && sweeping) {
+		SequencerCancel(s,SEQ_SOURCE_SWEEP);
+
+		/** Turn off DLP **/
+		Params->DLPOn=0;
+		return 0;
+	}
+
+	/** Case 4: We are in the midst of a head-to-tail illumination sweep **/
+	return 1;
+}
+
+int SequenceIlluminationTiming(Sequencer* s, WormAnalysisParam* Params){
+	int flashing= (SequencerPending(s,SEQ_SOURCE_FLASH) > 0);
+
+	/** Case 1: Nothing to do, or the user turned DLPOnFlash off early **/
+	if (!Params->DLPOnFlash) {
+		if (flashing) SequencerCancel(s,SEQ_SOURCE_FLASH);
+		return 0;
+	}
+
+	/** Case 2: First time DLPOnFlash  is turned on: on now, off after IllumDuration **/
+	if (!flashing) {
+		SequencerSchedule(s,s->nowUs,SEQ_EVENT_DLP,1,SEQ_SOURCE_FLASH);
+		SequencerSchedule(s,s->nowUs+SEQ_TENTH_US*Params->IllumDuration,SEQ_EVENT_DLP,0,SEQ_SOURCE_FLASH);
+		printf("Turning on DLP transiently for %d tenths of seconds ...\n",Params->IllumDuration);
+		return 1;
+	}
+
+	/** Case 3: DLPOnFlash has been on. We should continue to illuminate **/
+	Params->DLPOn = 1;
+	return 1;
+}
+
+int SequenceTimedSecondaryProtocolStep(Sequencer* s, WormAnalysisParam* Params){
+	int active= (SequencerPending(s,SEQ_SOURCE_SECONDARY) > 0);
+
+	/** Case 1: Nothing to do **/
+	if (!Params->ProtocolSecondaryIsOn) {
+		/** Switched off early: go back to the primary protocol step now **/
+		if (active) {
+			SequencerCancel(s,SEQ_SOURCE_SECONDARY);
+			Params->ProtocolStep = Params->ProtocolPrimaryStep;
+		}
+
+		/** Just for neatness the primary step should be set to zero **/
+		Params->ProtocolPrimaryStep=0;
+		return 0;
+	}
+
+	/** Case 2: First time the Secondary Protocol Step  is turned on**/
+	if (!active) {
+		/** Set the Primary Protocol Step to the currently selected Protocol **/
+		Params->ProtocolPrimaryStep=Params->ProtocolStep;
+
+		/** Secondary step now, back to the primary step after ProtocolSecondaryDuration **/
+		SequencerSchedule(s,s->nowUs,SEQ_EVENT_PROTOCOL_STEP,Params->ProtocolSecondaryStep,SEQ_SOURCE_SECONDARY);
+		SequencerSchedule(s,s->nowUs+SEQ_TENTH_US*Params->ProtocolSecondaryDuration,SEQ_EVENT_PROTOCOL_STEP,
+				Params->ProtocolPrimaryStep,SEQ_SOURCE_SECONDARY);
+		printf("Turning on the Secondary Protocol Step transiently for %d tenths of seconds ...\n",Params->ProtocolSecondaryDuration);
+		return 1;
+	}
+
+	/** Case 3: Secondary Protocol Step has already been on **/
+	return 1;
+}
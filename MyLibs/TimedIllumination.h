@@ -0,0 +1,89 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * TimedIllumination.h
+ *
+ * The features that switch illumination at set times, run on the
+ * Sequencer's timeline:
+ *   the timed DLP flash, DLPOnFlash, on for IllumDuration
+ *   the head-to-tail illumination sweep, IllumSweepOn, moving its cursor on
+ *     every IllumDuration until it has crossed the worm
+ *   the timed secondary protocol step, ProtocolSecondaryIsOn, for
+ *     ProtocolSecondaryDuration
+ *
+ * They read and change nothing but the WormAnalysisParam and the Sequencer,
+ * so they run the same on a sequencer with a fake clock as in an experiment.
+ *
+ * Each frame, after the sequencer's clock is sampled, call the three
+ * Sequence*() functions to start or cancel whatever the user has switched on
+ * or off, then hand every event that has come due to ApplyTimedEvent().
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef TIMEDILLUMINATION_H_
+#define TIMEDILLUMINATION_H_
+
+#ifndef WORMANALYSIS_H_
+ #error "#include WormAnalysis.h" must appear in source files before "#include TimedIllumination.h"
+#endif
+
+#include "Sequencer.h"
+
+/*
+ * Start the timed DLP flash when DLPOnFlash is switched on, or cancel it
+ * if it is switched off early.
+ * Returns 1 while the flash is on, 0 otherwise.
+ */
+int SequenceIlluminationTiming(Sequencer* s, WormAnalysisParam* Params);
+
+/*
+ * Start the head-to-tail illumination sweep when IllumSweepOn is switched
+ * on, or cancel it if it is switched off early.
+ * Returns 1 while the sweep is running, 0 otherwise.
+ */
+int SequenceIlluminationSweep(Sequencer* s, WormAnalysisParam* Params);
+
+/*
+ * Start the timed secondary protocol step when ProtocolSecondaryIsOn is
+ * switched on, or go back to the primary step if it is switched off early.
+ * Returns 1 while the secondary step is on, 0 otherwise.
+ */
+int SequenceTimedSecondaryProtocolStep(Sequencer* s, WormAnalysisParam* Params);
+
+/*
+ * Carry out an event from the sequencer's timeline.
+ *
+ * Returns the SEQ_SOURCE_* of the feature if this event was its last,
+ * -1 otherwise.
+ */
+int ApplyTimedEvent(Sequencer* s, WormAnalysisParam* Params, SequencerEvent* ev);
+
+#endif /* TIMEDILLUMINATION_H_ */
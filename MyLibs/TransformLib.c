@@ -33,7 +33,10 @@
 //#include <cv.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <windows.h>
 
 #include "AndysOpenCVLib.h"
 #include "WormAnalysis.h"
@@ -50,61 +53,259 @@
 
 
 /*
- * Create and allocate memory for the CalibData structure
- *
- * Currently SizeOfCCD is stored but not really used
+ * Create the CalibData structure for a DLP and camera of the given sizes.
+ * The lookup table comes from LoadCalibFromFile().
  *
  */
 CalibData* CreateCalibData( CvSize SizeOfDLP, CvSize SizeOfCCD){
 
 	printf("Inside CreateCalibData()\nSizeOfDLP.height =%d,SizeOfDLP.width=%d\n",SizeOfDLP.height ,SizeOfDLP.width);
 	CalibData* Calib=(CalibData*) malloc(sizeof(CalibData));
-	Calib->CCD2DLPLookUp = (int *) malloc(2 * SizeOfDLP.height * SizeOfDLP.width* sizeof(int));
+	Calib->CCD2DLPLookUp = NULL;
 	Calib->SizeOfCCD=SizeOfCCD;
 	Calib->SizeOfDLP=SizeOfDLP;
+	Calib->ValidRegion=cvRect(0,0,0,0);
+	Calib->file=INVALID_HANDLE_VALUE;
+	Calib->mapping=NULL;
+	Calib->view=NULL;
+	Calib->converted=NULL;
 	return Calib;
 }
 
 /*
- * Deallocate memory for CalibData object
+ * Unmap or free whatever lookup table Calib has
+ */
+static void ReleaseCalibTable(CalibData* Calib){
+	if (Calib->view!=NULL) UnmapViewOfFile(Calib->view);
+	if (Calib->mapping!=NULL) CloseHandle(Calib->mapping);
+	if (Calib->file!=INVALID_HANDLE_VALUE) CloseHandle(Calib->file);
+	free(Calib->converted);
+	Calib->view=NULL;
+	Calib->mapping=NULL;
+	Calib->file=INVALID_HANDLE_VALUE;
+	Calib->converted=NULL;
+	Calib->CCD2DLPLookUp=NULL;
+}
+
+/*
+ * Deallocate memory for CalibData object, and unmap its calibration file
  */
 void DestroyCalibData(CalibData* Calib){
-	free(Calib->CCD2DLPLookUp);
+	ReleaseCalibTable(Calib);
 	free(Calib);
 
 }
 
 
+/** FNV-1a over the bytes of the table **/
+static unsigned int CalibChecksum(const void* data, long bytes){
+	const unsigned char* p=(const unsigned char*) data;
+	unsigned int h=2166136261u;
+	long i;
+	for (i = 0; i < bytes; ++i) {
+		h^=p[i];
+		h*=16777619u;
+	}
+	return h;
+}
 
+/*
+ * The smallest rectangle of camera pixels holding every one that lands on
+ * the DLP, and how many entries are CALIB_OUT_OF_RANGE.
+ */
+static CvRect FindCalibValidRegion(const short* lut, CvSize ccd, CvSize dlp, int* numOutOfRange){
+	int n=ccd.width*ccd.height;
+	int minX=ccd.width, minY=ccd.height, maxX=-1, maxY=-1;
+	int x,y;
+	*numOutOfRange=0;
+	for (x = 0; x < ccd.width; ++x) {
+		const short* lx=lut+x*ccd.height;
+		const short* ly=lx+n;
+		for (y = 0; y < ccd.height; ++y) {
+			if (lx[y]==CALIB_OUT_OF_RANGE || ly[y]==CALIB_OUT_OF_RANGE) {
+				(*numOutOfRange)++;
+				continue;
+			}
+			if (lx[y]<0 || ly[y]<0 || lx[y]>=dlp.width || ly[y]>=dlp.height) continue;
+			if (x<minX) minX=x;
+			if (x>maxX) maxX=x;
+			if (y<minY) minY=y;
+			if (y>maxY) maxY=y;
+		}
+	}
+	if (maxX<0) return cvRect(0,0,0,0);
+	return cvRect(minX,minY,maxX-minX+1,maxY-minY+1);
+}
+
+/*
+ * Check the header and table of a mapped calibration file against the
+ * sizes Calib expects. Returns 0 if it is good, -1 otherwise.
+ */
+static int CheckCalibFile(CalibData* Calib, const CalibFileHeader* h, DWORD size){
+	if (h->version<1 || h->version>CALIB_FILE_VERSION){
+		printf("ERROR! Calibration file is version %d, but I only read up to version %d.\n",h->version,CALIB_FILE_VERSION);
+		return -1;
+	}
+	if (h->headerSize<(int) sizeof(CalibFileHeader) || (DWORD) h->fileSize!=size){
+		printf("ERROR! Calibration file is truncated or has a bad header.\n");
+		return -1;
+	}
+	if (h->CCDwidth!=Calib->SizeOfCCD.width || h->CCDheight!=Calib->SizeOfCCD.height
+			|| h->DLPwidth!=Calib->SizeOfDLP.width || h->DLPheight!=Calib->SizeOfDLP.height){
+		printf("ERROR! Calibration file is for a %dx%d camera and a %dx%d DLP, but this is a %dx%d camera and a %dx%d DLP.\n",
+				h->CCDwidth,h->CCDheight,h->DLPwidth,h->DLPheight,
+				Calib->SizeOfCCD.width,Calib->SizeOfCCD.height,Calib->SizeOfDLP.width,Calib->SizeOfDLP.height);
+		return -1;
+	}
+	long tableBytes=2L*h->CCDwidth*h->CCDheight*sizeof(short);
+	if (h->tableOffset<h->headerSize || h->tableOffset%sizeof(short)!=0 || (long long) h->tableOffset+tableBytes>(long long) size){
+		printf("ERROR! Calibration file's table runs off the end of the file.\n");
+		return -1;
+	}
+	const short* lut=(const short*) ((const char*) h+h->tableOffset);
+	if (CalibChecksum(lut,tableBytes)!=h->checksum){
+		printf("ERROR! Calibration file is corrupt: its checksum does not match.\n");
+		return -1;
+	}
+	int numOutOfRange;
+	CvRect valid=FindCalibValidRegion(lut,Calib->SizeOfCCD,Calib->SizeOfDLP,&numOutOfRange);
+	if (valid.x!=h->validX || valid.y!=h->validY || valid.width!=h->validWidth || valid.height!=h->validHeight
+			|| numOutOfRange!=h->numOutOfRange){
+		printf("ERROR! Calibration file's valid region does not match its table.\n");
+		return -1;
+	}
+	Calib->CCD2DLPLookUp=lut;
+	Calib->ValidRegion=valid;
+	return 0;
+}
 
+/*
+ * An old calibration file: 2*width*height ints of the DLP's size and no
+ * header. Convert it into memory of our own.
+ */
+static int ConvertOldCalibFile(CalibData* Calib, const int* old){
+	int n=Calib->SizeOfCCD.width*Calib->SizeOfCCD.height;
+	Calib->converted=(short*) malloc(2*n*sizeof(short));
+	int i;
+	for (i = 0; i < 2*n; ++i) {
+		Calib->converted[i]=(old[i]>CALIB_OUT_OF_RANGE && old[i]<=32767) ? (short) old[i] : CALIB_OUT_OF_RANGE;
+	}
+	int numOutOfRange;
+	Calib->ValidRegion=FindCalibValidRegion(Calib->converted,Calib->SizeOfCCD,Calib->SizeOfDLP,&numOutOfRange);
+	Calib->CCD2DLPLookUp=Calib->converted;
+	printf("This is an old calibration file with no header, so it could not be checked.\n");
+	if (numOutOfRange>0) printf("%d of its entries are out of range and will be ignored.\n",numOutOfRange);
+	return 0;
+}
 
 /*
  * Read In Calibration Frome File
  *
  * Returns 1 if open failed.
- * Returns -1 if open succesfully but read fails.
+ * Returns -1 if open succesfully but the file can't be used.
  */
 
-int LoadCalibFromFile(CalibData* Calib, char * filename){
-	FILE *fp;
-	int result;
-	int FLAG=0;
-	/*************** Read Calibration from File ****************/
+int LoadCalibFromFile(CalibData* Calib, const char * filename){
+	ReleaseCalibTable(Calib);
+	if (Calib->SizeOfCCD.width!=Calib->SizeOfDLP.width || Calib->SizeOfCCD.height!=Calib->SizeOfDLP.height) {
+		printf("ERROR: Currently CCD must be the same size as the DLP.\n This functionality has yet to be coded up.\n");
+		return -1;
+	}
 
-	if ((fp = fopen(filename, "rb")) == NULL) {
+	/*************** Map Calibration File ****************/
+	Calib->file=CreateFile(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,NULL);
+	if (Calib->file==INVALID_HANDLE_VALUE) {
 		printf("Cannot open file.\n");
-		FLAG=1;
+		return 1;
+	}
+	DWORD size=GetFileSize(Calib->file,NULL);
+	if (size!=INVALID_FILE_SIZE && size>=sizeof(CalibFileHeader)){
+		Calib->mapping=CreateFileMapping(Calib->file,NULL,PAGE_READONLY,0,0,NULL);
+		if (Calib->mapping!=NULL) Calib->view=MapViewOfFile(Calib->mapping,FILE_MAP_READ,0,0,0);
 	}
-	result = 0;
-	if (FLAG==0) result = fread(Calib->CCD2DLPLookUp, sizeof(int) * 2 * Calib->SizeOfDLP.height * Calib->SizeOfDLP.width , 1, fp);
-	if (result != 1) {
-		printf("Read error!\n");
-	} else{
-		printf("Read was successful.\n");
+	if (Calib->view==NULL) {
+		printf("Read error! %s is too short to be a calibration file.\n",filename);
+		ReleaseCalibTable(Calib);
+		return -1;
+	}
+
+	int ret;
+	const CalibFileHeader* h=(const CalibFileHeader*) Calib->view;
+	long oldSize=2L*Calib->SizeOfCCD.width*Calib->SizeOfCCD.height*sizeof(int);
+	if (memcmp(h->magic,CALIB_FILE_MAGIC,8)==0) {
+		ret=CheckCalibFile(Calib,h,size);
+	} else if ((long) size==oldSize) {
+		ret=ConvertOldCalibFile(Calib,(const int*) Calib->view);
+		/** The converted copy is all we need, so let go of the file **/
+		UnmapViewOfFile(Calib->view);
+		CloseHandle(Calib->mapping);
+		CloseHandle(Calib->file);
+		Calib->view=NULL;
+		Calib->mapping=NULL;
+		Calib->file=INVALID_HANDLE_VALUE;
+	} else {
+		printf("Read error! %s is %lu bytes. It is not a calibration file, or not for a %dx%d camera.\n",
+				filename,(unsigned long) size,Calib->SizeOfCCD.width,Calib->SizeOfCCD.height);
+		ret=-1;
 	}
-	if (FLAG==0) fclose(fp);
-	if (result ==0) FLAG=-1;
-	return FLAG;
+	if (ret!=0) {
+		ReleaseCalibTable(Calib);
+		return -1;
+	}
+	printf("Read was successful. Camera pixels (%d,%d) to (%d,%d) land on the DLP.\n",
+			Calib->ValidRegion.x,Calib->ValidRegion.y,
+			Calib->ValidRegion.x+Calib->ValidRegion.width-1,Calib->ValidRegion.y+Calib->ValidRegion.height-1);
+	return 0;
+}
+
+/*
+ * Write a lookup table of ints as a calibration file.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int WriteCalibToFile(const int* CCD2DLPLookUp, CvSize SizeOfCCD, CvSize SizeOfDLP, const char* filename){
+	int n=SizeOfCCD.width*SizeOfCCD.height;
+	short* lut=(short*) malloc(2*n*sizeof(short));
+	int i;
+	for (i = 0; i < 2*n; ++i) {
+		lut[i]=(CCD2DLPLookUp[i]>CALIB_OUT_OF_RANGE && CCD2DLPLookUp[i]<=32767) ? (short) CCD2DLPLookUp[i] : CALIB_OUT_OF_RANGE;
+	}
+
+	CalibFileHeader h;
+	memset(&h,0,sizeof(CalibFileHeader));
+	memcpy(h.magic,CALIB_FILE_MAGIC,8);
+	h.version=CALIB_FILE_VERSION;
+	h.headerSize=sizeof(CalibFileHeader);
+	h.CCDwidth=SizeOfCCD.width;
+	h.CCDheight=SizeOfCCD.height;
+	h.DLPwidth=SizeOfDLP.width;
+	h.DLPheight=SizeOfDLP.height;
+	CvRect valid=FindCalibValidRegion(lut,SizeOfCCD,SizeOfDLP,&(h.numOutOfRange));
+	h.validX=valid.x;
+	h.validY=valid.y;
+	h.validWidth=valid.width;
+	h.validHeight=valid.height;
+	h.tableOffset=sizeof(CalibFileHeader);
+	h.checksum=CalibChecksum(lut,2L*n*sizeof(short));
+	h.fileSize=h.tableOffset+2*n*sizeof(short);
+
+	/** Open File **/
+	FILE *fp;
+	if ((fp = fopen(filename, "wb")) == NULL) {
+		printf("ERROR: Cannot open file to write calibration\n");
+		free(lut);
+		return -1;
+	}
+	int err=(fwrite(&h,sizeof(CalibFileHeader),1,fp)!=1 || fwrite(lut,2*n*sizeof(short),1,fp)!=1);
+	if (fclose(fp)!=0) err=1;
+	free(lut);
+	if (err) {
+		printf("Write error!\n");
+		return -1;
+	}
+	printf("Write was successful. %d entries were out of range.\n",h.numOutOfRange);
+	return 0;
 }
 
 
@@ -148,7 +349,7 @@ int TransformFrameCam2DLP(Frame* Cam, Frame* DLP, CalibData* Calib) {
  *
  *
  */
-int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,
+int ConvertCharArrayImageFromCam2DLP(const short *CCD2DLPLookUp,
 		unsigned char* fromCCD, unsigned char* forDLP, int nsizex, int nsizey,
 		int ccdsizex, int ccdsizey, int DEBUG_FLAG) {
 	if (nsizex != ccdsizex || nsizey != ccdsizey) {
@@ -159,47 +360,25 @@ int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,
 		printf("ERROR! CCD2DLPLookUp==NULL!\n");
 		return -1;
 	}
-	unsigned int tempx = 0;
-	unsigned int tempy = 0;
-	int XOUT = 0;
-	int YOUT = 1;
-	unsigned int newptx;
-	unsigned int newpty;
-	while (tempx < nsizex) {
-		//printf("#");
-		tempy = 0;
-		while (tempy < nsizey) {
+	int tempx;
+	int tempy;
+	int newptx;
+	int newpty;
+	// I= z*Nx*Ny+x*Ny+y
+	const short* lookUpX = CCD2DLPLookUp;
+	const short* lookUpY = CCD2DLPLookUp + nsizey * nsizex;
+	for (tempx = 0; tempx < nsizex; tempx++) {
+		for (tempy = 0; tempy < nsizey; tempy++) {
 			//Actually Perform the LookUp and convert (tempx, tempy) in CCD coordinates to (newptx,newpty) in DLP coordinates
-			// I= z*Nx*Ny+x*Ny+y
-			if (XOUT * nsizey * nsizex + tempx * nsizey + tempy >= nsizex
-					* nsizey * 2) {
-				printf(" In accessing lookup table, we are out of bounds!!\n");
-			}
-			if (YOUT * nsizey * nsizex + tempx * nsizey + tempy >= nsizex
-					* nsizey * 2) {
-				printf(" In accessing lookup table, we are out of bounds!!\n");
-			}
-			newptx = CCD2DLPLookUp[XOUT * nsizey * nsizex + tempx * nsizey
-					+ tempy];
-			newpty = CCD2DLPLookUp[YOUT * nsizey * nsizex + tempx * nsizey
-					+ tempy];
-			if (newptx < 0 || newpty < 0 || newptx >= nsizex || newpty
-					>= nsizey) {
-				// Don't do anything because the pint is invalid
-			} else { //If the new point is reasonable, go ahead and do the conversion
-				//triple check that we're not actually accesssing an element outside of our array
-				if (tempx * nsizey + newpty >= nsizex * nsizey || newpty
-						* nsizex + newptx >= nsizex * nsizey) {
-					printf(
-							"In Accessing fromCCD or forDLP, we are out of bounds!!\n");
-				}
+			newptx = lookUpX[tempx * nsizey + tempy];
+			newpty = lookUpY[tempx * nsizey + tempy];
+			/** Points off the DLP, including CALIB_OUT_OF_RANGE, are invalid **/
+			if ((unsigned int) newptx < (unsigned int) nsizex && (unsigned int) newpty < (unsigned int) nsizey) {
 				//actually copy the value of the pixel at the two points
 				forDLP[newpty * nsizex + newptx] = fromCCD[tempy * nsizex
 						+ tempx];
 			}
-			tempy++;
 		}
-		tempx++;
 	}
 	return 0;
 }
@@ -222,21 +401,9 @@ int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,
 int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib) {
 
 
-	int nsizex= Calib->SizeOfDLP.width;
-	int nsizey=Calib->SizeOfDLP.height;
 	int ccdsizex=Calib->SizeOfCCD.width;
 	int ccdsizey=Calib->SizeOfCCD.height;
 
-	if (nsizex != ccdsizex || nsizey != ccdsizey) {
-		printf(
-				"ERROR: Ignoring values of ccdsizex & ccdsizey. \nCurrently CCD must be the same size as the DLP.\n This functionality has yet to be coded up.");
-	}
-	if (Calib->CCD2DLPLookUp == NULL) {
-		printf("ERROR! CCD2DLPLookUp==NULL!\n");
-		return -1;
-	}
-//	int* CCD2DLPLookUp=Calib->CCD2DLPLookUp;
-
 	const int XOUT = 0;
 	const int YOUT = 1;
 	
@@ -250,20 +417,18 @@ int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib) {
 	/* DLP.x = CCD2DLPLookup[camPt.x*nsizey+camPt.y]
 	/* DLP.y = CCD2DLPLookup[nsizey * nsizex +  camPt.x*nsizey+camPt.y]  */
 	
-	
-	if (XOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y >= nsizex* nsizey * 2) {
-		printf(" In accessing lookup table, we are out of bounds!!\n");
-		return 0;
-	}
-
-	if (YOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y >= nsizex* nsizey * 2) {
-		printf(" In accessing lookup table, we are out of bounds!!\n");
+#ifndef TRANSFORM_NO_BOUNDS_CHECK
+	if ((unsigned int) camPt.x >= (unsigned int) ccdsizex || (unsigned int) camPt.y >= (unsigned int) ccdsizey) {
+		DLPpt->x = CALIB_OUT_OF_RANGE;
+		DLPpt->y = CALIB_OUT_OF_RANGE;
 		return 0;
 	}
+#endif
 
 	/** Actually convert the camPt to the DLPpt **/
-	DLPpt->x = Calib->CCD2DLPLookUp[XOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y];
-	DLPpt->y = Calib->CCD2DLPLookUp[YOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y];
+	DLPpt->x = Calib->CCD2DLPLookUp[XOUT * ccdsizey * ccdsizex + camPt.x * ccdsizey + camPt.y];
+	DLPpt->y = Calib->CCD2DLPLookUp[YOUT * ccdsizey * ccdsizex + camPt.x * ccdsizey + camPt.y];
+	if (DLPpt->x == CALIB_OUT_OF_RANGE || DLPpt->y == CALIB_OUT_OF_RANGE) return 0;
 
 
 
@@ -293,9 +458,29 @@ int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib) {
 
 
 
+/*
+ * cvtPtCam2DLP(), but a camera point off the edge of the camera is first
+ * moved onto the nearest pixel of the camera.
+ * Returns 0 if there is still no DLP point for it.
+ */
+static int cvtPtCam2DLPClamped(CvPoint camPt, CvPoint* DLPpt, CalibData* Calib){
+	if (camPt.x < 0) camPt.x = 0;
+	if (camPt.x >= Calib->SizeOfCCD.width) camPt.x = Calib->SizeOfCCD.width - 1;
+	if (camPt.y < 0) camPt.y = 0;
+	if (camPt.y >= Calib->SizeOfCCD.height) camPt.y = Calib->SizeOfCCD.height - 1;
+	return cvtPtCam2DLP(camPt, DLPpt, Calib);
+}
+
 /*
  * Transform's a sequence from Cameraspace to DLP space
  * This is an internal function only.
+ *
+ * Every point is kept, so that the points stay matched up with the
+ * segments. A point with no DLP point, even after moving it onto the
+ * camera, takes the DLP point of its nearest neighbour before it in the
+ * sequence, or after it if it is at the start.
+ *
+ * Returns 1, or 0 if no point at all had a DLP point.
  */
 int TransformSeqCam2DLP(CvSeq* camSeq, CvSeq* DLPseq, CalibData* Calib){
 	if (camSeq==NULL || DLPseq==NULL) {
@@ -317,6 +502,9 @@ int TransformSeqCam2DLP(CvSeq* camSeq, CvSeq* DLPseq, CalibData* Calib){
 	CvPoint DLPpt;
 	CvPoint camPt;
 	CvPoint* camPtptr;
+	CvPoint lastGood=cvPoint(CALIB_OUT_OF_RANGE,CALIB_OUT_OF_RANGE);
+	int numLeadingMissing=0;
+	int found=0;
 	int numpts=camSeq->total;
 	int j;
 	for (j = 0; j < numpts; ++j) {
@@ -325,7 +513,13 @@ int TransformSeqCam2DLP(CvSeq* camSeq, CvSeq* DLPseq, CalibData* Calib){
 		camPt=*camPtptr;
 
 		/** Actually do the conversion **/
-		cvtPtCam2DLP(camPt,&DLPpt,Calib);
+		if (cvtPtCam2DLPClamped(camPt,&DLPpt,Calib)) {
+			lastGood=DLPpt;
+			found=1;
+		} else {
+			DLPpt=lastGood;
+			if (!found) numLeadingMissing++;
+		}
 
 
 		CV_WRITE_SEQ_ELEM( DLPpt, writer);
@@ -333,7 +527,13 @@ int TransformSeqCam2DLP(CvSeq* camSeq, CvSeq* DLPseq, CalibData* Calib){
 
 	}
 	cvEndWriteSeq(&writer);
-	return 1;
+
+	/** Points missing at the start take the first DLP point found **/
+	if (numLeadingMissing>0 && found) {
+		CvPoint firstGood=*((CvPoint*) cvGetSeqElem(DLPseq,numLeadingMissing));
+		for (j = 0; j < numLeadingMissing; ++j) *((CvPoint*) cvGetSeqElem(DLPseq,j))=firstGood;
+	}
+	return (found || numpts==0) ? 1 : 0;
 }
 
 /*
@@ -348,17 +548,19 @@ int TransformSegWormCam2DLP(SegmentedWorm* camWorm, SegmentedWorm* dlpWorm,Calib
 
 	/** Transform points on centerline, right and left bounds**/
 	ClearSegmentedInfo(dlpWorm);
-	TransformSeqCam2DLP(camWorm->Centerline, dlpWorm->Centerline, Calib);
+	int onDLP=TransformSeqCam2DLP(camWorm->Centerline, dlpWorm->Centerline, Calib);
 	TransformSeqCam2DLP(camWorm->RightBound, dlpWorm->RightBound, Calib);
 	TransformSeqCam2DLP(camWorm->LeftBound, dlpWorm->LeftBound, Calib);
 
 
-	/** Transform points on Head and Tail **/
-	cvtPtCam2DLP(*(camWorm->Head),dlpWorm->Head,Calib);
-	cvtPtCam2DLP(*(camWorm->Tail),dlpWorm->Tail,Calib);
+	/** Transform points on Head and Tail, falling back on the ends of the centerline **/
+	if (!cvtPtCam2DLPClamped(*(camWorm->Head),dlpWorm->Head,Calib) && dlpWorm->Centerline->total>0)
+		*(dlpWorm->Head)=*((CvPoint*) cvGetSeqElem(dlpWorm->Centerline,0));
+	if (!cvtPtCam2DLPClamped(*(camWorm->Tail),dlpWorm->Tail,Calib) && dlpWorm->Centerline->total>0)
+		*(dlpWorm->Tail)=*((CvPoint*) cvGetSeqElem(dlpWorm->Centerline,-1));
 
 	dlpWorm->NumSegments=camWorm->NumSegments;
 
-	return 1;
+	return (onDLP==1) ? 1 : 0;
 }
 
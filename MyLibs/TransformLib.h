@@ -48,16 +48,67 @@
  #error "#include WormAnalaysis.h" must appear in source files before "#include Transform.h" because one depends on the other.
 #endif
 
+#include <windows.h>
+
+
+/*
+ * Calibration file (calib.dat)
+ *
+ * The lookup table from camera pixels to DLP mirrors behind a header, laid
+ * out to be memory-mapped and used where it lies:
+ *
+ *   CalibFileHeader
+ *   short table[2*CCDwidth*CCDheight]  DLP x of camera pixel (x,y) at x*CCDheight+y,
+ *                                      its DLP y CCDwidth*CCDheight further on
+ *
+ * The table may point beyond the edges of the DLP, where the calibration
+ * is extrapolated. Entries that don't fit in a short are CALIB_OUT_OF_RANGE.
+ * The valid region is the smallest rectangle of camera pixels holding all
+ * those that land on the DLP. The checksum is FNV-1a over the table.
+ * Numbers are in the byte order of the PC that wrote the file.
+ *
+ * Old calibration files, 2*NSIZEX*NSIZEY ints and no header, still load.
+ */
+#define CALIB_FILE_MAGIC "MCCALIB1"
+#define CALIB_FILE_VERSION 1
+#define CALIB_OUT_OF_RANGE (-32768)
+
+typedef struct CalibFileHeaderStruct{
+	char magic[8];
+	int version;
+	int headerSize;
+	int CCDwidth;
+	int CCDheight;
+	int DLPwidth;
+	int DLPheight;
+	int validX; //valid region, in camera pixels
+	int validY;
+	int validWidth;
+	int validHeight;
+	int numOutOfRange;
+	int tableOffset;
+	unsigned int checksum;
+	int fileSize;
+} CalibFileHeader;
 
 
 /*
  * This structure contains information about calibrating the DLP to the CCD
  *
+ * The lookup table is in the layout of the calibration file. It is either
+ * the mapped file itself, or, for an old file, converted into memory of
+ * our own.
  */
 typedef struct CalibDataStruct{
-	int* CCD2DLPLookUp;
+	const short* CCD2DLPLookUp;
 	CvSize SizeOfDLP;
 	CvSize SizeOfCCD;
+	CvRect ValidRegion; //camera pixels that land on the DLP
+
+	HANDLE file;
+	HANDLE mapping;
+	const void* view;
+	short* converted;
 } CalibData;
 
 
@@ -74,15 +125,14 @@ int TransformFrameCam2DLP(Frame* Cam, Frame* DLP, CalibData* Calib);
 
 
 /*
- * Create and allocate memory for the CalibData structure
- *
- * Currently SizeOfCCD is stored but not really used
+ * Create the CalibData structure for a DLP and camera of the given sizes.
+ * The lookup table comes from LoadCalibFromFile().
  *
  */
 CalibData* CreateCalibData( CvSize SizeOfDLP, CvSize SizeOfCCD);
 
 /*
- * Deallocate memory for CalibData object
+ * Deallocate memory for CalibData object, and unmap its calibration file
  */
 void DestroyCalibData(CalibData* Calib);
 
@@ -92,11 +142,23 @@ void DestroyCalibData(CalibData* Calib);
 /*
  * Read In Calibration Frome File
  *
+ * Memory-maps the file and checks it once, here: the sizes against
+ * Calib's, the checksum and the valid region. Nothing that reads the
+ * table afterwards needs to check it again.
+ *
  * Returns 1 if open failed.
- * Returns -1 if open succesfully but read fails.
+ * Returns -1 if open succesfully but the file can't be used.
  */
 
-int LoadCalibFromFile(CalibData* Calib, char * filename);
+int LoadCalibFromFile(CalibData* Calib, const char * filename);
+
+/*
+ * Write a lookup table of 2*SizeOfCCD.width*SizeOfCCD.height ints, in the
+ * layout of the calibration file, as a calibration file.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int WriteCalibToFile(const int* CCD2DLPLookUp, CvSize SizeOfCCD, CvSize SizeOfDLP, const char* filename);
 
 
 
@@ -118,17 +180,18 @@ int LoadCalibFromFile(CalibData* Calib, char * filename);
  *
  *
  */
-int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,  unsigned char* fromCCD,unsigned char* forDLP, int nsizex, int nsizey, int ccdsizex, int ccdsizey, int DEBUG_FLAG);
+int ConvertCharArrayImageFromCam2DLP(const short *CCD2DLPLookUp,  unsigned char* fromCCD,unsigned char* forDLP, int nsizex, int nsizey, int ccdsizex, int ccdsizey, int DEBUG_FLAG);
 
 /*
  * Converts a CvPoint (x,y) camera space to DLP space.
- * This uses the lookup table generated by the CalibrationTest() function in calibrate.c
- *
- *  Currently ccdsizex and ccdsizey are simply placeholders, they don't do anything.
- *  In other words this assumes that both the camera and DLP are the simesize, namely 102
+ * This uses the lookup table loaded by LoadCalibFromFile().
  *
- *	If DEBUG_FLAG !=0, then print debugging information.
+ * The point may land off the DLP. Returns 0 if camPt is off the camera
+ * or the table has no DLP point for it, and 1 otherwise.
  *
+ * The table was checked when it was loaded, so the only check left is
+ * that camPt is on the camera. Build with -DTRANSFORM_NO_BOUNDS_CHECK to
+ * leave that out too, when every point is known to come from the image.
  *
  */
 int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib);
@@ -136,6 +199,13 @@ int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib);
 /*
  * Takes a SegmentedWorm and transforms all of the points from Camera to DLP coordinates
  *
+ * Points off the camera are moved onto its edge first. A point that still
+ * has no DLP point takes that of its neighbour along the boundary or
+ * centerline, and the head and tail take the ends of the centerline. So
+ * no CALIB_OUT_OF_RANGE point reaches the DLP worm unless none of a
+ * sequence's points had a DLP point.
+ *
+ * Returns 1, 0 if no point on the centerline had a DLP point, or -1 on error.
  */
 int TransformSegWormCam2DLP(SegmentedWorm* camWorm, SegmentedWorm* dlpWorm, CalibData* Calib);
 
@@ -0,0 +1,247 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * VideoSource.c
+ *
+ * Grayscale, fixed-size frames from a video file, optionally decoded
+ * ahead of time on a separate thread.
+ *
+ * See VideoSource.h for a description.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+//OpenCV Headers
+#include "opencv2/highgui/highgui_c.h"
+#include <cv.h>
+#include <cxcore.h>
+
+#include "VideoSource.h"
+
+/*
+ * Work out which part of the source lands where in the output.
+ * Along each axis crop a larger source around its center, or center a
+ * smaller source in the output.
+ */
+static void FitVideoSource(VideoSource* vs){
+	if (vs->inSize.width >= vs->outSize.width) {
+		vs->srcRect.x = (vs->inSize.width - vs->outSize.width) / 2;
+		vs->dstRect.x = 0;
+		vs->srcRect.width = vs->outSize.width;
+	} else {
+		vs->srcRect.x = 0;
+		vs->dstRect.x = (vs->outSize.width - vs->inSize.width) / 2;
+		vs->srcRect.width = vs->inSize.width;
+	}
+	if (vs->inSize.height >= vs->outSize.height) {
+		vs->srcRect.y = (vs->inSize.height - vs->outSize.height) / 2;
+		vs->dstRect.y = 0;
+		vs->srcRect.height = vs->outSize.height;
+	} else {
+		vs->srcRect.y = 0;
+		vs->dstRect.y = (vs->outSize.height - vs->inSize.height) / 2;
+		vs->srcRect.height = vs->inSize.height;
+	}
+	vs->dstRect.width = vs->srcRect.width;
+	vs->dstRect.height = vs->srcRect.height;
+
+	if (vs->inSize.width != vs->outSize.width || vs->inSize.height != vs->outSize.height)
+		printf("Video is %dx%d but frames are %dx%d. Cropping/letterboxing to fit.\n",
+				vs->inSize.width, vs->inSize.height, vs->outSize.width, vs->outSize.height);
+}
+
+/*
+ * Decode one frame into dest.
+ * Only ever called from one thread at a time.
+ */
+static int DecodeVideoFrame(VideoSource* vs, unsigned char* dest, double* msec){
+	IplImage* img = cvQueryFrame(vs->capture);
+	if (img == NULL) return VIDSRC_EOF;
+	*msec = cvGetCaptureProperty(vs->capture, CV_CAP_PROP_POS_MSEC);
+
+	if (img->width != vs->inSize.width || img->height != vs->inSize.height) {
+		printf("Error! Video frame size changed mid-stream.\n");
+		return VIDSRC_ERROR;
+	}
+
+	/** Convert into the persistent buffer. cvQueryFrame() gives BGR for color video. **/
+	IplImage* gray;
+	if (img->nChannels == 1 && img->depth == IPL_DEPTH_8U) {
+		gray = img;
+	} else {
+		cvCvtColor(img, vs->gray, CV_BGR2GRAY);
+		gray = vs->gray;
+	}
+
+	/** Copy the fitted region row by row. Letterbox borders were blacked out at allocation. **/
+	int y;
+	for (y = 0; y < vs->srcRect.height; y++) {
+		const unsigned char* src = (const unsigned char*) gray->imageData
+				+ (vs->srcRect.y + y) * gray->widthStep + vs->srcRect.x;
+		unsigned char* dst = dest + (vs->dstRect.y + y) * vs->outSize.width + vs->dstRect.x;
+		memcpy(dst, src, vs->srcRect.width);
+	}
+	return VIDSRC_OK;
+}
+
+static DWORD WINAPI VideoSourceThread(LPVOID lpParam){
+	VideoSource* vs = (VideoSource*) lpParam;
+	while (1) {
+		WaitForSingleObject(vs->freeSlots, INFINITE);
+		if (!InterlockedCompareExchange(&(vs->keepRunning), 0, 0)) break;
+
+		int status = DecodeVideoFrame(vs, vs->slot[vs->writeSlot], &(vs->slotMsec[vs->writeSlot]));
+		vs->slotStatus[vs->writeSlot] = status;
+		vs->writeSlot = (vs->writeSlot + 1) % vs->numSlots;
+		ReleaseSemaphore(vs->filledSlots, 1, NULL);
+
+		/** Nothing more to decode **/
+		if (status != VIDSRC_OK) break;
+	}
+	return 0;
+}
+
+VideoSource* OpenVideoSource(const char* fname, CvSize outSize, int readAhead){
+	CvCapture* capture = cvCreateFileCapture(fname);
+	if (capture == NULL) {
+		printf("Error! Could not open video file %s\n", fname);
+		return NULL;
+	}
+
+	VideoSource* vs = (VideoSource*) calloc(1, sizeof(VideoSource));
+	vs->capture = capture;
+	vs->outSize = outSize;
+	vs->inSize = cvSize((int) cvGetCaptureProperty(capture, CV_CAP_PROP_FRAME_WIDTH),
+			(int) cvGetCaptureProperty(capture, CV_CAP_PROP_FRAME_HEIGHT));
+	if (vs->inSize.width <= 0 || vs->inSize.height <= 0) {
+		printf("Error! Could not read the frame size of video file %s\n", fname);
+		CloseVideoSource(&vs);
+		return NULL;
+	}
+	if (outSize.width <= 0 || outSize.height <= 0) vs->outSize = outSize = vs->inSize;
+	FitVideoSource(vs);
+	vs->gray = cvCreateImage(vs->inSize, IPL_DEPTH_8U, 1);
+
+	/** Without read-ahead we still need one slot to decode into **/
+	vs->numSlots = (readAhead > 0) ? readAhead : 1;
+	vs->slot = (unsigned char**) calloc(vs->numSlots, sizeof(unsigned char*));
+	vs->slotStatus = (int*) calloc(vs->numSlots, sizeof(int));
+	vs->slotMsec = (double*) calloc(vs->numSlots, sizeof(double));
+	int k;
+	for (k = 0; k < vs->numSlots; k++) {
+		vs->slot[k] = (unsigned char*) calloc(outSize.width * outSize.height, 1);
+		if (vs->slot[k] == NULL) {
+			printf("Error! Could not allocate video read-ahead buffer.\n");
+			CloseVideoSource(&vs);
+			return NULL;
+		}
+	}
+
+	if (readAhead > 0) {
+		vs->freeSlots = CreateSemaphore(NULL, vs->numSlots, vs->numSlots, NULL);
+		vs->filledSlots = CreateSemaphore(NULL, 0, vs->numSlots, NULL);
+		InterlockedExchange(&(vs->keepRunning), 1);
+		vs->thread = CreateThread(NULL, 0, VideoSourceThread, (LPVOID) vs, 0, NULL);
+		if (vs->thread == NULL) {
+			printf("Error! Could not start video read-ahead thread.\n");
+			CloseVideoSource(&vs);
+			return NULL;
+		}
+	}
+	return vs;
+}
+
+int VideoSourceNextFrame(VideoSource* vs, unsigned char** frame){
+	if (vs == NULL) return VIDSRC_ERROR;
+
+	int status;
+	if (vs->thread == NULL) {
+		/** Decode on demand **/
+		status = DecodeVideoFrame(vs, vs->slot[0], &(vs->slotMsec[0]));
+		vs->readSlot = 0;
+	} else {
+		/** Hand the last frame back to the decoder, then wait for the next one **/
+		if (vs->holding) {
+			vs->readSlot = (vs->readSlot + 1) % vs->numSlots;
+			vs->holding = 0;
+			ReleaseSemaphore(vs->freeSlots, 1, NULL);
+		}
+		if (WaitForSingleObject(vs->filledSlots, INFINITE) == WAIT_FAILED)
+			return VIDSRC_ERROR;
+		status = vs->slotStatus[vs->readSlot];
+		if (status != VIDSRC_OK) {
+			/** Leave the end-of-stream marker in place for any later calls **/
+			ReleaseSemaphore(vs->filledSlots, 1, NULL);
+			return status;
+		}
+		vs->holding = 1;
+	}
+
+	if (status == VIDSRC_OK) {
+		*frame = vs->slot[vs->readSlot];
+		vs->frameMsec = vs->slotMsec[vs->readSlot];
+		vs->framesRead++;
+	}
+	return status;
+}
+
+void CloseVideoSource(VideoSource** vs){
+	if (vs == NULL || *vs == NULL) return;
+	VideoSource* v = *vs;
+
+	if (v->thread != NULL) {
+		/** Wake the decoder if it is waiting for a free slot **/
+		InterlockedExchange(&(v->keepRunning), 0);
+		ReleaseSemaphore(v->freeSlots, 1, NULL);
+		WaitForSingleObject(v->thread, INFINITE);
+		CloseHandle(v->thread);
+	}
+	if (v->freeSlots != NULL) CloseHandle(v->freeSlots);
+	if (v->filledSlots != NULL) CloseHandle(v->filledSlots);
+
+	if (v->slot != NULL) {
+		int k;
+		for (k = 0; k < v->numSlots; k++)
+			free(v->slot[k]);
+		free(v->slot);
+	}
+	free(v->slotStatus);
+	free(v->slotMsec);
+	if (v->gray != NULL) cvReleaseImage(&(v->gray));
+	if (v->capture != NULL) cvReleaseCapture(&(v->capture));
+
+	free(v);
+	*vs = NULL;
+}
@@ -0,0 +1,111 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * VideoSource.h
+ *
+ * Reads a video file as a stream of 8-bit grayscale frames of a fixed size.
+ *
+ * Each decoded frame is converted to grayscale into a buffer that is
+ * allocated once, and is then fitted into the output size without scaling:
+ * along each axis a larger source is cropped around its center and a smaller
+ * source is centered on a black background (letterboxed).
+ *
+ * With read-ahead enabled a decoder thread keeps a queue of up to readAhead
+ * frames ready, so that decoding overlaps with processing. Unlike a camera,
+ * no frame is ever dropped: the decoder waits when the queue is full.
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#ifndef VIDEOSOURCE_H_
+#define VIDEOSOURCE_H_
+
+#include <windows.h>
+
+#define VIDSRC_OK 0
+#define VIDSRC_EOF 1
+#define VIDSRC_ERROR -1
+
+typedef struct VideoSourceStruct{
+	CvCapture* capture;
+	CvSize inSize;
+	CvSize outSize;
+
+	/** Where the fitted frame comes from in the source and goes to in the output **/
+	CvRect srcRect;
+	CvRect dstRect;
+
+	IplImage* gray; //persistent grayscale conversion buffer, inSize
+
+	/** Queue of fitted frames, outSize.width*outSize.height bytes each **/
+	int numSlots;
+	unsigned char** slot;
+	int* slotStatus; //VIDSRC_OK, VIDSRC_EOF or VIDSRC_ERROR for each slot
+	double* slotMsec; //position in the video of the frame in each slot
+	int writeSlot; //only touched by the decoder
+	int readSlot; //only touched by the reader
+	int holding; //the reader holds readSlot from the last VideoSourceNextFrame()
+
+	/** Read-ahead thread, NULL when decoding on the caller's thread **/
+	HANDLE thread;
+	HANDLE freeSlots; //semaphore counting slots the decoder may fill
+	HANDLE filledSlots; //semaphore counting slots waiting for the reader
+	volatile LONG keepRunning;
+
+	long framesRead;
+	double frameMsec; //position in the video of the frame last returned, in ms
+} VideoSource;
+
+/*
+ * Open a video file and produce frames of size outSize.
+ *
+ * If readAhead > 0 a decoder thread keeps up to readAhead frames queued.
+ * If readAhead is 0 frames are decoded on demand by VideoSourceNextFrame().
+ * An outSize of 0x0 keeps the video's own frame size.
+ *
+ * Returns NULL if the file cannot be opened.
+ */
+VideoSource* OpenVideoSource(const char* fname, CvSize outSize, int readAhead);
+
+/*
+ * Get the next frame.
+ *
+ * On VIDSRC_OK *frame points to outSize.width*outSize.height grayscale
+ * bytes, which stay valid until the next call or until the source is closed.
+ * Returns VIDSRC_EOF when the video has run out and VIDSRC_ERROR on failure.
+ */
+int VideoSourceNextFrame(VideoSource* vs, unsigned char** frame);
+
+/*
+ * Stop the decoder thread, close the file and free everything.
+ */
+void CloseVideoSource(VideoSource** vs);
+
+#endif /* VIDEOSOURCE_H_ */
@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <string.h>
+#include <stdlib.h>
 
 
 //OpenCV Headers
@@ -43,6 +45,7 @@
 
 #include "AndysOpenCVLib.h"
 #include "AndysComputations.h"
+#include "ContourTracer.h"
 
 // Andy's Libraries
 #include "WormAnalysis.h"
@@ -91,6 +94,7 @@ WormAnalysisData* CreateWormAnalysisDataStruct(){
 	WormPtr->ImgOrig =NULL;
 	WormPtr->ImgSmooth =NULL;
 	WormPtr->ImgThresh =NULL;
+	WormPtr->Tracer=NULL;
 
 	WormPtr->frameNum=0;
 	WormPtr->frameNumCamInternal=0;
@@ -106,6 +110,7 @@ WormAnalysisData* CreateWormAnalysisDataStruct(){
 
 	/**** Allocate Memory for CvSeq ***/
 	WormPtr->Boundary=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),WormPtr->MemStorage);
+	WormPtr->BoundaryF=NULL;
 	WormPtr->Centerline=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),WormPtr->MemStorage);
 
 
@@ -118,6 +123,8 @@ WormAnalysisData* CreateWormAnalysisDataStruct(){
 
 	/** Position on plate information **/
 	WormPtr->stageVelocity=cvPoint(0,0);
+	WormPtr->predictionUs=0;
+	WormPtr->predictedShift=cvPoint2D32f(0,0);
 
 	return WormPtr;
 }
@@ -134,9 +141,9 @@ void DestroyWormAnalysisDataStruct(WormAnalysisData* Worm){
 	if (Worm->ImgOrig !=NULL)	cvReleaseImage(&(Worm->ImgOrig));
 	if (Worm->ImgThresh !=NULL) cvReleaseImage(&(Worm->ImgThresh));
 	if (Worm->ImgSmooth !=NULL) cvReleaseImage(&(Worm->ImgSmooth));
+	DestroyContourTracer(&(Worm->Tracer));
 	cvReleaseMemStorage(&((Worm)->MemScratchStorage));
 	cvReleaseMemStorage(&((Worm)->MemStorage));
-	free((Worm)->Segmented);
 	DestroyWormTimeEvolution(&(Worm->TimeEvolution));
 	free(Worm);
 	Worm=NULL;
@@ -169,6 +176,11 @@ int RefreshWormMemStorage(WormAnalysisData* Worm){
 		printf("Error! MemStorage is NULL in RefreshWormMemStorage()!\n");
 		return -1;
 	}
+
+	/** The old sequence headers lived in the storage we just cleared **/
+	Worm->Boundary=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemStorage);
+	Worm->BoundaryF=NULL;
+	Worm->Centerline=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemStorage);
 	return 0;
 }
 
@@ -185,6 +197,7 @@ void InitializeEmptyWormImages(WormAnalysisData* Worm, CvSize ImageSize){
 	Worm->ImgOrig= cvCreateImage(ImageSize,IPL_DEPTH_8U,1);
 	Worm->ImgSmooth=cvCreateImage(ImageSize,IPL_DEPTH_8U,1);
 	Worm->ImgThresh=cvCreateImage(ImageSize,IPL_DEPTH_8U,1);
+	Worm->Tracer=CreateContourTracer(ImageSize);
 
 	/** Clear the Time Stamp **/
 	Worm->timestamp=0;
@@ -261,6 +274,7 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->NumSegments=100;
 	ParamPtr->BoundSmoothSize=0;
 	ParamPtr->DilateErode=0;
+	ParamPtr->SubPixelBoundary=0;
 
 	/** Levels Brightness **/
 	ParamPtr->LevelsMin=0;
@@ -276,6 +290,10 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->MaxLocationChange=70;
 	ParamPtr->MaxPerimChange=10;
 
+	/** Multiple Worms **/
+	ParamPtr->MultiWorm=0;
+	ParamPtr->MultiWormStepByID=0;
+
 	/** DIsplay Parameters **/
 	ParamPtr->DispRate=1;
 	ParamPtr->Display=1;
@@ -333,9 +351,6 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->ProtocolSecondaryStep=0;
 	ParamPtr->ProtocolSecondaryDuration=15;
 	ParamPtr->ProtocolSecondaryIsOn=0;
-	
-	/** Timed Protocol Internal Timer Variables **/
-	ParamPtr->ProtocolSecondaryStartTime=0; //Time that the secondary protocol step began	
 
 	/** Stage Control Parameters **/
 	ParamPtr->stageTrackingOn=0;
@@ -343,6 +358,10 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->stageROIRadius=250;
 	ParamPtr->stageTargetSegment=10;
 
+	/** Latency Compensation Parameters **/
+	ParamPtr->PredictMotion=0;
+	ParamPtr->DLPLatencyMs=0;
+
 	/**Record Parameters **/
 	ParamPtr->Record=0;
 
@@ -471,20 +490,45 @@ WormTimeEvolution* CreateWormTimeEvolution(){
 	WormTimeEvolution* TimeEv;
 	TimeEv= (WormTimeEvolution*) malloc(sizeof(WormTimeEvolution));
 
-	/*** Setup Memory storage ***/
-	TimeEv->MemTimeEvolutionStorage=cvCreateMemStorage(0);
-	TimeEv->MeanHeadCurvatureBuffer=cvCreateSeq(0,sizeof(CvSeq),sizeof(double),TimeEv->MemTimeEvolutionStorage);
 	TimeEv->derivativeOfHeadCurvature=0;
 	TimeEv->currMeanHeadCurvature=0;
 
+	/*** Empty curvature history ***/
+	TimeEv->HeadCurvatureNewest=0;
+	TimeEv->HeadCurvatureCount=0;
+	TimeEv->HeadCurvatureSum=0;
+	TimeEv->HeadCurvatureAgeSum=0;
+	TimeEv->HeadCurvatureSincePrecise=0;
+
 	return TimeEv;
 }
 
 int DestroyWormTimeEvolution(WormTimeEvolution** TimeEvolution){
-	(*TimeEvolution)->MeanHeadCurvatureBuffer=NULL;
-	cvReleaseMemStorage(&( (*TimeEvolution)->MemTimeEvolutionStorage ));
 	free(*TimeEvolution);
 	*TimeEvolution=NULL;
+	return A_OK;
+}
+
+double GetMeanHeadCurvature(const WormTimeEvolution* TimeEvolution, int age){
+	int i=TimeEvolution->HeadCurvatureNewest-age;
+	if (i<0) i+=HEAD_CURVATURE_HIST_MAX;
+	return TimeEvolution->HeadCurvatureHist[i];
+}
+
+/*
+ * Recompute the running sums from the values in the history
+ */
+static void ResumHeadCurvature(WormTimeEvolution* TimeEv){
+	int age;
+	double v;
+	TimeEv->HeadCurvatureSum=0;
+	TimeEv->HeadCurvatureAgeSum=0;
+	for (age = 0; age < TimeEv->HeadCurvatureCount; age++) {
+		v=GetMeanHeadCurvature(TimeEv,age);
+		TimeEv->HeadCurvatureSum+=v;
+		TimeEv->HeadCurvatureAgeSum+=age*v;
+	}
+	TimeEv->HeadCurvatureSincePrecise=0;
 }
 
 int AddMeanHeadCurvature(WormTimeEvolution* TimeEvolution, double CurrHeadCurvature, WormAnalysisParam* AnalysisParam){
@@ -502,15 +546,48 @@ int AddMeanHeadCurvature(WormTimeEvolution* TimeEvolution, double CurrHeadCurvat
 	}else{
 		MaxBuff=1;
 	}
+	if (MaxBuff>HEAD_CURVATURE_HIST_MAX) MaxBuff=HEAD_CURVATURE_HIST_MAX;
 
 	if (DEBUG_INFO!=0) printf("MaxBuff=%d\n",MaxBuff);
 
-	/** Push onto Bufeer **/
-	PushToSeqBuffer(TimeEvolution->MeanHeadCurvatureBuffer,(void*) &CurrHeadCurvature,MaxBuff);
+	/** Everything already in the history gets one frame older **/
+	TimeEvolution->HeadCurvatureAgeSum+=TimeEvolution->HeadCurvatureSum;
+
+	/** Push onto Buffer **/
+	TimeEvolution->HeadCurvatureNewest=(TimeEvolution->HeadCurvatureNewest+1) % HEAD_CURVATURE_HIST_MAX;
+	TimeEvolution->HeadCurvatureHist[TimeEvolution->HeadCurvatureNewest]=CurrHeadCurvature;
+	TimeEvolution->HeadCurvatureCount++;
+	TimeEvolution->HeadCurvatureSum+=CurrHeadCurvature;
+
+	/** Drop the oldest values; more than one if the number of frames was just turned down **/
+	while (TimeEvolution->HeadCurvatureCount > MaxBuff){
+		int oldest=TimeEvolution->HeadCurvatureCount-1;
+		double v=GetMeanHeadCurvature(TimeEvolution,oldest);
+		TimeEvolution->HeadCurvatureSum-=v;
+		TimeEvolution->HeadCurvatureAgeSum-=oldest*v;
+		TimeEvolution->HeadCurvatureCount--;
+	}
+
+	if (++(TimeEvolution->HeadCurvatureSincePrecise) >= HEAD_CURVATURE_RESUM_INTERVAL) ResumHeadCurvature(TimeEvolution);
 
 	/** Set Current Mean Head Curvature **/
 	TimeEvolution->currMeanHeadCurvature = CurrHeadCurvature;
 
+	/*
+	 * Least squares slope of curvature against age, from the sums.
+	 * Age runs backwards in time, so the derivative is minus the slope.
+	 */
+	double n=TimeEvolution->HeadCurvatureCount;
+	if (n<2) {
+		TimeEvolution->derivativeOfHeadCurvature=0;
+	} else {
+		double s_x=n*(n-1)/2;
+		double s_xx=(n-1)*n*(2*n-1)/6;
+		double delta=n*s_xx-s_x*s_x;
+		TimeEvolution->derivativeOfHeadCurvature=
+				-(n*TimeEvolution->HeadCurvatureAgeSum-s_x*TimeEvolution->HeadCurvatureSum)/delta;
+	}
+
 	return A_OK;
 }
 
@@ -527,15 +604,10 @@ int AddMeanHeadCurvature(WormTimeEvolution* TimeEvolution, double CurrHeadCurvat
 
 
 /*
- * Smooths, thresholds and finds the worms contour.
+ * Smooths and thresholds the image.
  * The original image must already be loaded into Worm.ImgOrig
- * The Smoothed image is deposited into Worm.ImgSmooth
- * The thresholded image is deposited into Worm.ImgThresh
- * The Boundary is placed in Worm.Boundary
- *
  */
-void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params){
-	/** This function currently takes around 5-7 ms **/
+void SmoothAndThresholdWorm(WormAnalysisData* Worm, WormAnalysisParam* Params){
 	/**
 	 * Before I forget.. plan to make this faster by:
 	 *  a) using region of interest
@@ -567,36 +639,94 @@ void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params){
 		cvErode(Worm->ImgThresh, Worm->ImgThresh,NULL,2);
 		TICTOC::timer().toc("DilateAndErode");
 	}
+}
+
+
+/*
+ * Smooths, thresholds and finds the worms contour.
+ * The original image must already be loaded into Worm.ImgOrig
+ * The Smoothed image is deposited into Worm.ImgSmooth
+ * The thresholded image is deposited into Worm.ImgThresh
+ * The Boundary is placed in Worm.Boundary
+ *
+ * The boundary is traced starting from last frame's centerline in
+ * Worm.Segmented. Only if that finds nothing worm sized are the contours
+ * of every object in the frame searched for the longest.
+ *
+ * With Params->SubPixelBoundary the boundary is then refined to sub-pixel
+ * precision from ImgSmooth and put in Worm.BoundaryF. Worm.Boundary is
+ * that, rounded, and isn't smoothed any further.
+ *
+ */
+void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params){
+	Worm->BoundaryF=NULL;
 
+	/** This function currently takes around 5-7 ms **/
+	SmoothAndThresholdWorm(Worm,Params);
 
-	/** Find Contours **/
-	CvSeq* contours;
-	IplImage* TempImage=cvCreateImage(cvGetSize(Worm->ImgThresh),IPL_DEPTH_8U,1);
-	cvCopy(Worm->ImgThresh,TempImage);
-	TICTOC::timer().tic("cvFindContours");
-	cvFindContours(TempImage,Worm->MemStorage, &contours,sizeof(CvContour),CV_RETR_EXTERNAL,CV_CHAIN_APPROX_NONE,cvPoint(0,0));
-	TICTOC::timer().toc("cvFindContours");
+	/** Trace just the worm, starting from where it was last frame **/
+	CvSeq* rough=NULL;
+	if (Worm->Tracer!=NULL && Worm->Segmented->Centerline!=NULL){
+		TICTOC::timer().tic("TraceSeededContour");
+		rough=TraceSeededContour(Worm->Tracer,Worm->ImgThresh,Worm->Segmented->Centerline);
+		TICTOC::timer().toc("TraceSeededContour");
 
-	CvSeq* rough;
-	/** Find Longest Contour **/
-	TICTOC::timer().tic("cvLongestContour");
-	if (contours) LongestContour(contours,&rough);
-	TICTOC::timer().toc("cvLongestContour");
-	cvReleaseImage(&TempImage);
+		/** Too small to be the worm: the seed landed on debris or the worm broke up. Look everywhere **/
+		if (rough!=NULL && (rough->total < 2*Params->NumSegments || rough->total < Worm->Tracer->lastTotal/2)) rough=NULL;
+	}
 
-	/** Smooth the Boundary **/
-	if (Params->BoundSmoothSize>0){
-		TICTOC::timer().tic("SmoothBoundary");
-		CvSeq* smooth=smoothPtSequence(rough,Params->BoundSmoothSize,Worm->MemStorage);
-		Worm->Boundary=cvCloneSeq(smooth);
-		TICTOC::timer().toc("SmoothBoundary");
+	/** Find the Longest of all the Contours **/
+	if (rough==NULL){
+		TICTOC::timer().tic("cvFindContours");
+		if (Worm->Tracer!=NULL){
+			rough=FindLongestContour(Worm->Tracer,Worm->ImgThresh,Worm->MemStorage);
+		} else {
+			CvSeq* contours=NULL;
+			IplImage* TempImage=cvCloneImage(Worm->ImgThresh);
+			cvFindContours(TempImage,Worm->MemStorage, &contours,sizeof(CvContour),CV_RETR_EXTERNAL,CV_CHAIN_APPROX_NONE,cvPoint(0,0));
+			if (contours) LongestContour(contours,&rough);
+			cvReleaseImage(&TempImage);
+		}
+		TICTOC::timer().toc("cvFindContours");
+	}
+	if (Worm->Tracer!=NULL) Worm->Tracer->lastTotal= (rough==NULL) ? 0 : rough->total;
 
-	} else {
-		Worm->Boundary=cvCloneSeq(rough);
+	/** No worm in this frame. Leave an empty boundary for GivenBoundaryFindWormHeadTail() to reject **/
+	if (rough==NULL){
+		Worm->Boundary=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemStorage);
+		return;
 	}
 
+	/** Sub-pixel Boundary. It is already smooth **/
+	if (Params->SubPixelBoundary && !Params->DilateErode && Worm->Tracer!=NULL){
+		TICTOC::timer().tic("TraceSubPixelBorder");
+		Worm->BoundaryF=TraceSubPixelBorder(Worm->Tracer,Worm->ImgSmooth,Params->BinThresh,*(CvPoint*) cvGetSeqElem(rough,0),Worm->MemStorage);
+		TICTOC::timer().toc("TraceSubPixelBorder");
+		if (Worm->BoundaryF!=NULL){
+			Worm->Boundary=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemStorage);
+			RoundSeq2D32f(Worm->BoundaryF,Worm->Boundary);
+			return;
+		}
+	}
 
+	/** Smooth the Boundary **/
+	TICTOC::timer().tic("SmoothBoundary");
+	LoadWormBoundary(Worm,Params,rough);
+	TICTOC::timer().toc("SmoothBoundary");
+}
 
+/*
+ * Puts a copy of contour, smoothed by Params->BoundSmoothSize, in Worm.Boundary.
+ * The copy is made in Worm.MemStorage, so contour can live anywhere.
+ */
+void LoadWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params, CvSeq* contour){
+	Worm->BoundaryF=NULL;
+	if (Params->BoundSmoothSize>0){
+		CvSeq* smooth=smoothPtSequence(contour,Params->BoundSmoothSize,Worm->MemStorage);
+		Worm->Boundary=cvCloneSeq(smooth,Worm->MemStorage);
+	} else {
+		Worm->Boundary=cvCloneSeq(contour,Worm->MemStorage);
+	}
 }
 
 
@@ -986,8 +1116,9 @@ int SegmentWorm(WormAnalysisData* Worm, WormAnalysisParam* Params){
 	/***Clear Out any stale Segmented Information Already in the Worm Structure***/
 	ClearSegmentedInfo(Worm->Segmented);
 
-	Worm->Segmented->Head=Worm->Head;
-	Worm->Segmented->Tail=Worm->Tail;
+	/** Copy the points: Head and Tail are the SegmentedWorm's own, and are freed with it **/
+	*(Worm->Segmented->Head)=*(Worm->Head);
+	*(Worm->Segmented->Tail)=*(Worm->Tail);
 
 	/*** It would be nice to check that Worm->Boundary exists ***/
 
@@ -1012,50 +1143,76 @@ int SegmentWorm(WormAnalysisData* Worm, WormAnalysisParam* Params){
 	cvSeqInvert(OrigBoundB);
 
 
-	/*** Resample One of the Two Boundaries so that both are the same length ***/
+	if (Worm->BoundaryF!=NULL && Worm->BoundaryF->total==Worm->Boundary->total){
+		/*** Sub-pixel boundary: find the centerline without rounding. It needs no smoothing ***/
+		CvSeq* FBoundA=cvSeqSlice(Worm->BoundaryF,cvSlice(Worm->HeadIndex,Worm->TailIndex),Worm->MemScratchStorage,1);
+		CvSeq* FBoundB=cvSeqSlice(Worm->BoundaryF,cvSlice(Worm->TailIndex,Worm->HeadIndex),Worm->MemScratchStorage,1);
+		cvSeqInvert(FBoundB);
 
-	//Create sequences to store the Normalized Boundaries
-	CvSeq* NBoundA=	cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemScratchStorage);
-	CvSeq* NBoundB=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemScratchStorage);
+		/** resampleSeq() only copies points, so it works on CvPoint2D32f too **/
+		CvSeq* NFBoundA=cvCreateSeq(CV_32FC2,sizeof(CvSeq),sizeof(CvPoint2D32f),Worm->MemScratchStorage);
+		CvSeq* NFBoundB=cvCreateSeq(CV_32FC2,sizeof(CvSeq),sizeof(CvPoint2D32f),Worm->MemScratchStorage);
+		if (FBoundA->total > FBoundB->total){
+			resampleSeq(FBoundA,NFBoundA,FBoundB->total );
+			NFBoundB=FBoundB;
+		}else{
+			resampleSeq(FBoundB,NFBoundB,FBoundA->total );
+			NFBoundA=FBoundA;
+		}
 
-	//Resample L&R boundary to have the same number of points as min(L,R)
-	if (OrigBoundA->total > OrigBoundB->total){
-		resampleSeq(OrigBoundA,NBoundA,OrigBoundB->total );
-		NBoundB=OrigBoundB;
-	}else{
-		resampleSeq(OrigBoundB,NBoundB,OrigBoundA->total );
-		NBoundA=OrigBoundA;
-	}
-	//Now both NBoundA and NBoundB are the same length.
+		CvSeq* CenterlineF=cvCreateSeq(CV_32FC2,sizeof(CvSeq),sizeof(CvPoint2D32f),Worm->MemScratchStorage);
+		FindCenterline2D32f(NFBoundA,NFBoundB,CenterlineF);
+
+		cvClearSeq(Worm->Centerline);
+		RoundSeq2D32f(CenterlineF,Worm->Centerline);
+		resampleSeq2D32fConstPtsPerArcLength(CenterlineF,Worm->Segmented->Centerline,Params->NumSegments);
 
+	} else {
+		/*** Resample One of the Two Boundaries so that both are the same length ***/
 
+		//Create sequences to store the Normalized Boundaries
+		CvSeq* NBoundA=	cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemScratchStorage);
+		CvSeq* NBoundB=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),Worm->MemScratchStorage);
+
+		//Resample L&R boundary to have the same number of points as min(L,R)
+		if (OrigBoundA->total > OrigBoundB->total){
+			resampleSeq(OrigBoundA,NBoundA,OrigBoundB->total );
+			NBoundB=OrigBoundB;
+		}else{
+			resampleSeq(OrigBoundB,NBoundB,OrigBoundA->total );
+			NBoundA=OrigBoundA;
+		}
+		//Now both NBoundA and NBoundB are the same length.
 
-	/*
-	 * Now Find the Centerline
-	 *
-	 */
 
-	/*** Clear out Stale Centerline Information ***/
-	cvClearSeq(Worm->Centerline);
 
-	/*** Compute Centerline, from Head To Tail ***/
-	FindCenterline(NBoundA,NBoundB,Worm->Centerline);
+		/*
+		 * Now Find the Centerline
+		 *
+		 */
 
+		/*** Clear out Stale Centerline Information ***/
+		cvClearSeq(Worm->Centerline);
 
+		/*** Compute Centerline, from Head To Tail ***/
+		FindCenterline(NBoundA,NBoundB,Worm->Centerline);
 
-	/*** Smooth the Centerline***/
-	CvSeq* SmoothUnresampledCenterline = smoothPtSequence (Worm->Centerline, 0.5*Worm->Centerline->total/Params->NumSegments, Worm->MemScratchStorage);
 
-	/*** Note: If you wanted to you could smooth the centerline a second time here. ***/
 
+		/*** Smooth the Centerline***/
+		CvSeq* SmoothUnresampledCenterline = smoothPtSequence (Worm->Centerline, 0.5*Worm->Centerline->total/Params->NumSegments, Worm->MemScratchStorage);
 
-	/*** Resample the Centerline So it has the specified Number of Points ***/
-	//resampleSeq(SmoothUnresampledCenterline,Worm->Segmented->Centerline,Params->NumSegments);
+		/*** Note: If you wanted to you could smooth the centerline a second time here. ***/
 
-	resampleSeqConstPtsPerArcLength(SmoothUnresampledCenterline,Worm->Segmented->Centerline,Params->NumSegments);
+
+		/*** Resample the Centerline So it has the specified Number of Points ***/
+		//resampleSeq(SmoothUnresampledCenterline,Worm->Segmented->Centerline,Params->NumSegments);
+
+		resampleSeqConstPtsPerArcLength(SmoothUnresampledCenterline,Worm->Segmented->Centerline,Params->NumSegments);
+	}
 
 	/** Save the location of the centerOfWorm as the point halfway down the segmented centerline **/
-	Worm->Segmented->centerOfWorm= CV_GET_SEQ_ELEM( CvPoint , Worm->Segmented->Centerline, Worm->Segmented->NumSegments / 2 );
+	*(Worm->Segmented->centerOfWorm)= *CV_GET_SEQ_ELEM( CvPoint , Worm->Segmented->Centerline, Worm->Segmented->NumSegments / 2 );
 
 	/*** Remove Repeat Points***/
 	//RemoveSequentialDuplicatePoints (Worm->Segmented->Centerline);
@@ -1069,15 +1226,142 @@ int SegmentWorm(WormAnalysisData* Worm, WormAnalysisParam* Params){
 }
 
 
-/**
- *
- * Creates the Worm heads up display for monitoring or for saving to disk
- * You must first pass a pointer to an IplImage that has already been allocated and
- * has dimensions of Worm->SizeOfImage
- *
- *
+/** Push every point of from onto the end of to **/
+static void AppendSeqPoints(CvSeq* from, CvSeq* to){
+	CvSeqReader reader;
+	CvPoint pt;
+	int i;
+	cvStartReadSeq(from,&reader,0);
+	for (i=0; i<from->total; i++){
+		CV_READ_SEQ_ELEM(pt,reader);
+		cvSeqPush(to,&pt);
+	}
+}
+
+/*
+ * Copies the boundary, head and tail and segmentation of src into dest,
+ * as if dest had been segmented itself. dest's own images are untouched.
+ * The copies are made in dest's memory, so src can be reused straight away.
  */
-int CreateWormHUDS(IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisParam* Params, Frame* IlluminationFrame){
+int LoadWormSegmentation(WormAnalysisData* dest, WormAnalysisData* src){
+	if (cvSeqExists(src->Boundary)==0 || src->Boundary->total==0 || src->Segmented->Centerline==NULL){
+		printf("Error! No segmented worm to copy in LoadWormSegmentation()\n");
+		return -1;
+	}
+
+	dest->Boundary=cvCloneSeq(src->Boundary,dest->MemStorage);
+	dest->BoundaryF= (src->BoundaryF==NULL) ? NULL : cvCloneSeq(src->BoundaryF,dest->MemStorage);
+	dest->HeadIndex=src->HeadIndex;
+	dest->TailIndex=src->TailIndex;
+	dest->Head=CV_GET_SEQ_ELEM(CvPoint,dest->Boundary,dest->HeadIndex);
+	dest->Tail=CV_GET_SEQ_ELEM(CvPoint,dest->Boundary,dest->TailIndex);
+	dest->Centerline=cvCloneSeq(src->Centerline,dest->MemStorage);
+
+	SegmentedWorm* from=src->Segmented;
+	SegmentedWorm* to=dest->Segmented;
+	ClearSegmentedInfo(to);
+	AppendSeqPoints(from->Centerline,to->Centerline);
+	AppendSeqPoints(from->LeftBound,to->LeftBound);
+	AppendSeqPoints(from->RightBound,to->RightBound);
+	to->NumSegments=from->NumSegments;
+	*(to->Head)=*(dest->Head);
+	*(to->Tail)=*(dest->Tail);
+	*(to->centerOfWorm)=*CV_GET_SEQ_ELEM(CvPoint,to->Centerline,to->NumSegments/2);
+	return 0;
+}
+
+
+/*
+ * Allocate the cached font and text layer for heads up displays of size ImageSize
+ */
+WormHUDS* CreateWormHUDSCache(CvSize ImageSize){
+	WormHUDS* hud=(WormHUDS*) malloc(sizeof(WormHUDS));
+	cvInitFont(&(hud->font),CV_FONT_HERSHEY_TRIPLEX ,1.0,1.0,0,2,CV_AA);
+	hud->TextLayer=cvCreateImage(ImageSize,IPL_DEPTH_8U,1);
+	cvZero(hud->TextLayer);
+	int k;
+	for (k = 0; k < HUDS_NUM_LINES; k++) {
+		hud->text[k][0]='\0';
+		hud->rect[k]=cvRect(0,0,0,0);
+	}
+	return hud;
+}
+
+void DestroyWormHUDSCache(WormHUDS** hud){
+	if (hud==NULL || *hud==NULL) return;
+	cvReleaseImage(&((*hud)->TextLayer));
+	free(*hud);
+	*hud=NULL;
+}
+
+/*
+ * Make line k of the HUDS's text layer read text, drawn with its baseline at org.
+ * Does nothing if the line already reads text.
+ */
+static void SetWormHUDSLine(WormHUDS* hud, int k, const char* text, CvPoint org){
+	if (strncmp(hud->text[k],text,HUDS_LINE_LENGTH-1)==0) return;
+
+	/** Erase the old text **/
+	if (hud->rect[k].width>0 && hud->rect[k].height>0){
+		cvSetImageROI(hud->TextLayer,hud->rect[k]);
+		cvZero(hud->TextLayer);
+		cvResetImageROI(hud->TextLayer);
+	}
+
+	strncpy(hud->text[k],text,HUDS_LINE_LENGTH-1);
+	hud->text[k][HUDS_LINE_LENGTH-1]='\0';
+	hud->rect[k]=cvRect(0,0,0,0);
+	if (hud->text[k][0]=='\0') return;
+
+	/** Work out the region the new text covers, with room for the stroke thickness and anti-aliasing **/
+	CvSize size;
+	int baseline;
+	int pad=hud->font.thickness+2;
+	cvGetTextSize(hud->text[k],&(hud->font),&size,&baseline);
+	int x0=org.x-pad;
+	int y0=org.y-size.height-pad;
+	int x1=org.x+size.width+pad;
+	int y1=org.y+baseline+pad;
+	if (x0<0) x0=0;
+	if (y0<0) y0=0;
+	if (x1>hud->TextLayer->width) x1=hud->TextLayer->width;
+	if (y1>hud->TextLayer->height) y1=hud->TextLayer->height;
+	if (x1<=x0 || y1<=y0) return;
+	hud->rect[k]=cvRect(x0,y0,x1-x0,y1-y0);
+
+	cvPutText(hud->TextLayer,hud->text[k],org,&(hud->font),cvScalar(255,255,255));
+}
+
+/*
+ * Mark each point of the boundary with a small ring of white pixels,
+ * the same mark DrawSequence() makes, but without going through cvCircle.
+ */
+static void DrawWormHUDSBoundary(IplImage* image, CvSeq* Boundary){
+	if (Boundary==NULL) return;
+	CvSeqReader reader;
+	CvPoint pt;
+	int i,dx,dy;
+	cvStartReadSeq(Boundary,&reader,0);
+	for (i = 0; i < Boundary->total; i++) {
+		CV_READ_SEQ_ELEM(pt,reader);
+		for (dy = -1; dy <= 1; dy++) {
+			int y=pt.y+dy;
+			if (y<0 || y>=image->height) continue;
+			unsigned char* row=(unsigned char*) (image->imageData+y*image->widthStep);
+			for (dx = -1; dx <= 1; dx++) {
+				int x=pt.x+dx;
+				if ((dx==0 && dy==0) || x<0 || x>=image->width) continue;
+				row[x]=255;
+			}
+		}
+	}
+}
+
+/*
+ * Same as CreateWormHUDS() but reuses the font and any text that
+ * has not changed since the last call with the same hud.
+ */
+int ComposeWormHUDS(WormHUDS* hud, IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisParam* Params, Frame* IlluminationFrame){
 
 	int CircleDiameterSize=10;
 
@@ -1087,54 +1371,65 @@ int CreateWormHUDS(IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisPara
 	if (Params->DLPOn) weighting=0.45; // if DLP is on make the illumination pattern more opaque
 	cvAddWeighted(Worm->ImgOrig,1,IlluminationFrame->iplimg,weighting,0,TempImage);
 
-	//Want to also display boundary!
-	//cvDrawContours(TempImage, Worm->Boundary, cvScalar(255,0,0),cvScalar(0,255,0),100);
-
-	DrawSequence(&TempImage,Worm->Boundary);
-
-//	DrawSequence(&TempImage,Worm->Segmented->LeftBound);
-//	DrawSequence(&TempImage,Worm->Segmented->RightBound);
+	DrawWormHUDSBoundary(TempImage,Worm->Boundary);
 
 	cvCircle(TempImage,*(Worm->Tail),CircleDiameterSize,cvScalar(255,255,255),1,CV_AA,0);
 	cvCircle(TempImage,*(Worm->Head),CircleDiameterSize/2,cvScalar(255,255,255),1,CV_AA,0);
 
-	/** Prepare Text **/
-	CvFont font;
-	cvInitFont(&font,CV_FONT_HERSHEY_TRIPLEX ,1.0,1.0,0,2,CV_AA);
+	/** Update only the lines of text that have changed **/
+	SetWormHUDSLine(hud,HUDS_LINE_DLP,Params->DLPOn ? "DLP ON" : "",cvPoint(20,70));
 
-	/** Display DLP On Off **/
-	if (Params->DLPOn) {
-		cvPutText(TempImage,"DLP ON",cvPoint(20,70),&font,cvScalar(255,255,255));
-	}
 	/** Display Recording if we are recording **/
-	if (Params->Record){
-		cvPutText(TempImage,"Recording",cvPoint(20,100),&font,cvScalar(255,255,255));
-
-	} else {
-		if (Params->DLPOn) cvPutText(TempImage,"Did you forget to record?",cvPoint(20,100),&font,cvScalar(255,255,255));
+	const char* record="";
+	if (Params->Record) {
+		record="Recording";
+	} else if (Params->DLPOn) {
+		record="Did you forget to record?";
 	}
-
+	SetWormHUDSLine(hud,HUDS_LINE_RECORD,record,cvPoint(20,100));
 
 	/*** Let the user know if the illumination flood light is on ***/
-	if (Params->IllumFloodEverything){
-		cvPutText(TempImage,"Floodlight",cvPoint(20,130),&font,cvScalar(255,255,255));
-	}
+	SetWormHUDSLine(hud,HUDS_LINE_FLOOD,Params->IllumFloodEverything ? "Floodlight" : "",cvPoint(20,130));
 
-	char protoNum[20];
 	/** If we are using protocols, display the protocol number **/
-	if (Params->ProtocolUse){
-		sprintf(protoNum,"Step %d",Params->ProtocolStep);
-		cvPutText(TempImage,protoNum,cvPoint(20,160),&font,cvScalar(255,255,255));
-
-	}
+	char protoNum[HUDS_LINE_LENGTH]="";
+	if (Params->ProtocolUse) sprintf(protoNum,"Step %d",Params->ProtocolStep);
+	SetWormHUDSLine(hud,HUDS_LINE_PROTOCOL,protoNum,cvPoint(20,160));
 
-	char frame[30]; // these are freed automatically 
-					// SEE http://stackoverflow.com/questions/1335230/is-the-memory-of-a-character-array-freed-by-going-out-of-scope
+	char frame[HUDS_LINE_LENGTH];
 	sprintf(frame,"%d",Worm->frameNum);
-	cvPutText(TempImage,frame,cvPoint(Worm->SizeOfImage.width- 200,Worm->SizeOfImage.height - 10),&font,cvScalar(255,255,255) );
+	SetWormHUDSLine(hud,HUDS_LINE_FRAME,frame,cvPoint(Worm->SizeOfImage.width- 200,Worm->SizeOfImage.height - 10));
+
+	/** Stamp the text onto the display, touching only the regions that have text **/
+	int k;
+	for (k = 0; k < HUDS_NUM_LINES; k++) {
+		if (hud->rect[k].width<=0) continue;
+		cvSetImageROI(TempImage,hud->rect[k]);
+		cvSetImageROI(hud->TextLayer,hud->rect[k]);
+		cvMax(TempImage,hud->TextLayer,TempImage);
+		cvResetImageROI(hud->TextLayer);
+		cvResetImageROI(TempImage);
+	}
 	return 0;
 }
 
+/**
+ *
+ * Creates the Worm heads up display for monitoring or for saving to disk
+ * You must first pass a pointer to an IplImage that has already been allocated and
+ * has dimensions of Worm->SizeOfImage
+ *
+ * This renders all of the text from scratch. For every frame use
+ * ComposeWormHUDS() instead.
+ *
+ */
+int CreateWormHUDS(IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisParam* Params, Frame* IlluminationFrame){
+	WormHUDS* hud=CreateWormHUDSCache(cvGetSize(TempImage));
+	int ret=ComposeWormHUDS(hud,TempImage,Worm,Params,IlluminationFrame);
+	DestroyWormHUDSCache(&hud);
+	return ret;
+}
+
 
 /************************************************************/
 /* Monitoring Routines										*/
@@ -68,6 +68,7 @@ typedef struct WormAnalysisParamStruct{
 	int GaussSize;
 	int BoundSmoothSize;
 	int DilateErode;
+	int SubPixelBoundary; // find the boundary to sub-pixel precision from ImgSmooth. Ignored with DilateErode
 	int NumSegments;
 
 	/** Frame to Frame Temporal Analysis**/
@@ -76,6 +77,10 @@ typedef struct WormAnalysisParamStruct{
 	int MaxLocationChange;
 	int MaxPerimChange;
 
+	/** Multiple Worms **/
+	int MultiWorm; // most worms to track at once; 0 or 1 tracks just the biggest, as before
+	int MultiWormStepByID; // 1 = give each new worm its own protocol step, by ID
+
 	/** Display Stuff**/
 	int DispRate; //Deprecated
 	int Display;
@@ -119,9 +124,6 @@ typedef struct WormAnalysisParamStruct{
 	int ProtocolSecondaryDuration;
 	int ProtocolSecondaryIsOn;
 	
-	/** Timed Protocol Internal Timer Variables **/
-	double ProtocolSecondaryStartTime; //Time that the secondary protocol step began
-	
 	
 
 	/** Laser Power **/
@@ -149,6 +151,10 @@ typedef struct WormAnalysisParamStruct{
 	int stageROIRadius;   // radius of the active zone
 	int stageTargetSegment; //segment along the worms centerline used for targeting
 
+	/** Latency Compensation Parameters **/
+	int PredictMotion; // 1 = illuminate where the worm will be when the DLP shows the pattern
+	int DLPLatencyMs; // delay in the DLP itself, added to the measured latency
+
 	/** Record Data Parameters **/
 	int Record;
 
@@ -169,6 +175,12 @@ typedef struct SegmentedWormStruct{
 
 
 
+/** Most frames of head curvature history; at least the KNumFrames slider's maximum **/
+#define HEAD_CURVATURE_HIST_MAX 64
+
+/** Recompute the running sums from scratch this often, so rounding errors can't build up **/
+#define HEAD_CURVATURE_RESUM_INTERVAL 1024
+
 typedef struct WormTimeEvolutionStruct{
 	/*
 	 * This information about the worm
@@ -177,10 +189,21 @@ typedef struct WormTimeEvolutionStruct{
 	 */
 
 	/** Phase and Curvature Analysis **/
-	CvSeq* MeanHeadCurvatureBuffer;
 	double derivativeOfHeadCurvature;
 	double currMeanHeadCurvature;
-	CvMemStorage* MemTimeEvolutionStorage;
+
+	/*
+	 * Mean head curvature of the last few frames, in a ring.
+	 * The sums are kept up to date as values come and go so that the
+	 * least squares slope (the derivative) costs the same however many
+	 * frames there are. Age 0 is the current frame.
+	 */
+	double HeadCurvatureHist[HEAD_CURVATURE_HIST_MAX];
+	int HeadCurvatureNewest; // index of the current frame's value
+	int HeadCurvatureCount;
+	double HeadCurvatureSum; // sum of the values
+	double HeadCurvatureAgeSum; // sum of age * value
+	int HeadCurvatureSincePrecise; // pushes since the sums were last recomputed from scratch
 }WormTimeEvolution;
 
 
@@ -202,8 +225,12 @@ typedef struct WormImageAnalysisStruct{
 	CvMemStorage* MemStorage;
 	CvMemStorage* MemScratchStorage;
 
+	/** Finds the boundary starting from last frame's centerline. See ContourTracer.h **/
+	struct ContourTracerStruct* Tracer;
+
 	/** Features **/
 	CvSeq* Boundary;
+	CvSeq* BoundaryF; // Boundary to sub-pixel precision (CvPoint2D32f), or NULL. Boundary is this rounded
 	CvPoint* Head;
 	CvPoint* Tail;
 	int TailIndex;
@@ -222,6 +249,10 @@ typedef struct WormImageAnalysisStruct{
 	/** Information about location on plate **/
 	CvPoint stageVelocity; //compensating velocity of stage.
 
+	/** Latency compensation applied to this frame's illumination **/
+	int predictionUs; //how far ahead the worm was predicted; 0 if it wasn't
+	CvPoint2D32f predictedShift; //mean shift of the centerline, in pixels
+
 
 	//WormIlluminationData* Illum;
 }WormAnalysisData;
@@ -248,6 +279,32 @@ typedef struct WormGeomStruct{
 }WormGeom;
 
 
+/*
+ * Lines of text on the heads up display
+ */
+#define HUDS_LINE_DLP 0
+#define HUDS_LINE_RECORD 1
+#define HUDS_LINE_FLOOD 2
+#define HUDS_LINE_PROTOCOL 3
+#define HUDS_LINE_FRAME 4
+#define HUDS_NUM_LINES 5
+#define HUDS_LINE_LENGTH 32
+
+/*
+ * Cached state for drawing the heads up display.
+ *
+ * The font is initialized once, and the text is rendered once into its own
+ * layer. A line of text is only re-rendered, and only its region of the
+ * layer redrawn, when the text changes.
+ */
+typedef struct WormHUDSStruct{
+	CvFont font;
+	IplImage* TextLayer; // white text on black, the size of the HUDS
+	char text[HUDS_NUM_LINES][HUDS_LINE_LENGTH]; // what is rendered on each line now
+	CvRect rect[HUDS_NUM_LINES]; // region of TextLayer covered by each line
+}WormHUDS;
+
+
 /*
  *
  * Every function here should have the word Worm in it
@@ -395,8 +452,19 @@ WormTimeEvolution* CreateWormTimeEvolution();
 
 int DestroyWormTimeEvolution(WormTimeEvolution** TimeEvolution);
 
+/*
+ * Add this frame's mean head curvature to the history, keeping the last
+ * AnalysisParam->CurvaturePhaseNumFrames frames, and update
+ * currMeanHeadCurvature and derivativeOfHeadCurvature (per frame).
+ * The number of frames can change from call to call.
+ */
 int AddMeanHeadCurvature(WormTimeEvolution* TimeEvolution, double CurrHeadCurvature, WormAnalysisParam* AnalysisParam);
 
+/*
+ * The mean head curvature from age frames ago (0 is the current frame)
+ */
+double GetMeanHeadCurvature(const WormTimeEvolution* TimeEvolution, int age);
+
 
 
 
@@ -416,9 +484,25 @@ int AddMeanHeadCurvature(WormTimeEvolution* TimeEvolution, double CurrHeadCurvat
  * The thresholded image is deposited into Worm.ImgThresh
  * The Boundary is placed in Worm.Boundary
  *
+ * The boundary is traced starting from last frame's centerline in
+ * Worm.Segmented. Only if that finds nothing worm sized are the contours
+ * of every object in the frame searched for the longest.
+ *
  */
 void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* WormParams);
 
+/*
+ * Smooths and thresholds the image: the first half of FindWormBoundary().
+ * The original image must already be loaded into Worm.ImgOrig
+ */
+void SmoothAndThresholdWorm(WormAnalysisData* Worm, WormAnalysisParam* Params);
+
+/*
+ * Puts a copy of contour, smoothed by Params->BoundSmoothSize, in Worm.Boundary.
+ * The copy is made in Worm.MemStorage, so contour can live anywhere.
+ */
+void LoadWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params, CvSeq* contour);
+
 
 
 
@@ -474,9 +558,18 @@ int SimpleIlluminateWormLR(SegmentedWorm* SegWorm, Frame* IllumFrame,int center,
  * It requires Worm->Boundary be full
  * It requires that Params->NumSegments be greater than zero
  *
+ * If there is a sub-pixel boundary, Worm->BoundaryF, the centerline is
+ * found from it instead and isn't smoothed.
+ *
  */
 int SegmentWorm(WormAnalysisData* Worm, WormAnalysisParam* Params);
 
+/*
+ * Copies the boundary, head and tail and segmentation of src into dest,
+ * as if dest had been segmented itself. dest's own images are untouched.
+ */
+int LoadWormSegmentation(WormAnalysisData* dest, WormAnalysisData* src);
+
 
 /**
  *
@@ -488,6 +581,19 @@ int SegmentWorm(WormAnalysisData* Worm, WormAnalysisParam* Params);
  */
 int CreateWormHUDS(IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisParam* Params, Frame* IlluminationFrame);
 
+/*
+ * Allocate the cached font and text layer for heads up displays of size ImageSize
+ */
+WormHUDS* CreateWormHUDSCache(CvSize ImageSize);
+
+void DestroyWormHUDSCache(WormHUDS** hud);
+
+/*
+ * Same as CreateWormHUDS() but reuses the font and any text that
+ * has not changed since the last call with the same hud.
+ */
+int ComposeWormHUDS(WormHUDS* hud, IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisParam* Params, Frame* IlluminationFrame);
+
 /*****************************************
  *
  * Monitoring functions
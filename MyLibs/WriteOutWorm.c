@@ -218,6 +218,15 @@ void WriteOutDefaultGridSize(WriteOut* DataWriter, WormAnalysisParam* Param){
  * And more now!
  */
 int AppendWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, WriteOut* DataWriter){
+	return AppendMultiWormFrameToDisk(Worm,Params,DataWriter,NULL,NULL,NULL,0);
+}
+
+/*
+ * As AppendWormFrameToDisk(), and also writes each of numWorms tracked
+ * worms under "Worms" with its ID and the protocol step illuminating it.
+ */
+int AppendMultiWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, WriteOut* DataWriter,
+		WormAnalysisData** Worms, const int* ids, const int* steps, int numWorms){
 
 	CvFileStorage* fs=DataWriter->fs;
 
@@ -274,6 +283,14 @@ int AppendWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, Wri
 			cvEndWriteStruct(fs);
 		}
 
+		if (Params->PredictMotion){
+			cvStartWriteStruct(fs,"Prediction",CV_NODE_MAP,NULL);
+				cvWriteReal(fs,"ms",Worm->predictionUs/1000.0);
+				cvWriteReal(fs,"dx",Worm->predictedShift.x);
+				cvWriteReal(fs,"dy",Worm->predictedShift.y);
+			cvEndWriteStruct(fs);
+		}
+
 		cvStartWriteStruct(fs,"LaserPower",CV_NODE_MAP,NULL);
 			cvWriteInt(fs,"Green",Params->GreenLaser);
 			cvWriteInt(fs,"Blue",Params->BlueLaser);
@@ -289,6 +306,35 @@ int AppendWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, Wri
 
 		cvWriteInt(fs,"ProtocolIsOn",Params->ProtocolUse);
 		cvWriteInt(fs,"ProtocolStep",Params->ProtocolStep);
+
+		/** Every worm, in multi-worm mode **/
+		if (numWorms>0){
+			cvStartWriteStruct(fs,"Worms",CV_NODE_SEQ,NULL);
+			int k;
+			for (k = 0; k < numWorms; k++) {
+				SegmentedWorm* seg=Worms[k]->Segmented;
+				cvStartWriteStruct(fs,NULL,CV_NODE_MAP,NULL);
+					cvWriteInt(fs,"Id",ids[k]);
+					cvWriteInt(fs,"ProtocolStep",steps[k]);
+					if(cvPointExists(seg->Head)){
+					cvStartWriteStruct(fs,"Head",CV_NODE_MAP,NULL);
+						cvWriteInt(fs,"x",seg->Head->x);
+						cvWriteInt(fs,"y",seg->Head->y);
+					cvEndWriteStruct(fs);
+					}
+					if(cvPointExists(seg->Tail)){
+					cvStartWriteStruct(fs,"Tail",CV_NODE_MAP,NULL);
+						cvWriteInt(fs,"x",seg->Tail->x);
+						cvWriteInt(fs,"y",seg->Tail->y);
+					cvEndWriteStruct(fs);
+					}
+					if(cvSeqExists(seg->LeftBound)) cvWrite(fs,"BoundaryA",seg->LeftBound);
+					if(cvSeqExists(seg->RightBound)) cvWrite(fs,"BoundaryB",seg->RightBound);
+					if(cvSeqExists(seg->Centerline)) cvWrite(fs,"SegmentedCenterline",seg->Centerline);
+				cvEndWriteStruct(fs);
+			}
+			cvEndWriteStruct(fs);
+		}
 	cvEndWriteStruct(fs);
 
 	return 0;
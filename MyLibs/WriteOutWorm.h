@@ -114,6 +114,14 @@ void WriteOutDefaultGridSize(WriteOut* DataWriter, WormAnalysisParam* Param);
  */
 int AppendWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, WriteOut* DataWriter);
 
+/*
+ * As AppendWormFrameToDisk(), and also writes each of numWorms tracked
+ * worms under "Worms": its ID, the protocol step illuminating it, and its
+ * head, tail, bounds and centerline, with the same names as the main worm's.
+ */
+int AppendMultiWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, WriteOut* DataWriter,
+		WormAnalysisData** Worms, const int* ids, const int* steps, int numWorms);
+
 /*
  * Finish writing to disk and close the file and such.
  * Destroys the Data Writer
@@ -71,6 +71,17 @@
 #include "WriteOutWorm.h"
 #include "version.h"
 #include "../API/mc_api_dll.h"
+#include "Telemetry.h"
+#include "ParamSync.h"
+#include "VideoSource.h"
+#include "FrameArchive.h"
+#include "DisplayMailbox.h"
+#include "StageController.h"
+#include "StageTracker.h"
+#include "MotionPredictor.h"
+#include "MultiWorm.h"
+#include "Sequencer.h"
+#include "TimedIllumination.h"
 
 #include "experiment.h"
 
@@ -90,6 +101,8 @@ Experiment* CreateExperimentStruct() {
 	/** Simulation? True/False **/
 	exp->SimDLP = 0;
 	exp->VidFromFile = 0;
+	exp->FastReplay = 0;
+	exp->ReplaySpeed = 1.0;
 
 	/** GuiWindowNames **/
 	exp->WinDisp = NULL;
@@ -107,6 +120,7 @@ Experiment* CreateExperimentStruct() {
 	exp->infname = NULL;
 	exp->dirname = NULL;
 	exp->protocolfname = NULL;
+	exp->tracefname = NULL;
 
 	/** Protocol Data **/
 	exp->p = NULL;
@@ -120,10 +134,12 @@ Experiment* CreateExperimentStruct() {
 	exp->UseFrameGrabber = FALSE;
 
 	/** Video input **/
-	exp->capture = NULL;
+	exp->video = NULL;
+	exp->RawReplay = NULL;
 
 	/** Last Observerd CamFrameNumber **/
 	exp->lastFrameSeenOutside = 0;
+	exp->grabTimeUs = 0;
 
 	/** DLP Output **/
 	exp->myDLP = 0;
@@ -143,10 +159,21 @@ Experiment* CreateExperimentStruct() {
 	/** Segmented Worm in DLP Space **/
 	exp->segWormDLP = NULL;
 
+	/** Latency Compensation **/
+	exp->motionPredictor = NULL;
+	exp->segWormPredicted = NULL;
+	exp->segWormIllum = NULL;
+
+	/** Multiple Worms **/
+	exp->multiWorm = NULL;
+
 	/** internal IplImage **/
 	exp->SubSampled = NULL; // Image used to subsample stuff
 	exp->HUDS = NULL; //Image used to generate the Heads Up Display
-	exp->CurrentSelectedImg = NULL; //The current image selected for display
+	exp->HUDSCache = NULL;
+	exp->HeadCurvature = NULL;
+	exp->Levels.valid = 0; //Levels table is built on the first frame
+	exp->DisplayBox = NULL; //Display images handed to the display thread
 
 	/** Internal Frame data types **/
 	exp->fromCCD = NULL;
@@ -159,17 +186,15 @@ Experiment* CreateExperimentStruct() {
 	/** Write Video To File **/
 	exp->Vid = NULL; //Video Writer
 	exp->VidHUDS = NULL;
+	exp->RawArchive = NULL;
 
 	/** Timing  Information **/
 	exp->now = 0;
 	exp->last = 0;
 
-	/** Illumination Timing Info **/
-	exp->illumStart = 0;
-	exp->illumFinished = 0;
-
-	/** Illumination Head Tail Timing Info **/
-	exp->illumSweepHTtimer=0;
+	/** Timed Illumination **/
+	exp->sequencer = NULL;
+	exp->illumFinishedUs = 0;
 
 	/** Frame Rate Information **/
 	exp->nframes = 0;
@@ -179,6 +204,10 @@ Experiment* CreateExperimentStruct() {
 	/** Stage Control **/
 	exp->stageIsPresent=0;
 	exp->stage=NULL;
+	exp->stageCtl=NULL;
+	exp->stageTracker=NULL;
+	exp->stageTrackerActive=0;
+	exp->stageFramesLost=0;
 	exp->stageVel=cvPoint(0,0);
 	exp->stageCenter=cvPoint(0,0);
 	exp->stageFeedbackTarget=cvPoint(512,384);
@@ -186,10 +215,17 @@ Experiment* CreateExperimentStruct() {
 
 	/** Macros **/
 	exp->RECORDVID = 0;
+	exp->RECORDRAW = 0;
+	exp->RawArchiveCodec = FRAMEARCHIVE_CODEC_RAW;
 	exp->RECORDDATA = 0;
 
 	/** MindControl API **/
 	exp->sm=NULL;
+	exp->telemetry=NULL;
+
+	/** Parameters for the display thread **/
+	exp->GuiParams=NULL;
+	exp->paramSync=NULL;
 
 	exp->scratchMem =cvCreateMemStorage(0);
 
@@ -221,7 +257,15 @@ void displayHelp() {
 	printf(
 			"\t-d  D:/Path/To/My/Directory/\n\t\tWrite the video and data output to the specified directory. NOTE: it is important to have the trailing slash.\n\n");
 	printf(
-			"\t-i  InputVideo.avi\n\t\tNo camera. Use video file source instead.\n\n");
+			"\t-i  InputVideo.avi\n\t\tNo camera. Use video file source instead. A raw frame archive (.mcraw) is replayed with its original timing.\n\n");
+	printf(
+			"\t-F\n\t\tWith -i, replay the video as fast as it can be decoded instead of pacing it like a camera.\n\n");
+	printf(
+			"\t-A  2.0\n\t\tWith -i archive.mcraw, replay the archive this many times faster than it was recorded.\n\n");
+	printf(
+			"\t-a\n\t\tWith -o, also record the exact camera frames, with timestamps, to a raw frame archive (.mcraw).\n\n");
+	printf(
+			"\t-z\n\t\tWith -a, compress the frame archive losslessly. Smaller files for a little CPU.\n\n");
 	printf(
 			"\t-s\n\t\tSimulate the existence of DLP. (No physical DLP required.)\n\n");
 	printf("\t-g\n\t\tUse camera attached to FrameGrabber.\n\n");
@@ -229,7 +273,9 @@ void displayHelp() {
 	printf("\t-x\n\tx 512\t Target x position  of worm for stage feedback loop. 0 is left.\n\n");
 	printf("\t-y\n\ty 384\t Target y position of worm for stage feedback loop. 0 is top.\n\n");
 	printf(
-			"\t-p  protocol.yml\n\t\tIlluminate according to a YAML protocol file.\n\n");
+			"\t-p  protocol.yml\n\t\tIlluminate according to a YAML protocol file,\n\t\tor a protocol compiled with compileProtocol.exe.\n\n");
+	printf(
+			"\t-T  trace.json\n\t\tRecord a timeline of profiling events and write it to a Chrome trace file on exit or when T is pressed.\n\n");
 	printf("\t-?\n\t\tDisplay this help.\n\n");
 	printf("\nSee shortcutkeys.txt for a list of keyboard shortcuts.\n");
 }
@@ -245,7 +291,7 @@ int HandleCommandLineArguments(Experiment* exp) {
 	opterr = 0;
 
 	int c;
-	while ((c = getopt(exp->argc, exp->argv, "si:d:o:p:gtx:y:?")) != -1) {
+	while ((c = getopt(exp->argc, exp->argv, "si:FA:azd:o:p:gtx:y:T:?")) != -1) {
 		switch (c) {
 		case 'i': /** specify input video file **/
 			exp->VidFromFile = 1;
@@ -257,6 +303,27 @@ int HandleCommandLineArguments(Experiment* exp) {
 			}
 			break;
 
+		case 'F': /** Replay video from file at decode speed **/
+			exp->FastReplay = 1;
+			break;
+
+		case 'A': /** Replay a raw frame archive faster or slower **/
+			if (optarg != NULL && atof(optarg) > 0) {
+				exp->ReplaySpeed = atof(optarg);
+			} else {
+				printf("Error. The -A switch needs a positive speed up factor.\n");
+				return -1;
+			}
+			break;
+
+		case 'a': /** Record a raw frame archive **/
+			exp->RECORDRAW = 1;
+			break;
+
+		case 'z': /** Compress the raw frame archive **/
+			exp->RawArchiveCodec = FRAMEARCHIVE_CODEC_DELTA_RLE;
+			break;
+
 		case 'd': /** specifiy directory **/
 			dflag = 1;
 			if (optarg != NULL) {
@@ -316,6 +383,13 @@ int HandleCommandLineArguments(Experiment* exp) {
 				}
 				printf("Stage feedback target y= %d pixels.\n",exp->stageFeedbackTarget.y );
 		break;
+		case 'T': /** Record a profiling trace **/
+			if (optarg != NULL) {
+				exp->tracefname = optarg;
+			} else {
+				exp->tracefname = "trace.json";
+			}
+			break;
 
 
 		case '?':
@@ -325,7 +399,7 @@ int HandleCommandLineArguments(Experiment* exp) {
 			}
 			/** What is this? This looks bening but wrong to me.. -andy 26 Feb 2010 **/
 			if (optopt == 'i' || optopt == 'c' || optopt == 'd' || optopt
-					== 's') {
+					== 's' || optopt == 'T' || optopt == 'A') {
 				fprintf(stderr, "Option -%c requires an argument.\n", optopt);
 				displayHelp();
 				return -1;
@@ -348,108 +422,47 @@ int HandleCommandLineArguments(Experiment* exp) {
 }
 
 
-/**
- * The illumination sweep is a feature that lets the user automatically
- * increment an on-the-fly illumination step by step across the worm
+/*
+ * Run everything that happens at a set time: timed DLP flashes, the
+ * head-to-tail illumination sweep and the timed secondary protocol step.
+ *
+ * The sequencer's clock is sampled once, here, at the start of the frame.
+ * Each feature puts its events on the timeline when it is switched on,
+ * and every event that has come due is then applied, in the order it was due.
  */
-int HandleIlluminationSweep(Experiment* exp){
-	int debug=1;
-
-	// Case 1: We are not doing a head-tail sweep
-	if ((exp->Params->IllumSweepOn == 0) && (exp->illumSweepHTtimer ==0 ) ){
-		return 0;
-	}
-
-	struct timeval curr_tv;
-
-
-	// Case 2:We are initiating a head-tail sweep
-	if ((exp->Params->IllumSweepOn == 1) && (exp->illumSweepHTtimer == (double) 0 ) ){
-		printf("Initiating a head-to-tail illumination sweep.\n");
-		/** Set the cursor to the head (tail) **/
-		if (exp->Params->IllumSweepHT==1){
-			exp->Params->IllumSquareOrig.y=0;
-		}else{
-			exp->Params->IllumSquareOrig.y=exp->Params->NumSegments-1;
-		}
-		/**Set the start time to now. **/
-		gettimeofday(&curr_tv, NULL);
-		exp->illumSweepHTtimer = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0);
-
-		/** Turn the DLP On **/
-		exp->Params->DLPOn = 1;
-
-		printf("Initiating head to tail illumination sweep\n");
-		return 1;
+int DoSequencer(Experiment* exp){
+	Sequencer* s=exp->sequencer;
+	SequencerSampleClock(s);
+
+	/** Start or cancel the timed features the user has switched on or off **/
+	HandleIlluminationTiming(exp);
+	HandleIlluminationSweep(exp);
+	HandleTimedSecondaryProtocolStep(exp);
+
+	SequencerEvent ev;
+	int numRun=0;
+	while (SequencerNextDue(s,&ev)){
+		ApplySequencerEvent(exp,&ev);
+		numRun++;
 	}
+	return numRun;
+}
 
-	double diff;
-	int tenthsOfSecondsElapsed;
-	/** Case 3: We are in the midst of a head-to-tail illumination sweep **/
-	if ((exp->Params->IllumSweepOn == 1) && (exp->illumSweepHTtimer > (double) 0 ) ) {
-
-		/** Is it time to increment? **/
-		gettimeofday(&curr_tv, NULL);
-		diff = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0) - exp->illumSweepHTtimer;
-		tenthsOfSecondsElapsed = (int) (diff * 10.0);
-		/** Time to increment to the next segment ? **/
-		if (tenthsOfSecondsElapsed > exp->Params->IllumDuration) {
-			/** Yes.. it's time to increment to the next segment **/
-
-			/** Would the next segment push us off of the worm? **/
-			if (exp->Params->IllumSweepHT==1){
-				if (exp->Params->IllumSquareOrig.y <  exp->Params->NumSegments - exp->Params->IllumSquareRad.height){
-					/** Nope we are safe within the worm: INCREMENT **/
-					exp->Params->IllumSquareOrig.y=exp->Params->IllumSquareOrig.y + 2*(exp->Params->IllumSquareRad.height);
-				} else {
-					/** We are about to walk off. We are finished **/
-					exp->Params->DLPOn=0;/** Turn off DLP **/
-					exp->illumSweepHTtimer = (double) 0;
-					exp->Params->IllumSweepOn=0;
-					return 0;
-				}
-
-			} else {
-				/** We are going in the Opposite direction **/
-				if (exp->Params->IllumSquareOrig.y >= exp->Params->IllumSquareRad.height ) {
-					/** Nope we are safe within the worm: DECREMENT **/
-					exp->Params->IllumSquareOrig.y=exp->Params->IllumSquareOrig.y - 2* (exp->Params->IllumSquareRad.height);
-				} else {
-					/** We are about to walk off. We are finished **/
-					exp->Params->DLPOn=0;/** Turn off DLP **/
-					exp->illumSweepHTtimer = (double) 0;
-					exp->Params->IllumSweepOn=0;
-					return 0;
-				}
-			}
-
-			/** Ok.. we already incremented/decremented **/
-			/**Set the start time to now. **/
-			gettimeofday(&curr_tv, NULL);
-			exp->illumSweepHTtimer = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0);
-
-			return 1;
-
-		} else {
-			/** No need to move segments... just keep on illuminating **/
-			return 1;
-		}
-	}
-
-	/** Case 4: user prematurely aborts head to tail illumination sweep **/
-	if ((exp->Params->IllumSweepOn == 0) && (exp->illumSweepHTtimer > (double) 0 ) ) {
-
-		/** Turn off DLP **/
-		exp->Params->DLPOn=0;
-		exp->illumSweepHTtimer = (double) 0;
-		return 0;
+/*
+ * Carry out an event from the sequencer's timeline
+ */
+void ApplySequencerEvent(Experiment* exp, SequencerEvent* ev){
+	if (ApplyTimedEvent(exp->sequencer,exp->Params,ev)==SEQ_SOURCE_FLASH){
+		exp->illumFinishedUs=exp->sequencer->nowUs;
 	}
+}
 
-
-	printf("Error. In HandleIlluminationSweep() in experiment.c. This should never occur. :(\n");
-	return -1;
-
-
+/**
+ * The illumination sweep is a feature that lets the user automatically
+ * increment an on-the-fly illumination step by step across the worm
+ */
+int HandleIlluminationSweep(Experiment* exp){
+	return SequenceIlluminationSweep(exp->sequencer,exp->Params);
 }
 
 /*
@@ -478,66 +491,36 @@ int HandleCurvaturePhaseAnalysis(Experiment* exp){
 
 
 
-	/** Smoothing parameter**/
-	double sigma=5; /** made bigger **/
 	int factor=exp->Params->CurvaturePhaseVisualaziationFactor; //visualization parameter
 
-	/** Define the head in worm coordinates **/
-	int HEAD_BEGIN=10;
-	int HEAD_END=30;
-
-	/** Splice the head **/
-	CvSeq* headcent=cvSeqSlice(exp->Worm->Segmented->Centerline,cvSlice(HEAD_BEGIN,HEAD_END));
-	int N=headcent->total - 2;
 	if (DEBUG_FLAG!=0){
 		printf("Whole Centerline :\n");
 		printSeq(exp->Worm->Segmented->Centerline);
-		printf("Just the Head:\n");
-		printSeq(headcent);
 	}
 
-
-	/** Extract the curvature of the head **/
-	double* curvature= (double*) malloc(N* (sizeof(double)));
-	RefreshWormMemStorage(exp->Worm);
-
-	/** Smooth and Extract Curvature **/
-	if (extractCurvatureOfSeq( headcent,curvature,sigma,exp->Worm->MemScratchStorage)< 0) return EXP_ERROR;
-	RefreshWormMemStorage(exp->Worm);
+	/** Smooth the head and extract its curvature, into preallocated buffers **/
+	int N=CurvatureOfSeqSegment(exp->Worm->Segmented->Centerline,HEAD_CURVATURE_BEGIN,HEAD_CURVATURE_END,exp->HeadCurvature);
+	if (N < 1) return EXP_ERROR;
+	double* curvature=exp->HeadCurvature->k;
 	if (DEBUG_FLAG!=0) printDoubleArr(curvature,N);
 
-	/** Calculate Median Curvature **/
-	double median_curvature=MedianOfDoubleArr(curvature,N);
+	/** Calculate Median Curvature (reorders curvature) **/
+	double median_curvature=MedianOfDoubleArrInPlace(curvature,N);
 	if (DEBUG_FLAG!=0) {
 		printf("median_curvature*100=%f\n",median_curvature* (double) 100);
 		printf("About to add the mean head curvature to the buffer.\n");
 	}
 
 	/** Store Mean head curvature in buffer that includes mean head curvatures from previous 20 frames**/
+	/** This also updates the derivative of the mean head curvature with respect to time **/
 	if (AddMeanHeadCurvature(exp->Worm->TimeEvolution,median_curvature,exp->Params)!=A_OK) printf("Error adding mean curvature!!\n");
 	if (DEBUG_FLAG!=0) {
-		printf("exp->Worm->TimeEvolution->MeanHeadCurvatureBuffer->total=%d\n",exp->Worm->TimeEvolution->MeanHeadCurvatureBuffer->total);
-		printSeqScalarDoubles(exp->Worm->TimeEvolution->MeanHeadCurvatureBuffer);
-	}
-
-	/** Calculate the derivative of the mean head curvature with respect to time **/
-	double* headPhaseBuff=NULL;
-	SeqDoublesToArr((const CvSeq*) exp->Worm->TimeEvolution->MeanHeadCurvatureBuffer,&headPhaseBuff);
-	int N_curr=exp->Worm->TimeEvolution->MeanHeadCurvatureBuffer->total;
-
-	if (DEBUG_FLAG!=0){
-		printf("headPhaseBuff\n");
-		printDoubleArr(headPhaseBuff,N_curr);
+		printf("exp->Worm->TimeEvolution->HeadCurvatureCount=%d\n",exp->Worm->TimeEvolution->HeadCurvatureCount);
+		int age;
+		for (age = 0; age < exp->Worm->TimeEvolution->HeadCurvatureCount; age++)
+			printf("%d: %f\n",age,GetMeanHeadCurvature(exp->Worm->TimeEvolution,age));
 	}
 
-	double negative_k_dot;//our buffer is backwards. 0th index is most recent.
-
-	mean_derivative(headPhaseBuff,&negative_k_dot,N_curr);
-	exp->Worm->TimeEvolution->derivativeOfHeadCurvature=-negative_k_dot;
-
-
-	/** Deallocate memory for head phase buffer **/
-	free(headPhaseBuff);
 	if (DEBUG_FLAG!=0) {
 		printf("k*%d=%f\t, kdot* %d: %f\n",factor, (double)factor *median_curvature, factor, (double)factor* (exp->Worm->TimeEvolution->derivativeOfHeadCurvature));
 		printf("NumFrames: %d, kdot+/-: %d, k+/-: %d, Thresh: %d\n",exp->Params->CurvaturePhaseNumFrames, exp->Params->CurvaturePhaseDerivThresholdPositive,exp->Params->CurvaturePhaseThresholdPositive,exp->Params->CurvaturePhaseThreshold);
@@ -549,7 +532,6 @@ int HandleCurvaturePhaseAnalysis(Experiment* exp){
 	double k, kdot, trig, desiredSignk, desiredSignkdot, signOfk, signOfkdot;
 
 	if (exp->Params->CurvaturePhaseTriggerOn != 0){
-		struct timeval curr_tv;
 
 		/*
 		 * This is subtle. There is k and kdot. k is the median curvature. kdot is the derivative of the median curvature.
@@ -589,10 +571,9 @@ int HandleCurvaturePhaseAnalysis(Experiment* exp){
 			/** If we are in Illumination-Stay-On-and-Refractory-Period-Mode **/
 			if (exp->Params->StayOnAndRefract==1){
 
-				/** Get timing info to Find out if Refractory Period is Over **/
-				gettimeofday(&curr_tv, NULL);
-				double diff = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0) - exp->illumFinished;
-				if ( diff  >  (double) exp->Params->IllumRefractoryPeriod / 10.0){
+				/** Find out if Refractory Period is Over, at this frame's time **/
+				long long sinceUs = exp->sequencer->nowUs - exp->illumFinishedUs;
+				if ( sinceUs  >  SEQ_TENTH_US * exp->Params->IllumRefractoryPeriod){
 
 					/** Turn on the DLP for a preset amount of time **/
 					exp->Params->DLPOnFlash=1;
@@ -636,69 +617,22 @@ int HandleCurvaturePhaseAnalysis(Experiment* exp){
  *
  */
 int HandleIlluminationTiming(Experiment* exp) {
+	return SequenceIlluminationTiming(exp->sequencer,exp->Params);
+}
 
-	struct timeval curr_tv;
-	double diff;
-
-	int tenthsOfSecondsElapsed;
-
-
-	/** Case 1: Nothing to do **/
-	if (!exp->Params->DLPOnFlash) {
-		/** DLPOnFlash is off **/
-		exp->illumStart = 0;
-		return 0;
-	}
-
-	/** Case 2: First time DLPOnFlash  is turned onon**/
-	if ((exp->Params->DLPOnFlash) && (exp->illumStart == 0)) {
-		/**Set the start time to now. **/
-		gettimeofday(&curr_tv, NULL);
-
-		/** Set illumStart Time **/
-		exp->illumStart = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0);
-
-		/** Set illumFinished Time as now (even though we are not yet finished) **/
-		exp->illumFinished =exp->illumStart;
-
-
-		/** Turn the DLP On **/
-		exp->Params->DLPOn = 1;
-		printf("Turning on DLP transiently for %d tenths of seconds ...\n",exp->Params->IllumDuration);
-		return 1;
-	}
-
-	/** Case 3: DLPOnFlash has been on **/
-	if ((exp->Params->DLPOnFlash) && (exp->illumStart > (double) 0)) {
-		gettimeofday(&curr_tv, NULL);
-		diff = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0) - exp->illumStart;
-
-		/** Set IllumFinished **/
-		exp->illumFinished = curr_tv.tv_sec + (curr_tv.tv_usec / 1000000.0);
-
-
-		/** Determine if we should continue illuminating or stop **/
-		tenthsOfSecondsElapsed = (int) (diff * 10.0);
-		if (tenthsOfSecondsElapsed > exp->Params->IllumDuration) {
-			/** The illumination is now finished **/
-			/** Turn the DLP Off **/
-			exp->Params->DLPOn = 0;
-			exp->Params->DLPOnFlash = 0;
-
-			/** Set the start time to zero.**/
-			exp->illumStart = 0;
-			printf("Illumination is finished.\n");
-			return 0;
-
-		} else {
-			/** We should continue to illuminate **/
-			exp->Params->DLPOn = 1;
-			//printf("diff=%e illumstart=%d current=%d, IllumDuration=%d\n\n",diff,exp->illumStart,current,exp->Params->IllumDuration);
-			return 1;
-		}
-
-	}
-
+/*
+ * Switch to a different protocol step for a specified amount of time and then switch back
+ *
+ * This is useful for combined calcium imaging and optogenetic stimulation.
+ * Let some protocol step, A, be to illuminate a cell with a calcium indicator
+ * and protocol step B, be to illuminate that cell plus also some cell expressing ChR2.
+ *
+ * Often when calcium imaging we want to transiently stimulate some other cell for a given time,
+ * say 2 seconds. The machinery here allows the user to set a secondary protocol step and will transiently
+ * switch to that protocol for a specified amount of time.
+ */
+int HandleTimedSecondaryProtocolStep(Experiment* exp) {
+	return SequenceTimedSecondaryProtocolStep(exp->sequencer,exp->Params);
 }
 
 /** GUI **/
@@ -786,130 +720,146 @@ void SetupGUI(Experiment* exp) {
 
 
 	/** SelectDisplay **/
-	cvCreateTrackbar("SelDisplay", "Controls", &(exp->Params->Display), 7,
+	cvCreateTrackbar("SelDisplay", "Controls", &(exp->GuiParams->Display), 7,
 			(int) NULL);
 	printf("Pong\n");
 
 	/** On Off **/
-	cvCreateTrackbar("On", exp->WinCon1, &(exp->Params->OnOff), 1, (int) NULL);
+	cvCreateTrackbar("On", exp->WinCon1, &(exp->GuiParams->OnOff), 1, (int) NULL);
 
 	/** Temporal Coding **/
-	cvCreateTrackbar("TemporalIQ", exp->WinCon1, &(exp->Params->TemporalOn), 1,
+	cvCreateTrackbar("TemporalIQ", exp->WinCon1, &(exp->GuiParams->TemporalOn), 1,
 			(int) NULL);
 
 	/** Segmentation Parameters**/
-	cvCreateTrackbar("Threshold", exp->WinCon1, &(exp->Params->BinThresh), 255,
+	cvCreateTrackbar("Threshold", exp->WinCon1, &(exp->GuiParams->BinThresh), 255,
 			(int) NULL);
-	cvCreateTrackbar("Gauss=x*2+1", exp->WinCon1, &(exp->Params->GaussSize),
+	cvCreateTrackbar("Gauss=x*2+1", exp->WinCon1, &(exp->GuiParams->GaussSize),
 			15, (int) NULL);
-	cvCreateTrackbar("BoundSmooth", exp->WinCon1, &(exp->Params->BoundSmoothSize),
+	cvCreateTrackbar("BoundSmooth", exp->WinCon1, &(exp->GuiParams->BoundSmoothSize),
 				15, (int) NULL);
-	cvCreateTrackbar("DilateErode", exp->WinCon1, &(exp->Params->DilateErode),
+	cvCreateTrackbar("DilateErode", exp->WinCon1, &(exp->GuiParams->DilateErode),
+					1, (int) NULL);
+	cvCreateTrackbar("SubPixel", exp->WinCon1, &(exp->GuiParams->SubPixelBoundary),
 					1, (int) NULL);
-	cvCreateTrackbar("ScalePx", exp->WinCon1, &(exp->Params->LengthScale), 50,
+	cvCreateTrackbar("ScalePx", exp->WinCon1, &(exp->GuiParams->LengthScale), 50,
 			(int) NULL);
 	cvCreateTrackbar("Proximity", exp->WinCon1,
-			&(exp->Params->MaxLocationChange), 100, (int) NULL);
+			&(exp->GuiParams->MaxLocationChange), 100, (int) NULL);
+	cvCreateTrackbar("Worms", exp->WinCon1,
+			&(exp->GuiParams->MultiWorm), MULTIWORM_MAX_WORMS, (int) NULL);
 
 	/**Illumination Parameters **/
-	cvCreateTrackbar("x", exp->WinCon1, &(exp->Params->IllumSquareOrig.x),
-			exp->Params->DefaultGridSize.width, (int) NULL);
-	cvCreateTrackbar("y", exp->WinCon1, &(exp->Params->IllumSquareOrig.y),
-			exp->Params->DefaultGridSize.height, (int) NULL);
+	cvCreateTrackbar("x", exp->WinCon1, &(exp->GuiParams->IllumSquareOrig.x),
+			exp->GuiParams->DefaultGridSize.width, (int) NULL);
+	cvCreateTrackbar("y", exp->WinCon1, &(exp->GuiParams->IllumSquareOrig.y),
+			exp->GuiParams->DefaultGridSize.height, (int) NULL);
 	cvCreateTrackbar("xRad", exp->WinCon1,
-			&(exp->Params->IllumSquareRad.width), exp->Params->DefaultGridSize.width,
+			&(exp->GuiParams->IllumSquareRad.width), exp->GuiParams->DefaultGridSize.width,
 			(int) NULL);
 	cvCreateTrackbar("yRad", exp->WinCon1,
-			&(exp->Params->IllumSquareRad.height), exp->Params->DefaultGridSize.height,
+			&(exp->GuiParams->IllumSquareRad.height), exp->GuiParams->DefaultGridSize.height,
 			(int) NULL);
 
 	cvCreateTrackbar("IllumDuration", exp->WinCon1,
-			&(exp->Params->IllumDuration), 70, (int) NULL);
+			&(exp->GuiParams->IllumDuration), 70, (int) NULL);
 	cvCreateTrackbar("DLPFlashOn", exp->WinCon1,
-			&(exp->Params->DLPOnFlash), 1, (int) NULL);
+			&(exp->GuiParams->DLPOnFlash), 1, (int) NULL);
 
 	cvCreateTrackbar("IllumSweepHT", exp->WinCon1,
-				&(exp->Params->IllumSweepHT), 1, (int) NULL);
+				&(exp->GuiParams->IllumSweepHT), 1, (int) NULL);
 
 	cvCreateTrackbar("IllumSweepOn", exp->WinCon1,
-				&(exp->Params->IllumSweepOn), 1, (int) NULL);
+				&(exp->GuiParams->IllumSweepOn), 1, (int) NULL);
 
 
-	cvCreateTrackbar("DLPOn", exp->WinCon1, &(exp->Params->DLPOn), 1,
+	cvCreateTrackbar("DLPOn", exp->WinCon1, &(exp->GuiParams->DLPOn), 1,
 			(int) NULL);
 
 	/** Record Data **/
-	cvCreateTrackbar("RecordOn", exp->WinCon1, &(exp->Params->Record), 1,
+	cvCreateTrackbar("RecordOn", exp->WinCon1, &(exp->GuiParams->Record), 1,
 			(int) NULL);
 
 	/****** Setup Debug Control Panel ******/
 	cvNamedWindow(exp->WinCon2);
 	cvResizeWindow(exp->WinCon2, 450, 800);
 	cvCreateTrackbar("FloodLight", exp->WinCon2,
-			&(exp->Params->IllumFloodEverything), 1, (int) NULL);
+			&(exp->GuiParams->IllumFloodEverything), 1, (int) NULL);
 
 	/** Levels **/
-	cvCreateTrackbar("Min",exp->WinCon2,&(exp->Params->LevelsMin),255, (int) NULL );
-	cvCreateTrackbar("Max",exp->WinCon2,&(exp->Params->LevelsMax),255, (int) NULL );
+	cvCreateTrackbar("Min",exp->WinCon2,&(exp->GuiParams->LevelsMin),255, (int) NULL );
+	cvCreateTrackbar("Max",exp->WinCon2,&(exp->GuiParams->LevelsMax),255, (int) NULL );
 
 	/** Setup Information about Curvature Analysis on the extra control panel **/
 	//Curvature analysis? Yes / No
 	cvCreateTrackbar("KAnalyzeOn", exp->WinCon2,
-			&(exp->Params->CurvatureAnalyzeOn), 1, (int) NULL);
+			&(exp->GuiParams->CurvatureAnalyzeOn), 1, (int) NULL);
 
 	//Trigger based on the derivative of the mean curvature of the head? Yes/No
 	cvCreateTrackbar("KTriggerOn", exp->WinCon2,
-			&(exp->Params->CurvaturePhaseTriggerOn), 1, (int) NULL);
+			&(exp->GuiParams->CurvaturePhaseTriggerOn), 1, (int) NULL);
 
 	//How many number of frames do we go back in time to calculate the derivative?
 	cvCreateTrackbar("KNumFrames", exp->WinCon2,
-				&(exp->Params->CurvaturePhaseNumFrames), 50, (int) NULL);
+				&(exp->GuiParams->CurvaturePhaseNumFrames), 50, (int) NULL);
 
 	//Abs value threshold for mean curvature, greater than which we illuminate
 	cvCreateTrackbar("KThresh*10", exp->WinCon2,
-				&(exp->Params->CurvaturePhaseThreshold), 100, (int) NULL);
+				&(exp->GuiParams->CurvaturePhaseThreshold), 100, (int) NULL);
 
 	//Illuminate during sign of k positive or negative
 	cvCreateTrackbar("KThresh+/-", exp->WinCon2,
-				&(exp->Params->CurvaturePhaseThresholdPositive), 1, (int) NULL);
+				&(exp->GuiParams->CurvaturePhaseThresholdPositive), 1, (int) NULL);
 
 
 	//Illuminate for positive or negative derivative of curvature (kdot >? 0)?
 	cvCreateTrackbar("KdotThresh+/-", exp->WinCon2,
-					&(exp->Params->CurvaturePhaseDerivThresholdPositive), 1, (int) NULL);
+					&(exp->GuiParams->CurvaturePhaseDerivThresholdPositive), 1, (int) NULL);
 
 	cvCreateTrackbar("IllumRefractPeriod", exp->WinCon2,
-			&(exp->Params->IllumRefractoryPeriod), 70, (int) NULL);
+			&(exp->GuiParams->IllumRefractoryPeriod), 70, (int) NULL);
 
 	//Use the minimum DLP On and Refractory Period?
 	cvCreateTrackbar("StayOn&Refract", exp->WinCon2,
-					&(exp->Params->StayOnAndRefract), 1, (int) NULL);
+					&(exp->GuiParams->StayOnAndRefract), 1, (int) NULL);
+
+	/** Illuminate where the worm will be when the DLP shows the pattern **/
+	cvCreateTrackbar("PredictMotion", exp->WinCon2,
+			&(exp->GuiParams->PredictMotion), 1, (int) NULL);
+
+	//Delay inside the DLP, on top of the latency we can measure
+	cvCreateTrackbar("DLPDelay ms", exp->WinCon2,
+			&(exp->GuiParams->DLPLatencyMs), 50, (int) NULL);
 
 
 
 
 	/** If we have loaded a protocol, set up protocol specific sliders **/
 	if (exp->pflag) {
-		cvCreateTrackbar("Protocol", exp->WinCon2, &(exp->Params->ProtocolUse),
+		cvCreateTrackbar("Protocol", exp->WinCon2, &(exp->GuiParams->ProtocolUse),
+				1, (int) NULL);
+
+		/** In multi-worm mode, each new worm gets the next protocol step **/
+		cvCreateTrackbar("StepByID", exp->WinCon2, &(exp->GuiParams->MultiWormStepByID),
 				1, (int) NULL);
 
-		if (exp->p->Steps->total > 1){
+		if (ProtocolNumSteps(exp->p) > 1){
 			cvCreateTrackbar("ProtoStep", exp->WinCon2,
-					&(exp->Params->ProtocolStep), exp->p->Steps->total - 1,
+					&(exp->GuiParams->ProtocolStep), ProtocolNumSteps(exp->p) - 1,
 					(int) NULL);
 
 			/** Secondary Protocol Stop for Timed Switching Applications **/
 			cvCreateTrackbar("Proto2", exp->WinCon2,
-					&(exp->Params->ProtocolSecondaryStep), exp->p->Steps->total - 1,
+					&(exp->GuiParams->ProtocolSecondaryStep), ProtocolNumSteps(exp->p) - 1,
 					(int) NULL);
 			
 			/** Duration for Timed secondary protocol step illumintion **/
 			cvCreateTrackbar("Proto2Dur", exp->WinCon2,
-					&(exp->Params->ProtocolSecondaryDuration), 70,
+					&(exp->GuiParams->ProtocolSecondaryDuration), 70,
 					(int) NULL);
 			
 			cvCreateTrackbar("Proto2On", exp->WinCon2,
-					&(exp->Params->ProtocolSecondaryIsOn), 1,
+					&(exp->GuiParams->ProtocolSecondaryIsOn), 1,
 					(int) NULL);
 					
 				
@@ -920,10 +870,10 @@ void SetupGUI(Experiment* exp) {
 	/** Stage Related GUI elements **/
 	if (exp->stageIsPresent){
 		/* Slider to set Gain Factor akak StageSpeed */
-		cvCreateTrackbar("StageSpeed",exp->WinCon1,&(exp->Params->stageSpeedFactor),300, (int) NULL);
+		cvCreateTrackbar("StageSpeed",exp->WinCon1,&(exp->GuiParams->stageSpeedFactor),300, (int) NULL);
 		/* Within the Activezone, the gain on the feedback is linear with distance, outside it is  flat */
-		cvCreateTrackbar("ActiveZone",exp->WinCon1,&(exp->Params->stageROIRadius),300, (int) NULL);
-		cvCreateTrackbar("TargetSeg",exp->WinCon1,&(exp->Params->stageTargetSegment),99, (int) NULL);
+		cvCreateTrackbar("ActiveZone",exp->WinCon1,&(exp->GuiParams->stageROIRadius),300, (int) NULL);
+		cvCreateTrackbar("TargetSeg",exp->WinCon1,&(exp->GuiParams->stageTargetSegment),99, (int) NULL);
 
 
 		 /** Specifiy the target for trackign by double clicking on the image **/
@@ -945,71 +895,104 @@ void SetupGUI(Experiment* exp) {
  */
 void UpdateGUI(Experiment* exp) {
 
-		cvSetTrackbarPos("DLPFlashOn", exp->WinCon1, (exp->Params->DLPOnFlash));
-		cvSetTrackbarPos("DLPOn", exp->WinCon1, (exp->Params->DLPOn));
+		cvSetTrackbarPos("DLPFlashOn", exp->WinCon1, (exp->GuiParams->DLPOnFlash));
+		cvSetTrackbarPos("DLPOn", exp->WinCon1, (exp->GuiParams->DLPOn));
 
 		/** Illumination Controls **/
-		cvSetTrackbarPos("x", exp->WinCon1, (exp->Params->IllumSquareOrig.x));
-		cvSetTrackbarPos("y", exp->WinCon1, (exp->Params->IllumSquareOrig.y));
-		cvSetTrackbarPos("xRad", exp->WinCon1, (exp->Params->IllumSquareRad.width));
-		cvSetTrackbarPos("yRad", exp->WinCon1, (exp->Params->IllumSquareRad.height));
+		cvSetTrackbarPos("x", exp->WinCon1, (exp->GuiParams->IllumSquareOrig.x));
+		cvSetTrackbarPos("y", exp->WinCon1, (exp->GuiParams->IllumSquareOrig.y));
+		cvSetTrackbarPos("xRad", exp->WinCon1, (exp->GuiParams->IllumSquareRad.width));
+		cvSetTrackbarPos("yRad", exp->WinCon1, (exp->GuiParams->IllumSquareRad.height));
 
-		cvSetTrackbarPos("IllumSweepHT", exp->WinCon1, (exp->Params->IllumSweepHT));
-		cvSetTrackbarPos("IllumSweepOn", exp->WinCon1, (exp->Params->IllumSweepOn));
+		cvSetTrackbarPos("IllumSweepHT", exp->WinCon1, (exp->GuiParams->IllumSweepHT));
+		cvSetTrackbarPos("IllumSweepOn", exp->WinCon1, (exp->GuiParams->IllumSweepOn));
 
 
 		/** Threshold **/
-		cvSetTrackbarPos("Threshold", exp->WinCon1, (exp->Params->BinThresh));
-		cvSetTrackbarPos("Gauss=x*2+1",exp->WinCon1, exp->Params->GaussSize);
+		cvSetTrackbarPos("Threshold", exp->WinCon1, (exp->GuiParams->BinThresh));
+		cvSetTrackbarPos("Gauss=x*2+1",exp->WinCon1, exp->GuiParams->GaussSize);
 
 		/** Updated Temporal IQ **/
 		/** Temporal Coding **/
-		cvSetTrackbarPos("TemporalIQ", exp->WinCon1, (exp->Params->TemporalOn));
+		cvSetTrackbarPos("TemporalIQ", exp->WinCon1, (exp->GuiParams->TemporalOn));
 
 
 		cvSetTrackbarPos("IllumDuration", exp->WinCon1,
-				(exp->Params->IllumDuration));
+				(exp->GuiParams->IllumDuration));
 
 
 		/** Protocol Stuff **/
 		/** If we have loaded a protocol, update protocol specific sliders **/
 		if (exp->pflag) {
-			cvSetTrackbarPos("Protocol", exp->WinCon2, exp->Params->ProtocolUse);
+			cvSetTrackbarPos("Protocol", exp->WinCon2, exp->GuiParams->ProtocolUse);
 
-			if (exp->p->Steps->total > 1){
+			if (ProtocolNumSteps(exp->p) > 1){
 				cvSetTrackbarPos("ProtoStep", exp->WinCon2,
-						(exp->Params->ProtocolStep));
+						(exp->GuiParams->ProtocolStep));
 						
 			/** Secondary Protocol Stop for Timed Switching Applications **/
 			cvSetTrackbarPos("Proto2", exp->WinCon2,
-					(exp->Params->ProtocolSecondaryStep));
+					(exp->GuiParams->ProtocolSecondaryStep));
 			
 			/** Duration for Timed secondary protocol step illumintion **/
 			cvSetTrackbarPos("Proto2Dur", exp->WinCon2,
-					(exp->Params->ProtocolSecondaryDuration));
+					(exp->GuiParams->ProtocolSecondaryDuration));
 			
 			cvSetTrackbarPos("Proto2On", exp->WinCon2,
-					(exp->Params->ProtocolSecondaryIsOn));						
+					(exp->GuiParams->ProtocolSecondaryIsOn));						
 			}
 		}
 
 		/** Floodlight **/
-		cvSetTrackbarPos("FloodLight", exp->WinCon2,exp->Params->IllumFloodEverything);
+		cvSetTrackbarPos("FloodLight", exp->WinCon2,exp->GuiParams->IllumFloodEverything);
 
 
 		/** Record **/
-		cvSetTrackbarPos("RecordOn", exp->WinCon1, (exp->Params->Record));
+		cvSetTrackbarPos("RecordOn", exp->WinCon1, (exp->GuiParams->Record));
 
 		/** Record **/
-		cvSetTrackbarPos("On", exp->WinCon1, (exp->Params->OnOff));
+		cvSetTrackbarPos("On", exp->WinCon1, (exp->GuiParams->OnOff));
 
 		/**Stage Speed **/
-		cvSetTrackbarPos("StageSpeed",exp->WinCon1,(exp->Params->stageSpeedFactor));
+		cvSetTrackbarPos("StageSpeed",exp->WinCon1,(exp->GuiParams->stageSpeedFactor));
 
 	return;
 
 }
 
+/*
+ * Give the display thread its own copy of the parameters and set up the
+ * exchange between it and the processing thread.
+ */
+void StartParamSync(Experiment* exp) {
+	exp->GuiParams = CreateWormAnalysisParam();
+	*(exp->GuiParams) = *(exp->Params);
+	exp->paramSync = CreateParamSync(exp->Params);
+}
+
+/*
+ * Display thread: pull in parameter changes made by the processing thread
+ * and publish changes made by the user.
+ */
+void SyncGUIParams(Experiment* exp) {
+	ParamSyncPull(exp->paramSync, PARAM_SYNC_GUI, exp->GuiParams);
+	ParamSyncPush(exp->paramSync, PARAM_SYNC_GUI, exp->GuiParams);
+}
+
+/*
+ * Processing thread: bring exp->Params up to date with the user's changes.
+ */
+void SyncParamsFromGUI(Experiment* exp) {
+	ParamSyncPull(exp->paramSync, PARAM_SYNC_PROCESSING, exp->Params);
+}
+
+/*
+ * Processing thread: publish changes made during this frame back to the display thread.
+ */
+void PublishProcessingParams(Experiment* exp) {
+	ParamSyncPush(exp->paramSync, PARAM_SYNC_PROCESSING, exp->Params);
+}
+
 /*** Start Video Camera ***/
 
 /*
@@ -1022,8 +1005,20 @@ void UpdateGUI(Experiment* exp) {
  */
 void RollVideoInput(Experiment* exp) {
 	if (exp->VidFromFile) { /** Use source from file **/
-		/** Define the File catpure **/
-		exp->capture = cvCreateFileCapture(exp->infname);
+		if (IsFrameArchiveFileName(exp->infname)) {
+			/** Replay the exact frames of an earlier session **/
+			exp->RawReplay = OpenFrameArchive(exp->infname, exp->FastReplay ? 0 : exp->ReplaySpeed);
+			if (exp->RawReplay != NULL && (exp->RawReplay->header.width != exp->fromCCD->size.width
+					|| exp->RawReplay->header.height != exp->fromCCD->size.height)) {
+				printf("Error! Frame archive is %dx%d but frames are %dx%d.\n",
+						exp->RawReplay->header.width, exp->RawReplay->header.height,
+						exp->fromCCD->size.width, exp->fromCCD->size.height);
+				CloseFrameArchiveReader(&(exp->RawReplay));
+			}
+		} else {
+			/** Decode ahead into frames the same size as the camera's **/
+			exp->video = OpenVideoSource(exp->infname, exp->fromCCD->size, VIDEO_READ_AHEAD);
+		}
 
 	} else {
 		/** Use source from camera **/
@@ -1048,6 +1043,10 @@ void RollVideoInput(Experiment* exp) {
 
 			printf("Frame size checks out..");
 
+			/** Keep exposing while we process. GrabFrame() takes the newest finished frame. **/
+			if (StartContinuousAcquisition(exp->fg, T2FG_RING_BUFFERS) != T2FG_SUCCESS)
+				printf("Falling back to one snap per frame.\n");
+
 			/**Use Frame Grabber **/
 		} else {
 			/** Use ImagingSource USB Camera **/
@@ -1099,10 +1098,12 @@ void InitializeExperiment(Experiment* exp) {
 	IplImage* HUDS = cvCreateImage(cvSize(NSIZEX, NSIZEY), IPL_DEPTH_8U, 1);
 
 
-	exp->CurrentSelectedImg= cvCreateImage(cvSize(NSIZEX,NSIZEY), IPL_DEPTH_8U,1);
+	exp->DisplayBox = CreateDisplayMailbox(cvSize(NSIZEX, NSIZEY));
 
 	exp->SubSampled = SubSampled;
 	exp->HUDS = HUDS;
+	exp->HUDSCache = CreateWormHUDSCache(cvSize(NSIZEX, NSIZEY));
+	exp->HeadCurvature = CreateCurvatureScratch(HEAD_CURVATURE_END-HEAD_CURVATURE_BEGIN,HEAD_CURVATURE_SIGMA);
 
 	/*** Create Frames **/
 	Frame* fromCCD = CreateFrame(cvSize(NSIZEX, NSIZEY));
@@ -1122,6 +1123,18 @@ void InitializeExperiment(Experiment* exp) {
 	/** Create SegWormDLP object using memory from the worm object **/
 	exp->segWormDLP = CreateSegmentedWormStruct();
 
+	/** Latency compensation **/
+	exp->motionPredictor = (MotionPredictor*) malloc(sizeof(MotionPredictor));
+	InitializeMotionPredictor(exp->motionPredictor);
+	exp->segWormPredicted = CreateSegmentedWormStruct();
+	exp->segWormIllum = Worm->Segmented;
+
+	/** Multiple Worms **/
+	exp->multiWorm = CreateMultiWormTracker(cvSize(NSIZEX, NSIZEY));
+
+	/** Timed illumination, on the same clock as the frame timestamps **/
+	exp->sequencer = CreateSequencer(NULL, NULL);
+
 	exp->Worm = Worm;
 	exp->Params = Params;
 
@@ -1132,6 +1145,9 @@ void InitializeExperiment(Experiment* exp) {
 	/** Create MindControl API Shared Memory **/
 	exp->sm=MC_API_StartServer();
 
+	/** Create Telemetry Shared Memory **/
+	exp->telemetry=CreateTelemetry();
+
 }
 
 /*
@@ -1154,6 +1170,18 @@ void ReleaseExperiment(Experiment* exp) {
 		exp->sm=NULL;
 	}
 
+	/** Close the video file and stop its decoder **/
+	CloseVideoSource(&(exp->video));
+	CloseFrameArchiveReader(&(exp->RawReplay));
+
+	/** Stop publishing telemetry **/
+	DestroyTelemetry(&(exp->telemetry));
+
+	/** Send the last stage commands and stop the stage I/O thread **/
+	DestroyStageController(&(exp->stageCtl));
+	if (exp->stageTracker!=NULL) free(exp->stageTracker);
+	exp->stageTracker=NULL;
+
 
 	/** Free up Strings **/
 	exp->dirname = NULL;
@@ -1164,6 +1192,19 @@ void ReleaseExperiment(Experiment* exp) {
 	// Note that the memorystorage for the Cvseq's are in exp->worm->Memorystorage
 	free(exp->segWormDLP);
 
+	/** Latency compensation **/
+	if (exp->segWormPredicted != NULL) DestroySegmentedWormStruct(exp->segWormPredicted);
+	exp->segWormPredicted = NULL;
+	if (exp->motionPredictor != NULL) free(exp->motionPredictor);
+	exp->motionPredictor = NULL;
+	exp->segWormIllum = NULL;
+
+	/** Stop the multi-worm threads. This prints the time per frame by number of worms **/
+	DestroyMultiWormTracker(&(exp->multiWorm));
+
+	/** This prints how late the timed events ran **/
+	DestroySequencer(&(exp->sequencer));
+
 	/** Free up Worm Objects **/
 	if (exp->Worm != NULL) {
 		DestroyWormAnalysisDataStruct((exp->Worm));
@@ -1174,6 +1215,11 @@ void ReleaseExperiment(Experiment* exp) {
 		DestroyWormAnalysisParam((exp->Params));
 		exp->Params = NULL;
 	}
+	if (exp->GuiParams != NULL) {
+		DestroyWormAnalysisParam((exp->GuiParams));
+		exp->GuiParams = NULL;
+	}
+	DestroyParamSync(&(exp->paramSync));
 	if (exp->PrevWorm != NULL) {
 		DestroyWormGeom(&(exp->PrevWorm));
 		exp->PrevWorm = NULL;
@@ -1184,6 +1230,9 @@ void ReleaseExperiment(Experiment* exp) {
 		cvReleaseImage(&(exp->SubSampled));
 	if (exp->HUDS != NULL)
 		cvReleaseImage(&(exp->HUDS));
+	DestroyWormHUDSCache(&(exp->HUDSCache));
+	DestroyCurvatureScratch(&(exp->HeadCurvature));
+	DestroyDisplayMailbox(&(exp->DisplayBox));
 
 	/** Free Up Calib Data **/
 	if (exp->Calib != NULL)
@@ -1209,6 +1258,16 @@ void DestroyExperiment(Experiment** exp) {
  *
  */
 
+/*
+ * Copy a newly acquired frame into fromCCD and, in the same pass, its
+ * levels adjusted version into the worm's ImgOrig for segmentation.
+ * The levels table is only rebuilt when LevelsMin or LevelsMax change.
+ */
+static int IngestFrame(Experiment* exp, unsigned char* src){
+	SetLevelsLUT(&(exp->Levels), exp->Params->LevelsMin, exp->Params->LevelsMax);
+	return LoadFrameWithBinAndLevels(src, exp->fromCCD, exp->Worm->ImgOrig, &(exp->Levels));
+}
+
 /** Grab a Frame from either camera or video source
  *
  */
@@ -1218,59 +1277,89 @@ int GrabFrame(Experiment* exp) {
 		/** Acquire from Physical Camera **/
 		if (exp->UseFrameGrabber) {
 			/** Use BitFlow SDK to acquire from Frame Grabber **/
-			if (AcquireFrame(exp->fg)==T2FG_ERROR){
-				return EXP_ERROR;
-			}
+			if (exp->fg->ring == NULL) {
+				if (AcquireFrame(exp->fg)==T2FG_ERROR){
+					return EXP_ERROR;
+				}
+
+				/** Check to see if file sizes match **/
+
+				if (IngestFrame(exp, exp->fg->HostBuf)!=0) return EXP_ERROR;
+			} else {
+				/** Take the newest frame the acquisition thread has finished **/
+				unsigned char* frame;
+				unsigned long seq;
+				if (FrameRingGetNewest(exp->fg->ring, exp->lastFrameSeenOutside,
+						CAM_FRAME_TIMEOUT_MS, &frame, &seq) != FRAMERING_OK) {
+					return EXP_ERROR;
+				}
 
-			/** Check to see if file sizes match **/
+				/** Frames the ring completed between the last one we took and this one were dropped **/
+				if (exp->lastFrameSeenOutside > 0 && seq > exp->lastFrameSeenOutside + 1)
+					TelemetryAddDroppedFrames(exp->telemetry, (long) (seq - exp->lastFrameSeenOutside - 1));
+				exp->lastFrameSeenOutside = seq;
 
-			LoadFrameWithBin(exp->fg->HostBuf, exp->fromCCD);
+				int bad=IngestFrame(exp, frame);
+				FrameRingRelease(exp->fg->ring);
+				if (bad) return EXP_ERROR;
+			}
 
 		} else {
 
 			/** Acqure from ImagingSource USB Cam **/
+			/** isFrameReady() already claimed the newest slot of the triple buffer. It is ours until the next wait. **/
 
-			exp->lastFrameSeenOutside = exp->MyCamera->iFrameNumber;
+			/** Any camera frames between the last one we saw and this one were dropped **/
+			unsigned long camFrame = exp->MyCamera->iFrameNumber;
+			if (exp->lastFrameSeenOutside > 0 && camFrame > exp->lastFrameSeenOutside + 1)
+				TelemetryAddDroppedFrames(exp->telemetry, (long) (camFrame - exp->lastFrameSeenOutside - 1));
+			exp->lastFrameSeenOutside = camFrame;
 			/*** Create a local copy of the image***/
-			LoadFrameWithBin(exp->MyCamera->iImageData, exp->fromCCD);
+			if (IngestFrame(exp, exp->MyCamera->iImageData)!=0) return EXP_ERROR;
 
 		}
 
 	} else {
 
 		/** Acquire  from file **/
+		if (exp->RawReplay != NULL) {
+			/** Raw archive: restore the original frame numbers and timestamps too **/
+			FrameArchiveRecordHeader hdr;
+			unsigned char* frame;
+			int ret = ReadFrameFromArchive(exp->RawReplay, &hdr, &frame);
+			if (ret == FRAMEARCHIVE_EOF) {
+				printf("There are no more frames in the archive!\n");
+				return EXP_VIDEO_RAN_OUT;
+			}
+			if (ret != FRAMEARCHIVE_OK) return EXP_VIDEO_RAN_OUT;
 
-		IplImage* tempImg;
-		/** Grab the frame from the video **/
-		tempImg = cvQueryFrame(exp->capture);
-
-		/** Stall for a little bit **/
-		//Sleep(50);
-
+			if (IngestFrame(exp, frame)!=0) return EXP_ERROR;
+			exp->lastFrameSeenOutside = (unsigned long) hdr.camFrameNum;
+			exp->grabTimeUs = hdr.timestampUs;
+			exp->Worm->frameNum = (int) hdr.frameNum;
+			return EXP_SUCCESS;
+		}
 
-		if (tempImg == NULL) {
-			printf("There was an error querying the frame from video!\n");
+		if (exp->video == NULL) {
+			printf("The input video could not be opened!\n");
 			return EXP_VIDEO_RAN_OUT;
 		}
+		unsigned char* frame;
+		int ret = VideoSourceNextFrame(exp->video, &frame);
+		if (ret == VIDSRC_EOF) {
+			printf("There are no more frames in the video!\n");
+			return EXP_VIDEO_RAN_OUT;
+		}
+		if (ret != VIDSRC_OK) {
+			printf("There was an error querying the frame from video!\n");
+			return EXP_ERROR;
+		}
 
-		/** Create a new temp image that is grayscale and of the same size **/
-		IplImage* tempImgGray = cvCreateImage(cvGetSize(tempImg), IPL_DEPTH_8U,
-				1);
-
-		/** Convert Color to GrayScale **/
-		cvCvtColor(tempImg, tempImgGray, CV_RGB2GRAY);
-
-		/** Load the frame into the fromCCD frame object **/
-		/*** ANDY! THIS WILL FAIL BECAUSE THE SIZING ISN'T RIGHT **/
-		LoadFrameWithImage(tempImgGray, exp->fromCCD);
-		cvReleaseImage(&tempImgGray);
-		/*
-		 * Note: for some reason thingt crash when you go cvReleaseImage(&tempImg)
-		 * And there don't seem to be memory leaks if you leave it. So I'm going to leave it in place.
-		 *
-		 */
+		/** Already grayscale and fitted to fromCCD's size **/
+		if (IngestFrame(exp, frame)!=0) return EXP_ERROR;
 	}
 
+	exp->grabTimeUs = MonotonicUs();
 	exp->Worm->frameNum++;
 	return EXP_SUCCESS;
 }
@@ -1278,17 +1367,25 @@ int GrabFrame(Experiment* exp) {
 /*
  * Is a frame ready from the camera?
  *
+ * For the ImagingSource camera we sleep on the camera's frame event
+ * rather than spinning, and give up after CAM_FRAME_TIMEOUT_MS so the
+ * main loop can still notice that the user wants to stop.
+ *
  */
 int isFrameReady(Experiment* exp) {
 	if (!(exp->VidFromFile) && !(exp->UseFrameGrabber)) {
 		/** If This isn't a simulation.. **/
 		/** And if we arent using the frame grabber **/
-		return (exp->MyCamera->iFrameNumber > exp->lastFrameSeenOutside);
+		int ret = T2Cam_WaitForFrame(exp->MyCamera, CAM_FRAME_TIMEOUT_MS);
+		if (ret == T2CAM_TIMEOUT && exp->MyCamera->iTimeouts % 10 == 1)
+			printf("Still waiting for a frame from the camera...\n");
+		return (ret == T2CAM_FRAME_READY);
 	} else {
 		/** Otherwise just keep chugging... **/
 
 		/** Unless we're reading from video, in which case we should fake like we're waiting for something **/
-		if (exp->VidFromFile)
+		/** A raw archive paces itself from its timestamps **/
+		if (exp->VidFromFile && !(exp->FastReplay) && exp->RawReplay == NULL)
 			cvWaitKey(100);
 		return 1;
 	}
@@ -1356,6 +1453,19 @@ int SetupRecording(Experiment* exp) {
 		DestroyFilename(&HUDSFileName);
 		printf("Initialized video recording\n");
 	}
+
+	/** Set Up Raw Frame Archive **/
+	if (exp->RECORDRAW) {
+		if (exp->dirname == NULL || exp->outfname == NULL) {
+			printf("Error! Recording a raw frame archive requires -o.\n");
+			return -1;
+		}
+		char* RawFileName = CreateFileName(exp->dirname, exp->outfname, FRAMEARCHIVE_EXTENSION);
+		exp->RawArchive = CreateFrameArchive(RawFileName, exp->fromCCD->size.width,
+				exp->fromCCD->size.height, FRAMEARCHIVE_UNBUFFERED, exp->RawArchiveCodec);
+		DestroyFilename(&RawFileName);
+		if (exp->RawArchive == NULL) return -1;
+	}
 	return 0;
 
 }
@@ -1372,6 +1482,9 @@ void FinishRecording(Experiment* exp) {
 	if (exp->VidHUDS != NULL)
 		cvReleaseVideoWriter(&(exp->VidHUDS));
 
+	/** Flush the raw frame archive **/
+	CloseFrameArchive(&(exp->RawArchive));
+
 	/** Finish Writing to Disk **/
 	if (exp->RECORDDATA)
 		FinishWriteToDisk(&(exp->DataWriter));
@@ -1416,6 +1529,22 @@ void CalculateAndPrintFrameRateAndInfo(Experiment* exp) {
 			printf("%d fps\n", fps);
 		}
 
+		/** If the stage is tracking, show how quickly it answers **/
+		if (exp->stageCtl != NULL && exp->Params->stageTrackingOn) {
+			StageStats stage;
+			GetStageStats(exp->stageCtl, &stage);
+			printf("\tstage %ld sent, %ld coalesced, round trip %.1f ms median %.1f ms max\n",
+					stage.sent, stage.coalesced, stage.rttP50, stage.rttMax);
+		}
+
+		/** If we are compressing frames to disk, show how well it's keeping up **/
+		if (exp->RawArchive != NULL && exp->RawArchiveCodec != FRAMEARCHIVE_CODEC_RAW) {
+			double ratio, meanEncodeUs, maxEncodeUs;
+			if (FrameArchiveStats(exp->RawArchive, &ratio, &meanEncodeUs, &maxEncodeUs) > 0)
+				printf("\tarchive %.2f:1, encode %.0f us mean, %.0f us max\n",
+						ratio, meanEncodeUs, maxEncodeUs);
+		}
+
 		/** In all cases, reset the timer **/
 		exp->prevFrames = exp->Worm->frameNum;
 		exp->prevTime = exp->Worm->timestamp;
@@ -1453,6 +1582,16 @@ void DoSegmentation(Experiment* exp) {
 	_TICTOC_TIC_FUNC
 	/*** <segmentworm> ***/
 
+	/** Several worms **/
+	if (MultiWormIsOn(exp)) {
+		DoMultiWormSegmentation(exp);
+		_TICTOC_TOC_FUNC
+		return;
+	}
+
+	/** Forget any worms from multi-worm mode **/
+	if (exp->multiWorm != NULL) ResetMultiWormTracker(exp->multiWorm);
+
 	/*** Find Worm Boundary ***/
 	/*
 	 *  There is a lot in this one function, FindWormBoudnary(), including:
@@ -1494,67 +1633,151 @@ void DoSegmentation(Experiment* exp) {
 	/** Update PrevWorm Info **/
 	if (!(exp->e))
 		LoadWormGeom(exp->PrevWorm, exp->Worm);
+	else
+		TelemetryAddSegmentationFailure(exp->telemetry);
 
 	/*** </segmentworm> ***/
 _TICTOC_TOC_FUNC
 }
 
+/*
+ * Find and segment every worm, in parallel. exp->Worm gets a copy of the
+ * primary worm, so that everything that follows one worm follows that one.
+ */
+void DoMultiWormSegmentation(Experiment* exp) {
+	TICTOC::timer().tic("MultiWormSegment",exp->e);
+	if (!(exp->e))
+		exp->e = MultiWormSegment(exp->multiWorm, exp->Worm, exp->Params);
+	TICTOC::timer().toc("MultiWormSegment",exp->e);
+
+	/** MultiWormSegment() has flipped the primary worm if asked to **/
+	exp->Params->InduceHeadTailFlip=0;
+
+	if (!(exp->e))
+		exp->e = LoadWormSegmentation(exp->Worm, MultiWormPrimary(exp->multiWorm)->Worm);
+
+	AssignMultiWormProtocolSteps(exp);
+	TelemetrySetQueueDepth(exp->telemetry,"Worms",MultiWormCount(exp->multiWorm));
+
+	/** Update PrevWorm Info **/
+	if (!(exp->e))
+		LoadWormGeom(exp->PrevWorm, exp->Worm);
+	else
+		TelemetryAddSegmentationFailure(exp->telemetry);
+}
+
+/*
+ * Give each worm seen for the first time this frame its protocol step:
+ * the next step in turn if StepByID is on, otherwise the ProtocolStep slider's.
+ */
+void AssignMultiWormProtocolSteps(Experiment* exp) {
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(exp->multiWorm->track[k]);
+		if (t->id == 0 || !t->seen || t->age != 0) continue;
+		if (exp->Params->MultiWormStepByID && exp->pflag && ProtocolNumSteps(exp->p) > 0) {
+			t->protocolStep = (t->id - 1) % ProtocolNumSteps(exp->p);
+			printf("Worm %d gets protocol step %d\n", t->id, t->protocolStep);
+		} else {
+			t->protocolStep = MULTIWORM_FOLLOW_SLIDER;
+		}
+	}
+}
+
+/*
+ * The protocol step a worm is illuminated with
+ */
+int MultiWormTrackProtocolStep(Experiment* exp, MultiWormTrack* t) {
+	if (t->protocolStep < 0 || !(exp->pflag) || t->protocolStep >= ProtocolNumSteps(exp->p))
+		return exp->Params->ProtocolStep;
+	return t->protocolStep;
+}
+
 
 /*
  * Add a rectangle to the image to denote the target for stage recentering.
  */
-void MarkRecenteringTarget(Experiment* exp){
+void MarkRecenteringTarget(Experiment* exp, IplImage* img){
 
 	CvPoint a=cvPoint( exp->stageFeedbackTarget.x +2, exp->stageFeedbackTarget.y +2);
 	CvPoint b=cvPoint(exp->stageFeedbackTarget.x -2, exp->stageFeedbackTarget.y -2);
-	cvRectangle(exp->HUDS,a,b, cvScalar(255,255,255),1);
+	cvRectangle(img,a,b, cvScalar(255,255,255),1);
+
+}
+
+
+/*
+ * Label each worm with its ID, by its head.
+ */
+void MarkMultiWormIDs(Experiment* exp, IplImage* img){
+	char label[16];
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(exp->multiWorm->track[k]);
+		if (t->id == 0 || !t->seen || t->e != 0) continue;
+		CvPoint* head = t->Worm->Segmented->Head;
+		sprintf(label, "%d", t->id);
+		cvPutText(img, label, cvPoint(head->x + 8, head->y - 8), &(exp->HUDSCache->font), cvScalar(255,255,255));
+	}
+}
+
 
+/*
+ * Is the heads up display going to be recorded this frame?
+ */
+int HUDSIsRecorded(Experiment* exp){
+	return (exp->RECORDVID && exp->Params->Record);
 }
 
+/*
+ * Draw the heads up display and the stage recentering target into dest
+ */
+void ComposeHUDS(Experiment* exp, IplImage* dest){
+	TICTOC::timer().tic("ComposeHUDS");
+	ComposeWormHUDS(exp->HUDSCache,dest,exp->Worm,exp->Params,exp->IlluminationFrame);
+	if (exp->stageIsPresent==1) MarkRecenteringTarget(exp,dest);
+	if (MultiWormIsOn(exp)) MarkMultiWormIDs(exp,dest);
+	TelemetryAddSample(exp->telemetry,TELEM_HUDS,TICTOC::timer().toc("ComposeHUDS"));
+}
 
 /*
  * Prepare the Selected Display
- *
+ * Draws the selected image into the display mailbox and hands it to the display thread.
  */
 void PrepareSelectedDisplay(Experiment* exp) {
+	IplImage* out = DisplayMailboxBackImage(exp->DisplayBox);
+
 	/** There are no errors and we are displaying a frame **/
 	switch (exp->Params->Display) {
 	case 0:
-		//			 cvShowImage(exp->WinDisp, exp->Worm->ImgOrig);
-		exp->CurrentSelectedImg = exp->Worm->ImgOrig;
-
+		cvCopy(exp->Worm->ImgOrig, out, 0);
 		break;
 	case 1:
-		//			cvShowImage(exp->WinDisp,exp->HUDS);
-		exp->CurrentSelectedImg = exp->HUDS;
+	case 3: /** Head and tail display: for now the HUDS, which marks them **/
+		/** Reuse the HUDS if it was drawn for the video, otherwise draw it straight into the mailbox **/
+		if (HUDSIsRecorded(exp)) {
+			cvCopy(exp->HUDS, out, 0);
+		} else {
+			ComposeHUDS(exp, out);
+		}
 		break;
 	case 2:
-		//			 cvShowImage(exp->WinDisp,exp->Worm->ImgThresh);
-		exp->CurrentSelectedImg = exp->Worm->ImgThresh;
-		break;
-	case 3:
-		/** Implement this!! **/
-		//			 DisplayWormHeadTail(exp->Worm,exp->WinDisp);
-		exp->CurrentSelectedImg = exp->HUDS; // For now...
+		cvCopy(exp->Worm->ImgThresh, out, 0);
 		break;
 	case 4:
-		/** Implement this!! **/
-		DisplayWormSegmentation(exp->Worm,exp->CurrentSelectedImg);
-
+		DisplayWormSegmentation(exp->Worm, out);
 		break;
 	case 5:
-		//			cvShowImage(exp->WinDisp,exp->IlluminationFrame->iplimg);
-		exp->CurrentSelectedImg = exp->IlluminationFrame->iplimg;
+		cvCopy(exp->IlluminationFrame->iplimg, out, 0);
 		break;
 	case 6:
-		//			cvShowImage(exp->WinDisp, exp->forDLP->iplimg);
-		exp->CurrentSelectedImg = exp->forDLP->iplimg;
+		cvCopy(exp->forDLP->iplimg, out, 0);
 		break;
 	default:
-		break;
+		/** Nothing to show, keep showing the last image **/
+		return;
 	}
-	//cvWaitKey(1); // Pause one millisecond for things to display onscreen.
-
+	DisplayMailboxPublish(exp->DisplayBox);
 }
 
 /*
@@ -1569,135 +1792,135 @@ int HandleKeyStroke(int c, Experiment* exp) {
 	case 27:
 		printf("User has pressed escape!\n");
 		printf("Setting Stagge Tracking Variables to off");
-		exp->Params->stageTrackingOn=0;
+		exp->GuiParams->stageTrackingOn=0;
 		exp->stageIsTurningOff=1;
 		return 1;
 		break;
 	case ' ': /** Turn on off dlp **/
-		Toggle(&(exp->Params->DLPOn));
+		Toggle(&(exp->GuiParams->DLPOn));
 		break;
 	case 'r': /** record **/
-		Toggle(&(exp->Params->Record));
+		Toggle(&(exp->GuiParams->Record));
 		break;
 	case 'f': /** turn on off flood light **/
-		Toggle(&(exp->Params->IllumFloodEverything));
+		Toggle(&(exp->GuiParams->IllumFloodEverything));
 		break;
 
 	/** on off **/
 	case 'o':
-		Toggle(&(exp->Params->OnOff));
+		Toggle(&(exp->GuiParams->OnOff));
 		break;
 	/** On-The Fly Illumination Origin **/
 	case 'j':
-		Decrement(&(exp->Params->IllumSquareOrig.x),0);
+		Decrement(&(exp->GuiParams->IllumSquareOrig.x),0);
 		break;
 	case 'l':
-		Increment(&(exp->Params->IllumSquareOrig.x),exp->Params->DefaultGridSize.width-1);
+		Increment(&(exp->GuiParams->IllumSquareOrig.x),exp->GuiParams->DefaultGridSize.width-1);
 		break;
 	case 'k':
-		Decrement(&(exp->Params->IllumSquareOrig.y),0);
+		Decrement(&(exp->GuiParams->IllumSquareOrig.y),0);
 		break;
 	case 'i':
-		Increment(&(exp->Params->IllumSquareOrig.y),exp->Params->DefaultGridSize.height-1);
+		Increment(&(exp->GuiParams->IllumSquareOrig.y),exp->GuiParams->DefaultGridSize.height-1);
 		break;
 
 	/** On-The Fly Illumination Radius **/
 	case 'a':
-		Decrement(&(exp->Params->IllumSquareRad.width),0);
-		printf("Illumination Square Width Radius: %d",exp->Params->IllumSquareRad.height);
+		Decrement(&(exp->GuiParams->IllumSquareRad.width),0);
+		printf("Illumination Square Width Radius: %d",exp->GuiParams->IllumSquareRad.height);
 		break;
 	case 'd':
-		Increment(&(exp->Params->IllumSquareRad.width),exp->Params->DefaultGridSize.width-1);
-		printf("Illumination Square Width Radius: %d",exp->Params->IllumSquareRad.height);
+		Increment(&(exp->GuiParams->IllumSquareRad.width),exp->GuiParams->DefaultGridSize.width-1);
+		printf("Illumination Square Width Radius: %d",exp->GuiParams->IllumSquareRad.height);
 		break;
 	case 's':
-		Decrement(&(exp->Params->IllumSquareRad.height),0);
-		printf("Illumination Square Height Radius: %d",exp->Params->IllumSquareRad.height);
+		Decrement(&(exp->GuiParams->IllumSquareRad.height),0);
+		printf("Illumination Square Height Radius: %d",exp->GuiParams->IllumSquareRad.height);
 		break;
 	case 'w':
-		Increment(&(exp->Params->IllumSquareRad.height),exp->Params->DefaultGridSize.height-1);
-		printf("Illumination Square Height Radius: %d",exp->Params->IllumSquareRad.height);
+		Increment(&(exp->GuiParams->IllumSquareRad.height),exp->GuiParams->DefaultGridSize.height-1);
+		printf("Illumination Square Height Radius: %d",exp->GuiParams->IllumSquareRad.height);
 		break;
 
 	/** Head-Tail Illumination Sweep **/
 	case 'u': //initiate head-to-tail illumination sweep
-		Toggle(&(exp->Params->IllumSweepOn));
+		Toggle(&(exp->GuiParams->IllumSweepOn));
 		printf("u key pressed!\n");
 		break;
 
 	case 'U'://switch direction of head sweep
-		Toggle(&(exp->Params->IllumSweepHT));
+		Toggle(&(exp->GuiParams->IllumSweepHT));
 		break;
 	/** Protocol **/
 	case 'p':
-		if (exp->pflag) Toggle(&(exp->Params->ProtocolUse));
+		if (exp->pflag) Toggle(&(exp->GuiParams->ProtocolUse));
 		break;
 	case '.':
-		if (exp->pflag) Increment(&(exp->Params->ProtocolStep),CropNumber(0,exp->Params->ProtocolTotalSteps,exp->Params->ProtocolTotalSteps-1));
+		if (exp->pflag) Increment(&(exp->GuiParams->ProtocolStep),CropNumber(0,exp->GuiParams->ProtocolTotalSteps,exp->GuiParams->ProtocolTotalSteps-1));
 		break;
 	case ',':
-		if (exp->pflag) Decrement(&(exp->Params->ProtocolStep),0);
+		if (exp->pflag) Decrement(&(exp->GuiParams->ProtocolStep),0);
 		break;
 
 	/** Threshold **/
 	case ']':
-		Increment(&(exp->Params->BinThresh),200);
+		Increment(&(exp->GuiParams->BinThresh),200);
 		break;
 	case '[':
-		Decrement(&(exp->Params->BinThresh),0);
+		Decrement(&(exp->GuiParams->BinThresh),0);
 		break;
 
 	/** Gaussian Blur **/
 	case 'G':
-		Increment(&(exp->Params->GaussSize),10);
+		Increment(&(exp->GuiParams->GaussSize),10);
 		break;
 	case 'g':
-		Decrement(&(exp->Params->GaussSize),0);
+		Decrement(&(exp->GuiParams->GaussSize),0);
 		break;
 
 	/** Timed DLP on **/
 	case '/':
-		Toggle(&(exp->Params->DLPOnFlash));
+		Toggle(&(exp->GuiParams->DLPOnFlash));
 		break;
 
 	case '<':
-		Decrement(&(exp->Params->IllumDuration),0);
+		Decrement(&(exp->GuiParams->IllumDuration),0);
 		break;
 
 	case '>':
-		Increment(&(exp->Params->IllumDuration),100);
+		Increment(&(exp->GuiParams->IllumDuration),100);
 		break;
 
 	/** Timed Secondary Protocol Illumination **/
     case 'q':
-		Toggle(&(exp->Params->ProtocolSecondaryIsOn));
+		Toggle(&(exp->GuiParams->ProtocolSecondaryIsOn));
 		break;
 		
 	/** Temporal **/
 	case 't':
-		Toggle(&(exp->Params->TemporalOn));
+		Toggle(&(exp->GuiParams->TemporalOn));
 		break;
 	case 'F':
-		Toggle(&(exp->Params->InduceHeadTailFlip));
+		Toggle(&(exp->GuiParams->InduceHeadTailFlip));
 		break;
 
 
 
 	/** Invert Selection **/
 	case 'v':
-		Toggle(&(exp->Params->IllumInvert));
+		Toggle(&(exp->GuiParams->IllumInvert));
 		break;
 
 	/** Reflect Illumination over centerline **/
 	/** (flip dorsal-ventral) **/
 	case 'V':
-		Toggle(&(exp->Params->IllumFlipLR));
+		Toggle(&(exp->GuiParams->IllumFlipLR));
 		break;
 
 	/** Tracker **/
 	case '\t':
-		Toggle(&(exp->Params->stageTrackingOn));
-		if (exp->Params->stageTrackingOn==0) {
+		Toggle(&(exp->GuiParams->stageTrackingOn));
+		if (exp->GuiParams->stageTrackingOn==0) {
 			/** If we are turning the stage off, let the rest of the code know **/
 			printf("Turning tracking off!\n");
 			exp->stageIsTurningOff=1;
@@ -1706,17 +1929,22 @@ int HandleKeyStroke(int c, Experiment* exp) {
 		}
 		break;
 	case 'X':
-		Increment(&(exp->Params->stageSpeedFactor),50);
-		printf("stageSpeedFactor=%d\n",exp->Params->stageSpeedFactor);
+		Increment(&(exp->GuiParams->stageSpeedFactor),50);
+		printf("stageSpeedFactor=%d\n",exp->GuiParams->stageSpeedFactor);
 		break;
 	case 'Z':
-		Decrement(&(exp->Params->stageSpeedFactor),0);
-		printf("stageSpeedFactor=%d\n",exp->Params->stageSpeedFactor);
+		Decrement(&(exp->GuiParams->stageSpeedFactor),0);
+		printf("stageSpeedFactor=%d\n",exp->GuiParams->stageSpeedFactor);
+		break;
+
+	/** Profiling **/
+	case 'T':
+		FlushTrace(exp);
 		break;
 
 	case 127: /** Delete key **/
 	case 8: /** Backspace key **/
-		exp->Params->stageTrackingOn=0;
+		exp->GuiParams->stageTrackingOn=0;
 		exp->stageIsTurningOff=1;
 		printf("Instructing stage to turn off..");
 		break;
@@ -1755,6 +1983,21 @@ void SyncAPI(Experiment* exp){
 
 }
 
+/*
+ * If tracing was requested with the -T switch, write out the
+ * most recent tic/toc events to exp->tracefname in Chrome trace format.
+ */
+int FlushTrace(Experiment* exp){
+	if (exp->tracefname == NULL || !TICTOC::timer().isTracing()) return 0;
+	int numEvents=TICTOC::timer().writeTrace(exp->tracefname);
+	if (numEvents < 0) {
+		printf("Error writing trace to %s\n",exp->tracefname);
+		return EXP_ERROR;
+	}
+	printf("Wrote %d trace events to %s\n",numEvents,exp->tracefname);
+	return EXP_SUCCESS;
+}
+
 /*
  * Write video and data to Disk
  *
@@ -1788,11 +2031,35 @@ void DoWriteToDisk(Experiment* exp) {
 		cvWriteFrame(exp->VidHUDS, exp->SubSampled);
 	}
 
+	/** Record the untouched camera frame to the raw archive **/
+	if (exp->RawArchive != NULL && exp->Params->Record) {
+		TICTOC::timer().tic("AppendFrameToArchive");
+		AppendFrameToArchive(exp->RawArchive, exp->fromCCD->binary, exp->Worm->frameNum,
+				exp->lastFrameSeenOutside, exp->grabTimeUs);
+		TICTOC::timer().toc("AppendFrameToArchive");
+	}
+
 	/** Record data frame to diskl **/
 
 	if (exp->RECORDDATA && exp->Params->Record) {
 		TICTOC::timer().tic("AppendWormFrameToDisk");
-		AppendWormFrameToDisk(exp->Worm, exp->Params, exp->DataWriter);
+		if (MultiWormIsOn(exp)) {
+			WormAnalysisData* worms[MULTIWORM_MAX_WORMS];
+			int ids[MULTIWORM_MAX_WORMS];
+			int steps[MULTIWORM_MAX_WORMS];
+			int n = 0, k;
+			for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+				MultiWormTrack* t = &(exp->multiWorm->track[k]);
+				if (t->id == 0 || !t->seen || t->e != 0) continue;
+				worms[n] = t->Worm;
+				ids[n] = t->id;
+				steps[n] = MultiWormTrackProtocolStep(exp, t);
+				n++;
+			}
+			AppendMultiWormFrameToDisk(exp->Worm, exp->Params, exp->DataWriter, worms, ids, steps, n);
+		} else {
+			AppendWormFrameToDisk(exp->Worm, exp->Params, exp->DataWriter);
+		}
 		TICTOC	::timer().toc("AppendWormFrameToDisk");
 	}
 
@@ -1811,7 +2078,7 @@ int DoOnTheFlyIllumination(Experiment* exp) {
 	tmp=GenerateSimpleIllumMontage(montage, origin, exp->Params->IllumSquareRad, exp->Params->DefaultGridSize);
 	/** Illuminate the worm **/
 	/** ...in camera space **/
-	IllumWorm(exp->Worm->Segmented, montage, exp->IlluminationFrame->iplimg,
+	IllumWorm(exp->segWormIllum, montage, exp->IlluminationFrame->iplimg,
 			exp->Params->DefaultGridSize,exp->Params->IllumFlipLR);
 			
 	LoadFrameWithImage(exp->IlluminationFrame->iplimg, exp->IlluminationFrame);
@@ -1824,6 +2091,47 @@ int DoOnTheFlyIllumination(Experiment* exp) {
 
 }
 
+int MultiWormIsOn(Experiment* exp) {
+	return (exp->multiWorm != NULL && exp->Params->MultiWorm > 1);
+}
+
+int DoMultiWormIllumination(Experiment* exp) {
+	MultiWormTracker* mw = exp->multiWorm;
+	CvSeq* montage = NULL;
+	CvSize gridSize = exp->Params->DefaultGridSize;
+
+	/** Without a protocol every worm gets the slider rectangle **/
+	if (!(exp->Params->ProtocolUse)) {
+		montage = CreateIlluminationMontage(exp->Worm->MemScratchStorage);
+		CvPoint origin = ConvertSlidlerToWormSpace(exp->Params->IllumSquareOrig,exp->Params->DefaultGridSize);
+		GenerateSimpleIllumMontage(montage, origin, exp->Params->IllumSquareRad, exp->Params->DefaultGridSize);
+	} else {
+		gridSize = exp->p->GridSize;
+	}
+
+	TICTOC::timer().tic("DoMultiWormIllumination");
+	int k;
+	for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+		MultiWormTrack* t = &(mw->track[k]);
+		if (t->id == 0 || !t->seen || t->e != 0) continue;
+
+		int onDLP = (TransformSegWormCam2DLP(t->Worm->Segmented, t->segWormDLP, exp->Calib) == 1);
+
+		CvSeq* m = montage;
+		if (exp->Params->ProtocolUse) m = GetMontageFromProtocolInterp(exp->p, MultiWormTrackProtocolStep(exp, t));
+
+		/** Draw on top of the worms already drawn, in camera space and, if the worm maps onto it, in DLP space **/
+		IllumWorm(t->Worm->Segmented, m, exp->IlluminationFrame->iplimg, gridSize, exp->Params->IllumFlipLR);
+		if (onDLP) IllumWorm(t->segWormDLP, m, exp->forDLP->iplimg, gridSize, exp->Params->IllumFlipLR);
+	}
+	LoadFrameWithImage(exp->IlluminationFrame->iplimg, exp->IlluminationFrame);
+	LoadFrameWithImage(exp->forDLP->iplimg, exp->forDLP);
+	TelemetryAddSample(exp->telemetry,TELEM_ILLUMINATE,TICTOC::timer().toc("DoMultiWormIllumination"));
+
+	if (montage != NULL) cvClearSeq(montage);
+	return 0;
+}
+
 /**
  * Invert the illumination, so white becomes black and vice-versa.
  */
@@ -1853,16 +2161,21 @@ void InvertIllumination(Experiment* exp){
  */
 
 /*
- * Load a protocol from a YAML file into the
+ * Load a protocol from a YAML or compiled protocol file into the
  * experiment structure.
  *
  * Protocol filename must be specified in exp->protocolfname
  */
 void LoadProtocol(Experiment* exp) {
 	exp->p = LoadProtocolFromFile(exp->protocolfname);
+	if (exp->p == NULL) {
+		printf("Error! Could not load protocol %s. Running without a protocol.\n", exp->protocolfname);
+		exp->pflag = 0;
+		return;
+	}
 	/** Set the protocol to be enabled by default. **/
 	exp->Params->ProtocolUse = 1;
-	exp->Params->ProtocolTotalSteps=exp->p->Steps->total;
+	exp->Params->ProtocolTotalSteps=ProtocolNumSteps(exp->p);
 }
 
 /*
@@ -1884,7 +2197,7 @@ int WriteRecentFrameNumberToFile(Experiment* exp){
 	if (exp->Worm->frameNum < 0 || exp->DataWriter->filename == NULL  || build_git_sha == NULL) return -1;
 	FILE* pFile;
 	pFile = fopen("recentFrameNum.txt","w");
-	fprintf(pFile,"%d\n%s\n%s\n%u",exp->Worm->frameNum,exp->DataWriter->filename,build_git_sha,exp->Params->DLPOn);
+	fprintf(pFile,"%d\n%s\n%s\n%u",exp->Worm->frameNum,exp->DataWriter->filename,build_git_sha,exp->GuiParams->DLPOn);
 	fclose(pFile);
 	return 0;
 }
@@ -1917,42 +2230,15 @@ int WriteRecentFrameNumberToFile(Experiment* exp){
  *  When the object is out side the activeZoneRadius, then the velocity is flat.
  *
  *  The user can set both the active zone radius and the gain (speed).
+ *
+ * Update for predictive tracking:
+ *  The control law now lives in StageTracker.c and runs once per processed frame from the main
+ *  thread instead of at the display thread's pace. On top of the gain and the active zone above it
+ *  estimates how fast the worm is crawling and moves the stage to match, and adds integral and
+ *  derivative terms. The speed slider sets the gain and the active zone sets the maximum speed as before.
  */
 
 
-
-CvPoint AdjustStageToKeepObjectAtTarget(HANDLE stage, CvPoint* obj,CvPoint target, int speed,int activeZoneRadius){
-	if (obj==NULL){
-		printf("Error! obj is NULL in AdjustStageToKeepObjectAtTarget()\n");
-		return cvPoint(0,0);
-	}
-
-	if (obj==NULL){
-		printf("Error! target is NULL in AdjustStageToKeepObjectAtTarget()\n");
-		return cvPoint(0,0);
-	}
-//	printf("About to adjust stage.\n");
-
-	CvPoint diff;
-	CvPoint vel;
-	/** (stage-obj)*speed **/
-//	printf("obj= (%d, %d), target =(%d, %d)\n",obj->x, obj->y, target->x, target->y);
-
-	diff.x=target.x-obj->x;
-	diff.y=target.y-obj->y;
-
-	//printf("About to Multiply!\n");
-	vel.x= CropNumber(-activeZoneRadius,activeZoneRadius, diff.x)*speed;
-	vel.y= CropNumber(-activeZoneRadius,activeZoneRadius, diff.y)*speed;
-
-	//printf("SpinStage: vel.x=%d, vel.y=%d\n",vel.x,vel.y);
-	spinStage(stage,vel.x,vel.y);
-
-	return vel;
-
-}
-
-
 /*
  * Scan for the USB device.
  */
@@ -1962,56 +2248,128 @@ int InvokeStage(Experiment* exp){
 	exp->stage=InitializeUsbStage();
 	if (exp->stage==NULL){
 		printf("ERROR! Invoking the stage failed.\nTurning tracking off.\n");
-		exp->Params->stageTrackingOn=0;
+		exp->GuiParams->stageTrackingOn=0;
 		return 0;
 	} else {
 		printf("Telling stage to HALT.\n");
 		haltStage(exp->stage);
 	}
 
+	/** From now on all stage I/O happens on the stage thread **/
+	StageController* stageCtl=CreateStageController(exp->stage);
+	if (stageCtl==NULL){
+		printf("ERROR! Could not start the stage thread.\nTurning tracking off.\n");
+		exp->GuiParams->stageTrackingOn=0;
+		return 0;
+	}
+
+	StageTracker* stageTracker=(StageTracker*) malloc(sizeof(StageTracker));
+	ResetStageTracker(stageTracker,DefaultStageTrackerGains(exp->GuiParams->stageSpeedFactor,exp->GuiParams->stageROIRadius));
+
+	/*
+	 * The main thread may already be running DoStageTracking(), which does
+	 * nothing until both are set. Publish them only once they are built,
+	 * the controller last.
+	 */
+	InterlockedExchangePointer((PVOID*) &(exp->stageTracker),stageTracker);
+	InterlockedExchangePointer((PVOID*) &(exp->stageCtl),stageCtl);
+	return 0;
 }
 
 
 int ShutOffStage(Experiment* exp){
-	haltStage(exp->stage);
+	if (exp->stageCtl==NULL) return 0;
+	/** Make sure the HALT actually gets out before anyone shuts down **/
+	StageHalt(exp->stageCtl);
+	if (StageFlush(exp->stageCtl,STAGE_HALT_TIMEOUT_MS)!=STAGE_OK){
+		printf("Warning! The stage did not confirm the HALT.\n");
+	}
+	return 0;
+}
+
+/*
+ * Stop steering and make sure the stage doesn't keep going on our last command
+ */
+static void HaltStageTracking(Experiment* exp){
+	if (exp->stageTrackerActive){
+		StageHalt(exp->stageCtl);
+		exp->stageTrackerActive=0;
+		exp->Worm->stageVelocity=cvPoint(0,0);
+	}
+	exp->stageFramesLost=0;
+}
+
+int DoStageTracking(Experiment* exp){
+	if (exp->stageCtl==NULL || exp->stageTracker==NULL) return 0;
+
+	if (exp->Params->stageTrackingOn==0){
+		HaltStageTracking(exp);
+		return 0;
+	}
+
+	/*
+	 * A frame that didn't segment says nothing about where the worm went.
+	 * It is most likely still going the way it was, so the stage keeps its
+	 * last command through a few of them and only halts if we stay lost.
+	 */
+	CvSeq* centerline=(exp->e==0) ? exp->Worm->Segmented->Centerline : NULL;
+	if (centerline==NULL || centerline->total <= exp->Params->stageTargetSegment){
+		if (exp->stageTrackerActive && ++(exp->stageFramesLost) > STAGE_COAST_FRAMES){
+			printf("Lost the worm for %d frames. Halting the stage.\n",exp->stageFramesLost);
+			HaltStageTracking(exp);
+		}
+		return 0;
+	}
+	exp->stageFramesLost=0;
+
+	/** The speed and active zone sliders can change at any time **/
+	StageTrackerGains gains=DefaultStageTrackerGains(exp->Params->stageSpeedFactor,exp->Params->stageROIRadius);
+	if (!exp->stageTrackerActive){
+		ResetStageTracker(exp->stageTracker,gains);
+		exp->stageTrackerActive=1;
+	} else {
+		exp->stageTracker->gains=gains;
+	}
+
+	/** Get the Point on the worm some distance along the centerline **/
+	CvPoint* PtOnWorm= (CvPoint*) cvGetSeqElem(centerline, exp->Params->stageTargetSegment);
+
+	int vx, vy;
+	UpdateStageTracker(exp->stageTracker, PtOnWorm->x, PtOnWorm->y,
+			exp->stageFeedbackTarget.x, exp->stageFeedbackTarget.y, exp->grabTimeUs, &vx, &vy);
+
+	/** Queue it; the stage thread sends it and replaces it if a newer one comes first **/
+	StageSpin(exp->stageCtl,vx,vy);
+	exp->Worm->stageVelocity=cvPoint(vx,vy);
+	return 0;
 }
 
 /*
  * Update the Stage Tracker.
  * If the Stage tracker is not initialized, don't do anything.
- * If the stage tracker is initialized then either do the tracking,
- * or if we are in the process of turning off tracking off, then tell
- * the stage to halt and update flags.
+ * If the analysis system is off, turn tracking off. If we are in the
+ * process of turning tracking off, then tell the stage to halt and update flags.
  */
 int HandleStageTracker(Experiment* exp){
 	if (exp->stageIsPresent==1){ /** If the Stage is Present **/
-		if (exp->stage==NULL) return 0;
+		if (exp->stageCtl==NULL) return 0;
 
-		if (exp->Params->stageTrackingOn==1){
-			if (exp->Params->OnOff==0){ /** if the analysis system is off **/
+		if (exp->GuiParams->stageTrackingOn==1){
+			if (exp->GuiParams->OnOff==0){ /** if the analysis system is off **/
 				/** Turn the stage off **/
 				exp->stageIsTurningOff=1;
-				exp->Params->stageTrackingOn=0;
+				exp->GuiParams->stageTrackingOn=0;
 				printf("Setting flags to turn stage off in HandleStageTracker()\n");
-			} else {
-			/** Move the stage to keep the worm centered in the field of view **/
-			printf(".");
-
-			/** Get the Point on the worm some distance along the centerline **/
-			CvPoint* PtOnWorm= (CvPoint*) cvGetSeqElem(exp->Worm->Segmented->Centerline, exp->Params->stageTargetSegment);
-			
-			/** Adjust the stage velocity to keep that point centered in the field of view **/
-			exp->Worm->stageVelocity=AdjustStageToKeepObjectAtTarget(exp->stage,PtOnWorm,exp->stageFeedbackTarget,exp->Params->stageSpeedFactor, exp->Params->stageROIRadius);
 			}
 		}
-		if (exp->Params->stageTrackingOn==0){/** Tracking Should be off **/
+		if (exp->GuiParams->stageTrackingOn==0){/** Tracking Should be off **/
 		//	printf("Tracking is off in HandleStageTracker()\n");
 			/** If we are in the process of turning tacking off **/
 			if (exp->stageIsTurningOff==1){
 				/** Tell the stage to Halt **/
 				printf("Tracking Stopped!");
 				printf("Telling stage to HALT.\n");
-				haltStage(exp->stage);
+				StageHalt(exp->stageCtl);
 				exp->stageIsTurningOff=0;
 			}
 			/** The stage is already halted, so there is nothing to do. **/
@@ -2022,5 +2380,82 @@ int HandleStageTracker(Experiment* exp){
 	return 0;
 }
 
+int DoMotionPrediction(Experiment* exp){
+	exp->segWormIllum=exp->Worm->Segmented;
+	exp->Worm->predictionUs=0;
+	exp->Worm->predictedShift=cvPoint2D32f(0,0);
+	if (exp->motionPredictor==NULL || exp->segWormPredicted==NULL) return 0;
+
+	SegmentedWorm* seg=exp->Worm->Segmented;
+	if (exp->e!=0 || seg->Centerline==NULL || seg->LeftBound==NULL || seg->RightBound==NULL){
+		ResetMotionPredictor(exp->motionPredictor);
+		return 0;
+	}
+
+	/** Left and right bounds are sampled at the same segments as the centerline **/
+	int n=seg->Centerline->total;
+	if (n<1 || n>MOTION_PREDICTOR_MAX_POINTS || seg->LeftBound->total!=n || seg->RightBound->total!=n){
+		ResetMotionPredictor(exp->motionPredictor);
+		return 0;
+	}
+
+	double x[MOTION_PREDICTOR_MAX_POINTS];
+	double y[MOTION_PREDICTOR_MAX_POINTS];
+	CvSeqReader reader;
+	CvPoint pt;
+	int i;
+	cvStartReadSeq(seg->Centerline,&reader,0);
+	for (i=0; i<n; i++){
+		CV_READ_SEQ_ELEM(pt,reader);
+		x[i]=pt.x;
+		y[i]=pt.y;
+	}
+	int haveVelocity=MotionPredictorAddFrame(exp->motionPredictor,x,y,n,exp->grabTimeUs);
+
+	if (!exp->Params->PredictMotion || !haveVelocity) return 0;
+	long long horizon=MotionPredictorHorizon(exp->motionPredictor,(long long) exp->Params->DLPLatencyMs*1000);
+	if (horizon<=0) return 0;
+
+	/** Move every segment on by its own velocity; each bound point goes with its centerline point **/
+	SegmentedWorm* pred=exp->segWormPredicted;
+	ClearSegmentedInfo(pred);
+	CvSeqReader left, right;
+	CvPoint lpt, rpt;
+	double dx, dy, sumX=0, sumY=0;
+	cvStartReadSeq(seg->LeftBound,&left,0);
+	cvStartReadSeq(seg->RightBound,&right,0);
+	for (i=0; i<n; i++){
+		CV_READ_SEQ_ELEM(lpt,left);
+		CV_READ_SEQ_ELEM(rpt,right);
+		MotionPredictorShift(exp->motionPredictor,i,horizon,&dx,&dy);
+		sumX+=dx;
+		sumY+=dy;
+		int sx=cvRound(dx);
+		int sy=cvRound(dy);
+		CvPoint c=cvPoint(cvRound(x[i]+dx),cvRound(y[i]+dy));
+		CvPoint l=cvPoint(lpt.x+sx,lpt.y+sy);
+		CvPoint r=cvPoint(rpt.x+sx,rpt.y+sy);
+		cvSeqPush(pred->Centerline,&c);
+		cvSeqPush(pred->LeftBound,&l);
+		cvSeqPush(pred->RightBound,&r);
+	}
 
+	MotionPredictorShift(exp->motionPredictor,0,horizon,&dx,&dy);
+	*(pred->Head)=cvPoint(cvRound(seg->Head->x+dx),cvRound(seg->Head->y+dy));
+	MotionPredictorShift(exp->motionPredictor,n-1,horizon,&dx,&dy);
+	*(pred->Tail)=cvPoint(cvRound(seg->Tail->x+dx),cvRound(seg->Tail->y+dy));
+	MotionPredictorShift(exp->motionPredictor,n/2,horizon,&dx,&dy);
+	*(pred->centerOfWorm)=cvPoint(cvRound(seg->centerOfWorm->x+dx),cvRound(seg->centerOfWorm->y+dy));
+	pred->NumSegments=seg->NumSegments;
+
+	exp->Worm->predictionUs=(int) horizon;
+	exp->Worm->predictedShift=cvPoint2D32f(sumX/n,sumY/n);
+	exp->segWormIllum=pred;
+	return 1;
+}
 
+int NoteIlluminationLatency(Experiment* exp){
+	if (exp->motionPredictor==NULL || exp->e!=0) return 0;
+	MotionPredictorAddLatency(exp->motionPredictor,MonotonicUs()-exp->grabTimeUs);
+	return 0;
+}
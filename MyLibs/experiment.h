@@ -68,6 +68,36 @@
 #ifndef MC_API_DLL_H_
  #error "#include API/mc_api_dll.h" must appear in source files before "#include experiment.h"
 #endif
+#ifndef TELEMETRY_H_
+ #error "#include Telemetry.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef PARAMSYNC_H_
+ #error "#include ParamSync.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef VIDEOSOURCE_H_
+ #error "#include VideoSource.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef FRAMEARCHIVE_H_
+ #error "#include FrameArchive.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef DISPLAYMAILBOX_H_
+ #error "#include DisplayMailbox.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef STAGECONTROLLER_H_
+ #error "#include StageController.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef STAGETRACKER_H_
+ #error "#include StageTracker.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef MOTIONPREDICTOR_H_
+ #error "#include MotionPredictor.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef MULTIWORM_H_
+ #error "#include MultiWorm.h" must appear in source files before "#include experiment.h"
+#endif
+#ifndef SEQUENCER_H_
+ #error "#include Sequencer.h" must appear in source files before "#include experiment.h"
+#endif
 
 
 
@@ -75,10 +105,29 @@
 #define EXP_SUCCESS 0
 #define EXP_VIDEO_RAN_OUT 1
 
+/** How long isFrameReady() blocks waiting for the camera before giving the loop a chance to run **/
+#define CAM_FRAME_TIMEOUT_MS 100
+
+/** The head, in centerline points, for the curvature phase analysis, and how much to smooth it **/
+#define HEAD_CURVATURE_BEGIN 10
+#define HEAD_CURVATURE_END 30
+#define HEAD_CURVATURE_SIGMA 5
+
+/** How long ShutOffStage() waits for the stage to acknowledge HALT **/
+#define STAGE_HALT_TIMEOUT_MS 500
+
+/** Frames in a row the stage keeps its last command while the worm can't be found, before it halts **/
+#define STAGE_COAST_FRAMES 5
+
+/** Frames decoded ahead of time when reading video from file **/
+#define VIDEO_READ_AHEAD 8
+
 typedef struct ExperimentStruct{
 	/** Simulation? True/false **/
 	int SimDLP; //1= simulate the DLP, 0= real DLP
 	int VidFromFile; // 1 =Video from File, 0=Video From Camera
+	int FastReplay; // 1 =Read video from file as fast as it decodes, 0=Pace it like a camera
+	double ReplaySpeed; // Speed up factor when replaying a raw frame archive
 
 	/** GuiWindowNames **/
 	char* WinDisp ;
@@ -94,6 +143,7 @@ typedef struct ExperimentStruct{
 	char* outfname;
 	char* infname;
 	char* protocolfname;
+	char* tracefname; //Chrome trace JSON file to write profiling events to
 
 	/** Protocol Data **/
     Protocol* p;
@@ -106,12 +156,18 @@ typedef struct ExperimentStruct{
 	FrameGrabber* fg;
 	bool UseFrameGrabber;
 
-	/** Video Capture (for simulation mode) **/
-	CvCapture* capture;
+	/** Video Source (for simulation mode) **/
+	VideoSource* video;
+
+	/** Raw frame archive being replayed instead of a video (for simulation mode) **/
+	FrameArchiveReader* RawReplay;
 
 	/** MostRecently Observed CameraFrameNumber **/
 	unsigned long lastFrameSeenOutside;
 
+	/** When the current frame was acquired, MonotonicUs() microseconds **/
+	long long grabTimeUs;
+
 	/** DLP Output **/
 	long myDLP;
 
@@ -119,7 +175,13 @@ typedef struct ExperimentStruct{
 	CalibData* Calib;
 
 	/** User-configurable Worm-related Parameters **/
-	WormAnalysisParam* Params;
+	WormAnalysisParam* Params; //owned by the processing thread
+
+	/** The display thread's copy of the parameters (trackbars and keystrokes) **/
+	WormAnalysisParam* GuiParams;
+
+	/** Exchanges parameter changes between the two threads **/
+	ParamSync* paramSync;
 
 	/** Information about Our Worm **/
 	WormAnalysisData* Worm;
@@ -130,10 +192,21 @@ typedef struct ExperimentStruct{
 	/** Segmented Worm in DLP Space **/
 	SegmentedWorm* segWormDLP;
 
+	/** Latency Compensation **/
+	MotionPredictor* motionPredictor; // Velocity of each segment from recent frames
+	SegmentedWorm* segWormPredicted; // Where the worm will be when the DLP shows this frame
+	SegmentedWorm* segWormIllum; // Worm to illuminate in camera space; one of the two above
+
+	/** Several worms at once. exp->Worm is then a copy of the primary worm **/
+	MultiWormTracker* multiWorm;
+
 	/** internal IplImage **/
 	IplImage* SubSampled; // Image used to subsample stuff
 	IplImage* HUDS;  //Image used to generate the Heads Up Display
-	IplImage* CurrentSelectedImg;
+	WormHUDS* HUDSCache; //Font and text reused from one HUDS to the next
+	CurvatureScratch* HeadCurvature; //Buffers for the head curvature analysis
+	LevelsLUT Levels; //Levels table applied to each frame as it comes in
+	DisplayMailbox* DisplayBox; //Finished display images on their way to the display thread
 
 	/** Internal Frame data types **/
 	Frame* fromCCD;
@@ -147,16 +220,16 @@ typedef struct ExperimentStruct{
 	CvVideoWriter* Vid;  //Video Writer
 	CvVideoWriter* VidHUDS;
 
+	/** Write the exact frames from the camera to a raw archive **/
+	FrameArchiveWriter* RawArchive;
+
 	/** Timing  Information **/
 	clock_t now;
 	clock_t last;
 
-	/** Illumination Timer **/
-	double illumStart; //Time that the illumination began
-	double illumFinished;  //Time that the illumination finished
-
-	/** Illum Head-To-Tail Sweep Internal Variables **/
-	double illumSweepHTtimer;
+	/** Timed DLP flashes, head-to-tail sweeps and secondary protocol steps **/
+	Sequencer* sequencer;
+	long long illumFinishedUs; //When the last timed DLP flash finished, on the sequencer's clock
 	
 	/** Frame Rate Information **/
 	int nframes;
@@ -166,10 +239,16 @@ typedef struct ExperimentStruct{
 	/** Macros **/
 	int RECORDVID;
 	int RECORDDATA;
+	int RECORDRAW;
+	int RawArchiveCodec; // FRAMEARCHIVE_CODEC_* for the raw frame archive
 
 	/** Stage Control **/
 	int stageIsPresent;
 	HANDLE stage; // Handle to USB stage object
+	StageController* stageCtl; // Sends commands to the stage from its own thread
+	StageTracker* stageTracker; // Works out the stage velocity from each frame
+	int stageTrackerActive; // 1 while the main thread is steering the stage
+	int stageFramesLost; // frames in a row the worm couldn't be found while steering
 	CvPoint stageVel; //Current velocity of stage
 	CvPoint stageCenter; // Point indicating center of stage.
 	CvPoint stageFeedbackTarget; //Target of the stage feedback loop as a point in the image
@@ -179,6 +258,9 @@ typedef struct ExperimentStruct{
 	/** MindControl API **/
 	SharedMemory_handle sm;
 
+	/** Live performance telemetry (separate shared memory block) **/
+	Telemetry* telemetry;
+
 	/** Scratch CvMemoryStorage **/
 	CvMemStorage* scratchMem;
 
@@ -209,6 +291,21 @@ int HandleCommandLineArguments(Experiment* exp);
 
 
 
+/*
+ * Run everything that happens at a set time: timed DLP flashes, the
+ * head-to-tail illumination sweep and the timed secondary protocol step.
+ *
+ * The sequencer's clock is sampled once, here, at the start of the frame.
+ * Each feature puts its events on the timeline when it is switched on,
+ * and every event that has come due is then applied, in the order it was due.
+ */
+int DoSequencer(Experiment* exp);
+
+/*
+ * Carry out an event from the sequencer's timeline
+ */
+void ApplySequencerEvent(Experiment* exp, SequencerEvent* ev);
+
 /**
  * The illumination sweep is a feature that lets the user automatically
  * increment an on-the-fly illumination step by step across the worm
@@ -231,6 +328,19 @@ int HandleCurvaturePhaseAnalysis(Experiment* exp);
 /** Handle Transient Illumination Timing **/
 int HandleIlluminationTiming(Experiment* exp);
 
+/*
+ * Switch to a different protocol step for a specified amount of time and then switch back
+ *
+ * This is useful for combined calcium imaging and optogenetic stimulation.
+ * Let some protocol step, A, be to illuminate a cell with a calcium indicator
+ * and protocol step B, be to illuminate that cell plus also some cell expressing ChR2.
+ *
+ * Often when calcium imaging we want to transiently stimulate some other cell for a given time,
+ * say 2 seconds. The machinery here allows the user to set a secondary protocol step and will transiently
+ * switch to that protocol for a specified amount of time.
+ */
+int HandleTimedSecondaryProtocolStep(Experiment* exp);
+
 /*
  * Flips the simulation variable to on.
  */
@@ -260,6 +370,33 @@ void SetupGUI(Experiment* exp);
  */
 void UpdateGUI(Experiment* exp);
 
+/*
+ * Give the display thread its own copy of the parameters and set up the
+ * exchange between it and the processing thread.
+ * Call once the command line and protocol have been loaded,
+ * before the display thread is started.
+ */
+void StartParamSync(Experiment* exp);
+
+/*
+ * Display thread: pull in parameter changes made by the processing thread
+ * and publish changes made by the user.
+ */
+void SyncGUIParams(Experiment* exp);
+
+/*
+ * Processing thread: bring exp->Params up to date with the user's changes.
+ * Call once at the start of every frame so the frame sees one consistent set
+ * of parameters.
+ */
+void SyncParamsFromGUI(Experiment* exp);
+
+/*
+ * Processing thread: publish changes the processing thread made to exp->Params
+ * (e.g. timed illumination or protocol steps) back to the display thread.
+ */
+void PublishProcessingParams(Experiment* exp);
+
 
 /*
  * Initialize camera library
@@ -316,6 +453,10 @@ void ReleaseExperiment(Experiment* exp);
 
 /*
  * Is a frame ready from the camera?
+ *
+ * When using the ImagingSource camera this blocks until the camera
+ * delivers a new frame or CAM_FRAME_TIMEOUT_MS elapses, and claims the
+ * frame so that GrabFrame() can copy it.
  */
 int isFrameReady(Experiment* exp);
 
@@ -389,11 +530,44 @@ void ClearDLPifNotDisplayingNow(Experiment* exp);
  */
 void DoSegmentation(Experiment* exp);
 
+/*
+ * Find and segment every worm, in parallel. exp->Worm gets a copy of the
+ * primary worm, so that everything that follows one worm follows that one.
+ * Called by DoSegmentation() in multi-worm mode.
+ */
+void DoMultiWormSegmentation(Experiment* exp);
+
+/*
+ * Give each worm seen for the first time this frame its protocol step:
+ * the next step in turn if StepByID is on, otherwise the ProtocolStep slider's.
+ */
+void AssignMultiWormProtocolSteps(Experiment* exp);
+
+/*
+ * The protocol step a worm is illuminated with
+ */
+int MultiWormTrackProtocolStep(Experiment* exp, MultiWormTrack* t);
+
 
 /*
  * Add a rectangle to the image to denote the target for stage recentering.
  */
-void MarkRecenteringTarget(Experiment* exp);
+void MarkRecenteringTarget(Experiment* exp, IplImage* img);
+
+/*
+ * Label each worm with its ID, by its head.
+ */
+void MarkMultiWormIDs(Experiment* exp, IplImage* img);
+
+/*
+ * Is the heads up display going to be recorded this frame?
+ */
+int HUDSIsRecorded(Experiment* exp);
+
+/*
+ * Draw the heads up display and the stage recentering target into dest
+ */
+void ComposeHUDS(Experiment* exp, IplImage* dest);
 
 /*
  * Preparesthe Selected Display
@@ -408,6 +582,20 @@ void PrepareSelectedDisplay(Experiment* exp);
  */
 int DoOnTheFlyIllumination(Experiment* exp);
 
+/*
+ * Is more than one worm being tracked?
+ */
+int MultiWormIsOn(Experiment* exp);
+
+/*
+ * Illuminate every worm segmented this frame, each with its own protocol
+ * step (or the slider rectangle if no protocol is running), in both camera
+ * space and DLP space. The patterns are all drawn into the same frames.
+ * A worm none of whose centerline maps onto the DLP is only drawn in
+ * camera space.
+ */
+int DoMultiWormIllumination(Experiment* exp);
+
 /**
  * Invert the illumination, so white becomes black and vice-versa.
  */
@@ -439,6 +627,15 @@ void SyncAPI(Experiment* exp);
  */
 void DoWriteToDisk(Experiment* exp);
 
+/*
+ * If tracing was requested with the -T switch, write out the
+ * most recent tic/toc events to exp->tracefname in Chrome trace format.
+ * (Open with chrome://tracing or ui.perfetto.dev)
+ *
+ * Can be called at any time, e.g. from a keystroke, and again at exit.
+ */
+int FlushTrace(Experiment* exp);
+
 /*********************
  *
  *  Protocol related functions
@@ -481,20 +678,48 @@ int WriteRecentFrameNumberToFile(Experiment* exp);
  */
 
 /*
- * Scan for the USB device.
+ * Scan for the USB device, and start the stage thread and the tracker.
+ * They are published only once built, so this can run on the display
+ * thread while the main thread is already in DoStageTracking().
  */
 int InvokeStage(Experiment* exp);
 
+/*
+ * Steer the stage from the frame that was just segmented.
+ * Called once per processed frame from the main thread. Estimates the
+ * worm's velocity and sets the stage velocity to follow it and pull the
+ * target point on the centerline back to exp->stageFeedbackTarget.
+ * When tracking goes off, tells the stage to halt. When the worm can't be
+ * found the stage keeps its last command for up to STAGE_COAST_FRAMES
+ * frames before it is halted.
+ */
+int DoStageTracking(Experiment* exp);
+
 /*
  * Update the Stage Tracker.
  * If the Stage tracker is not initialized, don't do anything.
- * If the stage tracker is initialized then either do the tracking,
- * or if we are in the process of turning off tracking off, then tell
- * the stage to halt and update flags.
+ * If the analysis system is off, turn tracking off. If we are in the
+ * process of turning tracking off, then tell the stage to halt and update flags.
+ * The tracking itself happens per frame in DoStageTracking().
  */
 int HandleStageTracker(Experiment* exp);
 
 int ShutOffStage(Experiment* exp);
 
+/*
+ * Work out where the worm will be by the time the DLP shows the pattern
+ * made from this frame, and point exp->segWormIllum at it.
+ * Called once per processed frame, after segmentation. If prediction is
+ * off, or there isn't enough history yet, exp->segWormIllum is just the
+ * segmented worm.
+ */
+int DoMotionPrediction(Experiment* exp);
+
+/*
+ * Tell the motion predictor how long this frame took from being grabbed
+ * to its pattern going to the DLP. Call right after sending the frame.
+ */
+int NoteIlluminationLatency(Experiment* exp);
+
 
 #endif /* EXPERIMENT_H_ */
@@ -0,0 +1,660 @@
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * https://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+
+/*
+ * batchSegment.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+/*
+ * Headless batch re-segmentation of recorded worm videos.
+ *
+ * Each video is decoded on the main thread in chunks of frames. The frames of a
+ * chunk are segmented in parallel by a pool of worker threads, each of which
+ * owns its own WormAnalysisData so that no analysis memory is shared.
+ * Workers run the same single-frame chain as the live software:
+ *
+ * 	FindWormBoundary() -> GivenBoundaryFindWormHeadTail() -> SegmentWorm()
+ *
+ * Temporal head/tail correction depends on the previous frame and so is applied
+ * afterwards, in frame order, on the main thread. Frames whose head and tail
+ * need to be reversed are re-segmented from their stored boundary so that the
+ * output is identical to what the live software would have written and does not
+ * depend on the number of threads.
+ *
+ * Results are written to a YAML data log in the same format as a live experiment.
+ *
+ * Usage:
+ * 	batchSegment [options] video.avi [video2.avi ...] [directory/ ...]
+ */
+
+//Standard C headers
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+//Windows Header
+#include <windows.h>
+
+//OpenCV Headers
+#include "opencv2/highgui/highgui_c.h"
+#include <cv.h>
+
+//Andy's Personal Headers
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/Talk2DLP.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/WriteOutWorm.h"
+#include "MyLibs/VideoSource.h"
+
+//3rd Party Libraries
+#include "3rdPartyLibs/tictoc.h"
+
+
+/** Number of frames each worker is handed per chunk **/
+#define BATCH_FRAMES_PER_THREAD 16
+#define BATCH_READ_AHEAD 8 //frames the decoder thread keeps ready
+
+/** WaitForMultipleObjects() can wait on at most this many workers **/
+#define BATCH_MAX_THREADS 64
+
+#define BATCH_SUCCESS 0
+#define BATCH_ERROR -1
+
+
+/*
+ * One decoded frame and everything the workers extract from it.
+ * The point buffers are reused from chunk to chunk and only grow.
+ */
+typedef struct BatchFrameStruct{
+	IplImage* img; //8 bit grayscale frame at analysis size
+	int frameNum;
+	unsigned long timestamp; //position in the video in clock ticks
+	int e; //error from segmentation
+
+	/** Boundary and head/tail indices, kept so the ordered pass can re-segment **/
+	CvPoint* boundary;
+	int boundaryTotal;
+	int boundaryCapacity;
+	CvPoint2D32f* boundaryF; //sub-pixel boundary, when there is one
+	int boundaryFTotal;
+	int boundaryFCapacity;
+	int HeadIndex;
+	int TailIndex;
+
+	/** Segmented Worm **/
+	CvPoint* centerline;
+	int centerlineTotal;
+	int centerlineCapacity;
+	CvPoint* left;
+	int leftTotal;
+	int leftCapacity;
+	CvPoint* right;
+	int rightTotal;
+	int rightCapacity;
+} BatchFrame;
+
+
+struct BatchPoolStruct;
+
+typedef struct BatchWorkerStruct{
+	HANDLE thread;
+	HANDLE start; //auto-reset, signaled when a chunk is ready
+	HANDLE done; //auto-reset, signaled when the worker has run out of frames
+	WormAnalysisData* Worm;
+	WormAnalysisParam* Params;
+	struct BatchPoolStruct* pool;
+} BatchWorker;
+
+typedef struct BatchPoolStruct{
+	BatchWorker* workers;
+	HANDLE* doneEvents;
+	int numWorkers;
+
+	/** The current chunk **/
+	BatchFrame* frames;
+	int numFrames;
+	volatile LONG nextFrame;
+	volatile LONG quit;
+} BatchPool;
+
+
+/*
+ * Command line settings
+ */
+typedef struct BatchSettingsStruct{
+	const char* outdir;
+	int numThreads;
+	int nativeSize; //analyze at the size of the video instead of NSIZEX x NSIZEY
+	WormAnalysisParam* Params;
+	int argc;
+	char** argv;
+} BatchSettings;
+
+
+
+
+void displayBatchHelp() {
+	printf("\n\nRe-segments recorded worm videos without a camera, DLP or display and writes a YAML data log for each.\n");
+	printf("\nUsage:\n\n");
+	printf("\tbatchSegment [options] video.avi [video2.avi ...] [D:/Path/To/Videos/ ...]\n\n");
+	printf("Given a directory, every .avi in it is analyzed except the _HUDS.avi recordings.\n\n");
+	printf("Optional arguments:\n");
+	printf("\t-d  D:/Path/To/My/Directory/\n\t\tWrite the data logs to the specified directory. NOTE: it is important to have the trailing slash.\n\n");
+	printf("\t-j  4\n\t\tNumber of worker threads. Defaults to the number of processors.\n\n");
+	printf("\t-t  48\n\t\tBinary threshold.\n\n");
+	printf("\t-g  1\n\t\tGaussian blur size.\n\n");
+	printf("\t-b  0\n\t\tBoundary smoothing size.\n\n");
+	printf("\t-n  100\n\t\tNumber of segments along the centerline.\n\n");
+	printf("\t-m  70\n\t\tMaximum head/tail movement between frames, in pixels, for temporal correction.\n\n");
+	printf("\t-r\n\t\tAnalyze frames at the size they were recorded instead of cropping or letterboxing them to %dx%d as a live run does.\n\n", NSIZEX, NSIZEY);
+	printf("\t-s\n\t\tFind the boundary to sub-pixel precision. The boundary smoothing size is then ignored.\n\n");
+	printf("\t-x\n\t\tTurn off temporal head/tail correction.\n\n");
+	printf("\t-?\n\t\tDisplay this help.\n\n");
+}
+
+/*
+ * Parse the command line. On success optind points at the first input.
+ */
+int HandleBatchArguments(BatchSettings* s) {
+	opterr = 0;
+	int c;
+	while ((c = getopt(s->argc, s->argv, "d:j:t:g:b:n:m:rsx?")) != -1) {
+		switch (c) {
+		case 'd':
+			s->outdir = optarg;
+			break;
+		case 'j':
+			s->numThreads = atoi(optarg);
+			break;
+		case 't':
+			s->Params->BinThresh = atoi(optarg);
+			break;
+		case 'g':
+			s->Params->GaussSize = atoi(optarg);
+			break;
+		case 'b':
+			s->Params->BoundSmoothSize = atoi(optarg);
+			break;
+		case 'n':
+			s->Params->NumSegments = atoi(optarg);
+			s->Params->DefaultGridSize = cvSize(s->Params->DefaultGridSize.width, s->Params->NumSegments);
+			break;
+		case 'm':
+			s->Params->MaxLocationChange = atoi(optarg);
+			break;
+		case 'r':
+			s->nativeSize = 1;
+			break;
+		case 's':
+			s->Params->SubPixelBoundary = 1;
+			break;
+		case 'x':
+			s->Params->TemporalOn = 0;
+			break;
+		case '?':
+		default:
+			displayBatchHelp();
+			return BATCH_ERROR;
+		}
+	}
+
+	if (optind >= s->argc) {
+		printf("Error. No input video or directory was specified.\n");
+		displayBatchHelp();
+		return BATCH_ERROR;
+	}
+
+	if (s->numThreads < 1) {
+		SYSTEM_INFO sysinfo;
+		GetSystemInfo(&sysinfo);
+		s->numThreads = (int) sysinfo.dwNumberOfProcessors;
+	}
+	if (s->numThreads < 1) s->numThreads = 1;
+	if (s->numThreads > BATCH_MAX_THREADS) s->numThreads = BATCH_MAX_THREADS;
+	return BATCH_SUCCESS;
+}
+
+
+
+/************************************************************/
+/* Per-frame Results										*/
+/************************************************************/
+
+/*
+ * Copy the points of a sequence into a growable buffer.
+ * Returns the number of points copied.
+ */
+int CopySeqToBuffer(CvSeq* seq, CvPoint** buf, int* capacity) {
+	if (!cvSeqExists(seq)) return 0;
+	if (seq->total > *capacity) {
+		*buf = (CvPoint*) realloc(*buf, seq->total * sizeof(CvPoint));
+		*capacity = seq->total;
+	}
+	cvCvtSeqToArray(seq, *buf, CV_WHOLE_SEQ);
+	return seq->total;
+}
+
+/*
+ * Replace the contents of a sequence with the points in a buffer.
+ */
+void LoadSeqFromBuffer(CvSeq* seq, CvPoint* buf, int total) {
+	cvClearSeq(seq);
+	if (total > 0) cvSeqPushMulti(seq, buf, total);
+}
+
+void ReleaseBatchFrames(BatchFrame** frames, int numFrames) {
+	if (*frames == NULL) return;
+	int k;
+	for (k = 0; k < numFrames; ++k) {
+		BatchFrame* f = &((*frames)[k]);
+		if (f->img != NULL) cvReleaseImage(&(f->img));
+		free(f->boundary);
+		free(f->boundaryF);
+		free(f->centerline);
+		free(f->left);
+		free(f->right);
+	}
+	free(*frames);
+	*frames = NULL;
+}
+
+BatchFrame* CreateBatchFrames(int numFrames, CvSize size) {
+	BatchFrame* frames = (BatchFrame*) calloc(numFrames, sizeof(BatchFrame));
+	int k;
+	for (k = 0; k < numFrames; ++k) {
+		frames[k].img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	}
+	return frames;
+}
+
+
+/************************************************************/
+/* Worker Threads											*/
+/************************************************************/
+
+/*
+ * Run the single-frame segmentation chain on one frame using the worker's
+ * own WormAnalysisData, and copy the results out into the frame.
+ */
+void SegmentBatchFrame(BatchWorker* w, BatchFrame* f) {
+	WormAnalysisData* Worm = w->Worm;
+	WormAnalysisParam* Params = w->Params;
+
+	f->boundaryTotal = 0;
+	f->boundaryFTotal = 0;
+	f->centerlineTotal = 0;
+	f->leftTotal = 0;
+	f->rightTotal = 0;
+
+	f->e = RefreshWormMemStorage(Worm);
+	if (f->e == 0) f->e = LoadWormImg(Worm, f->img);
+	if (f->e == 0) f->e = simpleAdjustLevels(f->img, Worm->ImgOrig, Params->LevelsMin, Params->LevelsMax);
+	if (f->e != 0) return;
+
+	Worm->frameNum = f->frameNum;
+	Worm->timestamp = f->timestamp;
+
+	FindWormBoundary(Worm, Params);
+	f->e = GivenBoundaryFindWormHeadTail(Worm, Params);
+	if (f->e == 0) f->e = SegmentWorm(Worm, Params);
+	if (f->e != 0) return;
+
+	f->boundaryTotal = CopySeqToBuffer(Worm->Boundary, &(f->boundary), &(f->boundaryCapacity));
+	if (Worm->BoundaryF != NULL) {
+		if (Worm->BoundaryF->total > f->boundaryFCapacity) {
+			f->boundaryF = (CvPoint2D32f*) realloc(f->boundaryF, Worm->BoundaryF->total * sizeof(CvPoint2D32f));
+			f->boundaryFCapacity = Worm->BoundaryF->total;
+		}
+		cvCvtSeqToArray(Worm->BoundaryF, f->boundaryF, CV_WHOLE_SEQ);
+		f->boundaryFTotal = Worm->BoundaryF->total;
+	}
+	f->HeadIndex = Worm->HeadIndex;
+	f->TailIndex = Worm->TailIndex;
+	f->centerlineTotal = CopySeqToBuffer(Worm->Segmented->Centerline, &(f->centerline), &(f->centerlineCapacity));
+	f->leftTotal = CopySeqToBuffer(Worm->Segmented->LeftBound, &(f->left), &(f->leftCapacity));
+	f->rightTotal = CopySeqToBuffer(Worm->Segmented->RightBound, &(f->right), &(f->rightCapacity));
+}
+
+DWORD WINAPI BatchWorkerThread(LPVOID lpParam) {
+	BatchWorker* w = (BatchWorker*) lpParam;
+	BatchPool* pool = w->pool;
+	while (1) {
+		WaitForSingleObject(w->start, INFINITE);
+		if (pool->quit) break;
+
+		/** Claim frames until the chunk is used up **/
+		LONG k;
+		while ((k = InterlockedIncrement(&(pool->nextFrame)) - 1) < pool->numFrames) {
+			SegmentBatchFrame(w, &(pool->frames[k]));
+		}
+		SetEvent(w->done);
+	}
+	return 0;
+}
+
+BatchPool* CreateBatchPool(int numWorkers, CvSize size, WormAnalysisParam* Params) {
+	BatchPool* pool = (BatchPool*) malloc(sizeof(BatchPool));
+	pool->numWorkers = numWorkers;
+	pool->workers = (BatchWorker*) calloc(numWorkers, sizeof(BatchWorker));
+	pool->doneEvents = (HANDLE*) malloc(numWorkers * sizeof(HANDLE));
+	pool->frames = NULL;
+	pool->numFrames = 0;
+	pool->nextFrame = 0;
+	pool->quit = 0;
+
+	int k;
+	for (k = 0; k < numWorkers; ++k) {
+		BatchWorker* w = &(pool->workers[k]);
+		w->pool = pool;
+
+		/** Each worker gets its own analysis memory and its own copy of the parameters **/
+		w->Worm = CreateWormAnalysisDataStruct();
+		InitializeEmptyWormImages(w->Worm, size);
+		w->Params = CreateWormAnalysisParam();
+		*(w->Params) = *Params;
+
+		w->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+		pool->doneEvents[k] = w->done;
+		w->thread = CreateThread(NULL, 0, BatchWorkerThread, (LPVOID) w, 0, NULL);
+	}
+	return pool;
+}
+
+/*
+ * Segment every frame of a chunk and block until all the workers are finished.
+ */
+void RunBatchPool(BatchPool* pool, BatchFrame* frames, int numFrames) {
+	pool->frames = frames;
+	pool->numFrames = numFrames;
+	InterlockedExchange(&(pool->nextFrame), 0);
+
+	int k;
+	for (k = 0; k < pool->numWorkers; ++k) SetEvent(pool->workers[k].start);
+	WaitForMultipleObjects(pool->numWorkers, pool->doneEvents, TRUE, INFINITE);
+}
+
+void DestroyBatchPool(BatchPool** pool) {
+	if (*pool == NULL) return;
+	BatchPool* p = *pool;
+
+	InterlockedExchange(&(p->quit), 1);
+	int k;
+	for (k = 0; k < p->numWorkers; ++k) SetEvent(p->workers[k].start);
+	for (k = 0; k < p->numWorkers; ++k) {
+		BatchWorker* w = &(p->workers[k]);
+		WaitForSingleObject(w->thread, INFINITE);
+		CloseHandle(w->thread);
+		CloseHandle(w->start);
+		CloseHandle(w->done);
+		DestroyWormAnalysisDataStruct(w->Worm);
+		DestroyWormAnalysisParam(w->Params);
+	}
+	free(p->workers);
+	free(p->doneEvents);
+	free(p);
+	*pool = NULL;
+}
+
+
+/************************************************************/
+/* Ordered Pass												*/
+/************************************************************/
+
+/*
+ * Apply temporal head/tail correction to one frame and append it to the data log.
+ * Must be called in frame order.
+ *
+ * Worm is scratch analysis memory owned by the main thread.
+ * PrevWorm carries the geometry of the last successfully segmented frame.
+ */
+void FinishBatchFrame(BatchFrame* f, WormAnalysisData* Worm, WormAnalysisParam* Params,
+		WormGeom* PrevWorm, WriteOut* DataWriter) {
+	if (f->e != 0) return;
+
+	/** Rebuild the worker's result in the scratch worm **/
+	if (RefreshWormMemStorage(Worm) != 0) {
+		f->e = BATCH_ERROR;
+		return;
+	}
+	Worm->frameNum = f->frameNum;
+	Worm->timestamp = f->timestamp;
+	cvSeqPushMulti(Worm->Boundary, f->boundary, f->boundaryTotal);
+	if (f->boundaryFTotal > 0) {
+		Worm->BoundaryF = cvCreateSeq(CV_32FC2, sizeof(CvSeq), sizeof(CvPoint2D32f), Worm->MemStorage);
+		cvSeqPushMulti(Worm->BoundaryF, f->boundaryF, f->boundaryFTotal);
+	}
+	Worm->HeadIndex = f->HeadIndex;
+	Worm->TailIndex = f->TailIndex;
+	Worm->Head = (CvPoint*) cvGetSeqElem(Worm->Boundary, Worm->HeadIndex);
+	Worm->Tail = (CvPoint*) cvGetSeqElem(Worm->Boundary, Worm->TailIndex);
+
+	int reversed = 0;
+	if (Params->TemporalOn) reversed = (PrevFrameImproveWormHeadTail(Worm, Params, PrevWorm) == 0);
+
+	if (reversed) {
+		/** The head and tail were swapped, so segment again exactly as the live software would have **/
+		f->e = SegmentWorm(Worm, Params);
+		if (f->e != 0) return;
+	} else {
+		Worm->Segmented->NumSegments = Params->NumSegments;
+		*(Worm->Segmented->Head) = *(Worm->Head);
+		*(Worm->Segmented->Tail) = *(Worm->Tail);
+		LoadSeqFromBuffer(Worm->Segmented->Centerline, f->centerline, f->centerlineTotal);
+		LoadSeqFromBuffer(Worm->Segmented->LeftBound, f->left, f->leftTotal);
+		LoadSeqFromBuffer(Worm->Segmented->RightBound, f->right, f->rightTotal);
+	}
+
+	LoadWormGeom(PrevWorm, Worm);
+	if (DataWriter != NULL) AppendWormFrameToDisk(Worm, Params, DataWriter);
+}
+
+
+/************************************************************/
+/* Videos													*/
+/************************************************************/
+
+/*
+ * Take the next frame of the video into a batch frame.
+ * Frames come through the same VideoSource as a live run from a video file,
+ * so they are converted and cropped/letterboxed exactly the same way.
+ * Returns 0 on success and -1 when the video has run out.
+ */
+int ReadBatchFrame(VideoSource* vs, BatchFrame* f) {
+	unsigned char* frame;
+	if (VideoSourceNextFrame(vs, &frame) != VIDSRC_OK) return BATCH_ERROR;
+	if (CopyCharArrayToIplImage(frame, f->img, vs->outSize.width, vs->outSize.height) != 0) return BATCH_ERROR;
+	f->timestamp = (unsigned long) (vs->frameMsec * CLOCKS_PER_SEC / 1000.0);
+	return BATCH_SUCCESS;
+}
+
+/*
+ * Strip the directory and extension off of a path.
+ * Returns a newly allocated string.
+ */
+char* BatchCoreName(const char* path) {
+	const char* base = path;
+	const char* p;
+	for (p = path; *p != '\0'; ++p) {
+		if (*p == '/' || *p == '\\') base = p + 1;
+	}
+	char* core = (char*) malloc(strlen(base) + strlen("_reseg") + 1);
+	strcpy(core, base);
+	char* dot = strrchr(core, '.');
+	if (dot != NULL) *dot = '\0';
+	strcat(core, "_reseg");
+	return core;
+}
+
+int ResegmentVideo(const char* infname, BatchSettings* s) {
+	/** Decode ahead, as a live run from a video file does **/
+	VideoSource* vs = OpenVideoSource(infname, s->nativeSize ? cvSize(0, 0) : cvSize(NSIZEX, NSIZEY), BATCH_READ_AHEAD);
+	if (vs == NULL) {
+		printf("Error. Could not open video %s\n", infname);
+		return BATCH_ERROR;
+	}
+	CvSize size = vs->outSize;
+	printf("Re-segmenting %s at %dx%d with %d threads\n", infname, size.width, size.height, s->numThreads);
+
+	/** Set up the data log **/
+	CvMemStorage* mem = cvCreateMemStorage(0);
+	char* core = BatchCoreName(infname);
+	WriteOut* DataWriter = SetUpWriteToDisk(s->outdir, core, mem);
+	free(core);
+	if (DataWriter->error < 0) {
+		printf("Error. Could not open the data log for %s\n", infname);
+		FinishWriteToDisk(&DataWriter);
+		cvReleaseMemStorage(&mem);
+		CloseVideoSource(&vs);
+		return BATCH_ERROR;
+	}
+	cvWriteString(DataWriter->fs, "SourceVideo", infname, 0);
+	WriteOutCommandLineArguments(DataWriter, s->argc, s->argv);
+	WriteOutDefaultGridSize(DataWriter, s->Params);
+	BeginToWriteOutFrames(DataWriter);
+
+	/** Workers, frames and the main thread's own scratch worm **/
+	int chunkSize = s->numThreads * BATCH_FRAMES_PER_THREAD;
+	BatchFrame* frames = CreateBatchFrames(chunkSize, size);
+	BatchPool* pool = CreateBatchPool(s->numThreads, size, s->Params);
+	WormAnalysisData* Worm = CreateWormAnalysisDataStruct();
+	InitializeEmptyWormImages(Worm, size);
+	WormGeom* PrevWorm = CreateWormGeom();
+
+	int frameNum = 0;
+	int numFailed = 0;
+	clock_t start = clock();
+	int k;
+	int numFrames;
+	do {
+		/** Decode a chunk **/
+		for (numFrames = 0; numFrames < chunkSize; ++numFrames) {
+			if (ReadBatchFrame(vs, &(frames[numFrames])) != BATCH_SUCCESS) break;
+			frames[numFrames].frameNum = ++frameNum;
+		}
+		if (numFrames == 0) break;
+
+		/** Segment it in parallel **/
+		RunBatchPool(pool, frames, numFrames);
+
+		/** Correct and write it out in order **/
+		for (k = 0; k < numFrames; ++k) {
+			FinishBatchFrame(&(frames[k]), Worm, s->Params, PrevWorm, DataWriter);
+			if (frames[k].e != 0) numFailed++;
+		}
+		printf("\t%d frames\r", frameNum);
+	} while (numFrames == chunkSize);
+
+	double seconds = (double) (clock() - start) / (double) CLOCKS_PER_SEC;
+	printf("\t%d frames, %d failed to segment, %.1f s (%.1f fps)\n", frameNum, numFailed, seconds,
+			(seconds > 0) ? frameNum / seconds : 0.0);
+	printf("Wrote %s\n", DataWriter->filename);
+
+	FinishWriteToDisk(&DataWriter);
+	DestroyBatchPool(&pool);
+	ReleaseBatchFrames(&frames, chunkSize);
+	DestroyWormAnalysisDataStruct(Worm);
+	DestroyWormGeom(&PrevWorm);
+	cvReleaseMemStorage(&mem);
+	CloseVideoSource(&vs);
+	return BATCH_SUCCESS;
+}
+
+/*
+ * Is this a recorded video we should analyze from a directory listing?
+ * The _HUDS.avi recordings have the illumination pattern burned in and are skipped.
+ */
+int IsBatchVideo(const char* name) {
+	int len = strlen(name);
+	if (len < 4 || strcmp(name + len - 4, ".avi") != 0) return 0;
+	if (len >= 9 && strcmp(name + len - 9, "_HUDS.avi") == 0) return 0;
+	return 1;
+}
+
+/*
+ * Re-segment a single video, or every video in a directory.
+ * Returns the number of videos that failed.
+ */
+int ResegmentInput(const char* input, BatchSettings* s) {
+	DIR* dir = opendir(input);
+	if (dir == NULL) return (ResegmentVideo(input, s) == BATCH_SUCCESS) ? 0 : 1;
+
+	int failed = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (!IsBatchVideo(entry->d_name)) continue;
+		char* path = (char*) malloc(strlen(input) + strlen(entry->d_name) + 2);
+		strcpy(path, input);
+		int len = strlen(path);
+		if (len > 0 && path[len - 1] != '/' && path[len - 1] != '\\') strcat(path, "/");
+		strcat(path, entry->d_name);
+		if (ResegmentVideo(path, s) != BATCH_SUCCESS) failed++;
+		free(path);
+	}
+	closedir(dir);
+	return failed;
+}
+
+
+int main(int argc, char** argv) {
+	BatchSettings s;
+	s.outdir = "./";
+	s.numThreads = 0;
+	s.nativeSize = 0;
+	s.Params = CreateWormAnalysisParam();
+	s.argc = argc;
+	s.argv = argv;
+
+	if (HandleBatchArguments(&s) != BATCH_SUCCESS) {
+		DestroyWormAnalysisParam(s.Params);
+		return -1;
+	}
+
+	/** TICTOC's bookkeeping is not thread safe, and the workers all call into it **/
+	TICTOC::timer().enable(false);
+
+	int failed = 0;
+	int k;
+	for (k = optind; k < argc; ++k) {
+		failed += ResegmentInput(argv[k], &s);
+	}
+
+	DestroyWormAnalysisParam(s.Params);
+	if (failed > 0) {
+		printf("%d video(s) could not be re-segmented.\n", failed);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * benchmarkContourTracer.c
+ *
+ * Measures how long it takes to find the worm's boundary with the seeded
+ * tracer (MyLibs/ContourTracer.h) and with the full search it replaces,
+ * without a camera.
+ *
+ * Synthetic 1024x768 thresholded frames hold a 14 px wide worm crawling
+ * with a travelling body wave, 0.2% speckle, and a given number of discs,
+ * lines and single pixels of clutter. Each frame the worm is traced from
+ * last frame's centerline, as FindWormBoundary() does, and the whole frame
+ * is searched with FindLongestContour().
+ *
+ * Every seeded trace is compared point by point with the contour
+ * cvFindContours() finds for the same object. A seeded trace that comes back
+ * empty or less than half as long as the longest contour is counted as a
+ * fall back, since FindWormBoundary() would search the whole frame instead.
+ *
+ * Prints the mean time per frame of each for every level of clutter, and
+ * exits with 1 if any trace differed from cvFindContours() or the worm could
+ * not be traced on an uncluttered frame.
+ *
+ * Usage: benchmarkContourTracer.exe [frames per level]
+ *   e.g. benchmarkContourTracer.exe 50
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <windows.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/ContourTracer.h"
+
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 768
+#define BENCH_CENTERLINE_PTS 100
+#define BENCH_WORM_WIDTH 14
+#define BENCH_HALF_LENGTH 300 // pixels from the middle of the worm to either end
+#define BENCH_WAVE 40 // amplitude of the body wave, pixels
+#define BENCH_SPECKLE 0.002 // fraction of pixels that are turned on at random
+#define BENCH_PI 3.14159265358979
+
+static const int clutterLevels[] = { 0, 200, 1000, 3000 };
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long benchSeed = 12345;
+
+/*
+ * Where the worm is and how its body wave is going
+ */
+typedef struct WormPoseStruct{
+	double x;
+	double y;
+	double heading;
+	double phase;
+} WormPose;
+
+/*
+ * The worm's centerline in pose p
+ */
+static void MakeCenterline(const WormPose* p, CvPoint* pts){
+	int i;
+	for (i = 0; i < BENCH_CENTERLINE_PTS; i++) {
+		double t = 2.0 * i / (BENCH_CENTERLINE_PTS - 1) - 1;
+		double u = BENCH_HALF_LENGTH * t;
+		double v = BENCH_WAVE * sin(3 * t + p->phase);
+		pts[i].x = (int) (p->x + u * cos(p->heading) - v * sin(p->heading));
+		pts[i].y = (int) (p->y + u * sin(p->heading) + v * cos(p->heading));
+	}
+}
+
+/*
+ * Draw the worm, the clutter and the speckle into the thresholded image
+ */
+static void MakeFrame(IplImage* img, CvPoint* centerline, int clutter){
+	cvZero(img);
+	int n = BENCH_CENTERLINE_PTS;
+	cvPolyLine(img, &centerline, &n, 1, 0, cvScalarAll(255), BENCH_WORM_WIDTH, 8);
+
+	int k;
+	for (k = 0; k < clutter; k++) {
+		CvPoint p = cvPoint(RandomBits(&benchSeed) % BENCH_WIDTH, RandomBits(&benchSeed) % BENCH_HEIGHT);
+		switch (RandomBits(&benchSeed) % 3) {
+		case 0:
+			cvCircle(img, p, 1 + RandomBits(&benchSeed) % 12, cvScalarAll(255), CV_FILLED, 8);
+			break;
+		case 1:
+			cvLine(img, p, cvPoint(p.x + (int) (RandomBits(&benchSeed) % 121) - 60,
+					p.y + (int) (RandomBits(&benchSeed) % 121) - 60), cvScalarAll(255), 1 + RandomBits(&benchSeed) % 3, 8);
+			break;
+		default:
+			CV_IMAGE_ELEM(img, uchar, p.y, p.x) = 255;
+			break;
+		}
+	}
+	long numSpeckles = (long) (BENCH_SPECKLE * BENCH_WIDTH * BENCH_HEIGHT);
+	for (k = 0; k < numSpeckles; k++)
+		CV_IMAGE_ELEM(img, uchar, RandomBits(&benchSeed) % BENCH_HEIGHT, RandomBits(&benchSeed) % BENCH_WIDTH) = 255;
+
+	/** As in cvFindContours() the one pixel frame is background **/
+	cvRectangle(img, cvPoint(0, 0), cvPoint(BENCH_WIDTH - 1, BENCH_HEIGHT - 1), cvScalarAll(0), 1, 8);
+}
+
+/*
+ * 1 if cvFindContours() finds a contour with exactly the points of trace
+ */
+static int MatchesFindContours(const IplImage* img, IplImage* scratch, const CvSeq* trace, CvMemStorage* mem){
+	CvSeq* contours = NULL;
+	cvCopy(img, scratch);
+	cvFindContours(scratch, mem, &contours, sizeof(CvContour), CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE, cvPoint(0, 0));
+	CvPoint start = *(CvPoint*) cvGetSeqElem(trace, 0);
+	CvSeq* c;
+	for (c = contours; c != NULL; c = c->h_next) {
+		CvPoint first = *(CvPoint*) cvGetSeqElem(c, 0);
+		if (first.x != start.x || first.y != start.y) continue;
+		if (c->total != trace->total) return 0;
+		int i;
+		for (i = 0; i < c->total; i++) {
+			CvPoint a = *(CvPoint*) cvGetSeqElem(c, i);
+			CvPoint b = *(CvPoint*) cvGetSeqElem(trace, i);
+			if (a.x != b.x || a.y != b.y) return 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv){
+	int numFrames = (argc > 1) ? atoi(argv[1]) : 50;
+
+	CvSize size = cvSize(BENCH_WIDTH, BENCH_HEIGHT);
+	IplImage* img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	IplImage* scratch = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	ContourTracer* ct = CreateContourTracer(size);
+	CvMemStorage* mem = cvCreateMemStorage(0);
+	CvPoint current[BENCH_CENTERLINE_PTS];
+	CvPoint last[BENCH_CENTERLINE_PTS];
+	CvSeq seedHeader;
+	CvSeqBlock seedBlock;
+
+	printf("%d frames of %dx%d per level, a %d px wide worm, %.1f%% speckle\n",
+			numFrames, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WORM_WIDTH, 100 * BENCH_SPECKLE);
+	printf("clutter   full search   seeded trace   fall backs   differ from cvFindContours\n");
+
+	int failed = 0;
+	int level;
+	for (level = 0; level < (int) (sizeof(clutterLevels) / sizeof(clutterLevels[0])); level++) {
+		WormPose pose;
+		pose.x = 250 + RandomBits(&benchSeed) % (BENCH_WIDTH - 500);
+		pose.y = 200 + RandomBits(&benchSeed) % (BENCH_HEIGHT - 400);
+		pose.heading = BENCH_PI * RandomUniform(&benchSeed);
+		pose.phase = 2 * BENCH_PI * RandomUniform(&benchSeed);
+		MakeCenterline(&pose, current);
+
+		double fullMs = 0;
+		double seededMs = 0;
+		int fallBacks = 0;
+		int mismatched = 0;
+		int f;
+		for (f = 0; f < numFrames; f++) {
+			/** Crawl a little **/
+			memcpy(last, current, sizeof(current));
+			pose.phase -= 0.1;
+			pose.x += cos(pose.heading);
+			pose.y += sin(pose.heading);
+			MakeCenterline(&pose, current);
+			MakeFrame(img, current, clutterLevels[level]);
+			cvClearMemStorage(mem);
+			CvSeq* seeds = cvMakeSeqHeaderForArray(CV_SEQ_ELTYPE_POINT, sizeof(CvSeq), sizeof(CvPoint),
+					last, BENCH_CENTERLINE_PTS, &seedHeader, &seedBlock);
+
+			long long t0 = MonotonicUs();
+			CvSeq* seeded = TraceSeededContour(ct, img, seeds);
+			long long t1 = MonotonicUs();
+			CvSeq* longest = FindLongestContour(ct, img, mem);
+			long long t2 = MonotonicUs();
+			seededMs += (t1 - t0) / 1000.0;
+			fullMs += (t2 - t1) / 1000.0;
+
+			if (seeded == NULL || longest == NULL || seeded->total < longest->total / 2) fallBacks++;
+			if (seeded != NULL && !MatchesFindContours(img, scratch, seeded, mem)) mismatched++;
+		}
+
+		printf("%7d   %8.2f ms   %9.2f ms   %10d   %d of %d\n", clutterLevels[level], fullMs / numFrames,
+				seededMs / numFrames, fallBacks, mismatched, numFrames);
+		if (mismatched > 0 || (clutterLevels[level] == 0 && fallBacks > 0)) failed = 1;
+	}
+
+	cvReleaseMemStorage(&mem);
+	DestroyContourTracer(&ct);
+	cvReleaseImage(&scratch);
+	cvReleaseImage(&img);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed;
+}
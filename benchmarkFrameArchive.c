@@ -0,0 +1,171 @@
+/*
+ * benchmarkFrameArchive.c
+ *
+ * Measures whether the lossless frame archive (MyLibs/FrameArchive.h) keeps
+ * up with the camera, without a camera.
+ *
+ * Synthetic 1024x768 frames of a worm crawling over a still, textured
+ * background with sensor noise are handed to the archive at a fixed frame
+ * rate, as the tracker would hand it the frames it grabs. Frames the archive
+ * had to drop because its encoder or the disk fell behind are counted. The
+ * archive is then replayed as fast as possible and every frame compared with
+ * the one that was recorded.
+ *
+ * Prints the number of cores and encoder threads, the compression ratio, the
+ * mean and worst time to encode a frame and the frame rate that the mean
+ * encode time would sustain. Exits with 1 if any frame was dropped or did
+ * not replay exactly.
+ *
+ * Usage: benchmarkFrameArchive.exe [frames] [fps] [archive]
+ *   e.g. benchmarkFrameArchive.exe 500 50 benchmark.mcraw
+ * The archive is deleted afterwards.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <windows.h>
+
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/FrameArchive.h"
+
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 768
+#define BENCH_NOISE_TABLE (BENCH_WIDTH * BENCH_HEIGHT + 65537) // noise is read from a shifting offset
+#define BENCH_WORM_LENGTH 300
+#define BENCH_WORM_RADIUS 9
+#define BENCH_PI 3.14159265358979
+
+/*
+ * The still background and a table of sensor noise, made once.
+ */
+typedef struct SceneStruct{
+	unsigned char* background;
+	signed char* noise;
+} Scene;
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long benchSeed = 12345;
+
+static Scene* CreateScene(void){
+	Scene* s = (Scene*) malloc(sizeof(Scene));
+	s->background = (unsigned char*) malloc(BENCH_WIDTH * BENCH_HEIGHT);
+	s->noise = (signed char*) malloc(BENCH_NOISE_TABLE);
+	int x, y;
+	for (y = 0; y < BENCH_HEIGHT; y++) {
+		for (x = 0; x < BENCH_WIDTH; x++) {
+			/** Uneven illumination and a little agar texture **/
+			double vignette = 1.0 - 0.25 * ((x - 512.0) * (x - 512.0) + (y - 384.0) * (y - 384.0)) / (512.0 * 512.0);
+			s->background[y * BENCH_WIDTH + x] = (unsigned char) (45 * vignette + (RandomBits(&benchSeed) % 4));
+		}
+	}
+	long k;
+	for (k = 0; k < BENCH_NOISE_TABLE; k++) {
+		/** Mostly -1..1, now and then a bigger excursion **/
+		unsigned int r = RandomBits(&benchSeed) % 100;
+		s->noise[k] = (signed char) ((r < 95) ? (int) (RandomBits(&benchSeed) % 3) - 1 : (int) (RandomBits(&benchSeed) % 9) - 4);
+	}
+	return s;
+}
+
+static void DestroyScene(Scene** s){
+	free((*s)->background);
+	free((*s)->noise);
+	free(*s);
+	*s = NULL;
+}
+
+/*
+ * Frame i: background plus this frame's noise, and a bright worm whose
+ * body wave travels from head to tail while it crawls to the right.
+ */
+static void MakeFrame(const Scene* s, long i, unsigned char* px){
+	const signed char* noise = s->noise + (i * 7919) % (BENCH_NOISE_TABLE - BENCH_WIDTH * BENCH_HEIGHT);
+	long k;
+	for (k = 0; k < BENCH_WIDTH * BENCH_HEIGHT; k++) {
+		int v = s->background[k] + noise[k];
+		px[k] = (unsigned char) ((v < 0) ? 0 : v);
+	}
+
+	int head = 150 + (int) ((i * 2) % (BENCH_WIDTH - BENCH_WORM_LENGTH - 200)) + BENCH_WORM_LENGTH;
+	int x, y;
+	for (x = head - BENCH_WORM_LENGTH; x <= head; x++) {
+		double phase = 2 * BENCH_PI * ((head - x) / 200.0 - i / 25.0);
+		int cy = 384 + (int) (30 * sin(phase));
+		for (y = cy - BENCH_WORM_RADIUS; y <= cy + BENCH_WORM_RADIUS; y++)
+			px[y * BENCH_WIDTH + x] = (unsigned char) (190 + noise[y * BENCH_WIDTH + x] * 3);
+	}
+}
+
+int main(int argc, char** argv){
+	long numFrames = (argc > 1) ? atol(argv[1]) : 500;
+	double fps = (argc > 2) ? atof(argv[2]) : 50;
+	const char* fname = (argc > 3) ? argv[3] : "benchmark.mcraw";
+
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	printf("%ld frames of %dx%d at %.0f fps, %d cores\n", numFrames, BENCH_WIDTH, BENCH_HEIGHT,
+			fps, (int) sysinfo.dwNumberOfProcessors);
+
+	Scene* scene = CreateScene();
+	unsigned char* px = (unsigned char*) malloc(BENCH_WIDTH * BENCH_HEIGHT);
+	FrameArchiveWriter* fa = CreateFrameArchive(fname, BENCH_WIDTH, BENCH_HEIGHT,
+			FRAMEARCHIVE_UNBUFFERED, FRAMEARCHIVE_CODEC_DELTA_RLE);
+	if (fa == NULL) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+	int numWorkers = fa->numWorkers;
+
+	/** Hand over each frame when it is due, as the camera would **/
+	long long periodUs = (long long) (1000000 / fps);
+	long long start = MonotonicUs();
+	long dropped = 0;
+	long i;
+	for (i = 0; i < numFrames; i++) {
+		MakeFrame(scene, i, px);
+		long long due = start + i * periodUs;
+		while (MonotonicUs() < due) Sleep(1);
+		if (AppendFrameToArchive(fa, px, i, i, MonotonicUs()) != FRAMEARCHIVE_OK) dropped++;
+	}
+
+	/** Frames in the last, partly filled batch are only encoded on close, so wait for the rest **/
+	long long fullBatches = (numFrames - dropped) / FRAMEARCHIVE_BATCH_FRAMES * FRAMEARCHIVE_BATCH_FRAMES;
+	double ratio, meanEncodeUs, maxEncodeUs;
+	while (FrameArchiveStats(fa, &ratio, &meanEncodeUs, &maxEncodeUs) < fullBatches) Sleep(1);
+	CloseFrameArchive(&fa);
+
+	FrameArchiveReader* fr = OpenFrameArchive(fname, 0);
+	if (fr == NULL) {
+		printf("Could not open %s\n", fname);
+		return 1;
+	}
+	long replayed = 0;
+	long mismatched = 0;
+	long long payloadBytes = 0;
+	FrameArchiveRecordHeader hdr;
+	unsigned char* replay;
+	while (ReadFrameFromArchive(fr, &hdr, &replay) == FRAMEARCHIVE_OK) {
+		MakeFrame(scene, (long) hdr.frameNum, px);
+		if (memcmp(px, replay, BENCH_WIDTH * BENCH_HEIGHT) != 0) mismatched++;
+		payloadBytes += hdr.payloadBytes;
+		replayed++;
+	}
+	CloseFrameArchiveReader(&fr);
+	remove(fname);
+
+	printf("encoder threads        %d\n", numWorkers);
+	printf("dropped at %.0f fps     %ld of %ld\n", fps, dropped, numFrames);
+	printf("replayed exactly       %ld of %ld\n", replayed - mismatched, numFrames - dropped);
+	printf("compression            %.2f:1 (payload only %.2f:1)\n", ratio,
+			(double) replayed * BENCH_WIDTH * BENCH_HEIGHT / (payloadBytes > 0 ? payloadBytes : 1));
+	printf("encode ms per frame    %.2f mean, %.2f worst\n", meanEncodeUs / 1000.0, maxEncodeUs / 1000.0);
+	printf("sustainable fps        %.0f\n", (meanEncodeUs > 0) ? 1000000.0 / meanEncodeUs : 0.0);
+
+	free(px);
+	DestroyScene(&scene);
+	int failed = (dropped > 0 || mismatched > 0 || replayed != numFrames - dropped);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed ? 1 : 0;
+}
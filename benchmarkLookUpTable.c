@@ -0,0 +1,269 @@
+/*
+ * benchmarkLookUpTable.c
+ *
+ * Times filling the 1024x768 CCD2DLPLookUp table with the thin-plate spline
+ * (MyLibs/ThinPlateSpline.h) on 1, 2 and 4 threads, and on one per
+ * processor, and checks how accurate the table is, without a camera or DLP.
+ *
+ * The calibration is made up: the points of calibrate_colbert_first's
+ * 100-mirror grid are sent through a known warp (a rotation, a scale and a
+ * 2% barrel distortion) to the camera, with 0.5 px of noise, and rounded to
+ * whole pixels as calibPoints.yaml holds them. Each table is compared with
+ * the exact inverse of the warp at every camera pixel that sees the DLP, and
+ * by how far it misses the calibrated points, which is what makeLookUpTable
+ * judges a table by when it has no exact one.
+ *
+ * MATLAB/makeLUTfromCalibData.m is reproduced for comparison. It calls
+ * cp2tform('lwm') with as many neighbours as there are points, so every
+ * local fit is the same least-squares quadratic and the blend of them is
+ * just that quadratic. The script evaluates it at 1-based pixel coordinates
+ * and rounds up with ceil.
+ *
+ * Exits with 1 if the tables made on different numbers of threads differ,
+ * or if fewer than 95% of the spline's entries are within 1 mirror.
+ *
+ * Usage: benchmarkLookUpTable.exe [repeats]
+ *   e.g. benchmarkLookUpTable.exe 3
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <windows.h>
+
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/ThinPlateSpline.h"
+
+#define BENCH_CCD_WIDTH 1024
+#define BENCH_CCD_HEIGHT 768
+#define BENCH_DLP_WIDTH 1024
+#define BENCH_DLP_HEIGHT 768
+#define BENCH_STEP 100 // calibrate_colbert_first's c->StepSize
+#define BENCH_ROTATION 0.05 // radians
+#define BENCH_SCALE 0.9 // camera pixels per mirror
+#define BENCH_BARREL 0.02 // extra stretch at BENCH_BARREL_RADIUS mirrors from the middle
+#define BENCH_BARREL_RADIUS 640.0
+#define BENCH_NOISE 0.5 // pixels, standard deviation
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long benchSeed = 12345;
+
+/** Where the camera sees DLP mirror (u,v) **/
+static void Warp(double u, double v, double* x, double* y){
+	double pu = u - BENCH_DLP_WIDTH / 2, pv = v - BENCH_DLP_HEIGHT / 2;
+	double r2 = (pu * pu + pv * pv) / (BENCH_BARREL_RADIUS * BENCH_BARREL_RADIUS);
+	double s = BENCH_SCALE * (1 + BENCH_BARREL * r2);
+	*x = BENCH_CCD_WIDTH / 2 + s * (cos(BENCH_ROTATION) * pu - sin(BENCH_ROTATION) * pv);
+	*y = BENCH_CCD_HEIGHT / 2 + s * (sin(BENCH_ROTATION) * pu + cos(BENCH_ROTATION) * pv);
+}
+
+/** The mirror the camera sees at (x,y): undo the rotation and scale, then solve for the radius **/
+static void Unwarp(double x, double y, double* u, double* v){
+	double qx = (x - BENCH_CCD_WIDTH / 2) / BENCH_SCALE, qy = (y - BENCH_CCD_HEIGHT / 2) / BENCH_SCALE;
+	double pu = cos(BENCH_ROTATION) * qx + sin(BENCH_ROTATION) * qy;
+	double pv = -sin(BENCH_ROTATION) * qx + cos(BENCH_ROTATION) * qy;
+	double q = sqrt(pu * pu + pv * pv);
+	double k = BENCH_BARREL / (BENCH_BARREL_RADIUS * BENCH_BARREL_RADIUS);
+	double r = q;
+	int i;
+	for (i = 0; i < 6; i++) r -= (r + k * r * r * r - q) / (1 + 3 * k * r * r);
+	double f = (q > 0) ? r / q : 1;
+	*u = BENCH_DLP_WIDTH / 2 + f * pu;
+	*v = BENCH_DLP_HEIGHT / 2 + f * pv;
+}
+
+/*
+ * The MATLAB script's table: the least-squares quadratic from camera to
+ * DLP points, at 1-based pixels, rounded up.
+ */
+static int QuadraticLookUpTable(const double* ccdX, const double* ccdY, const double* dlpX, const double* dlpY,
+		int numPoints, int* lookUp, int width, int height){
+	double ata[6][6], atx[6], aty[6];
+	memset(ata, 0, sizeof(ata));
+	memset(atx, 0, sizeof(atx));
+	memset(aty, 0, sizeof(aty));
+	int i, j, k;
+	for (k = 0; k < numPoints; k++) {
+		double x = ccdX[k] / width, y = ccdY[k] / width;
+		double t[6] = { 1, x, y, x * y, x * x, y * y };
+		for (i = 0; i < 6; i++) {
+			for (j = 0; j < 6; j++) ata[i][j] += t[i] * t[j];
+			atx[i] += t[i] * dlpX[k];
+			aty[i] += t[i] * dlpY[k];
+		}
+	}
+	for (i = 0; i < 6; i++) {
+		int pivot = i;
+		for (k = i + 1; k < 6; k++)
+			if (fabs(ata[k][i]) > fabs(ata[pivot][i])) pivot = k;
+		if (fabs(ata[pivot][i]) < 1e-12) return -1;
+		for (j = 0; j < 6; j++) {
+			double s = ata[i][j]; ata[i][j] = ata[pivot][j]; ata[pivot][j] = s;
+		}
+		double s = atx[i]; atx[i] = atx[pivot]; atx[pivot] = s;
+		s = aty[i]; aty[i] = aty[pivot]; aty[pivot] = s;
+		for (k = 0; k < 6; k++) {
+			if (k == i) continue;
+			double f = ata[k][i] / ata[i][i];
+			for (j = 0; j < 6; j++) ata[k][j] -= f * ata[i][j];
+			atx[k] -= f * atx[i];
+			aty[k] -= f * aty[i];
+		}
+	}
+	for (i = 0; i < 6; i++) {
+		atx[i] /= ata[i][i];
+		aty[i] /= ata[i][i];
+	}
+
+	int n = width * height;
+	int px, py;
+	for (px = 0; px < width; px++) {
+		for (py = 0; py < height; py++) {
+			double x = (px + 1.0) / width, y = (py + 1.0) / width;
+			double t[6] = { 1, x, y, x * y, x * x, y * y };
+			double fx = 0, fy = 0;
+			for (i = 0; i < 6; i++) {
+				fx += atx[i] * t[i];
+				fy += aty[i] * t[i];
+			}
+			lookUp[px * height + py] = (int) ceil(fx);
+			lookUp[n + px * height + py] = (int) ceil(fy);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Compare a table with the exact mapping, or with another table if other
+ * isn't NULL, over the camera pixels whose exact mirror is on the DLP.
+ * Returns the fraction within 1 mirror.
+ */
+static double PrintTableError(const char* name, const int* lookUp, const int* other, const int* exact,
+		int width, int height){
+	int n = width * height;
+	long seen = 0, withinOne = 0, withinTwo = 0;
+	double sum = 0;
+	int maxDiff = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (exact[i] < 0 || exact[i] >= BENCH_DLP_WIDTH || exact[n + i] < 0 || exact[n + i] >= BENCH_DLP_HEIGHT) continue;
+		const int* ref = (other != NULL) ? other : exact;
+		int dx = abs(lookUp[i] - ref[i]);
+		int dy = abs(lookUp[n + i] - ref[n + i]);
+		int d = (dx > dy) ? dx : dy;
+		seen++;
+		sum += d;
+		if (d <= 1) withinOne++;
+		if (d <= 2) withinTwo++;
+		if (d > maxDiff) maxDiff = d;
+	}
+	printf("%-34s %8.2f %9.1f %9.1f %7d\n", name, sum / seen, 100.0 * withinOne / seen,
+			100.0 * withinTwo / seen, maxDiff);
+	return (double) withinOne / seen;
+}
+
+int main(int argc, char** argv){
+	int repeats = (argc > 1) ? atoi(argv[1]) : 3;
+	if (repeats < 1) repeats = 1;
+	int width = BENCH_CCD_WIDTH, height = BENCH_CCD_HEIGHT;
+	int n = width * height;
+
+	/** The calibrated pairs of points **/
+	int maxPoints = (BENCH_DLP_WIDTH / BENCH_STEP + 1) * (BENCH_DLP_HEIGHT / BENCH_STEP + 1);
+	double* ccdX = (double*) malloc(maxPoints * sizeof(double));
+	double* ccdY = (double*) malloc(maxPoints * sizeof(double));
+	double* dlpX = (double*) malloc(maxPoints * sizeof(double));
+	double* dlpY = (double*) malloc(maxPoints * sizeof(double));
+	int numPoints = 0;
+	int u, v;
+	for (v = 0; v < BENCH_DLP_HEIGHT; v += BENCH_STEP) {
+		for (u = 0; u < BENCH_DLP_WIDTH; u += BENCH_STEP) {
+			double x, y;
+			Warp(u, v, &x, &y);
+			dlpX[numPoints] = u;
+			dlpY[numPoints] = v;
+			ccdX[numPoints] = floor(x + BENCH_NOISE * RandomGaussian(&benchSeed) + 0.5);
+			ccdY[numPoints] = floor(y + BENCH_NOISE * RandomGaussian(&benchSeed) + 0.5);
+			numPoints++;
+		}
+	}
+
+	/** The exact table **/
+	int* exact = (int*) malloc(2 * n * sizeof(int));
+	int px, py;
+	for (px = 0; px < width; px++) {
+		for (py = 0; py < height; py++) {
+			double du, dv;
+			Unwarp(px, py, &du, &dv);
+			exact[px * height + py] = (int) floor(du + 0.5);
+			exact[n + px * height + py] = (int) floor(dv + 0.5);
+		}
+	}
+
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	int cores = (int) sysinfo.dwNumberOfProcessors;
+	printf("%d pairs of points, %dx%d table, best of %d, %d cores\n\n", numPoints, width, height, repeats, cores);
+
+	long long start = MonotonicUs();
+	ThinPlateSpline* tps = FitThinPlateSpline(ccdX, ccdY, dlpX, dlpY, numPoints, TPS_DEFAULT_SMOOTHING);
+	if (tps == NULL) return 1;
+	printf("Fitting the spline took %.1f ms\n\n", (MonotonicUs() - start) / 1000.0);
+
+	/** Fill the table on more and more threads **/
+	int* lookUp = (int*) malloc(2 * n * sizeof(int));
+	int* first = (int*) malloc(2 * n * sizeof(int));
+	int threadCounts[4] = { 1, 2, 4, cores };
+	int numCounts = (cores > 4) ? 4 : 3;
+	double oneThreadMs = 0;
+	int failed = 0;
+	int c;
+	printf("threads   fill ms   speedup\n");
+	for (c = 0; c < numCounts; c++) {
+		double best = 0;
+		int r;
+		for (r = 0; r < repeats; r++) {
+			start = MonotonicUs();
+			ThinPlateSplineLookUpTable(tps, lookUp, width, height, threadCounts[c]);
+			double ms = (MonotonicUs() - start) / 1000.0;
+			if (r == 0 || ms < best) best = ms;
+		}
+		if (c == 0) {
+			oneThreadMs = best;
+			memcpy(first, lookUp, 2 * n * sizeof(int));
+		} else if (memcmp(first, lookUp, 2 * n * sizeof(int)) != 0) {
+			printf("The table made on %d threads differs from the one made on 1\n", threadCounts[c]);
+			failed = 1;
+		}
+		printf("%7d %9.1f %9.2f\n", threadCounts[c], best, oneThreadMs / best);
+	}
+	DestroyThinPlateSpline(&tps);
+
+	/** How close each table is, in mirrors, the larger of x and y **/
+	int* quadratic = (int*) malloc(2 * n * sizeof(int));
+	if (QuadraticLookUpTable(ccdX, ccdY, dlpX, dlpY, numPoints, quadratic, width, height) != 0) return 1;
+	printf("\n%-34s %8s %9s %9s %7s\n", "table", "mean", "% <= 1", "% <= 2", "max");
+	double splineWithinOne = PrintTableError("thin-plate spline vs exact", first, NULL, exact, width, height);
+	PrintTableError("MATLAB script vs exact", quadratic, NULL, exact, width, height);
+	PrintTableError("thin-plate spline vs MATLAB script", first, quadratic, exact, width, height);
+	if (splineWithinOne < 0.95) failed = 1;
+
+	/** What makeLookUpTable judges a table by: how far it misses the calibrated points **/
+	printf("\nmisses the calibrated points by, mirrors rms\n");
+	printf("%-34s %8.2f\n", "thin-plate spline",
+			LookUpTableRmsMiss(first, width, height, ccdX, ccdY, dlpX, dlpY, numPoints));
+	printf("%-34s %8.2f\n", "MATLAB script",
+			LookUpTableRmsMiss(quadratic, width, height, ccdX, ccdY, dlpX, dlpY, numPoints));
+
+	free(ccdX);
+	free(ccdY);
+	free(dlpX);
+	free(dlpY);
+	free(exact);
+	free(lookUp);
+	free(first);
+	free(quadratic);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed;
+}
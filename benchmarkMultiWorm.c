@@ -0,0 +1,146 @@
+/*
+ * benchmarkMultiWorm.c
+ *
+ * Measures what it costs per frame to track and segment 1 to 8 worms at
+ * once with the multi-worm tracker (MyLibs/MultiWorm.h), without a camera.
+ * Frames with no worm at all are timed too, for the part of the cost that is
+ * paid once per frame (smoothing, thresholding and finding contours).
+ *
+ * Synthetic 1024x768 frames hold the given number of 14 px wide worms,
+ * each crawling with a travelling body wave in its own part of the field of
+ * view, on a dim, noisy background. For each number of worms the tracker
+ * is reset and run on a series of frames, as DoMultiWormSegmentation()
+ * runs it.
+ *
+ * Prints the tracker's own table of the mean and worst time per frame by
+ * the number of worms, and exits with 1 if on any frame after the first
+ * fewer worms were segmented than are in view, or a worm's ID changed.
+ *
+ * Usage: benchmarkMultiWorm.exe [frames per worm count]
+ *   e.g. benchmarkMultiWorm.exe 200
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <windows.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/Talk2DLP.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/MultiWorm.h"
+#include "3rdPartyLibs/tictoc.h"
+
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 768
+#define BENCH_COLUMNS 4 // each worm crawls in its own cell of a 4x2 grid
+#define BENCH_ROWS 2
+#define BENCH_CENTERLINE_PTS 50
+#define BENCH_HALF_LENGTH 90 // pixels from the middle of a worm to either end
+#define BENCH_WAVE 20 // amplitude of the body wave, pixels
+#define BENCH_WORM_WIDTH 14
+#define BENCH_BACKGROUND 20
+#define BENCH_WORM_LEVEL 160
+#define BENCH_NOISE_LEVELS 9 // background noise is uniform over this many grey levels
+#define BENCH_PI 3.14159265358979
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long benchSeed = 12345;
+
+/*
+ * Draw worm k of frame f. Worms sway about the middle of their own cell, so
+ * they never touch.
+ */
+static void DrawWorm(IplImage* img, int k, long f){
+	double cellW = (double) BENCH_WIDTH / BENCH_COLUMNS;
+	double cellH = (double) BENCH_HEIGHT / BENCH_ROWS;
+	double x0 = cellW * (k % BENCH_COLUMNS + 0.5) + 10 * sin(f / 40.0 + k);
+	double y0 = cellH * (k / BENCH_COLUMNS + 0.5) + 10 * cos(f / 55.0 + 2 * k);
+	double heading = BENCH_PI / 2 * k / 3 + 0.2 * sin(f / 70.0 + k);
+	double phase = 2 * BENCH_PI * f / 25.0 + k;
+
+	CvPoint pts[BENCH_CENTERLINE_PTS];
+	CvPoint* ptsPtr = pts;
+	int n = BENCH_CENTERLINE_PTS;
+	int i;
+	for (i = 0; i < n; i++) {
+		double t = 2.0 * i / (n - 1) - 1;
+		double u = BENCH_HALF_LENGTH * t;
+		double v = BENCH_WAVE * sin(1.5 * BENCH_PI * t - phase);
+		pts[i].x = (int) (x0 + u * cos(heading) - v * sin(heading));
+		pts[i].y = (int) (y0 + u * sin(heading) + v * cos(heading));
+	}
+	cvPolyLine(img, &ptsPtr, &n, 1, 0, cvScalarAll(BENCH_WORM_LEVEL), BENCH_WORM_WIDTH, 8);
+}
+
+static void MakeFrame(IplImage* img, int numWorms, long f){
+	int x, y, k;
+	for (y = 0; y < BENCH_HEIGHT; y++) {
+		for (x = 0; x < BENCH_WIDTH; x++)
+			CV_IMAGE_ELEM(img, uchar, y, x) = (uchar) (BENCH_BACKGROUND + RandomBits(&benchSeed) % BENCH_NOISE_LEVELS);
+	}
+	for (k = 0; k < numWorms; k++) DrawWorm(img, k, f);
+}
+
+int main(int argc, char** argv){
+	long numFrames = (argc > 1) ? atol(argv[1]) : 200;
+
+	/** TICTOC's bookkeeping is not thread safe, and the workers all call into it **/
+	TICTOC::timer().enable(false);
+
+	CvSize size = cvSize(BENCH_WIDTH, BENCH_HEIGHT);
+	IplImage* img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	WormAnalysisData* Worm = CreateWormAnalysisDataStruct();
+	InitializeEmptyWormImages(Worm, size);
+	WormAnalysisParam* Params = CreateWormAnalysisParam();
+	MultiWormTracker* tracker = CreateMultiWormTracker(size);
+	if (tracker == NULL) {
+		printf("Could not create the multi-worm tracker\n");
+		return 1;
+	}
+
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	printf("%ld frames of %dx%d per worm count, %d cores\n", numFrames, BENCH_WIDTH, BENCH_HEIGHT,
+			(int) sysinfo.dwNumberOfProcessors);
+
+	int failed = 0;
+	int numWorms;
+	for (numWorms = 0; numWorms <= MULTIWORM_MAX_WORMS; numWorms++) {
+		Params->MultiWorm = numWorms;
+		ResetMultiWormTracker(tracker);
+
+		int firstIds[MULTIWORM_MAX_WORMS];
+		long missing = 0;
+		long switched = 0;
+		long f;
+		for (f = 0; f < numFrames; f++) {
+			MakeFrame(img, numWorms, f);
+			if (RefreshWormMemStorage(Worm) != 0 || LoadWormImg(Worm, img) != 0) {
+				printf("Could not load frame %ld\n", f);
+				return 1;
+			}
+			MultiWormSegment(tracker, Worm, Params);
+
+			/** The first frame starts every worm; after that each must be found, with the same ID **/
+			int k;
+			for (k = 0; k < MULTIWORM_MAX_WORMS; k++) {
+				if (f == 0) firstIds[k] = tracker->track[k].id;
+				else if (tracker->track[k].id != firstIds[k]) switched++;
+			}
+			if (f > 0 && MultiWormCount(tracker) < numWorms) missing++;
+		}
+		if (missing > 0 || switched > 0) {
+			printf("%d worms: %ld frames segmented too few, %ld ID changes\n", numWorms, missing, switched);
+			failed = 1;
+		}
+	}
+
+	DestroyMultiWormTracker(&tracker); // prints the times
+	DestroyWormAnalysisDataStruct(Worm);
+	cvReleaseImage(&img);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed;
+}
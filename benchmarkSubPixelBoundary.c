@@ -0,0 +1,221 @@
+/*
+ * benchmarkSubPixelBoundary.c
+ *
+ * Measures how close the sub-pixel worm boundary (TraceSubPixelBorder() in
+ * MyLibs/ContourTracer.h) comes to the true edge of the worm, and what it
+ * costs, against the integer contour it refines, without a camera.
+ *
+ * Synthetic 1024x768 frames hold a 14 px wide worm whose edge falls off
+ * as a tanh over a couple of pixels, with gaussian sensor noise. They are
+ * smoothed and thresholded as SmoothAndThresholdWorm() does. Because the
+ * worm's true outline is known, the distance of every boundary point from
+ * it can be measured, for
+ *   integer    the contour TraceSeededContour() follows
+ *   smoothed   that contour smoothed with smoothPtSequence() at sigma 3,
+ *              which the sub-pixel boundary replaces in LoadWormBoundary()
+ *   sub-pixel  TraceSubPixelBorder() on the smoothed image
+ * The bias is the mean signed distance, positive outside the worm.
+ *
+ * Also times the sub-pixel trace against the two smoothing passes it makes
+ * unnecessary: the boundary smoothing above and the centerline smoothing in
+ * SegmentWorm(), timed here on a sequence as long as the centerline.
+ *
+ * Exits with 1 if a frame couldn't be traced or the sub-pixel boundary is
+ * not at least twice as close to the edge as the integer contour.
+ *
+ * Usage: benchmarkSubPixelBoundary.exe [frames]
+ *   e.g. benchmarkSubPixelBoundary.exe 20
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <windows.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/ContourTracer.h"
+
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 768
+#define BENCH_CENTERLINE_PTS 401
+#define BENCH_HALF_LENGTH 200 // pixels from the middle of the worm to either end
+#define BENCH_WAVE 35 // amplitude of the body wave, pixels
+#define BENCH_RADIUS 7.0 // half the worm's width
+#define BENCH_EDGE_WIDTH 1.2 // pixels over which the edge falls off
+#define BENCH_NOISE 4.0 // standard deviation of the sensor noise
+#define BENCH_THRESH 127
+#define BENCH_GAUSS_SIZE 1 // as WormAnalysisParam's GaussSize
+#define BENCH_BOUND_SMOOTH 3 // sigma of the boundary smoothing
+#define BENCH_NUM_SEGMENTS 100
+#define BENCH_REPEATS 50 // times each step is repeated for timing
+#define BENCH_PI 3.14159265358979
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long benchSeed = 12345;
+
+/*
+ * Signed distance from (x,y) to the worm's outline, positive outside
+ */
+static double EdgeDistance(const CvPoint2D64f* centerline, double x, double y){
+	double best = 1e30;
+	int i;
+	for (i = 0; i + 1 < BENCH_CENTERLINE_PTS; i++) {
+		double vx = centerline[i + 1].x - centerline[i].x;
+		double vy = centerline[i + 1].y - centerline[i].y;
+		double wx = x - centerline[i].x;
+		double wy = y - centerline[i].y;
+		double t = (vx * wx + vy * wy) / (vx * vx + vy * vy);
+		t = (t < 0) ? 0 : ((t > 1) ? 1 : t);
+		double dx = wx - t * vx;
+		double dy = wy - t * vy;
+		double d = dx * dx + dy * dy;
+		if (d < best) best = d;
+	}
+	return sqrt(best) - BENCH_RADIUS;
+}
+
+/*
+ * A new worm, drawn into orig with noise
+ */
+static void MakeFrame(IplImage* orig, CvPoint2D64f* centerline){
+	double x0 = 350 + 300 * RandomUniform(&benchSeed);
+	double y0 = 330 + 100 * RandomUniform(&benchSeed);
+	double heading = 2 * BENCH_PI * RandomUniform(&benchSeed);
+	double phase = 2 * BENCH_PI * RandomUniform(&benchSeed);
+	int i;
+	for (i = 0; i < BENCH_CENTERLINE_PTS; i++) {
+		double t = 2.0 * i / (BENCH_CENTERLINE_PTS - 1) - 1;
+		double u = BENCH_HALF_LENGTH * t;
+		double v = BENCH_WAVE * sin(1.5 * BENCH_PI * t + phase);
+		centerline[i].x = x0 + u * cos(heading) - v * sin(heading);
+		centerline[i].y = y0 + u * sin(heading) + v * cos(heading);
+	}
+
+	int x, y;
+	for (y = 0; y < BENCH_HEIGHT; y++) {
+		for (x = 0; x < BENCH_WIDTH; x++) {
+			/** Only pixels near the worm need the distance **/
+			double level = 127.5 - 90;
+			if (fabs(x - x0) < BENCH_HALF_LENGTH + 3 * BENCH_RADIUS + BENCH_WAVE
+					&& fabs(y - y0) < BENCH_HALF_LENGTH + 3 * BENCH_RADIUS + BENCH_WAVE)
+				level = 127.5 + 90 * tanh(-EdgeDistance(centerline, x, y) / BENCH_EDGE_WIDTH);
+			int v = (int) floor(level + BENCH_NOISE * RandomGaussian(&benchSeed) + 0.5);
+			CV_IMAGE_ELEM(orig, uchar, y, x) = (uchar) ((v < 0) ? 0 : ((v > 255) ? 255 : v));
+		}
+	}
+}
+
+/*
+ * Running totals of |distance| and distance from the true edge
+ */
+typedef struct EdgeErrorStruct{
+	double absolute;
+	double signedSum;
+	long n;
+} EdgeError;
+
+static void AddEdgeError(EdgeError* e, const CvPoint2D64f* centerline, double x, double y){
+	double d = EdgeDistance(centerline, x, y);
+	e->absolute += fabs(d);
+	e->signedSum += d;
+	e->n++;
+}
+
+int main(int argc, char** argv){
+	int numFrames = (argc > 1) ? atoi(argv[1]) : 20;
+
+	CvSize size = cvSize(BENCH_WIDTH, BENCH_HEIGHT);
+	IplImage* orig = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	IplImage* smooth = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	IplImage* thresh = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	ContourTracer* ct = CreateContourTracer(size);
+	CvMemStorage* mem = cvCreateMemStorage(0);
+	CvPoint2D64f* centerline = (CvPoint2D64f*) malloc(BENCH_CENTERLINE_PTS * sizeof(CvPoint2D64f));
+	CvSeq seedHeader;
+	CvSeqBlock seedBlock;
+
+	EdgeError integer = { 0, 0, 0 };
+	EdgeError smoothed = { 0, 0, 0 };
+	EdgeError subPixel = { 0, 0, 0 };
+	double subPixelUs = 0;
+	double boundSmoothUs = 0;
+	double centerlineSmoothUs = 0;
+	int untraced = 0;
+	int f, r, i;
+	for (f = 0; f < numFrames; f++) {
+		MakeFrame(orig, centerline);
+		cvSmooth(orig, smooth, CV_GAUSSIAN, BENCH_GAUSS_SIZE * 2 + 1);
+		cvThreshold(smooth, thresh, BENCH_THRESH, 255, CV_THRESH_BINARY);
+		cvClearMemStorage(mem);
+
+		CvPoint seed = cvPoint((int) centerline[BENCH_CENTERLINE_PTS / 2].x, (int) centerline[BENCH_CENTERLINE_PTS / 2].y);
+		CvSeq* seeds = cvMakeSeqHeaderForArray(CV_SEQ_ELTYPE_POINT, sizeof(CvSeq), sizeof(CvPoint), &seed, 1, &seedHeader, &seedBlock);
+		CvSeq* contour = TraceSeededContour(ct, thresh, seeds);
+		if (contour == NULL) {
+			untraced++;
+			continue;
+		}
+		contour = cvCloneSeq(contour, mem);
+		CvPoint start = *(CvPoint*) cvGetSeqElem(contour, 0);
+
+		CvSeq* border = NULL;
+		long long t0 = MonotonicUs();
+		for (r = 0; r < BENCH_REPEATS; r++) border = TraceSubPixelBorder(ct, smooth, BENCH_THRESH, start, mem);
+		subPixelUs += (double) (MonotonicUs() - t0) / BENCH_REPEATS;
+		if (border == NULL) {
+			untraced++;
+			continue;
+		}
+
+		CvSeq* smoothContour = NULL;
+		t0 = MonotonicUs();
+		for (r = 0; r < BENCH_REPEATS; r++) smoothContour = smoothPtSequence(contour, BENCH_BOUND_SMOOTH, mem);
+		boundSmoothUs += (double) (MonotonicUs() - t0) / BENCH_REPEATS;
+
+		/** The centerline has about half as many points as the boundary **/
+		CvSeq* half = cvSeqSlice(contour, cvSlice(0, contour->total / 2), mem, 1);
+		t0 = MonotonicUs();
+		for (r = 0; r < BENCH_REPEATS; r++) smoothPtSequence(half, 0.5 * half->total / BENCH_NUM_SEGMENTS, mem);
+		centerlineSmoothUs += (double) (MonotonicUs() - t0) / BENCH_REPEATS;
+
+		for (i = 0; i < contour->total; i++) {
+			CvPoint* p = (CvPoint*) cvGetSeqElem(contour, i);
+			AddEdgeError(&integer, centerline, p->x, p->y);
+			CvPoint* q = (CvPoint*) cvGetSeqElem(smoothContour, i);
+			AddEdgeError(&smoothed, centerline, q->x, q->y);
+		}
+		for (i = 0; i < border->total; i++) {
+			CvPoint2D32f* p = (CvPoint2D32f*) cvGetSeqElem(border, i);
+			AddEdgeError(&subPixel, centerline, p->x, p->y);
+		}
+	}
+
+	int traced = numFrames - untraced;
+	if (traced == 0) traced = 1;
+	if (integer.n == 0) integer.n = 1;
+	if (smoothed.n == 0) smoothed.n = 1;
+	if (subPixel.n == 0) subPixel.n = 1;
+	printf("%d frames of %dx%d, a %.0f px wide worm, edge width %.1f px, noise sigma %.0f\n", numFrames,
+			BENCH_WIDTH, BENCH_HEIGHT, 2 * BENCH_RADIUS, BENCH_EDGE_WIDTH, BENCH_NOISE);
+	printf("distance from the true edge, px   mean     bias\n");
+	printf("  integer contour                 %.3f   %+.3f\n", integer.absolute / integer.n, integer.signedSum / integer.n);
+	printf("  smoothed at sigma %d             %.3f   %+.3f\n", BENCH_BOUND_SMOOTH, smoothed.absolute / smoothed.n, smoothed.signedSum / smoothed.n);
+	printf("  sub-pixel                       %.3f   %+.3f\n", subPixel.absolute / subPixel.n, subPixel.signedSum / subPixel.n);
+	printf("us per frame\n");
+	printf("  sub-pixel trace                 %.1f\n", subPixelUs / traced);
+	printf("  boundary smoothing              %.1f\n", boundSmoothUs / traced);
+	printf("  centerline smoothing            %.1f\n", centerlineSmoothUs / traced);
+	if (untraced > 0) printf("%d frames could not be traced\n", untraced);
+
+	int failed = (untraced > 0 || 2 * subPixel.absolute / subPixel.n > integer.absolute / integer.n);
+	free(centerline);
+	cvReleaseMemStorage(&mem);
+	DestroyContourTracer(&ct);
+	cvReleaseImage(&thresh);
+	cvReleaseImage(&smooth);
+	cvReleaseImage(&orig);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed;
+}
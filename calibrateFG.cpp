@@ -33,10 +33,15 @@
  *
  *  This routine works by flipping the mirrors so as to scan a point
  *  across the camera. The software records the location of the mirror
- *  and the corresponding light on the camera and then opens MATLAB
+ *  and the corresponding light on the camera and then fits a thin-plate
+ *  spline through the measured points (see MyLibs/ThinPlateSpline.h)
  *  to generate a lookup table to transform between camera space and
- *  mirror space based on the measured points. The calibration is stored in
- *  calib.dat
+ *  mirror space. The calibration is stored in calib.dat, and the measured
+ *  points in calibPoints.yaml.
+ *
+ *  With -l it instead projects a short sequence of structured light
+ *  patterns (see MyLibs/StructuredLight.h), decodes the DLP position seen
+ *  by every camera pixel, and writes calib.dat itself. No MATLAB needed.
  *
  */
 
@@ -72,6 +77,10 @@ using namespace std;
 #include "MyLibs/Talk2FrameGrabber.h"
 #include "MyLibs/Talk2DLP.h"
 #include "MyLibs/AndysComputations.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/TransformLib.h"
+#include "MyLibs/StructuredLight.h"
+#include "MyLibs/ThinPlateSpline.h"
 #include "version.h"
 
 
@@ -387,31 +396,6 @@ void CalibrateAPoint(CvPoint pt, CalibrationSession* c){
 
 }
 
-void WriteCalibrationToFile(int* CCD2DLPLookup, CvSize size, const char * filename ){
-
-	/** Open File **/
-	FILE *fp;
-	if ((fp = fopen(filename, "wb+")) == NULL) {
-		printf("ERROR: Cannot open file to write calibration\n");
-		return;
-	}
-
-	/** Write lookup table to disk **/
-	int result=fwrite(CCD2DLPLookup, sizeof(int)* 2 * size.width* size.height,1, fp);
-
-	if ( result != 1) {
-		printf("Write error!\n");
-	} else{
-		printf("Write was successful.\n");
-	}
-
-	fclose(fp);
-
-	return;
-}
-
-
-
 /*
 /* Write out the raw calibrated points to disk as a YAML fil
 /* MATLAB will later read this file in and generated a lookup table that is to be provided
@@ -500,10 +484,95 @@ int WriteOutCalibPointPairs(CvSeq *CalibSeq, int nsizex, int nsizey,int CCDsizex
 
 
 
+/*
+ * Calibrate every camera pixel at once with structured light. Projects each
+ * pattern, grabs the camera's view of it, then decodes the lookup table into
+ * c->CCD2DLPLookUp.
+ *
+ * Returns -1 if the patterns couldn't be decoded.
+ */
+int CalibrateWithStructuredLight(CalibrationSession* c){
+	StructuredLight* sl = CreateStructuredLight(c->DLPsize.width, c->DLPsize.height, c->Camsize.width, c->Camsize.height);
+	if (sl == NULL) return -1;
+
+	printf("Projecting %d structured light patterns.\n", sl->numPatterns);
+	int k;
+	for (k = 0; k < sl->numPatterns; k++) {
+		DrawStructuredLightPattern(sl, k, c->toDLP->binary);
+		T2DLP_SendFrame(c->toDLP->binary, c->myDLP);
+
+		/** The first frame may have been exposed before the mirrors flipped, so use the second **/
+		AcquireFrame(c->fg);
+		AcquireFrame(c->fg);
+		CheckFGSizeMatch(c->fromCCD->iplimg, c->fg);
+		LoadFrameWithBin(c->fg->HostBuf, c->fromCCD);
+		AddStructuredLightFrame(sl, k, c->fromCCD->binary);
+
+		CopyCharArrayToIplImage(c->toDLP->binary, c->toDLP->iplimg, c->DLPsize.width, c->DLPsize.height);
+		cvShowImage("ToDLP", c->toDLP->iplimg);
+		cvShowImage("FromCamera", c->fromCCD->iplimg);
+		cvWaitKey(3);
+		printf("Pattern %d of %d\n", k + 1, sl->numPatterns);
+	}
+	T2DLP_clear(c->myDLP);
+
+	int ret = DecodeStructuredLight(sl, c->CCD2DLPLookUp);
+	DestroyStructuredLight(&sl);
+	return (ret < 0) ? -1 : 0;
+}
+
+/*
+ * Generate the lookup table from the calibrated pairs of points with a
+ * thin-plate spline, rather than in MATLAB. Leaves CalibSeq as it is.
+ *
+ * Returns -1 if no spline could be fitted.
+ */
+int GenLookUpTableFromCalibSeq(CvSeq* CalibSeq, int* CCD2DLPLookUp, CvSize Camsize){
+	int numPairs = CalibSeq->total;
+	double* ccdX = (double*) malloc(numPairs * sizeof(double));
+	double* ccdY = (double*) malloc(numPairs * sizeof(double));
+	double* dlpX = (double*) malloc(numPairs * sizeof(double));
+	double* dlpY = (double*) malloc(numPairs * sizeof(double));
+	int k;
+	for (k = 0; k < numPairs; ++k) {
+		PairOfPoints* pair = (PairOfPoints*) cvGetSeqElem(CalibSeq, k);
+		dlpX[k] = pair->alpha.x;
+		dlpY[k] = pair->alpha.y;
+		ccdX[k] = pair->beta.x;
+		ccdY[k] = pair->beta.y;
+	}
+	ThinPlateSpline* tps = FitThinPlateSpline(ccdX, ccdY, dlpX, dlpY, numPairs, TPS_DEFAULT_SMOOTHING);
+	free(ccdX);
+	free(ccdY);
+	free(dlpX);
+	free(dlpY);
+	if (tps == NULL) return -1;
+
+	printf("The spline through %d pairs of points misses them by %.2f mirrors rms.\n", numPairs, tps->rmsResidual);
+	ThinPlateSplineLookUpTable(tps, CCD2DLPLookUp, Camsize.width, Camsize.height, 0);
+	DestroyThinPlateSpline(&tps);
+	return 0;
+}
+
 
 int main (int argc, char** argv){
 
 
+	/** Calibrate point by point, unless told to use structured light **/
+	int structuredLight = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "l")) != -1) {
+		switch (opt) {
+		case 'l': /** Calibrate with structured light **/
+			structuredLight = 1;
+			break;
+		default:
+			printf("Usage: calibrate_colbert_first.exe [-l]\n");
+			printf("\t-l\tCalibrate with structured light patterns and write calib.dat directly\n");
+			return -1;
+		}
+	}
+
 	/** Display output about the OpenCV setup currently installed **/
 	DisplayOpenCVInstall();
 
@@ -557,6 +626,22 @@ int main (int argc, char** argv){
 	T2DLP_clear(c->myDLP);
 
 
+	if (structuredLight) {
+		/** Decode the lookup table for every camera pixel and write it out **/
+		printf(" Beginning structured light calibration..\n");
+		if (CalibrateWithStructuredLight(c) == 0) {
+			WriteCalibToFile(c->CCD2DLPLookUp, c->Camsize, c->DLPsize, "calib.dat");
+		} else {
+			printf("Structured light calibration failed. Is the camera in focus on the DLP and exposed well enough?\n");
+		}
+		cvDestroyAllWindows();
+		T2DLP_off(c->myDLP);
+		CloseFrameGrabber(c->fg);
+		DestroyCalibrationSession(c);
+		printf("\n Good bye.\n");
+		return 0;
+	}
+
 
 	/*** Build Up a set of calibrated points ***/
 	int calx = 0;
@@ -581,16 +666,17 @@ int main (int argc, char** argv){
 
 	cvDestroyAllWindows();
 	
-	/** Generate Look Up Table in Matlab **/
-	printf("Writing out Calibrated Pair of Points to YAML for later processing by MATLAB...\n");
+	/** Generate Look Up Table, before writing out the points empties CalibSeq **/
+	printf("Generating look up table...\n");
+	int lutMade = GenLookUpTableFromCalibSeq(c->CalibSeq, c->CCD2DLPLookUp, c->Camsize);
+
+	/** Keep the raw points as well, for makeLookUpTable or MATLAB **/
+	printf("Writing out Calibrated Pair of Points to YAML...\n");
 	WriteOutCalibPointPairs(c->CalibSeq,c->DLPsize.width, c->DLPsize.height, c->Camsize.width, c->Camsize.height);
 	printf("YAML file written.\n");
-	
-	
-	//T2Matlab_GenLookUpTable(c->CalibSeq, c->CCD2DLPLookUp, c->DLPsize.width, c->DLPsize.height, c->Camsize.width, c->Camsize.height);
 
 	/** Write calibration to file **/
-	//WriteCalibrationToFile(c->CCD2DLPLookUp,c->Camsize,"calib.dat");
+	if (lutMade == 0) WriteCalibToFile(c->CCD2DLPLookUp, c->Camsize, c->DLPsize, "calib.dat");
 
 	/** Turn everything Off **/
 	T2DLP_off(c->myDLP);
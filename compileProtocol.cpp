@@ -0,0 +1,166 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+
+/*
+ * compileProtocol.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+/*
+ * Compiles a YAML illumination protocol into a compiled protocol file.
+ *
+ * Loading a YAML protocol parses every polygon through CvFileStorage and
+ * copies it into the protocol's memory storage, and every frame then
+ * interpolates the current step's polygons again. A compiled protocol has
+ * each polygon already interpolated into a contour and a table of where each
+ * step starts, so MindControl just memory-maps it and draws from it.
+ *
+ * After writing the file, the compiled protocol is loaded back and every
+ * step is checked against the YAML protocol, and both load times are printed.
+ *
+ * Usage:
+ * 	compileProtocol protocol.yml [protocol.mcproto]
+ *
+ * Then run MindControl with -p protocol.mcproto
+ */
+
+//Standard C headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//Windows Header
+#include <windows.h>
+
+//OpenCV Headers
+#include "opencv2/highgui/highgui_c.h"
+#include <cv.h>
+
+//Andy's Personal Headers
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/IllumWormProtocol.h"
+
+
+/*
+ * Returns 1 if both montages have the same polygons with the same points
+ */
+static int MontagesMatch(CvSeq* a, CvSeq* b){
+	if (a->total != b->total) return 0;
+	int k;
+	for (k = 0; k < a->total; ++k) {
+		CvSeq* pa = (*(WormPolygon**) cvGetSeqElem(a, k))->Points;
+		CvSeq* pb = (*(WormPolygon**) cvGetSeqElem(b, k))->Points;
+		if (pa->total != pb->total) return 0;
+		int i;
+		for (i = 0; i < pa->total; ++i) {
+			CvPoint* ptA = (CvPoint*) cvGetSeqElem(pa, i);
+			CvPoint* ptB = (CvPoint*) cvGetSeqElem(pb, i);
+			if (ptA->x != ptB->x || ptA->y != ptB->y) return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Use the input filename with its extension replaced
+ */
+static char* DefaultOutputName(const char* in){
+	char* out = (char*) malloc(strlen(in) + strlen(PROTOCOL_COMPILED_EXTENSION) + 1);
+	strcpy(out, in);
+	char* dot = strrchr(out, '.');
+	if (dot != NULL && strpbrk(dot, "/\\") == NULL) *dot = '\0';
+	strcat(out, PROTOCOL_COMPILED_EXTENSION);
+	return out;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 3) {
+		printf("Usage: compileProtocol protocol.yml [protocol%s]\n", PROTOCOL_COMPILED_EXTENSION);
+		return -1;
+	}
+	const char* in = argv[1];
+	char* out = (argc > 2) ? argv[2] : DefaultOutputName(in);
+
+	if (IsCompiledProtocolFile(in)) {
+		printf("Error! %s is already compiled.\n", in);
+		return -1;
+	}
+
+	long long start = MonotonicUs();
+	Protocol* yaml = LoadProtocolFromFile(in);
+	double yamlMs = (MonotonicUs() - start) / 1000.0;
+	if (yaml == NULL || yaml->Steps == NULL) {
+		printf("Error! Could not load %s\n", in);
+		return -1;
+	}
+
+	if (WriteCompiledProtocol(yaml, out) != 0) return -1;
+
+	start = MonotonicUs();
+	Protocol* compiled = LoadCompiledProtocol(out);
+	double compiledMs = (MonotonicUs() - start) / 1000.0;
+	if (compiled == NULL) return -1;
+
+	/**
+	 * Every step must draw exactly what the YAML protocol draws. Each step is
+	 * looked up twice, since the montages are built once and handed out on
+	 * every lookup, so the second lookup must give back the same montage.
+	 */
+	int numSteps = ProtocolNumSteps(yaml);
+	if (ProtocolNumSteps(compiled) != numSteps
+			|| compiled->GridSize.width != yaml->GridSize.width
+			|| compiled->GridSize.height != yaml->GridSize.height) {
+		printf("Error! %s does not match %s\n", out, in);
+		return -1;
+	}
+	int step;
+	for (step = 0; step < numSteps; ++step) {
+		CvSeq* a = GetMontageFromProtocolInterp(yaml, step);
+		CvSeq* b = GetMontageFromProtocolInterp(compiled, step);
+		if (!MontagesMatch(a, b)) {
+			printf("Error! Step %d of %s does not match %s\n", step, out, in);
+			return -1;
+		}
+		CvSeq* a2 = GetMontageFromProtocolInterp(yaml, step);
+		CvSeq* b2 = GetMontageFromProtocolInterp(compiled, step);
+		if (a2 != a || b2 != b || !MontagesMatch(a2, b2)) {
+			printf("Error! Step %d changed when it was looked up a second time\n", step);
+			return -1;
+		}
+	}
+
+	printf("Checked all %d steps.\n", numSteps);
+	printf("Loading %s took %.1f ms, loading %s took %.3f ms\n", in, yamlMs, out, compiledMs);
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * emulateStage.c
+ *
+ * Pretends to be a Ludl MAC6000 stage controller on a serial port, so that
+ * the stage code can be exercised without the stage.
+ *
+ * Connect it to MindControl or testStage.exe with a virtual null modem
+ * cable, such as a com0com pair: run this on one end of the pair and
+ * point the stage code at the other.
+ *
+ * Every command, terminated by \r, is answered with ":A\n" after the given
+ * delay, just like the real controller, or ":N -1\n" if it isn't one of
+ * the commands MindControl sends. The emulator prints the command rate
+ * and the velocity it was last told to spin at once a second.
+ *
+ * Usage: emulateStage.exe [port] [replyDelayMs]
+ *   e.g. emulateStage.exe COM8 5
+ *
+ * Press any key to quit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <conio.h>
+#include <windows.h>
+#include "MyLibs/Talk2Stage.h"
+
+
+int main(int argc, char** argv){
+	const char* port = (argc > 1) ? argv[1] : "COM8";
+	int delayMs = (argc > 2) ? atoi(argv[2]) : 5;
+
+	HANDLE s = InitializeSerialStage(port);
+	if (s == NULL) {
+		printf("Could not open %s\n", port);
+		return -1;
+	}
+	printf("Emulating a MAC6000 on %s, answering after %d ms. Press any key to quit.\n", port, delayMs);
+
+	char cmd[128];
+	int n = 0;
+	long commands = 0;
+	long errors = 0;
+	int vx = 0, vy = 0;
+	DWORD lastPrint = GetTickCount();
+	long commandsAtLastPrint = 0;
+
+	while (!_kbhit()) {
+		char c;
+		DWORD nRead = 0;
+		/** Times out according to the port's timeouts, so that we get to check the keyboard **/
+		if (ReadFile(s, &c, 1, &nRead, NULL) && nRead == 1) {
+			if (c != '\r') {
+				if (n < (int) sizeof(cmd) - 1) cmd[n++] = c;
+				continue;
+			}
+			cmd[n] = '\0';
+			n = 0;
+
+			int x, y;
+			int ok = 1;
+			if (sscanf(cmd, "SPIN X=%d Y=%d", &x, &y) == 2) {
+				vx = x;
+				vy = y;
+			} else if (strcmp(cmd, "HALT") == 0) {
+				vx = 0;
+				vy = 0;
+			} else if (sscanf(cmd, "MOVEI X=%d Y=%d", &x, &y) != 2
+					&& strcmp(cmd, "HERE X=0 Y=0") != 0
+					&& sscanf(cmd, "CENTER X=%d Y=%d", &x, &y) != 2) {
+				ok = 0;
+				errors++;
+				printf("Unknown command: %s\n", cmd);
+			}
+
+			if (delayMs > 0) Sleep(delayMs);
+			StageSendCommand(s, ok ? ":A\n" : ":N -1\n");
+			commands++;
+		}
+
+		if (GetTickCount() - lastPrint >= 1000) {
+			printf("%ld commands/s, %ld total, %ld unknown, velocity X=%d Y=%d\n",
+					commands - commandsAtLastPrint, commands, errors, vx, vy);
+			commandsAtLastPrint = commands;
+			lastPrint = GetTickCount();
+		}
+	}
+	CloseHandle(s);
+	return 0;
+}
@@ -83,6 +83,16 @@ using namespace std;
 #include "MyLibs/IllumWormProtocol.h"
 #include "MyLibs/TransformLib.h"
 #include "API/mc_api_dll.h"
+#include "MyLibs/Telemetry.h"
+#include "MyLibs/ParamSync.h"
+#include "MyLibs/VideoSource.h"
+#include "MyLibs/FrameArchive.h"
+#include "MyLibs/DisplayMailbox.h"
+#include "MyLibs/StageController.h"
+#include "MyLibs/StageTracker.h"
+#include "MyLibs/MotionPredictor.h"
+#include "MyLibs/MultiWorm.h"
+#include "MyLibs/Sequencer.h"
 #include "MyLibs/experiment.h"
 
 
@@ -90,12 +100,13 @@ using namespace std;
 #include "3rdPartyLibs/tictoc.h"
 
 /** Global Variables (for multithreading) **/
+/** The flags are only ever set with InterlockedExchange() **/
 UINT Thread(LPVOID lpdwParam);
 IplImage* CurrentImg;
-bool DispThreadHasStarted;
-bool MainThreadHasStopped;
-bool DispThreadHasStopped;
-bool UserWantsToStop;
+volatile LONG DispThreadHasStarted;
+volatile LONG MainThreadHasStopped;
+volatile LONG DispThreadHasStopped;
+volatile LONG UserWantsToStop;
 
 int main (int argc, char** argv){
 	int DEBUG=0;
@@ -121,6 +132,9 @@ int main (int argc, char** argv){
 	LoadCommandLineArguments(exp,argc,argv);
 	if (HandleCommandLineArguments(exp)==-1) return -1;
 
+	/** Start recording a timeline of profiling events if requested **/
+	if (exp->tracefname!=NULL) TICTOC::timer().enableTrace();
+
 	/** Read In Calibration Data ***/
 	if (HandleCalibrationData(exp)<0) return -1;
 
@@ -141,6 +155,14 @@ int main (int argc, char** argv){
 	AssignWindowNames(exp);
 
 
+	/** Give the display thread its own copy of the parameters **/
+	StartParamSync(exp);
+
+	/** Clear the flags before the thread can set them **/
+	InterlockedExchange(&DispThreadHasStarted,FALSE);
+	InterlockedExchange(&DispThreadHasStopped,FALSE);
+	InterlockedExchange(&MainThreadHasStopped,FALSE);
+
 	/** Start New Thread **/
 	DWORD dwThreadId;
 	HANDLE hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) Thread, (void*) exp,
@@ -153,9 +175,6 @@ int main (int argc, char** argv){
 
 
 	// wait for thread
-	DispThreadHasStarted=FALSE;
-	DispThreadHasStopped=FALSE;
-	MainThreadHasStopped=FALSE;
 	while (!DispThreadHasStarted)
 		Sleep(10);
 
@@ -172,7 +191,7 @@ int main (int argc, char** argv){
 	/** Giant While Loop Where Everything Happens **/
 	TICTOC::timer().tic("WholeLoop");
 	int VideoRanOut=0;
-	UserWantsToStop=0;
+	InterlockedExchange(&UserWantsToStop,0);
 	while (UserWantsToStop!=1) {
 		_TICTOC_TIC_FUNC
 		TICTOC::timer().tic("OneLoop");
@@ -180,11 +199,17 @@ int main (int argc, char** argv){
 
 			/** Set error to zero **/
 			exp->e=0;
+
+			/** Take in the user's latest parameters. They stay fixed for the rest of the frame. **/
+			SyncParamsFromGUI(exp);
+			/** Tag the grab with the number of the frame it is about to bring in **/
+			TICTOC::timer().setTraceFrame(exp->Worm->frameNum+1);
 			TICTOC::timer().tic("GrabFrame()");
 			/** Grab a frame **/
 			int ret=0;
 			ret=GrabFrame(exp);
-			TICTOC::timer().toc("GrabFrame()");
+			TelemetryAddSample(exp->telemetry,TELEM_GRAB,TICTOC::timer().toc("GrabFrame()"));
+			TICTOC::timer().setTraceFrame(exp->Worm->frameNum);
 
 			if (ret==EXP_VIDEO_RAN_OUT){
 				VideoRanOut=1;
@@ -212,33 +237,34 @@ int main (int argc, char** argv){
 			
 			
 			/**** Functions to decide if Illumination Should be on Or Off ***/
-			/** Handle Transient Illumination Timing **/
-			HandleIlluminationTiming(exp);
-
-			/** Handle head-tail illumination sweep **/
-			HandleIlluminationSweep(exp);
+			/** Timed illumination, head-tail sweep and timed secondary protocol step **/
+			DoSequencer(exp);
 
 
 			
 			/** Load Image into Our Worm Objects **/
 
 			if (exp->e == 0) exp->e=RefreshWormMemStorage(exp->Worm);
-			if (exp->e == 0) exp->e=LoadWormImg(exp->Worm,exp->fromCCD->iplimg);
-
-			/** Apply Levels**/  //Note this is slightly redundant with LoadWormImg
-			if (exp->e == 0) exp->e=simpleAdjustLevels(exp->fromCCD->iplimg, exp->Worm->ImgOrig, exp->Params->LevelsMin, exp->Params->LevelsMax);
+			/** GrabFrame() already put the levels adjusted image in ImgOrig **/
+			exp->Worm->timestamp=clock();
 
 
 			TICTOC::timer().tic("EntireSegmentation");
 			/** Do Segmentation **/
 			DoSegmentation(exp);
-			TICTOC::timer().toc("EntireSegmentation");
+			TelemetryAddSample(exp->telemetry,TELEM_SEGMENT,TICTOC::timer().toc("EntireSegmentation"));
 
 
 
 			/** Real-Time Curvature Phase Analysis, and phase induced illumination **/
 		    HandleCurvaturePhaseAnalysis(exp);
 
+			/** Steer the stage to follow the worm in this frame **/
+			DoStageTracking(exp);
+
+			/** Illuminate where the worm will be once the DLP shows this frame **/
+			DoMotionPrediction(exp);
+
 			/** If the DLP is not displaying right now, than turn off the mirrors */
 			ClearDLPifNotDisplayingNow(exp);
 
@@ -248,15 +274,11 @@ int main (int argc, char** argv){
 			or to transform the resulting illumination pattern                                           */ 
 			
 			TICTOC::timer().tic("TransformSegWormCam2DLP");
+			int wormOnDLP = 0; // 1 if the worm has a centerline in DLP space this frame
 			if (exp->e == 0){
-				TransformSegWormCam2DLP(exp->Worm->Segmented, exp->segWormDLP,exp->Calib);
+				wormOnDLP = (TransformSegWormCam2DLP(exp->segWormIllum, exp->segWormDLP,exp->Calib) == 1);
 			}
-			TICTOC::timer().toc("TransformSegWormCam2DLP");
-
-			/** Handle the Choise of Illumination Protocol Here**/
-			/** ANDY: write this here **/
-			 HandleTimedSecondaryProtocolStep(exp->p,exp->Params);
-
+			TelemetryAddSample(exp->telemetry,TELEM_TRANSFORM,TICTOC::timer().toc("TransformSegWormCam2DLP"));
 
 			/*** Do Some Illumination ***/
 			if (exp->e == 0) {
@@ -268,6 +290,10 @@ int main (int argc, char** argv){
 					SetFrame(exp->IlluminationFrame,128); // Turn all of the pixels on
 					SetFrame(exp->forDLP,128); // Turn all of the pixels o
 
+				} else if (MultiWormIsOn(exp)) {
+					/** Every worm, each with its own protocol step, into the same frame **/
+					DoMultiWormIllumination(exp);
+
 				} else {
 
 					if (!(exp->Params->ProtocolUse)) /** if not running the protocol **/{
@@ -283,15 +309,18 @@ int main (int argc, char** argv){
 						IlluminateFromProtocol(exp->segWormDLP,exp->forDLP,exp->p,exp->Params);
 						
 						/** Illuminate The worm in Camera Space **/						
-						IlluminateFromProtocol(exp->Worm->Segmented,exp->IlluminationFrame,exp->p,exp->Params);
+						IlluminateFromProtocol(exp->segWormIllum,exp->IlluminationFrame,exp->p,exp->Params);
 
-						TICTOC::timer().toc("IlluminateFromProtocol()");
+						TelemetryAddSample(exp->telemetry,TELEM_ILLUMINATE,TICTOC::timer().toc("IlluminateFromProtocol()"));
 
 					}
 
 				}
 				/** If InvertIllumination is on, then do that now in both cam space and DLP space**/
 				if (exp->Params->IllumInvert) InvertIllumination(exp);
+
+				/** If no part of the worm maps onto the DLP, don't illuminate where it isn't **/
+				if (!wormOnDLP && !(exp->Params->IllumFloodEverything)) SetFrame(exp->forDLP,0);
 			} else {
 				printf("Error in exp->e in the mainloop! code line 295\n");
 			}
@@ -299,19 +328,19 @@ int main (int argc, char** argv){
 
 			TICTOC::timer().tic("SendFrameToDLP");
 			if (exp->e == 0 && exp->Params->DLPOn && !(exp->SimDLP)) T2DLP_SendFrame((unsigned char *) exp->forDLP->binary, exp->myDLP); // Send image to DLP
-			TICTOC::timer().toc("SendFrameToDLP");
+			TelemetryAddSample(exp->telemetry,TELEM_DLP,TICTOC::timer().toc("SendFrameToDLP"));
+			NoteIlluminationLatency(exp);
 		
 
-			/*** DIsplay Some Monitoring Output ***/
-			if (exp->e == 0) CreateWormHUDS(exp->HUDS,exp->Worm,exp->Params,exp->IlluminationFrame);
-			if (exp->e==0 && exp->stageIsPresent==1) MarkRecenteringTarget(exp);
+			/*** DIsplay Some Monitoring Output. The HUDS for the video is drawn here, the one for the screen in PrepareSelectedDisplay() ***/
+			if (exp->e == 0 && HUDSIsRecorded(exp)) ComposeHUDS(exp,exp->HUDS);
 
 
 			if (exp->e == 0 &&  EverySoOften(exp->Worm->frameNum,exp->Params->DispRate) ){
 				TICTOC::timer().tic("DisplayOnScreen");
-				/** Setup Display but don't actually send to screen **/
+				/** Draw the display and post it to the display thread, which sends it to screen **/
 				PrepareSelectedDisplay(exp);
-				TICTOC::timer().toc("DisplayOnScreen");
+				TelemetryAddSample(exp->telemetry,TELEM_DISPLAY,TICTOC::timer().toc("DisplayOnScreen"));
 			}
 
 
@@ -321,16 +350,22 @@ int main (int argc, char** argv){
 				/** Send and Receive Values from API / Shared Memory **/
 				TICTOC::timer().tic("SyncAPI");
 				SyncAPI(exp);
-				TICTOC::timer().tic("SyncAPI");
+				TICTOC::timer().toc("SyncAPI");
 
 				/** Write Values to Disk **/
 				TICTOC::timer().tic("DoWriteToDisk()");
 				DoWriteToDisk(exp);
-				TICTOC::timer().toc("DoWriteToDisk()");
+				TelemetryAddSample(exp->telemetry,TELEM_WRITE,TICTOC::timer().toc("DoWriteToDisk()"));
 
 			}
 
 
+			/** Let the display thread know about parameters we changed this frame **/
+			PublishProcessingParams(exp);
+
+			/** Publish performance telemetry for external monitoring **/
+			TelemetryPublish(exp->telemetry,exp->Worm->frameNum);
+
 			if (exp->e != 0) {
 				printf("\nError in main loop. :(\n");
 				//where emergency stage shutoff used to go
@@ -339,7 +374,7 @@ int main (int argc, char** argv){
 
 		}
 		if (UserWantsToStop) break;
-			TICTOC::timer().toc("OneLoop");
+			TelemetryAddSample(exp->telemetry,TELEM_LOOP,TICTOC::timer().toc("OneLoop"));
 
 	}
 	/** Shut down the main thread **/
@@ -347,7 +382,7 @@ int main (int argc, char** argv){
 
 	TICTOC::timer().toc("WholeLoop");
 	/** Tell the display thread that the main thread is shutting down**/
-	MainThreadHasStopped=TRUE;
+	InterlockedExchange(&MainThreadHasStopped,TRUE);
 
 	TICTOC::timer().tic("FinishRecording()");
 	FinishRecording(exp);
@@ -372,6 +407,7 @@ int main (int argc, char** argv){
 
 
 	printf("%s",TICTOC::timer().generateReportCstr());
+	FlushTrace(exp);
     if (!DispThreadHasStopped){
 	   printf("Waiting for DisplayThread to Stop...");
 
@@ -410,18 +446,18 @@ UINT Thread(LPVOID lpdwParam) {
 //	SetPriorityClass(GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
 
 	printf("Beginning ProtocolStep Display\n");
-	DispThreadHasStarted = TRUE;
+	InterlockedExchange(&DispThreadHasStarted,TRUE);
 	cvWaitKey(30);
 
 	/** Protocol WormSpace Display **/
 	int prevProtocolStep;
-	int prevIllumFlipLR=exp->Params->IllumFlipLR;
+	int prevIllumFlipLR=exp->GuiParams->IllumFlipLR;
 	IplImage* rectWorm;
 	if (exp->pflag){ /** If a protocol was loaded **/
 		rectWorm= GenerateRectangleWorm(exp->p->GridSize);
 		cvZero(rectWorm);
-		IllumRectWorm(rectWorm,exp->p,exp->Params->ProtocolStep,exp->Params->IllumFlipLR);
-		prevProtocolStep=exp->Params->ProtocolStep;
+		IllumRectWorm(rectWorm,exp->p,exp->GuiParams->ProtocolStep,exp->GuiParams->IllumFlipLR);
+		prevProtocolStep=exp->GuiParams->ProtocolStep;
 		cvShowImage("ProtoIllum",rectWorm);
 	}
 
@@ -446,8 +482,11 @@ UINT Thread(LPVOID lpdwParam) {
 
 			TICTOC::timer().tic("DisplayThreadGuts");
 			TICTOC::timer().tic("cvShowImage");
-			if (exp->Params->OnOff){
-				cvShowImage("Display",exp->CurrentSelectedImg);
+			if (exp->GuiParams->OnOff){
+				/** Show the latest finished display image, if there is a new one **/
+				int isNew;
+				IplImage* latest=DisplayMailboxLatest(exp->DisplayBox,&isNew);
+				if (latest!=NULL && isNew) cvShowImage("Display",latest);
 			}else{
 				cvShowImage(exp->WinDisp, exp->fromCCD->iplimg);
 			}
@@ -458,17 +497,18 @@ UINT Thread(LPVOID lpdwParam) {
 
 
 			/** If we are using protocols and we havec chosen a new protocol step **/
-			if (exp->Params->ProtocolUse &&  ( (prevProtocolStep!= exp->Params->ProtocolStep) || prevIllumFlipLR != exp->Params->IllumFlipLR  ) )  {
+			if (exp->GuiParams->ProtocolUse &&  ( (prevProtocolStep!= exp->GuiParams->ProtocolStep) || prevIllumFlipLR != exp->GuiParams->IllumFlipLR  ) )  {
 				cvZero(rectWorm);
-				IllumRectWorm(rectWorm,exp->p,exp->Params->ProtocolStep,exp->Params->IllumFlipLR);
-				prevProtocolStep=exp->Params->ProtocolStep;
-				prevIllumFlipLR=exp->Params->IllumFlipLR;
+				IllumRectWorm(rectWorm,exp->p,exp->GuiParams->ProtocolStep,exp->GuiParams->IllumFlipLR);
+				prevProtocolStep=exp->GuiParams->ProtocolStep;
+				prevIllumFlipLR=exp->GuiParams->IllumFlipLR;
 				/** Update the Protocol **/
 				cvShowImage("ProtoIllum",rectWorm);
 
 			}
 
 			TICTOC::timer().toc("DisplayThreadGuts");
+			SyncGUIParams(exp);
 			UpdateGUI(exp);
 
 			key=cvWaitKey(20); //This controls how often the stage and GUI get updated
@@ -480,36 +520,29 @@ UINT Thread(LPVOID lpdwParam) {
 				printf("\n\nEscape key pressed!\n\n");
 
 				/** Let the Other thread know that the user wants to stop **/
-				UserWantsToStop=1;
+				InterlockedExchange(&UserWantsToStop,1);
 
 				/** Emergency Shut off the Stage **/
 				printf("Emergency stage shut off.");
 				if (exp->stageIsPresent) ShutOffStage(exp);
 
 				/** Exit the display thread immediately **/
-				DispThreadHasStopped=TRUE;
+				InterlockedExchange(&DispThreadHasStopped,TRUE);
 				printf("\nDisplayThread: Goodbye!\n");
 				return 0;
 
 
 			}
 
+			SyncGUIParams(exp);
 			UpdateGUI(exp);
 
 			if(EverySoOften(k,1)){ //This determines how often the stage is updated
-				
-				
-				if (exp->e != 0 && exp->stageIsPresent) {
-					printf("\tAuto-safety STAGE SHUTOFF from dispThread!\n");
-					ShutOffStage(exp);
-				} else {
-				
-					/** Do the Stage Tracking **/
-					TICTOC::timer().tic("HandleStageTracker()");
-					HandleStageTracker(exp);
-					TICTOC::timer().toc("HandleStageTracker()");
-				
-				}
+
+				/** Turning tracking on and off. DoStageTracking() halts the stage if the worm is lost. **/
+				TICTOC::timer().tic("HandleStageTracker()");
+				HandleStageTracker(exp);
+				TICTOC::timer().toc("HandleStageTracker()");
 
 				/** Write the Recent Frame Number to File to be accessed by the Annotation System **/
 				TICTOC::timer().tic("WriteRecentFrameNumberToFile()");
@@ -529,7 +562,7 @@ UINT Thread(LPVOID lpdwParam) {
 
 	//	printf("%s",TICTOC::timer().generateReportCstr());
 		printf("\nDisplayThread: Goodbye!\n");
-		DispThreadHasStopped=TRUE;
+		InterlockedExchange(&DispThreadHasStopped,TRUE);
 	return 0;
 }
 
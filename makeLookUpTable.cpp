@@ -0,0 +1,226 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+
+/*
+ * makeLookUpTable.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+/*
+ * Makes calib.dat from the calibrated pairs of points that
+ * calibrate_colbert_first writes to calibPoints.yaml, with a thin-plate
+ * spline (see MyLibs/ThinPlateSpline.h). This does the job of
+ * MATLAB/makeLUTfromCalibData.m without MATLAB.
+ *
+ * If given a lookup table made some other way, for instance by the MATLAB
+ * script, it also reports how far the two disagree over the camera pixels
+ * that see the DLP, and how far each misses the calibrated points. It exits
+ * with 1 if the new table misses the points by more than LUT_TOLERANCE
+ * mirrors rms beyond what the other table does.
+ *
+ * Usage:
+ * 	makeLookUpTable [calibPoints.yaml] [calib.dat] [compareWith.dat]
+ */
+
+//Standard C headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//Windows Header
+#include <windows.h>
+
+//OpenCV Headers
+#include "opencv2/highgui/highgui_c.h"
+#include <cv.h>
+
+//Andy's Personal Headers
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/TransformLib.h"
+#include "MyLibs/ThinPlateSpline.h"
+
+/*
+ * How much further, in mirrors rms, the new table may miss the calibrated
+ * points than the other table. Two tables made in different ways aren't
+ * expected to agree pixel for pixel (the MATLAB script fits one quadratic
+ * to the whole field and rounds up, so it is several mirrors from the spline
+ * in places), but both should land on the points they were made from.
+ * Rounding to whole mirrors alone misses by about 0.4 rms.
+ */
+#define LUT_TOLERANCE 0.5
+
+
+/*
+ * Compare the new lookup table with one in a file: how far apart they are
+ * over the camera pixels the new one puts on the DLP, and how far each
+ * misses the calibrated pairs of points.
+ * Returns 0 if the new table is within tolerance, 1 if not, -1 if the file can't be read.
+ */
+static int CompareLookUpTables(const int* lookUp, const char* filename, int nsizex, int nsizey, int CCDsizex, int CCDsizey,
+		const double* ccdX, const double* ccdY, const double* dlpX, const double* dlpY, int numPairs){
+	int n = CCDsizex * CCDsizey;
+	CalibData* Calib = CreateCalibData(cvSize(nsizex, nsizey), cvSize(CCDsizex, CCDsizey));
+	if (LoadCalibFromFile(Calib, filename) != 0) {
+		printf("Error! Could not read a %dx%d lookup table from %s\n", CCDsizex, CCDsizey, filename);
+		DestroyCalibData(Calib);
+		return -1;
+	}
+	int* other = (int*) malloc(2 * n * sizeof(int));
+	int i;
+	for (i = 0; i < 2 * n; i++) other[i] = Calib->CCD2DLPLookUp[i];
+	DestroyCalibData(Calib);
+
+	long seen = 0, withinOne = 0, withinTwo = 0;
+	double sum = 0;
+	int maxDiff = 0;
+	for (i = 0; i < n; i++) {
+		if (lookUp[i] < 0 || lookUp[i] >= nsizex || lookUp[n + i] < 0 || lookUp[n + i] >= nsizey) continue;
+		if (other[i] == CALIB_OUT_OF_RANGE || other[n + i] == CALIB_OUT_OF_RANGE) continue;
+		int dx = abs(lookUp[i] - other[i]);
+		int dy = abs(lookUp[n + i] - other[n + i]);
+		int d = (dx > dy) ? dx : dy;
+		seen++;
+		sum += d;
+		if (d <= 1) withinOne++;
+		if (d <= 2) withinTwo++;
+		if (d > maxDiff) maxDiff = d;
+	}
+	if (seen > 0) {
+		printf("Compared with %s over %ld camera pixels on the DLP:\n", filename, seen);
+		printf("\tmean difference %.2f mirrors, %.1f%% within 1, %.1f%% within 2, at most %d\n",
+				sum / seen, 100.0 * withinOne / seen, 100.0 * withinTwo / seen, maxDiff);
+	} else {
+		printf("%s puts none of the camera pixels that the new table does on the DLP.\n", filename);
+	}
+
+	/** Judge both tables by the points they were made from **/
+	double newMiss = LookUpTableRmsMiss(lookUp, CCDsizex, CCDsizey, ccdX, ccdY, dlpX, dlpY, numPairs);
+	double otherMiss = LookUpTableRmsMiss(other, CCDsizex, CCDsizey, ccdX, ccdY, dlpX, dlpY, numPairs);
+	free(other);
+	if (newMiss < 0) {
+		printf("None of the calibrated points is on the camera, so the tables can't be judged.\n");
+		return 1;
+	}
+	printf("\tthe new table misses the calibrated points by %.2f mirrors rms, %s by %.2f\n",
+			newMiss, filename, otherMiss);
+	if (newMiss > otherMiss + LUT_TOLERANCE) {
+		printf("The new table is NOT within tolerance: it misses the points by more than %.1f mirrors rms beyond %s.\n",
+				LUT_TOLERANCE, filename);
+		return 1;
+	}
+	printf("The new table is within tolerance.\n");
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 4) {
+		printf("Usage: makeLookUpTable [calibPoints.yaml] [calib.dat] [compareWith.dat]\n");
+		return -1;
+	}
+	const char* in = (argc > 1) ? argv[1] : "calibPoints.yaml";
+	const char* out = (argc > 2) ? argv[2] : "calib.dat";
+
+	/** Read in the pairs of points **/
+	long long start = MonotonicUs();
+	CvFileStorage* fs = cvOpenFileStorage(in, 0, CV_STORAGE_READ);
+	if (fs == NULL) {
+		printf("Error! Could not open %s\n", in);
+		return -1;
+	}
+	int nsizex = cvReadIntByName(fs, NULL, "DLPwidth", 0);
+	int nsizey = cvReadIntByName(fs, NULL, "DLPheight", 0);
+	int CCDsizex = cvReadIntByName(fs, NULL, "CCDwidth", 0);
+	int CCDsizey = cvReadIntByName(fs, NULL, "CCDheight", 0);
+	CvFileNode* node = cvGetFileNodeByName(fs, NULL, "PairOfPoints");
+	if (nsizex <= 0 || nsizey <= 0 || CCDsizex <= 0 || CCDsizey <= 0 || node == NULL || !CV_NODE_IS_SEQ(node->tag)) {
+		printf("Error! %s is missing the sizes or the PairOfPoints.\n", in);
+		cvReleaseFileStorage(&fs);
+		return -1;
+	}
+
+	CvSeq* pairSeq = node->data.seq;
+	int numPairs = pairSeq->total;
+	double* ccdX = (double*) malloc(numPairs * sizeof(double));
+	double* ccdY = (double*) malloc(numPairs * sizeof(double));
+	double* dlpX = (double*) malloc(numPairs * sizeof(double));
+	double* dlpY = (double*) malloc(numPairs * sizeof(double));
+	CvSeqReader reader;
+	cvStartReadSeq(pairSeq, &reader, 0);
+	int k;
+	for (k = 0; k < numPairs; ++k) {
+		CvFileNode* pairNode = (CvFileNode*) reader.ptr;
+		CvFileNode* dlp = cvGetFileNodeByName(fs, pairNode, "DLP");
+		CvFileNode* ccd = cvGetFileNodeByName(fs, pairNode, "CCD");
+		dlpX[k] = cvReadIntByName(fs, dlp, "x", 0);
+		dlpY[k] = cvReadIntByName(fs, dlp, "y", 0);
+		ccdX[k] = cvReadIntByName(fs, ccd, "x", 0);
+		ccdY[k] = cvReadIntByName(fs, ccd, "y", 0);
+		CV_NEXT_SEQ_ELEM(pairSeq->elem_size, reader);
+	}
+	cvReleaseFileStorage(&fs);
+	double readMs = (MonotonicUs() - start) / 1000.0;
+	printf("Read %d pairs of points from %s, DLP %dx%d, camera %dx%d\n", numPairs, in, nsizex, nsizey, CCDsizex, CCDsizey);
+
+	/** Fit the spline and fill in the table **/
+	start = MonotonicUs();
+	ThinPlateSpline* tps = FitThinPlateSpline(ccdX, ccdY, dlpX, dlpY, numPairs, TPS_DEFAULT_SMOOTHING);
+	if (tps == NULL) return -1;
+	double fitMs = (MonotonicUs() - start) / 1000.0;
+
+	int* lookUp = (int*) malloc(2 * CCDsizex * CCDsizey * sizeof(int));
+	start = MonotonicUs();
+	int numThreads = ThinPlateSplineLookUpTable(tps, lookUp, CCDsizex, CCDsizey, 0);
+	double tableMs = (MonotonicUs() - start) / 1000.0;
+	printf("The spline misses the points by %.2f mirrors rms.\n", tps->rmsResidual);
+	printf("Reading took %.1f ms, fitting %.1f ms, and filling the table %.1f ms on %d threads.\n",
+			readMs, fitMs, tableMs, numThreads);
+	DestroyThinPlateSpline(&tps);
+
+	/** Write out calib.dat **/
+	int ret = 0;
+	if (WriteCalibToFile(lookUp, cvSize(CCDsizex, CCDsizey), cvSize(nsizex, nsizey), out) != 0) {
+		printf("Error! Could not write %s\n", out);
+		ret = -1;
+	} else {
+		printf("Wrote %s\n", out);
+		if (argc > 3 && CompareLookUpTables(lookUp, argv[3], nsizex, nsizey, CCDsizex, CCDsizey,
+				ccdX, ccdY, dlpX, dlpY, numPairs) != 0) ret = 1;
+	}
+	free(ccdX);
+	free(ccdY);
+	free(dlpX);
+	free(dlpY);
+	free(lookUp);
+	return ret;
+}
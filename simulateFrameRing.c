@@ -0,0 +1,137 @@
+/*
+ * simulateFrameRing.c
+ *
+ * Runs the continuous acquisition ring (MyLibs/FrameRing.h) against the
+ * simulated grabber, without a frame grabber.
+ *
+ * Two sources are tried:
+ *   copy   the grabber is handed a free slot and fills it
+ *   dma    the grabber fills its own ring of buffers in order, as the BitFlow
+ *          board does during a continuous grab, and skips the ones held for
+ *          the newest frame and the one being read
+ *
+ * The grabber exposes a frame every few ms, and now and then bursts frames
+ * back to back or times out several times in a row, which makes the ring
+ * restart it. The processing thread takes the newest frame, takes anywhere
+ * from no time to three frame periods over it, and checks that the frame was
+ * not written to while it held it.
+ *
+ * Prints what it saw and exits with 1 if any frame was torn, any grab failed,
+ * or the frames the processing thread missed don't add up to the overflows.
+ *
+ * Usage: simulateFrameRing.exe [seconds]
+ *   e.g. simulateFrameRing.exe 5
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <windows.h>
+
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/FrameRing.h"
+
+#define SIM_FRAME_BYTES (1024 * 768)
+#define SIM_BUFFERS 8
+#define SIM_PERIOD_MS 5
+#define SIM_TIMEOUT_EVERY 200 // grabs between runs of timeouts
+#define SIM_TIMEOUTS_BEFORE_RECOVER 3
+#define SIM_OVERRUN_EVERY 97 // grabs between bursts
+#define SIM_OVERRUN_BURST 6
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long simSeed = 12345;
+
+/*
+ * 1 if every byte of the frame is value
+ */
+static int FrameIs(const unsigned char* frame, long frameSize, unsigned char value){
+	long k;
+	for (k = 0; k < frameSize; k++) {
+		if (frame[k] != value) return 0;
+	}
+	return 1;
+}
+
+/*
+ * Take frames from the ring for the given time, as GrabFrame() does.
+ * Returns the number of failures.
+ */
+static int RunConsumer(const char* name, int dma, double seconds){
+	SimulatedGrabber* sim = CreateSimulatedGrabber(SIM_PERIOD_MS, SIM_TIMEOUT_EVERY,
+			SIM_OVERRUN_EVERY, SIM_OVERRUN_BURST);
+	sim->timeoutRun = SIM_TIMEOUTS_BEFORE_RECOVER;
+
+	FrameRing* ring;
+	FrameSource src;
+	if (dma) {
+		src = SimulatedDMAFrameSource(sim, SIM_BUFFERS, SIM_FRAME_BYTES);
+		ring = CreateFrameRingOnBuffers(SIM_BUFFERS, SIM_FRAME_BYTES, sim->buffers);
+	} else {
+		src = SimulatedFrameSource(sim);
+		ring = CreateFrameRing(SIM_BUFFERS, SIM_FRAME_BYTES);
+	}
+	src.maxConsecutiveTimeouts = SIM_TIMEOUTS_BEFORE_RECOVER;
+	if (ring == NULL || (src.Grab == NULL && src.WaitSlot == NULL)
+			|| StartFrameRingAcquisition(ring, src) != FRAMERING_OK) {
+		printf("%-5s could not start the ring\n", name);
+		return 1;
+	}
+
+	unsigned long lastSeq = 0;
+	long claimed = 0;
+	long missed = 0;
+	long torn = 0;
+	long waits = 0;
+	DWORD start = GetTickCount();
+	while (GetTickCount() - start < (DWORD) (1000 * seconds)) {
+		unsigned char* frame;
+		unsigned long seq;
+		if (FrameRingGetNewest(ring, lastSeq, 200, &frame, &seq) != FRAMERING_OK) {
+			waits++;
+			continue;
+		}
+		if (lastSeq > 0 && seq > lastSeq + 1) missed += (long) (seq - lastSeq - 1);
+		lastSeq = seq;
+		claimed++;
+
+		/** Process it for a while, then make sure nothing wrote into it meanwhile **/
+		unsigned char value = (unsigned char) (seq & 0xFF);
+		if (!FrameIs(frame, SIM_FRAME_BYTES, value)) torn++;
+		Sleep(RandomBits(&simSeed) % (3 * SIM_PERIOD_MS + 1));
+		if (!FrameIs(frame, SIM_FRAME_BYTES, value)) torn++;
+		FrameRingRelease(ring);
+	}
+
+	StopFrameRingAcquisition(ring);
+	long overflows = (long) ring->overflows;
+	long produced = (long) ring->seq;
+	long errors = (long) ring->errors;
+	long recoveries = (long) ring->recoveries;
+
+	/*
+	 * Every frame the consumer skipped was replaced while unclaimed.
+	 * Frames completed after its last claim may have been replaced too.
+	 */
+	int countsAgree = (missed <= overflows && overflows <= missed + (long) (produced - lastSeq));
+	int failed = (torn > 0 || errors > 0 || !countsAgree || recoveries == 0 || waits > 0);
+
+	printf("%-5s %6ld frames, %6ld processed, %6ld missed, %6ld overflows, %4ld timeouts, %3ld recoveries, %ld torn: %s\n",
+			name, produced, claimed, missed, overflows, (long) ring->timeouts, recoveries, torn,
+			failed ? "FAILED" : "ok");
+
+	DestroyFrameRing(&ring);
+	DestroySimulatedGrabber(&sim);
+	return failed;
+}
+
+int main(int argc, char** argv){
+	double seconds = (argc > 1) ? atof(argv[1]) : 5;
+
+	printf("%d buffers, a frame every %d ms, bursts of %d, %d timeouts in a row every %d grabs\n",
+			SIM_BUFFERS, SIM_PERIOD_MS, SIM_OVERRUN_BURST, SIM_TIMEOUTS_BEFORE_RECOVER, SIM_TIMEOUT_EVERY);
+	int failed = 0;
+	failed += RunConsumer("copy", 0, seconds);
+	failed += RunConsumer("dma", 1, seconds);
+	printf((failed == 0) ? "All passed.\n" : "FAILED\n");
+	return (failed == 0) ? 0 : 1;
+}
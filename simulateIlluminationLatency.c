@@ -0,0 +1,191 @@
+/*
+ * simulateIlluminationLatency.c
+ *
+ * Measures how far the illumination pattern lands from the worm because of
+ * the time between grabbing a frame and the DLP showing the pattern made
+ * from it, with and without the MotionPredictor's latency compensation.
+ *
+ * The simulated worm crawls along a smoothly turning heading with a sine wave
+ * travelling from head to tail, and now and then pauses and reverses. The
+ * camera grabs it every frame and the segmentation returns the centerline
+ * rounded to whole pixels, with some noise. Each frame's pattern goes to
+ * the DLP after a processing time that varies from frame to frame, and the
+ * DLP shows it a fixed time after that, which the software can't see.
+ *
+ * For each segment the targeting error is the distance between where the
+ * pattern put that segment and where the segment really was when the
+ * pattern came up. It is reported as an RMS over the whole body, an RMS
+ * over the head (the first tenth of the segments) and a 99th percentile.
+ *
+ * Usage: simulateIlluminationLatency.exe [processMs] [dlpDelayMs] [seconds]
+ *   e.g. simulateIlluminationLatency.exe 15 10 120
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/MotionPredictor.h"
+
+#define SIM_FRAME_US 20000 // 50 fps
+#define SIM_JITTER_US 8000 // processing time varies by up to this much
+#define SIM_NOISE_PX 1.0 // segmentation noise on each centerline point
+#define SIM_SEGMENTS 100
+#define SIM_LENGTH_PX 300.0 // worm length in the image
+#define SIM_WAVE_AMP_PX 15.0
+#define SIM_WAVELENGTH_PX 200.0
+#define SIM_WAVE_HZ 0.5
+#define SIM_CRAWL_PX_S 150.0
+
+#define SIM_PI 3.14159265358979
+
+typedef struct SimResultStruct{
+	double rmsError;
+	double rmsHead;
+	double p99;
+} SimResult;
+
+/** Seed of the reproducible random numbers, so every run sees the same worm **/
+static unsigned long long simSeed;
+
+/*
+ * The worm's head and heading, and how far along it the body wave is.
+ * Each segment lies a fixed arc length behind the head.
+ */
+typedef struct SimWormStruct{
+	double x, y;
+	double heading;
+	double turnRate;
+	double speed;
+	double phase;
+	double pauseLeft;
+} SimWorm;
+
+static void StepWorm(SimWorm* w, double dt){
+	if (w->pauseLeft > 0) {
+		/** Paused, about to reverse **/
+		w->pauseLeft -= dt;
+		if (w->pauseLeft <= 0) w->speed = -w->speed;
+	} else if (RandomUniform(&simSeed) < dt / 8.0) {
+		w->pauseLeft = 0.5 + RandomUniform(&simSeed);
+	} else if (w->speed < 0 && RandomUniform(&simSeed) < dt / 2.0) {
+		w->speed = SIM_CRAWL_PX_S; // reversals are short
+	}
+	double v = (w->pauseLeft > 0) ? 0 : w->speed;
+	/** Turn smoothly: the body bends into the turn rather than jumping **/
+	w->turnRate += -w->turnRate * dt / 2.0 + 0.2 * RandomGaussian(&simSeed) * sqrt(dt);
+	w->heading += w->turnRate * dt;
+	w->x += v * cos(w->heading) * dt;
+	w->y += v * sin(w->heading) * dt;
+	if (v != 0) w->phase += 2 * SIM_PI * SIM_WAVE_HZ * dt * (v > 0 ? 1 : -1);
+}
+
+/** Where segment i is now **/
+static void SegmentPosition(const SimWorm* w, int i, double* x, double* y){
+	double s = SIM_LENGTH_PX * i / (SIM_SEGMENTS - 1);
+	double side = SIM_WAVE_AMP_PX * sin(2 * SIM_PI * s / SIM_WAVELENGTH_PX - w->phase);
+	double c = cos(w->heading), n = sin(w->heading);
+	*x = w->x - s * c - side * n;
+	*y = w->y - s * n + side * c;
+}
+
+/*
+ * Run the pipeline for the given time.
+ * If predict, the centerline is moved on by the predicted motion before illuminating.
+ * extraUs is the DLP delay the predictor is told about.
+ */
+static SimResult RunSimulation(int predict, long long processUs, long long dlpDelayUs, long long extraUs, double seconds){
+	SimResult r;
+	SimWorm w = { 512, 384, 0, 0, SIM_CRAWL_PX_S, 0, 0 };
+	simSeed = 12345;
+
+	MotionPredictor mp;
+	InitializeMotionPredictor(&mp);
+
+	long frames = (long) (seconds * 1e6 / SIM_FRAME_US);
+	double* errors = (double*) malloc(frames * SIM_SEGMENTS * sizeof(double));
+	double sumSq = 0, sumSqHead = 0;
+	long n = 0, nHead = 0;
+
+	/** Illuminated centerline, waiting for the DLP to show it **/
+	double litX[SIM_SEGMENTS], litY[SIM_SEGMENTS];
+	double segX[SIM_SEGMENTS], segY[SIM_SEGMENTS];
+
+	const double stepUs = 1000;
+	long long t = 0;
+	long f;
+	for (f = 0; f < frames; f++) {
+		long long grabUs = (long long) f * SIM_FRAME_US;
+		while (t < grabUs) {
+			StepWorm(&w, stepUs / 1e6);
+			t += (long long) stepUs;
+		}
+
+		/** Segment the frame **/
+		int i;
+		for (i = 0; i < SIM_SEGMENTS; i++) {
+			double x, y;
+			SegmentPosition(&w, i, &x, &y);
+			segX[i] = floor(x + SIM_NOISE_PX * RandomGaussian(&simSeed) + 0.5);
+			segY[i] = floor(y + SIM_NOISE_PX * RandomGaussian(&simSeed) + 0.5);
+		}
+		int haveVelocity = MotionPredictorAddFrame(&mp, segX, segY, SIM_SEGMENTS, grabUs);
+
+		long long sentUs = grabUs + processUs + (long long) (SIM_JITTER_US * RandomUniform(&simSeed));
+		long long horizon = (predict && haveVelocity) ? MotionPredictorHorizon(&mp, extraUs) : 0;
+		for (i = 0; i < SIM_SEGMENTS; i++) {
+			double dx = 0, dy = 0;
+			if (horizon > 0) MotionPredictorShift(&mp, i, horizon, &dx, &dy);
+			litX[i] = floor(segX[i] + dx + 0.5);
+			litY[i] = floor(segY[i] + dy + 0.5);
+		}
+		MotionPredictorAddLatency(&mp, sentUs - grabUs);
+
+		/** The frames overlap, so run a copy of the worm forward to when the pattern comes up **/
+		SimWorm ahead = w;
+		unsigned long long seed = simSeed;
+		long long ta;
+		for (ta = grabUs; ta < sentUs + dlpDelayUs; ta += (long long) stepUs) StepWorm(&ahead, stepUs / 1e6);
+		simSeed = seed;
+
+		for (i = 0; i < SIM_SEGMENTS; i++) {
+			double x, y;
+			SegmentPosition(&ahead, i, &x, &y);
+			double ex = litX[i] - x, ey = litY[i] - y;
+			double e2 = ex * ex + ey * ey;
+			errors[n] = sqrt(e2);
+			sumSq += e2;
+			n++;
+			if (i < SIM_SEGMENTS / 10) {
+				sumSqHead += e2;
+				nHead++;
+			}
+		}
+	}
+
+	SortDoubleArr(errors, n);
+	r.rmsError = sqrt(sumSq / n);
+	r.rmsHead = sqrt(sumSqHead / nHead);
+	r.p99 = errors[(long) (0.99 * (n - 1))];
+	free(errors);
+	return r;
+}
+
+static void PrintResult(const char* name, SimResult r){
+	printf("%-36s %10.2f %10.2f %10.2f\n", name, r.rmsError, r.rmsHead, r.p99);
+}
+
+int main(int argc, char** argv){
+	long long processUs = (long long) (1000 * ((argc > 1) ? atof(argv[1]) : 15));
+	long long dlpDelayUs = (long long) (1000 * ((argc > 2) ? atof(argv[2]) : 10));
+	double seconds = (argc > 3) ? atof(argv[3]) : 120;
+
+	printf("Simulating %.0f s: %d fps, %.0f-%.0f ms to send, %.0f ms in the DLP, %.1f px noise\n",
+			seconds, 1000000 / SIM_FRAME_US, processUs / 1000.0, (processUs + SIM_JITTER_US) / 1000.0,
+			dlpDelayUs / 1000.0, SIM_NOISE_PX);
+	printf("%-36s %10s %10s %10s\n", "illumination", "RMS px", "head px", "99% px");
+	PrintResult("no compensation", RunSimulation(0, processUs, dlpDelayUs, 0, seconds));
+	PrintResult("predicted, measured latency only", RunSimulation(1, processUs, dlpDelayUs, 0, seconds));
+	PrintResult("predicted, DLP delay added", RunSimulation(1, processUs, dlpDelayUs, dlpDelayUs, seconds));
+	return 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * simulateParamSync.c
+ *
+ * Stress tests the parameter exchange between the display thread and the
+ * processing thread (MyLibs/ParamSync.h) without a camera or a GUI.
+ *
+ * Three tests are run:
+ *   channel    one thread publishes generations as fast as it can while two
+ *              others read them; every copy read out must be one whole
+ *              generation and never a mix of two
+ *   scripted   the cases that matter, one step at a time: both sides
+ *              changing the same field at once, one side changing a field
+ *              after seeing the other's change, and a stale value arriving
+ *              after a local change
+ *   threads    a simulated display thread and processing thread edit random
+ *              fields at random while syncing as colbert does, then both
+ *              change a field neither has touched at once and stop editing;
+ *              both copies must end up the same, with the display thread's
+ *              last edit
+ *
+ * Prints what it checked and exits with 1 if anything failed.
+ *
+ * Usage: simulateParamSync.exe [iterations]
+ *   e.g. simulateParamSync.exe 200000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/ParamSync.h"
+
+#define SIM_FIELDS 8 // the first few ints of WormAnalysisParam are edited, the very first only last
+#define SIM_SETTLE_ROUNDS 1000 // syncs each thread keeps doing after it stops editing
+#define SIM_LAST_EDIT 100 // plus the side, for the last edit each side makes
+
+static int* Words(WormAnalysisParam* p){
+	return (int*) p;
+}
+
+
+/************************************************************/
+/* Channel													*/
+/************************************************************/
+
+typedef struct ChannelTestStruct{
+	ParamChannel* ch;
+	long iterations;
+	volatile LONG done;
+	volatile LONG reads;
+	volatile LONG torn;
+} ChannelTest;
+
+static DWORD WINAPI ChannelWriter(LPVOID lpParam){
+	ChannelTest* t = (ChannelTest*) lpParam;
+	WormAnalysisParam p;
+	long n;
+	int k;
+	for (n = 1; n <= t->iterations; n++) {
+		/** Every int of generation n is n, so a mix of two generations shows **/
+		for (k = 0; k < (int) PARAM_SYNC_WORDS; k++) Words(&p)[k] = (int) n;
+		LONG version[PARAM_SYNC_WORDS];
+		for (k = 0; k < (int) PARAM_SYNC_WORDS; k++) version[k] = (LONG) n;
+		PublishParams(t->ch, &p, version);
+	}
+	InterlockedExchange(&(t->done), 1);
+	return 0;
+}
+
+static DWORD WINAPI ChannelReader(LPVOID lpParam){
+	ChannelTest* t = (ChannelTest*) lpParam;
+	WormAnalysisParam p;
+	long reads = 0, torn = 0;
+	int k;
+	while (!InterlockedCompareExchange(&(t->done), 0, 0)) {
+		LONG version[PARAM_SYNC_WORDS];
+		LONG gen = ReadParams(t->ch, &p, version);
+		reads++;
+		int bad = 0;
+		for (k = 0; k < (int) PARAM_SYNC_WORDS; k++) {
+			if (gen > 0 && (Words(&p)[k] != gen || version[k] != gen)) bad = 1;
+		}
+		torn += bad;
+	}
+	InterlockedExchangeAdd(&(t->reads), reads);
+	InterlockedExchangeAdd(&(t->torn), torn);
+	return 0;
+}
+
+static int TestChannel(long iterations){
+	WormAnalysisParam initial;
+	memset(&initial, 0, sizeof(WormAnalysisParam));
+	ParamSync* ps = CreateParamSync(&initial);
+
+	ChannelTest t;
+	t.ch = &(ps->channel[PARAM_SYNC_GUI]);
+	t.iterations = iterations;
+	t.done = 0;
+	t.reads = 0;
+	t.torn = 0;
+
+	HANDLE threads[3];
+	threads[0] = CreateThread(NULL, 0, ChannelReader, (LPVOID) &t, 0, NULL);
+	threads[1] = CreateThread(NULL, 0, ChannelReader, (LPVOID) &t, 0, NULL);
+	threads[2] = CreateThread(NULL, 0, ChannelWriter, (LPVOID) &t, 0, NULL);
+	WaitForMultipleObjects(3, threads, TRUE, INFINITE);
+	int k;
+	for (k = 0; k < 3; k++) CloseHandle(threads[k]);
+	DestroyParamSync(&ps);
+
+	printf("channel:  %ld generations published, %ld read, %ld torn\n", iterations, t.reads, t.torn);
+	return (t.torn == 0) ? 0 : 1;
+}
+
+
+/************************************************************/
+/* Scripted													*/
+/************************************************************/
+
+static int Expect(const char* what, int gui, int proc, int expected){
+	int ok = (gui == expected && proc == expected);
+	printf("scripted: %-46s GUI %d, processing %d: %s\n", what, gui, proc, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+/** Pull then push for one side, as SyncGUIParams() does **/
+static void Sync(ParamSync* ps, int side, WormAnalysisParam* p){
+	ParamSyncPull(ps, side, p);
+	ParamSyncPush(ps, side, p);
+}
+
+static int TestScripted(void){
+	WormAnalysisParam initial;
+	memset(&initial, 0, sizeof(WormAnalysisParam));
+	int failed = 0;
+	int f = 0; // the field being edited
+	int g = 1; // another field
+
+	/** Both change the same field before seeing each other's change: the GUI wins **/
+	{
+		ParamSync* ps = CreateParamSync(&initial);
+		WormAnalysisParam gui = initial, proc = initial;
+		Words(&gui)[f] = 5;
+		Words(&proc)[f] = 7;
+		ParamSyncPush(ps, PARAM_SYNC_GUI, &gui);
+		ParamSyncPush(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		failed += Expect("same field at once", Words(&gui)[f], Words(&proc)[f], 5);
+		DestroyParamSync(&ps);
+	}
+
+	/** Same, but the processing side pulls first **/
+	{
+		ParamSync* ps = CreateParamSync(&initial);
+		WormAnalysisParam gui = initial, proc = initial;
+		Words(&gui)[f] = 5;
+		Words(&proc)[f] = 7;
+		ParamSyncPush(ps, PARAM_SYNC_GUI, &gui);
+		ParamSyncPush(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		failed += Expect("same field at once, processing pulls first", Words(&gui)[f], Words(&proc)[f], 5);
+		DestroyParamSync(&ps);
+	}
+
+	/** Processing changes a field after it has seen the GUI's change: processing wins **/
+	{
+		ParamSync* ps = CreateParamSync(&initial);
+		WormAnalysisParam gui = initial, proc = initial;
+		Words(&gui)[f] = 5;
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Words(&proc)[f] = 7;
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		failed += Expect("processing changes it after seeing the GUI", Words(&gui)[f], Words(&proc)[f], 7);
+		DestroyParamSync(&ps);
+	}
+
+	/** The GUI publishes another field while a processing change is in flight **/
+	{
+		WormAnalysisParam on = initial;
+		Words(&on)[f] = 1;
+		ParamSync* ps = CreateParamSync(&on);
+		WormAnalysisParam gui = on, proc = on;
+		/** e.g. the processing thread turns the DLP off while the user moves a slider **/
+		Words(&proc)[f] = 0;
+		Words(&gui)[g] = 3;
+		ParamSyncPush(ps, PARAM_SYNC_PROCESSING, &proc);
+		ParamSyncPush(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		failed += Expect("processing change with GUI busy elsewhere", Words(&gui)[f], Words(&proc)[f], 0);
+		failed += Expect("... and the GUI's own change", Words(&gui)[g], Words(&proc)[g], 3);
+		DestroyParamSync(&ps);
+	}
+
+	/** A stale value arriving after a local change does not undo it **/
+	{
+		ParamSync* ps = CreateParamSync(&initial);
+		WormAnalysisParam gui = initial, proc = initial;
+		Words(&proc)[g] = 9;
+		ParamSyncPush(ps, PARAM_SYNC_PROCESSING, &proc); // still has f == 0
+		Words(&gui)[f] = 4;
+		ParamSyncPush(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		Sync(ps, PARAM_SYNC_PROCESSING, &proc);
+		Sync(ps, PARAM_SYNC_GUI, &gui);
+		failed += Expect("stale value after a local change", Words(&gui)[f], Words(&proc)[f], 4);
+		DestroyParamSync(&ps);
+	}
+	return (failed == 0) ? 0 : 1;
+}
+
+
+/************************************************************/
+/* Threads													*/
+/************************************************************/
+
+typedef struct SideTestStruct{
+	ParamSync* ps;
+	int side;
+	WormAnalysisParam local;
+	long iterations;
+	unsigned long long seed;
+	long edits;
+	volatile LONG* readyForLastEdit; //how many sides have pulled before their last edit
+	volatile LONG* stoppedEditing; //how many sides have made their last edit
+} SideTest;
+
+/*
+ * The display thread pulls and pushes every pass of its loop.
+ * The processing thread pulls at the start of a frame and pushes at its end.
+ * Either may change a few fields in between.
+ */
+static DWORD WINAPI SideThread(LPVOID lpParam){
+	SideTest* t = (SideTest*) lpParam;
+	long n;
+	long settled = 0;
+	for (n = 0; settled < SIM_SETTLE_ROUNDS; n++) {
+		ParamSyncPull(t->ps, t->side, &(t->local));
+		if (n < t->iterations && RandomBits(&(t->seed)) % 4 == 0) {
+			int k = 1 + RandomBits(&(t->seed)) % (SIM_FIELDS - 1);
+			Words(&(t->local))[k] = (int) (RandomBits(&(t->seed)) % 16);
+			t->edits++;
+		}
+		if (n == t->iterations) {
+			/*
+			 * Both sides' last edit is to the same untouched field,
+			 * before either can see the other's
+			 */
+			InterlockedIncrement(t->readyForLastEdit);
+			while (InterlockedCompareExchange(t->readyForLastEdit, 0, 0) != 2) Sleep(0);
+			Words(&(t->local))[0] = SIM_LAST_EDIT + t->side;
+			ParamSyncPush(t->ps, t->side, &(t->local));
+			InterlockedIncrement(t->stoppedEditing);
+			while (InterlockedCompareExchange(t->stoppedEditing, 0, 0) != 2) Sleep(0);
+			continue;
+		}
+		ParamSyncPush(t->ps, t->side, &(t->local));
+
+		/** Keep syncing until the other side has stopped editing too **/
+		if (InterlockedCompareExchange(t->stoppedEditing, 0, 0) == 2) settled++;
+		if (RandomBits(&(t->seed)) % 8 == 0 || n >= t->iterations) Sleep(0);
+	}
+	return 0;
+}
+
+static int TestThreads(long iterations, int run){
+	WormAnalysisParam initial;
+	memset(&initial, 0, sizeof(WormAnalysisParam));
+	ParamSync* ps = CreateParamSync(&initial);
+
+	SideTest t[2];
+	volatile LONG readyForLastEdit = 0;
+	volatile LONG stoppedEditing = 0;
+	int k;
+	for (k = 0; k < 2; k++) {
+		t[k].ps = ps;
+		t[k].side = k;
+		t[k].local = initial;
+		t[k].iterations = iterations;
+		t[k].seed = 12345 + 1000 * run + k;
+		t[k].edits = 0;
+		t[k].readyForLastEdit = &readyForLastEdit;
+		t[k].stoppedEditing = &stoppedEditing;
+	}
+	HANDLE threads[2];
+	for (k = 0; k < 2; k++)
+		threads[k] = CreateThread(NULL, 0, SideThread, (LPVOID) &(t[k]), 0, NULL);
+	WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+	for (k = 0; k < 2; k++) CloseHandle(threads[k]);
+
+	/*
+	 * The last thread to finish may have pushed after the other's last pull,
+	 * so let each side pull once more, as the next frame would.
+	 */
+	for (k = 0; k < 2; k++) {
+		Sync(ps, PARAM_SYNC_GUI, &(t[PARAM_SYNC_GUI].local));
+		Sync(ps, PARAM_SYNC_PROCESSING, &(t[PARAM_SYNC_PROCESSING].local));
+	}
+
+	/** Once both have stopped editing and synced a while, they must agree **/
+	int differ = 0;
+	for (k = 0; k < (int) PARAM_SYNC_WORDS; k++) {
+		if (Words(&(t[0].local))[k] != Words(&(t[1].local))[k]) differ++;
+	}
+	int lastEdit = Words(&(t[PARAM_SYNC_PROCESSING].local))[0];
+	DestroyParamSync(&ps);
+
+	printf("threads:  run %d, %ld GUI and %ld processing edits, %d fields differ at the end, %s's last edit kept\n",
+			run, t[0].edits, t[1].edits, differ,
+			(lastEdit == SIM_LAST_EDIT + PARAM_SYNC_GUI) ? "the GUI" : "processing");
+	return (differ == 0 && lastEdit == SIM_LAST_EDIT + PARAM_SYNC_GUI) ? 0 : 1;
+}
+
+
+int main(int argc, char** argv){
+	long iterations = (argc > 1) ? atol(argv[1]) : 200000;
+	if (iterations <= 0) {
+		printf("Usage: simulateParamSync.exe [iterations]\n");
+		return 1;
+	}
+
+	int failed = 0;
+	failed += TestChannel(iterations);
+	failed += TestScripted();
+	int run;
+	for (run = 0; run < 5; run++)
+		failed += TestThreads(iterations, run);
+
+	printf("%s\n", (failed == 0) ? "All passed." : "FAILED");
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+/*
+ * simulateProtocolTiming.c
+ *
+ * Compares how accurately the timed illumination features keep time with
+ * the old per-feature timers and with the Sequencer.
+ *
+ * Frames arrive at about 50 fps, with some jitter and now and then a long
+ * stall, on a fake clock. The old timers read the wall clock with
+ * gettimeofday() whenever they were called and compared whole tenths of a
+ * second against the slider. Partway through, the wall clock is stepped back,
+ * the way a time server would correct it. The Sequencer reads a monotonic
+ * clock once per frame and has every event on one timeline. The features are
+ * run on it by the code the experiment runs (MyLibs/TimedIllumination.h),
+ * with the fake clock.
+ *
+ * Two features are run many times:
+ *   flash  the DLP goes on for IllumDuration, then off
+ *          (the timed secondary protocol step is timed the same way)
+ *   sweep  the head-to-tail sweep moves its cursor on every IllumDuration
+ *          until it has crossed the worm, 100 segments with a cursor
+ *          radius of 3
+ * and for each the error is how much longer or shorter than asked for the
+ * whole thing lasted, from the frame it started on to the frame it finished on.
+ *
+ * Usage: simulateProtocolTiming.exe [flashTenths] [sweepTenths] [runs]
+ *   e.g. simulateProtocolTiming.exe 15 2 200
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/Sequencer.h"
+#include "MyLibs/TimedIllumination.h"
+
+#define SIM_FRAME_US 20000 // 50 fps
+#define SIM_JITTER_US 6000 // frames arrive up to this much late
+#define SIM_STALL_CHANCE 0.02 // chance that a frame is held up
+#define SIM_STALL_US 150000 // by this long
+#define SIM_CLOCK_STEP_US -1000000 // the wall clock is set back this far
+#define SIM_NUM_SEGMENTS 100 // the sweep crosses this many segments
+#define SIM_SWEEP_RADIUS 3 // half the height of the sweep cursor, in segments
+
+typedef struct SimResultStruct{
+	double sumErrUs;
+	double sumAbsErrUs;
+	double maxAbsErrUs;
+	int runs;
+} SimResult;
+
+/** Seed of the reproducible random numbers, so every run sees the same frames **/
+static unsigned long long simSeed;
+
+/*
+ * The fake clocks. Frames arrive on the monotonic clock.
+ * The wall clock is the same until it is stepped.
+ */
+typedef struct SimClockStruct{
+	long long monoUs;
+	long long wallOffsetUs;
+	long long stepAtUs; // when the wall clock gets stepped
+	long long frame;
+} SimClock;
+
+static long long SimMonotonicUs(void* clockData){
+	return ((SimClock*) clockData)->monoUs;
+}
+
+static double SimWallSeconds(SimClock* c){
+	return (c->monoUs + c->wallOffsetUs) / 1e6;
+}
+
+static void NextFrame(SimClock* c){
+	c->frame++;
+	long long t = c->frame * SIM_FRAME_US + (long long) (SIM_JITTER_US * RandomUniform(&simSeed));
+	if (RandomUniform(&simSeed) < SIM_STALL_CHANCE) t += SIM_STALL_US;
+	if (t < c->monoUs) t = c->monoUs;
+	c->monoUs = t;
+	if (c->stepAtUs > 0 && c->monoUs >= c->stepAtUs) {
+		c->wallOffsetUs += SIM_CLOCK_STEP_US;
+		c->stepAtUs = 0;
+	}
+}
+
+static void AddResult(SimResult* r, double errUs){
+	r->sumErrUs += errUs;
+	r->sumAbsErrUs += fabs(errUs);
+	if (fabs(errUs) > r->maxAbsErrUs) r->maxAbsErrUs = fabs(errUs);
+	r->runs++;
+}
+
+/** Leave a gap between runs **/
+static void Idle(SimClock* c){
+	int k;
+	for (k = 0; k < 25; k++) NextFrame(c);
+}
+
+/*
+ * Old HandleIlluminationTiming(): on when first seen, then off the first
+ * frame on which more than IllumDuration whole tenths have gone by.
+ */
+static void LegacyFlash(SimClock* c, int tenths, SimResult* r){
+	long long onUs = c->monoUs;
+	double start = SimWallSeconds(c);
+	for (;;) {
+		NextFrame(c);
+		int tenthsElapsed = (int) ((SimWallSeconds(c) - start) * 10.0);
+		if (tenthsElapsed > tenths) break;
+	}
+	AddResult(r, (double) (c->monoUs - onUs) - tenths * SEQ_TENTH_US);
+}
+
+/*
+ * Old HandleIlluminationSweep(): the timer starts again from the frame on
+ * which the cursor moved, and the sweep ends on the first timeout at which
+ * the cursor can't move on without leaving the worm.
+ */
+static void LegacySweep(SimClock* c, int tenths, SimResult* r){
+	long long onUs = c->monoUs;
+	double timer = SimWallSeconds(c);
+	int y = 0;
+	int timeouts = 0;
+	for (;;) {
+		NextFrame(c);
+		int tenthsElapsed = (int) ((SimWallSeconds(c) - timer) * 10.0);
+		if (tenthsElapsed > tenths) {
+			timeouts++;
+			if (y >= SIM_NUM_SEGMENTS - SIM_SWEEP_RADIUS) break;
+			y += 2 * SIM_SWEEP_RADIUS;
+			timer = SimWallSeconds(c);
+		}
+	}
+	AddResult(r, (double) (c->monoUs - onUs) - (double) timeouts * tenths * SEQ_TENTH_US);
+}
+
+/*
+ * One frame of the experiment's DoSequencer(): sample the clock, start the
+ * features that were switched on, and apply every event that is due.
+ * Counts the sweep steps taken. Returns the SEQ_SOURCE_* of a feature that
+ * finished this frame, or -1.
+ */
+static int SequencerFrame(Sequencer* s, WormAnalysisParam* Params, int* sweepSteps){
+	SequencerSampleClock(s);
+	SequenceIlluminationTiming(s, Params);
+	SequenceIlluminationSweep(s, Params);
+	SequenceTimedSecondaryProtocolStep(s, Params);
+
+	int finished = -1;
+	SequencerEvent ev;
+	while (SequencerNextDue(s, &ev)) {
+		if (ev.type == SEQ_EVENT_SWEEP_STEP) (*sweepSteps)++;
+		int source = ApplyTimedEvent(s, Params, &ev);
+		if (source >= 0) finished = source;
+	}
+	return finished;
+}
+
+/** The flash, switched on with DLPOnFlash **/
+static void SequencedFlash(Sequencer* s, WormAnalysisParam* Params, SimClock* c, int tenths, SimResult* r){
+	int sweepSteps = 0;
+	Params->IllumDuration = tenths;
+	Params->DLPOnFlash = 1;
+	long long onUs = c->monoUs;
+	while (SequencerFrame(s, Params, &sweepSteps) != SEQ_SOURCE_FLASH) NextFrame(c);
+	AddResult(r, (double) (c->monoUs - onUs) - tenths * SEQ_TENTH_US);
+}
+
+/** The head-to-tail sweep, switched on with IllumSweepOn **/
+static void SequencedSweep(Sequencer* s, WormAnalysisParam* Params, SimClock* c, int tenths, SimResult* r){
+	int sweepSteps = 0;
+	Params->IllumDuration = tenths;
+	Params->IllumSweepHT = 1;
+	Params->IllumSweepOn = 1;
+	long long onUs = c->monoUs;
+	while (SequencerFrame(s, Params, &sweepSteps) != SEQ_SOURCE_SWEEP) NextFrame(c);
+	AddResult(r, (double) (c->monoUs - onUs) - (double) sweepSteps * tenths * SEQ_TENTH_US);
+}
+
+static void PrintResult(const char* name, SimResult r){
+	printf("%-22s %12.1f %12.1f %12.1f\n", name, r.sumErrUs / r.runs / 1000.0,
+			r.sumAbsErrUs / r.runs / 1000.0, r.maxAbsErrUs / 1000.0);
+}
+
+int main(int argc, char** argv){
+	int flashTenths = (argc > 1) ? atoi(argv[1]) : 15;
+	int sweepTenths = (argc > 2) ? atoi(argv[2]) : 2;
+	int runs = (argc > 3) ? atoi(argv[3]) : 200;
+
+	printf("Simulating %d runs each: %d fps, up to %.0f ms jitter, %.0f%% of frames held up %.0f ms,\n",
+			runs, 1000000 / SIM_FRAME_US, SIM_JITTER_US / 1000.0, 100 * SIM_STALL_CHANCE, SIM_STALL_US / 1000.0);
+	printf("wall clock stepped by %.1f s once. Flash %d tenths, sweep of %d segments in steps of %d tenths.\n\n",
+			SIM_CLOCK_STEP_US / 1e6, flashTenths, SIM_NUM_SEGMENTS, sweepTenths);
+
+	SimResult legacyFlash = { 0 }, legacySweep = { 0 }, seqFlash = { 0 }, seqSweep = { 0 };
+	SimClock c = { 0 };
+	int k;
+
+	/** The old timers **/
+	simSeed = 12345;
+	c.stepAtUs = (long long) runs / 2 * (flashTenths + 6) * SEQ_TENTH_US;
+	for (k = 0; k < runs; k++) {
+		LegacyFlash(&c, flashTenths, &legacyFlash);
+		Idle(&c);
+	}
+	for (k = 0; k < runs; k++) {
+		LegacySweep(&c, sweepTenths, &legacySweep);
+		Idle(&c);
+	}
+
+	/** The same frames through the Sequencer **/
+	simSeed = 12345;
+	SimClock c2 = { 0 };
+	c2.stepAtUs = c.stepAtUs;
+	Sequencer* s = CreateSequencer(SimMonotonicUs, &c2);
+	WormAnalysisParam Params;
+	memset(&Params, 0, sizeof(Params));
+	Params.NumSegments = SIM_NUM_SEGMENTS;
+	Params.IllumSquareRad = cvSize(1, SIM_SWEEP_RADIUS);
+	for (k = 0; k < runs; k++) {
+		SequencedFlash(s, &Params, &c2, flashTenths, &seqFlash);
+		Idle(&c2);
+	}
+	for (k = 0; k < runs; k++) {
+		SequencedSweep(s, &Params, &c2, sweepTenths, &seqSweep);
+		Idle(&c2);
+	}
+
+	printf("\n%-22s %12s %12s %12s\n", "timing", "mean err ms", "mean |err| ms", "max |err| ms");
+	PrintResult("flash, old timer", legacyFlash);
+	PrintResult("flash, sequencer", seqFlash);
+	PrintResult("sweep, old timer", legacySweep);
+	PrintResult("sweep, sequencer", seqSweep);
+	printf("\n");
+	DestroySequencer(&s);
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * simulateStageTracking.c
+ *
+ * Runs the stage tracking controllers against a simulated worm and stage,
+ * so they can be compared and tuned without a microscope.
+ *
+ * The worm's tracked point crawls at a few hundred microns a second,
+ * meanders, undulates from side to side, and now and then pauses and
+ * reverses. The camera sees it every frame with some segmentation noise.
+ * Each command reaches the stage after a serial round trip and the stage
+ * takes a while to get up to speed.
+ *
+ * Two controllers are run on the same worm:
+ *   legacy     proportional only, updated at the display thread's pace
+ *              from whatever frame was processed last
+ *   predictive StageTracker, updated every processed frame
+ * and the predictive one is run again with the stage's pixels per speed
+ * off by 25% either way, to show how much it relies on that calibration.
+ *
+ * For each it prints the RMS and maximum distance of the tracked point from
+ * the target, and how many SPIN commands a second actually go to the stage.
+ *
+ * Usage: simulateStageTracking.exe [speed] [activeZone] [seconds]
+ *   e.g. simulateStageTracking.exe 25 250 120
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/StageTracker.h"
+
+#define SIM_STEP_US 1000
+#define SIM_FRAME_US 20000 // 50 fps
+#define SIM_PROCESS_US 12000 // grab to segmented centerline
+#define SIM_DISPLAY_US 30000 // cvWaitKey(20) plus drawing
+#define SIM_STAGE_RTT_US 8000 // serial round trip for one SPIN
+#define SIM_STAGE_TAU_S 0.03 // stage velocity time constant
+#define SIM_NOISE_PX 1.5 // segmentation noise on the tracked point
+
+#define SIM_PI 3.14159265358979
+
+typedef struct SimResultStruct{
+	double rmsError;
+	double maxError;
+	double commandsPerSec;
+} SimResult;
+
+/** Seed of the reproducible random numbers, so every controller sees the same worm **/
+static unsigned long long simSeed;
+
+/*
+ * Where the tracked point is in the world at time t, in pixels.
+ * Advances the worm by dt seconds.
+ */
+typedef struct SimWormStruct{
+	double x, y;
+	double heading;
+	double speed;
+	double phase;
+	double pauseLeft;
+} SimWorm;
+
+static void StepWorm(SimWorm* w, double dt){
+	const double crawl = 150; // pixels per second
+	if (w->pauseLeft > 0) {
+		/** Paused, about to reverse **/
+		w->pauseLeft -= dt;
+		if (w->pauseLeft <= 0) w->speed = -w->speed;
+	} else if (RandomUniform(&simSeed) < dt / 8.0) {
+		w->pauseLeft = 0.5 + RandomUniform(&simSeed);
+	} else if (w->speed < 0 && RandomUniform(&simSeed) < dt / 2.0) {
+		w->speed = crawl; // reversals are short
+	}
+	double v = (w->pauseLeft > 0) ? 0 : w->speed;
+	w->heading += 0.6 * RandomGaussian(&simSeed) * sqrt(dt);
+	w->phase += 2 * SIM_PI * 0.5 * dt;
+
+	/** Crawl along the heading and undulate across it **/
+	double sway = 2 * SIM_PI * 0.5 * 20 * cos(w->phase);
+	w->x += (v * cos(w->heading) - sway * sin(w->heading)) * dt;
+	w->y += (v * sin(w->heading) + sway * cos(w->heading)) * dt;
+}
+
+/*
+ * Run one controller for the given time.
+ * legacy selects the old proportional controller at display rate.
+ * trueScale is the stage's real pixels per speed as a multiple of what the tracker assumes.
+ */
+static SimResult RunSimulation(int legacy, double trueScale, int speed, int activeZone, double seconds){
+	SimResult r;
+	SimWorm w = { 0, 0, 0, 150, 0, 0 };
+	simSeed = 12345;
+
+	StageTracker st;
+	ResetStageTracker(&st, DefaultStageTrackerGains(speed, activeZone));
+	const double g = st.gains.pixelsPerSpeed * trueScale;
+	const double targetX = 512, targetY = 384;
+
+	/** The tracked point starts on target **/
+	double stageX = targetX / g, stageY = targetY / g; // stage position in SPIN units * seconds
+	double stageVx = 0, stageVy = 0;
+
+	/** The frame being processed, and the last one finished **/
+	double grabX = 0, grabY = 0;
+	long long grabUs = -1;
+	double seenX = targetX, seenY = targetY;
+	long long seenUs = -1;
+	int frameReady = 0;
+
+	/** The stage I/O thread: one command in flight, newer ones replace the queued one **/
+	int queued = 0, qx = 0, qy = 0;
+	long long inFlightUntil = -1;
+	int flightX = 0, flightY = 0;
+	int setX = 0, setY = 0; // what the stage is spinning at
+	int lastSentX = 0, lastSentY = 0;
+	long sent = 0;
+
+	double sumSq = 0, maxErr = 0;
+	long n = 0;
+	long long endUs = (long long) (seconds * 1e6);
+	long long t;
+	for (t = 0; t < endUs; t += SIM_STEP_US) {
+		double dt = SIM_STEP_US / 1e6;
+		StepWorm(&w, dt);
+
+		/** The stage gets up to the speed it was told **/
+		double a = dt / SIM_STAGE_TAU_S;
+		stageVx += (setX - stageVx) * a;
+		stageVy += (setY - stageVy) * a;
+		stageX += stageVx * dt;
+		stageY += stageVy * dt;
+
+		double imgX = w.x + g * stageX;
+		double imgY = w.y + g * stageY;
+		double ex = imgX - targetX, ey = imgY - targetY;
+		double err = sqrt(ex * ex + ey * ey);
+		sumSq += err * err;
+		if (err > maxErr) maxErr = err;
+		n++;
+
+		/** Camera **/
+		if (t % SIM_FRAME_US == 0) {
+			grabX = imgX + SIM_NOISE_PX * RandomGaussian(&simSeed);
+			grabY = imgY + SIM_NOISE_PX * RandomGaussian(&simSeed);
+			grabUs = t;
+		}
+		if (grabUs >= 0 && t == grabUs + SIM_PROCESS_US) {
+			seenX = grabX;
+			seenY = grabY;
+			seenUs = grabUs;
+			frameReady = 1;
+		}
+
+		/** Controller **/
+		int vx, vy, update = 0;
+		if (legacy) {
+			if (seenUs >= 0 && t % SIM_DISPLAY_US == 0) {
+				double dx = targetX - seenX, dy = targetY - seenY;
+				if (dx > activeZone) dx = activeZone;
+				if (dx < -activeZone) dx = -activeZone;
+				if (dy > activeZone) dy = activeZone;
+				if (dy < -activeZone) dy = -activeZone;
+				vx = (int) dx * speed;
+				vy = (int) dy * speed;
+				update = 1;
+			}
+		} else if (frameReady) {
+			UpdateStageTracker(&st, seenX, seenY, targetX, targetY, seenUs, &vx, &vy);
+			update = 1;
+		}
+		frameReady = 0;
+		if (update) {
+			queued = 1;
+			qx = vx;
+			qy = vy;
+		}
+
+		/** Stage I/O thread **/
+		if (inFlightUntil >= 0 && t >= inFlightUntil) {
+			setX = flightX;
+			setY = flightY;
+			inFlightUntil = -1;
+		}
+		if (inFlightUntil < 0 && queued) {
+			queued = 0;
+			if (qx != lastSentX || qy != lastSentY) {
+				flightX = lastSentX = qx;
+				flightY = lastSentY = qy;
+				inFlightUntil = t + SIM_STAGE_RTT_US;
+				sent++;
+			}
+		}
+	}
+
+	r.rmsError = sqrt(sumSq / n);
+	r.maxError = maxErr;
+	r.commandsPerSec = sent / seconds;
+	return r;
+}
+
+static void PrintResult(const char* name, SimResult r){
+	printf("%-28s %10.1f %10.1f %12.1f\n", name, r.rmsError, r.maxError, r.commandsPerSec);
+}
+
+int main(int argc, char** argv){
+	int speed = (argc > 1) ? atoi(argv[1]) : 25;
+	int activeZone = (argc > 2) ? atoi(argv[2]) : 250;
+	double seconds = (argc > 3) ? atof(argv[3]) : 120;
+
+	printf("Simulating %.0f s of tracking: speed %d, active zone %d, %d fps, %.1f px noise\n",
+			seconds, speed, activeZone, 1000000 / SIM_FRAME_US, SIM_NOISE_PX);
+	printf("%-28s %10s %10s %12s\n", "controller", "RMS px", "max px", "commands/s");
+	PrintResult("legacy proportional", RunSimulation(1, 1.0, speed, activeZone, seconds));
+	PrintResult("predictive", RunSimulation(0, 1.0, speed, activeZone, seconds));
+	PrintResult("predictive, stage 25% slow", RunSimulation(0, 0.75, speed, activeZone, seconds));
+	PrintResult("predictive, stage 25% fast", RunSimulation(0, 1.25, speed, activeZone, seconds));
+	return 0;
+}
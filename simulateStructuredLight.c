@@ -0,0 +1,216 @@
+/*
+ * simulateStructuredLight.c
+ *
+ * Runs the structured light calibration end to end against a simulated
+ * DLP and camera, and compares the lookup table it makes with the warp
+ * the simulation used.
+ *
+ * The camera looks at the DLP through a known warp: a small rotation,
+ * a scale that takes the edges of the DLP just out of view at the corners,
+ * an offset and some barrel distortion. Each pattern the calibration asks
+ * for is drawn on the simulated mirrors, blurred by the optics, sampled
+ * at the warped position of every camera pixel, scaled by a vignetted gain
+ * on top of a dark level, given camera noise and rounded to 8 bits.
+ *
+ * Each row of the results is one set of optics and camera. The errors are
+ * the lookup table minus the true DLP mirror, rounded, over the camera
+ * pixels that see the DLP, and separately over those beyond its edge,
+ * where the table is extrapolated.
+ *
+ * Usage: simulateStructuredLight.exe [blurMirrors] [noiseLevels] [contrastLevels]
+ *   e.g. simulateStructuredLight.exe 1.0 2 120
+ * With no arguments, runs a few typical cases.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "MyLibs/AndysComputations.h"
+#include "MyLibs/StructuredLight.h"
+
+#define SIM_DLP_WIDTH 1024
+#define SIM_DLP_HEIGHT 768
+#define SIM_ROTATION_DEG 1.5
+#define SIM_SCALE 1.04 // mirrors per camera pixel
+#define SIM_OFFSET_X 6.0 // mirrors
+#define SIM_OFFSET_Y -4.0
+#define SIM_BARREL 0.02 // fractional stretch at the corners
+#define SIM_DARK_LEVEL 12 // grey levels with the mirrors off
+#define SIM_VIGNETTING 0.3 // fraction of the gain lost at the corners
+
+/* The old point by point calibration: a point every 100 mirrors, 20 frames each */
+#define SIM_POINT_SCAN_STEP 100
+#define SIM_POINT_SCAN_FRAMES 20
+
+typedef struct SimCaseStruct{
+	double blur; // optical blur, sigma in mirrors
+	double noise; // camera noise, sigma in grey levels
+	double contrast; // grey levels between mirrors off and on, at the centre
+} SimCase;
+
+/** Seed of the reproducible random numbers, so every run sees the same noise **/
+static unsigned long long simSeed;
+
+/** The true DLP position, in mirrors, seen by the centre of camera pixel (x,y) **/
+static void TrueWarp(double x, double y, double* dlpx, double* dlpy){
+	double cx = SIM_DLP_WIDTH / 2.0, cy = SIM_DLP_HEIGHT / 2.0;
+	double u = x - cx, v = y - cy;
+	double r2 = (u * u + v * v) / (cx * cx + cy * cy);
+	double d = SIM_SCALE * (1 + SIM_BARREL * r2);
+	double a = SIM_ROTATION_DEG * 3.14159265358979 / 180;
+	*dlpx = cx + SIM_OFFSET_X + d * (cos(a) * u - sin(a) * v);
+	*dlpy = cy + SIM_OFFSET_Y + d * (sin(a) * u + cos(a) * v);
+}
+
+/** Blur the mirrors with a Gaussian of sigma mirrors, rows then columns **/
+static void Blur(const unsigned char* mirrors, float* out, float* temp, double sigma){
+	int W = SIM_DLP_WIDTH, H = SIM_DLP_HEIGHT;
+	int r = (int) ceil(3 * sigma);
+	double kernel[64];
+	double norm = 0;
+	int k, x, y;
+	if (r > 31) r = 31;
+	for (k = -r; k <= r; k++) norm += kernel[k + r] = exp(-k * k / (2 * sigma * sigma));
+	for (k = 0; k <= 2 * r; k++) kernel[k] /= norm;
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			double acc = 0;
+			for (k = -r; k <= r; k++) {
+				int xx = x + k;
+				if (xx >= 0 && xx < W) acc += kernel[k + r] * mirrors[y * W + xx];
+			}
+			temp[y * W + x] = (float) acc;
+		}
+	}
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			double acc = 0;
+			for (k = -r; k <= r; k++) {
+				int yy = y + k;
+				if (yy >= 0 && yy < H) acc += kernel[k + r] * temp[yy * W + x];
+			}
+			out[y * W + x] = (float) (acc / 255);
+		}
+	}
+}
+
+/** Bilinear sample of the blurred mirrors, dark beyond the edge **/
+static double Sample(const float* light, double x, double y){
+	int W = SIM_DLP_WIDTH, H = SIM_DLP_HEIGHT;
+	int x0 = (int) floor(x), y0 = (int) floor(y);
+	double fx = x - x0, fy = y - y0;
+	double acc = 0;
+	int i, j;
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < 2; i++) {
+			int xx = x0 + i, yy = y0 + j;
+			if (xx < 0 || yy < 0 || xx >= W || yy >= H) continue;
+			acc += (i ? fx : 1 - fx) * (j ? fy : 1 - fy) * light[yy * W + xx];
+		}
+	}
+	return acc;
+}
+
+static void RunCase(SimCase sc){
+	int W = SIM_DLP_WIDTH, H = SIM_DLP_HEIGHT;
+	int n = W * H;
+	int x, y, k;
+	StructuredLight* sl = CreateStructuredLight(W, H, W, H);
+	unsigned char* mirrors = (unsigned char*) malloc(n);
+	unsigned char* cam = (unsigned char*) malloc(n);
+	float* light = (float*) malloc(n * sizeof(float));
+	float* temp = (float*) malloc(n * sizeof(float));
+	double* warpX = (double*) malloc(n * sizeof(double));
+	double* warpY = (double*) malloc(n * sizeof(double));
+	double* gain = (double*) malloc(n * sizeof(double));
+	int* lookUp = (int*) malloc(2 * n * sizeof(int));
+
+	simSeed = 12345;
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			TrueWarp(x, y, &warpX[y * W + x], &warpY[y * W + x]);
+			double u = (x - W / 2.0) / (W / 2.0), v = (y - H / 2.0) / (H / 2.0);
+			gain[y * W + x] = sc.contrast * (1 - SIM_VIGNETTING * (u * u + v * v) / 2);
+		}
+	}
+
+	/** Project and grab every pattern, then decode **/
+	double decodeSeconds = 0;
+	for (k = 0; k < sl->numPatterns; k++) {
+		DrawStructuredLightPattern(sl, k, mirrors);
+		Blur(mirrors, light, temp, sc.blur);
+		for (y = 0; y < n; y++) {
+			double level = SIM_DARK_LEVEL + gain[y] * Sample(light, warpX[y], warpY[y]) + sc.noise * RandomGaussian(&simSeed);
+			cam[y] = (unsigned char) (level < 0 ? 0 : (level > 255 ? 255 : floor(level + 0.5)));
+		}
+		clock_t start = clock();
+		AddStructuredLightFrame(sl, k, cam);
+		decodeSeconds += (double) (clock() - start) / CLOCKS_PER_SEC;
+	}
+	clock_t start = clock();
+	int ret = DecodeStructuredLight(sl, lookUp);
+	decodeSeconds += (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	/** Compare with the truth **/
+	double sumAbs = 0, sumAbsBeyond = 0;
+	int maxErr = 0, maxErrBeyond = 0;
+	int seen = 0, exact = 0, withinOne = 0, beyond = 0;
+	for (x = 0; x < W; x++) {
+		for (y = 0; y < H; y++) {
+			int i = y * W + x;
+			int tx = (int) floor(warpX[i] + 0.5), ty = (int) floor(warpY[i] + 0.5);
+			int ex = abs(lookUp[x * H + y] - tx), ey = abs(lookUp[n + x * H + y] - ty);
+			int e = (ex > ey) ? ex : ey;
+			if (tx >= 0 && ty >= 0 && tx < W && ty < H) {
+				seen++;
+				sumAbs += ex + ey;
+				if (e > maxErr) maxErr = e;
+				if (e == 0) exact++;
+				if (e <= 1) withinOne++;
+			} else {
+				beyond++;
+				sumAbsBeyond += ex + ey;
+				if (e > maxErrBeyond) maxErrBeyond = e;
+			}
+		}
+	}
+	if (ret < 0) printf("%5.1f %6.1f %6.0f   decode failed\n", sc.blur, sc.noise, sc.contrast);
+	else printf("%5.1f %6.1f %6.0f %8.3f %6.1f%% %7.2f%% %6d %9.2f %6d %9.2f\n", sc.blur, sc.noise, sc.contrast,
+			sumAbs / (2.0 * seen), 100.0 * exact / seen, 100.0 * withinOne / seen, maxErr,
+			beyond ? sumAbsBeyond / (2.0 * beyond) : 0.0, maxErrBeyond, decodeSeconds);
+
+	DestroyStructuredLight(&sl);
+	free(mirrors);
+	free(cam);
+	free(light);
+	free(temp);
+	free(warpX);
+	free(warpY);
+	free(gain);
+	free(lookUp);
+}
+
+int main(int argc, char** argv){
+	SimCase cases[] = { { 1.0, 2, 120 }, { 0.3, 2, 120 }, { 2.0, 2, 120 }, { 1.0, 4, 30 }, { 1.0, 3, 20 } };
+	int numCases = sizeof(cases) / sizeof(cases[0]);
+	if (argc > 1) {
+		cases[0].blur = atof(argv[1]);
+		if (argc > 2) cases[0].noise = atof(argv[2]);
+		if (argc > 3) cases[0].contrast = atof(argv[3]);
+		numCases = 1;
+	}
+
+	StructuredLight* sl = CreateStructuredLight(SIM_DLP_WIDTH, SIM_DLP_HEIGHT, SIM_DLP_WIDTH, SIM_DLP_HEIGHT);
+	int pointScan = ((SIM_DLP_WIDTH + SIM_POINT_SCAN_STEP - 1) / SIM_POINT_SCAN_STEP)
+			* ((SIM_DLP_HEIGHT + SIM_POINT_SCAN_STEP - 1) / SIM_POINT_SCAN_STEP) * SIM_POINT_SCAN_FRAMES;
+	printf("Structured light: %d frames for every camera pixel. Point by point: %d frames for %d points.\n\n",
+			sl->numPatterns, pointScan, pointScan / SIM_POINT_SCAN_FRAMES);
+	DestroyStructuredLight(&sl);
+
+	printf("                        -------- seen on the DLP ---------   -- beyond its edge --\n");
+	printf("blur  noise contrast  mean err  exact  within 1 max err  mean err max err decode s\n");
+	int k;
+	for (k = 0; k < numCases; k++) RunCase(cases[k]);
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * soakCurvature.c
+ *
+ * Soak test for the head curvature (CurvatureOfSeqSegment() in
+ * MyLibs/AndysOpenCVLib.h), without a camera.
+ *
+ * Random smooth centerlines are built in a CvSeq as the segmentation builds
+ * them. Every third one is grown in small blocks, so that the head is split
+ * across blocks and has to be copied out. The curvature of the head is found
+ * with CurvatureOfSeqSegment() and its median with
+ * MedianOfDoubleArrInPlace(), as HandleCurvaturePhaseAnalysis() does, and
+ * both are compared with the old route: a slice of the head, then
+ * extractCurvatureOfSeq() with the tangent angle differences wrapped to
+ * (-pi, pi], then the median of a sorted copy.
+ *
+ * The process's private memory is read after a warm-up and again at the end.
+ * Any growth means something is leaking, since nothing in the loop should
+ * keep what it allocates.
+ *
+ * Prints the largest differences and the memory use, and exits with 1 if
+ * either difference is too big, memory grew, or no head was split.
+ *
+ * Usage: soakCurvature.exe [centerlines]
+ *   e.g. soakCurvature.exe 1000000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <windows.h>
+#include <psapi.h>
+
+#include "opencv2/highgui/highgui_c.h"
+#include "MyLibs/AndysOpenCVLib.h"
+#include "MyLibs/AndysComputations.h"
+
+/** The head as HandleCurvaturePhaseAnalysis() takes it (see experiment.h) **/
+#define SOAK_HEAD_BEGIN 10
+#define SOAK_HEAD_END 30
+#define SOAK_SIGMA 5
+
+#define SOAK_POINTS 100 // points in a centerline
+#define SOAK_STEP 4 // pixels between centerline points
+#define SOAK_SPLIT_BLOCK 15 // points per block when the head is to be split
+#define SOAK_WARMUP 1000 // centerlines before memory is first read
+#define SOAK_MAX_DIFF 1e-4 // radians
+#define SOAK_MAX_GROWTH (256 * 1024) // bytes
+#define SOAK_PI 3.14159265358979
+
+/** Seed of the reproducible random numbers **/
+static unsigned long long soakSeed = 12345;
+
+/*
+ * Bytes of memory the process has committed for itself
+ */
+static long PrivateBytes(void){
+	PROCESS_MEMORY_COUNTERS_EX pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*) &pmc, sizeof(pmc))) return -1;
+	return (long) pmc.PrivateUsage;
+}
+
+/*
+ * Fill seq with a random centerline that bends back and forth, heading
+ * anywhere, so that its tangents cross the branch cut of atan2 now and then.
+ */
+static void MakeCenterline(CvSeq* seq){
+	double x = 100 + RandomBits(&soakSeed) % 800;
+	double y = 100 + RandomBits(&soakSeed) % 600;
+	double heading = 2 * SOAK_PI * RandomUniform(&soakSeed);
+	double bend = 0.3 * RandomUniform(&soakSeed);
+	double phase = RandomBits(&soakSeed) % 1000;
+	int i;
+	for (i = 0; i < SOAK_POINTS; i++) {
+		heading += bend * sin(i * 0.15 + phase);
+		x += SOAK_STEP * cos(heading);
+		y += SOAK_STEP * sin(heading);
+		CvPoint pt = cvPoint((int) x, (int) y);
+		cvSeqPush(seq, &pt);
+	}
+}
+
+int main(int argc, char** argv){
+	long numCenterlines = (argc > 1) ? atol(argv[1]) : 200000;
+
+	int maxK = SOAK_HEAD_END - SOAK_HEAD_BEGIN;
+	CurvatureScratch* cs = CreateCurvatureScratch(maxK, SOAK_SIGMA);
+	double* reference = (double*) malloc(maxK * sizeof(double));
+	CvMemStorage* mem = cvCreateMemStorage(0);
+
+	long split = 0;
+	long bad = 0;
+	double worstK = 0;
+	double worstMedian = 0;
+	long warm = 0;
+	long i;
+	for (i = 0; i < numCenterlines; i++) {
+		if (i == SOAK_WARMUP) warm = PrivateBytes();
+		cvClearMemStorage(mem);
+
+		CvSeq* centerline = cvCreateSeq(CV_SEQ_ELTYPE_POINT, sizeof(CvSeq), sizeof(CvPoint), mem);
+		if (i % 3 == 0) cvSetSeqBlockSize(centerline, SOAK_SPLIT_BLOCK);
+		MakeCenterline(centerline);
+		if (centerline->first->count < SOAK_HEAD_END) split++;
+
+		/** The new route **/
+		int N = CurvatureOfSeqSegment(centerline, SOAK_HEAD_BEGIN, SOAK_HEAD_END, cs);
+
+		/** The old route, with the angles wrapped **/
+		CvSeq* head = cvSeqSlice(centerline, cvSlice(SOAK_HEAD_BEGIN, SOAK_HEAD_END), mem, 1);
+		if (extractCurvatureOfSeq(head, reference, SOAK_SIGMA, mem) != A_OK || N != head->total - 2) {
+			bad++;
+			continue;
+		}
+		int j;
+		for (j = 0; j < N; j++) {
+			while (reference[j] > SOAK_PI) reference[j] -= 2 * SOAK_PI;
+			while (reference[j] <= -SOAK_PI) reference[j] += 2 * SOAK_PI;
+			double d = fabs(reference[j] - cs->k[j]);
+			if (d > worstK) worstK = d;
+		}
+
+		double median = MedianOfDoubleArrInPlace(cs->k, N);
+		SortDoubleArr(reference, N);
+		double d = fabs(median - reference[N / 2]);
+		if (d > worstMedian) worstMedian = d;
+	}
+	long end = PrivateBytes();
+
+	cvReleaseMemStorage(&mem);
+	free(reference);
+	DestroyCurvatureScratch(&cs);
+
+	printf("centerlines            %ld, %ld with the head split across blocks\n", numCenterlines, split);
+	printf("curvature differs by   %g rad at most\n", worstK);
+	printf("median differs by      %g rad at most\n", worstMedian);
+	printf("private memory         %ld kB after warm-up, %ld kB at the end\n", warm / 1024, end / 1024);
+
+	int failed = (bad > 0 || split == 0 || worstK > SOAK_MAX_DIFF || worstMedian > SOAK_MAX_DIFF
+			|| numCenterlines <= SOAK_WARMUP || warm < 0 || end - warm > SOAK_MAX_GROWTH);
+	if (bad > 0) printf("%ld centerlines could not be measured\n", bad);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed ? 1 : 0;
+}
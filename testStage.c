@@ -2,21 +2,40 @@
 #include <math.h>
 #include <windows.h>
 #include "MyLibs/Talk2Stage.h"
+#include "MyLibs/StageController.h"
 
-
-int main(){
+/*
+ * Spins the stage around a circle in velocity space through the stage I/O
+ * thread and reports how the stage keeps up.
+ *
+ * Usage: testStage.exe [port]
+ * With no port the stage is found the same way MindControl finds it.
+ * To test without a stage, give the port of a virtual null modem cable
+ * whose other end is running emulateStage.exe.
+ */
+int main(int argc, char** argv){
 	printf("Testing the Ludl stage.\nWait\n");
-	HANDLE stage=InitializeUsbStage();
+	HANDLE stage;
+	if (argc > 1) {
+		stage=InitializeSerialStage(argv[1]);
+	} else {
+		stage=InitializeUsbStage();
+	}
+	StageController* sc=CreateStageController(stage);
+	if (sc==NULL) {
+		printf("Could not talk to the stage.\n");
+		return -1;
+	}
 	
 	
 	int k=1;
-	int key=0;
 	
 	float x;
 	float y;
 	float t;
 	
 	int commandInterval=10;
+	StageStats stats;
 	
 	printf("Sending commands with %d ms interval\n",commandInterval);
 	while (1) {
@@ -32,13 +51,15 @@ int main(){
 		vx=(int) x;
 		vy= (int) y;
 		
-		//Send velocity command to stage
-		spinStage(stage,vx,vy);
+		//Queue velocity command for the stage; this never waits on the port
+		StageSpin(sc,vx,vy);
 		
 		
 		if (k%100==0){
-			printf("\n%d commands sent",k);	
+			GetStageStats(sc,&stats);
+			printf("\n%d commands queued, %ld sent, %ld coalesced, %ld errors, %ld timeouts",k,stats.sent,stats.coalesced,stats.errors,stats.timeouts);
 			printf(" current velocity: %d, %d\n",vx, vy);
+			printf("round trip: %.1f ms median, %.1f ms p90, %.1f ms max\n",stats.rttP50,stats.rttP90,stats.rttMax);
 		}
 		printf(".");
 		k=k+1;
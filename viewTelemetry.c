@@ -0,0 +1,63 @@
+/*
+ * viewTelemetry.c
+ *
+ * Small command line viewer for the live performance telemetry
+ * that MindControl publishes in shared memory. (See MyLibs/Telemetry.h)
+ *
+ * Run it in a second console while MindControl is running.
+ * Press any key to quit.
+ */
+#include <stdio.h>
+#include <conio.h>
+#include <windows.h>
+#include "MyLibs/Telemetry.h"
+
+
+void PrintTelemetry(TelemetryBlock* tb){
+	int k;
+	printf("\n==== Frame %ld  |  %.1f fps  |  dropped %ld  |  seg failures %ld ====\n",
+			tb->frameNum, tb->fps, tb->droppedFrames, tb->segmentationFailures);
+	printf("%-20s %8s %8s %8s %8s\n", "stage (ms)", "p50", "p90", "p99", "max");
+	for (k = 0; k < tb->numStages && k < TELEM_NUM_STAGES; ++k) {
+		TelemetryStage* s = &(tb->stage[k]);
+		if (s->numSamples == 0) continue;
+		printf("%-20s %8.2f %8.2f %8.2f %8.2f\n", s->name, s->p50, s->p90, s->p99, s->max);
+	}
+	if (tb->numQueues > 0) {
+		printf("%-20s %8s %8s\n", "queue", "depth", "max");
+		for (k = 0; k < tb->numQueues && k < TELEMETRY_MAX_QUEUES; ++k) {
+			printf("%-20s %8d %8d\n", tb->queue[k].name, tb->queue[k].depth, tb->queue[k].maxDepth);
+		}
+	}
+}
+
+int main(){
+	printf("MindControl telemetry viewer. Press any key to quit.\n");
+
+	HANDLE hMapFile = NULL;
+	TelemetryBlock* shared = NULL;
+	TelemetryBlock snapshot;
+	long lastPublish = -1;
+
+	while (!_kbhit()) {
+		/** Wait for MindControl to start **/
+		if (shared == NULL) {
+			shared = OpenTelemetryReader(&hMapFile);
+			if (shared == NULL) {
+				printf("Waiting for MindControl...\r");
+				Sleep(1000);
+				continue;
+			}
+			printf("Connected to MindControl telemetry.\n");
+		}
+
+		if (ReadTelemetry(shared, &snapshot) == TELEMETRY_SUCCESS && snapshot.publishCount != lastPublish) {
+			PrintTelemetry(&snapshot);
+			lastPublish = snapshot.publishCount;
+		}
+		Sleep(250);
+	}
+
+	CloseTelemetryReader(shared, hMapFile);
+	return 0;
+}